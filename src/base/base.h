@@ -1,7 +1,8 @@
 
 #pragma once
 
-#define NUMBER_OF_THREADS 16
+// Worker threads of the terrain tile loader. Loading is mostly i/o and memory bound, more don't help.
+#define NUMBER_OF_THREADS 4
 // for filenames, e.g. tiles and bounding boxes. Adapt it
 #define MAX_LEN_FILENAMES 100
 // for logbook messages. Keep it short
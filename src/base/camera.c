@@ -3,6 +3,7 @@
 #include "window.h"
 #include "base/logbook.h"
 #include <stdio.h>
+#include <string.h>
 #include <tgmath.h>
 
 // @todo: fix this struct, split it, setters and getters
@@ -35,11 +36,15 @@ static struct camera {
 	direction_t direction;
 	float mouse_sensitivity;
 	view_frustum_t view_frustum;
+	// Bumped when the view frustum differs from the one of the last version
+	unsigned int version;
+	view_frustum_t versioned_frustum;
 } camera;
 
 static void camera_calculate_fov();
 static void camera_calculate_initial_angles();
 static void camera_update_vectors();
+static void camera_update_version();
 
 inline void camera_create( const vec3f *const position, const vec3f *const target ) {
 	camera.near_plane = 1.0;
@@ -339,6 +344,10 @@ inline mat4f *camera_get_projection_matrix() {
 	return &camera.perspective_matrix;
 }
 
+inline unsigned int camera_get_version() {
+	return camera.version;
+}
+
 // -------------- statics ------------------
 inline void camera_calculate_fov() {
 	// @todo float conversions
@@ -361,6 +370,7 @@ inline void camera_calculate_fov() {
 			camera.far_plane,
 			&camera.view_frustum
 	);
+	camera_update_version();
 }
 
 inline void camera_calculate_initial_angles() {
@@ -422,6 +432,7 @@ inline void camera_update_vectors() {
 	//vec3f_normalize( vec3f_cross( &camera.right, &camera.front, &temp ), &camera.up );
 	// prefab projection * view
 	mat4f_mul( &camera.perspective_matrix, &camera.view_matrix, &camera.view_perspective_matrix );
+	camera_update_version();
 	// prefab proj * untranslated view matrix, stripped of translation
 	/*mat4 temp_mat;
 	mat4_from( &temp_mat, &camera.view_matrix );
@@ -429,3 +440,11 @@ inline void camera_update_vectors() {
 	temp_mat.data[12] = 0.0f; temp_mat.data[13] = 0.0f; temp_mat.data[14] = 0.0f; temp_mat.data[15] = 1.0f;
 	mat4_mul( &camera.untranslated_view_perspective_matrix, &camera.perspective_matrix, &temp_mat );*/
 }
+
+// The frustum holds position, orientation, near/far planes and view angle, all the selection depends on
+inline void camera_update_version() {
+	if( 0 == memcmp( &camera.view_frustum, &camera.versioned_frustum, sizeof(view_frustum_t) ) )
+		return;
+	camera.versioned_frustum = camera.view_frustum;
+	++camera.version;
+}
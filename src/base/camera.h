@@ -49,6 +49,9 @@ extern vec3f *camera_get_up();
 
 extern view_frustum_t *camera_get_view_frustum();
 
+// Changes whenever the view frustum does. Unchanged from one frame to the next when the camera rests.
+extern unsigned int camera_get_version();
+
 extern void camera_print_position();
 
 extern bool camera_mouse_move( float x_pos, float y_pos );
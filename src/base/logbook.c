@@ -3,12 +3,12 @@
 #include <stdio.h>
 #include <time.h>
 #include <string.h>
-//#include <threads.h>
+#include <threads.h>
 
 static const char log_filename[] = "orf_n_log.txt";
 static const char *p_types[4] = { "UNSPECIFIED", "INFO", "WARNING", "ERROR" };
 static FILE *logfile = NULL;
-// static mtx_t log_file_mutex;
+static mtx_t log_file_mutex;
 
 inline void logbook_log( logbook_error_t type, char *message ) {
 	// shouldn't happen if assembled thoroughly, but anyway
@@ -18,19 +18,24 @@ inline void logbook_log( logbook_error_t type, char *message ) {
 		type = LOG_UNSPECIFIED;
 	if( logfile ) {
 		const time_t t = time( NULL );
-		char *now = ctime( &t );
+		char now[26];
+		ctime_r( &t, now );
 		// Overwrite newline
 		now[strlen(now)-1] = 0;
 		char msg[MAX_LEN_MESSAGES];
 		snprintf( msg, MAX_LEN_MESSAGES, "[%s] [%s] %s\n", p_types[type], now, message );
+		// Messages may come from the tile loader threads
+		mtx_lock( &log_file_mutex );
 		fputs( msg, logfile );
 		fflush(logfile);
 		fputs( msg, stdout );
+		mtx_unlock( &log_file_mutex );
 	} else
 		fprintf( stderr, "Logfile not open for logging. Message '%s'", message );
 }
 
 inline void logbook_init() {
+	mtx_init( &log_file_mutex, mtx_plain );
 	logfile = fopen( log_filename, "w" );
 	if( !logfile )
 		fputs( "Error opening logfile ! Missing access/rights ?", stderr );
@@ -43,4 +48,6 @@ inline void logbook_init() {
 inline void logbook_de_init() {
 	if( logfile )
 		fclose( logfile );
+	logfile = NULL;
+	mtx_destroy( &log_file_mutex );
 }
@@ -8,7 +8,7 @@ typedef enum {
 		LOG_UNSPECIFIED, LOG_INFO, LOG_WARNING, LOG_ERROR
 } logbook_error_t;
 
-// @todo: make thread safe
+// Thread safe once logbook_init() has been called
 extern void logbook_log( logbook_error_t type, char *message );
 
 extern void logbook_init();
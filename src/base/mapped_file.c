@@ -0,0 +1,87 @@
+#include "mapped_file.h"
+#include "logbook.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+mapped_file_t *mapped_file_create( const char *filename, mapped_file_t *file ) {
+	char msg[MAX_LEN_MESSAGES];
+	if( file ) {
+		logbook_log( LOG_WARNING, "Non-null pointer passed to mapped_file_create" );
+		return file;
+	}
+	if( strlen(filename) >= MAX_LEN_FILENAMES-1 ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Filename too long for mapped file '%s'", filename );
+		logbook_log( LOG_ERROR, msg );
+		return NULL;
+	}
+	const int fd = open( filename, O_RDONLY );
+	if( fd < 0 ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Could not open file '%s' for mapping", filename );
+		logbook_log( LOG_ERROR, msg );
+		return NULL;
+	}
+	struct stat st;
+	if( fstat( fd, &st ) != 0 || st.st_size <= 0 ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Could not stat file '%s' or file is empty", filename );
+		logbook_log( LOG_ERROR, msg );
+		close(fd);
+		return NULL;
+	}
+	void *data = mmap( NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	// The mapping keeps its own reference to the file
+	close(fd);
+	if( MAP_FAILED == data ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error mapping file '%s'", filename );
+		logbook_log( LOG_ERROR, msg );
+		return NULL;
+	}
+	file = malloc(sizeof(mapped_file_t));
+	if( !file ) {
+		logbook_log( LOG_ERROR, "Error allocating mapped file" );
+		munmap( data, (size_t)st.st_size );
+		return NULL;
+	}
+	strncpy( file->filename, filename, MAX_LEN_FILENAMES-1 );
+	file->filename[MAX_LEN_FILENAMES-1] = 0;
+	file->size = (size_t)st.st_size;
+	file->data = data;
+	return file;
+}
+
+inline mapped_file_t *mapped_file_delete( mapped_file_t *file ) {
+	if( file ) {
+		if( file->data )
+			munmap( file->data, file->size );
+		free(file);
+		file = NULL;
+	}
+	return file;
+}
+
+inline void mapped_file_advise_sequential( const mapped_file_t *const file ) {
+	madvise( file->data, file->size, MADV_SEQUENTIAL );
+}
+
+inline void mapped_file_prefault( const mapped_file_t *const file, const size_t offset, const size_t size ) {
+	if( offset >= file->size )
+		return;
+	const size_t end = offset + size < file->size ? offset + size : file->size;
+	const size_t page_size = (size_t)sysconf( _SC_PAGESIZE );
+	const size_t aligned_offset = offset / page_size * page_size;
+	madvise( (char *)file->data + aligned_offset, end - aligned_offset, MADV_WILLNEED );
+	// Touch one byte per page, the result only keeps the reads from being optimized away
+	volatile unsigned char sum = 0;
+	for( size_t i = offset; i < end; i += page_size )
+		sum += ((const unsigned char *)file->data)[i];
+	(void)sum;
+}
+
+inline bool mapped_file_exists( const char *filename ) {
+	struct stat st;
+	return stat( filename, &st ) == 0 && S_ISREG(st.st_mode);
+}
@@ -0,0 +1,27 @@
+/* Read only memory mapping of a whole file. Pages are loaded on demand
+ * by the os when they are first accessed, nothing is read up front. */
+
+#pragma once
+
+#include "base.h"
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct mapped_file_t {
+	char filename[MAX_LEN_FILENAMES];
+	size_t size;
+	void *data;
+} mapped_file_t;
+
+// Returns NULL if the file does not exist or could not be mapped
+mapped_file_t *mapped_file_create( const char *filename, mapped_file_t *file );
+
+extern mapped_file_t *mapped_file_delete( mapped_file_t *file );
+
+// Hint to the os that the mapping will be read front to back, e.g. for a texture upload
+extern void mapped_file_advise_sequential( const mapped_file_t *const file );
+
+// Reads all pages of a range of the mapping, so later accesses don't block on i/o
+extern void mapped_file_prefault( const mapped_file_t *const file, const size_t offset, const size_t size );
+
+extern bool mapped_file_exists( const char *filename );
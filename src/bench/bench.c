@@ -0,0 +1,22 @@
+#include "bench.h"
+#include <math.h>
+#include <time.h>
+
+inline double bench_get_ms() {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (double)now.tv_sec * 1e3 + (double)now.tv_nsec * 1e-6;
+}
+
+void bench_fill_heights( uint16_t *height_values, const unsigned int extent, const unsigned int seed ) {
+	// xorshift, rand() differs between c libraries
+	uint32_t state = seed * 2654435761u + 1u;
+	for( size_t z = 0; z < extent; ++z )
+		for( size_t x = 0; x < extent; ++x ) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			const float hills = sinf( (float)x * 0.013f ) * cosf( (float)z * 0.011f ) * 0.5f + 0.5f;
+			height_values[z * extent + x] = (uint16_t)( hills * 60000.0f + (float)( state % 2000 ) );
+		}
+}
@@ -0,0 +1,18 @@
+/* Shared parts of the benchmarks and checks in this directory. Every program is a single file with
+ * its own main() that runs without a window, its head comment lists the sources to build it with.
+ * Build and run from the repository root, e.g.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/height_kernels_bench.c src/bench/bench.c \
+ *       src/terrain/height_kernels.c src/terrain/minmax_pyramid.c src/base/logbook.c -lm -lpthread
+ * Timings are the best of a few runs, results are printed to stdout. */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Monotonic clock in milliseconds
+extern double bench_get_ms();
+
+/* Fills extent^2 row major heights with smooth hills plus some noise. The same seed gives the same
+ * heights. */
+extern void bench_fill_heights( uint16_t *height_values, const unsigned int extent, const unsigned int seed );
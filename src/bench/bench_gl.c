@@ -0,0 +1,50 @@
+#include "bench_gl.h"
+#include "glad/glad.h"
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <stdio.h>
+
+static struct {
+	EGLDisplay display;
+	EGLContext context;
+} bench_gl;
+
+bool bench_gl_create_context() {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+	if( !get_platform_display ) {
+		puts( "No eglGetPlatformDisplayEXT" );
+		return false;
+	}
+	bench_gl.display = get_platform_display( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
+	EGLint major, minor;
+	if( EGL_NO_DISPLAY == bench_gl.display || !eglInitialize( bench_gl.display, &major, &minor ) ) {
+		puts( "Can't initialize a surfaceless EGL display" );
+		return false;
+	}
+	eglBindAPI( EGL_OPENGL_API );
+	const EGLint context_attribs[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4, EGL_CONTEXT_MINOR_VERSION, 5,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT, EGL_NONE
+	};
+	bench_gl.context = eglCreateContext( bench_gl.display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attribs );
+	if( EGL_NO_CONTEXT == bench_gl.context ||
+			!eglMakeCurrent( bench_gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, bench_gl.context ) ) {
+		puts( "Can't create a GL 4.5 core context" );
+		eglTerminate( bench_gl.display );
+		return false;
+	}
+	if( !gladLoadGLLoader( (GLADloadproc)eglGetProcAddress ) ) {
+		puts( "Can't load the gl functions" );
+		bench_gl_delete_context();
+		return false;
+	}
+	printf( "GL %s, %s\n", glGetString( GL_VERSION ), glGetString( GL_RENDERER ) );
+	return true;
+}
+
+inline void bench_gl_delete_context() {
+	eglMakeCurrent( bench_gl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+	eglDestroyContext( bench_gl.display, bench_gl.context );
+	eglTerminate( bench_gl.display );
+}
@@ -0,0 +1,11 @@
+/* Headless gl for the checks that need the gpu: a GL 4.5 core context through EGL without a surface,
+ * e.g. Mesa's llvmpipe. Programs using it also build extern/glad/glad.c and link -lEGL -ldl. */
+
+#pragma once
+
+#include <stdbool.h>
+
+// Creates the context, makes it current and loads the gl functions. False if that fails.
+bool bench_gl_create_context();
+
+extern void bench_gl_delete_context();
@@ -0,0 +1,176 @@
+#include "bench_terrain.h"
+#include "bench.h"
+#include "base/camera.h"
+#include "terrain/minmax_pyramid.h"
+#include "terrain/node.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Stand in for the camera module
+static struct {
+	vec3f position;
+	view_frustum_t frustum;
+	float far_plane;
+} bench_terrain = { .far_plane = 6000.0f };
+
+static intersect_t bench_terrain_select_node(
+		const node_t *const node, const quadtree_t *const quadtree, bool parent_completely_in_frustum,
+		lod_selection_buffer_t *buffer );
+
+terrain_tile_t *bench_terrain_create_tile(
+		const unsigned int extent, const unsigned int seed, const float min_x, const float min_z ) {
+	terrain_tile_t *tile = calloc( 1, sizeof(terrain_tile_t) );
+	heightmap_t *heightmap = calloc( 1, sizeof(heightmap_t) );
+	uint16_t *height_values = malloc( (size_t)extent * extent * sizeof(uint16_t) );
+	if( !tile || !heightmap || !height_values ) {
+		free( tile );
+		free( heightmap );
+		free( height_values );
+		return NULL;
+	}
+	bench_fill_heights( height_values, extent, seed );
+	strcpy( tile->filename, "bench tile" );
+	strcpy( heightmap->filename, tile->filename );
+	heightmap->extent = extent;
+	heightmap->height_values = height_values;
+	heightmap->pyramid = minmax_pyramid_create( height_values, extent, NULL );
+	tile->heightmap = heightmap;
+	tile->aabb.min = (vec3f){ min_x, 0.0f, min_z };
+	tile->aabb.max = (vec3f){ min_x + (float)extent, HEIGHT_FACTOR, min_z + (float)extent };
+	if( !heightmap->pyramid ) {
+		bench_terrain_delete_tile( tile );
+		return NULL;
+	}
+	return tile;
+}
+
+void bench_terrain_delete_tile( terrain_tile_t *tile ) {
+	if( !tile )
+		return;
+	quadtree_delete( tile->quadtree );
+	if( tile->heightmap ) {
+		minmax_pyramid_delete( tile->heightmap->pyramid );
+		free( tile->heightmap->height_values );
+		free( tile->heightmap );
+	}
+	free( tile );
+}
+
+void bench_terrain_set_far_plane( const float far_plane ) {
+	bench_terrain.far_plane = far_plane;
+	frustum_set_fov( 60.0f, 1.5f, camera_get_near_plane(), far_plane, &bench_terrain.frustum );
+	lod_selection_calculate_ranges();
+}
+
+void bench_terrain_fly( const int frame, const float size ) {
+	const float radius = size * 0.4f;
+	const float angle = (float)frame * 0.37f;
+	bench_terrain.position = (vec3f){ cosf( (float)frame * 0.011f ) * radius, 100.0f + 300.0f * (float)( frame % 4 ),
+			sinf( (float)frame * 0.013f ) * radius };
+	const vec3f target = { bench_terrain.position.x + cosf( angle ),
+			bench_terrain.position.y - 0.05f - (float)( frame % 5 ) * 0.15f, bench_terrain.position.z + sinf( angle ) };
+	const vec3f up = { 0.0f, 1.0f, 0.0f };
+	frustum_set_camera_vectors( &bench_terrain.position, &target, &up, &bench_terrain.frustum );
+}
+
+void bench_terrain_glide( const int frame, const float size ) {
+	const int path = frame / BENCH_TERRAIN_GLIDE_FRAMES;
+	const float t = (float)( frame % BENCH_TERRAIN_GLIDE_FRAMES );
+	const float radius = size * ( 0.1f + 0.06f * (float)( path % 5 ) );
+	// About 4 units a frame along the circle
+	const float angle = (float)path * 2.1f + t * 4.0f / radius;
+	bench_terrain.position = (vec3f){ cosf( angle ) * radius, 150.0f + 120.0f * (float)( path % 3 ) + 20.0f * sinf( t * 0.05f ),
+			sinf( angle ) * radius };
+	const float heading = angle + 1.5708f + 0.3f * sinf( t * 0.03f );
+	const vec3f target = { bench_terrain.position.x + cosf( heading ),
+			bench_terrain.position.y - 0.1f - 0.1f * (float)( path % 4 ), bench_terrain.position.z + sinf( heading ) };
+	const vec3f up = { 0.0f, 1.0f, 0.0f };
+	frustum_set_camera_vectors( &bench_terrain.position, &target, &up, &bench_terrain.frustum );
+}
+
+void bench_terrain_select_recursive( const quadtree_t *const quadtree, lod_selection_buffer_t *buffer ) {
+	for( unsigned int z = 0; z < quadtree->top_node_count; ++z )
+		for( unsigned int x = 0; x < quadtree->top_node_count; ++x )
+			bench_terrain_select_node( quadtree_get_node( quadtree, 0, x, z ), quadtree, false, buffer );
+}
+
+bool bench_terrain_is_same_selection( const lod_selection_buffer_t *const one, const lod_selection_buffer_t *const other ) {
+	if( one->count != other->count || one->has_overflowed != other->has_overflowed )
+		return false;
+	for( unsigned int i = 0; i < one->count; ++i ) {
+		const selected_node_t *a = &one->nodes[i];
+		const selected_node_t *b = &other->nodes[i];
+		if( a->node != b->node || a->tile_index != b->tile_index || a->lod_level != b->lod_level ||
+				a->hasTL != b->hasTL || a->hasTR != b->hasTR || a->hasBL != b->hasBL || a->hasBR != b->hasBR )
+			return false;
+	}
+	return true;
+}
+
+// The camera module's interface, as far as the terrain uses it without a window
+float camera_get_near_plane() {
+	return 1.0f;
+}
+
+float camera_get_far_plane() {
+	return bench_terrain.far_plane;
+}
+
+vec3f *camera_get_position() {
+	return &bench_terrain.position;
+}
+
+view_frustum_t *camera_get_view_frustum() {
+	return &bench_terrain.frustum;
+}
+
+// *** static stuff
+// node_lod_select() as it was before the selection became iterative
+intersect_t bench_terrain_select_node(
+		const node_t *const node, const quadtree_t *const quadtree, bool parent_completely_in_frustum,
+		lod_selection_buffer_t *buffer ) {
+	aabbf aabb;
+	node_get_aabb( node, quadtree->terrain_tile, &aabb );
+	// Test early outs
+	intersect_t frustum_intersection = parent_completely_in_frustum ?
+			INSIDE : frustum_contains_box( &aabb, camera_get_view_frustum() );
+	if( OUTSIDE == frustum_intersection )
+		return OUTSIDE;
+	float dist_limit = lod_selection_get_visibility_range(node->level);
+	if( !aabbf_intersect_sphere_sq( &aabb, camera_get_position(), dist_limit * dist_limit ) )
+		return OUT_OF_RANGE;
+	// TL, TR, BL, BR
+	intersect_t sub_results[4] = { UNDEFINED, UNDEFINED, UNDEFINED, UNDEFINED };
+	// Stop at one below number of lod levels. Leaves have no range for the next level.
+	if( !node_is_leaf( node ) && node->level != lod_selection_get_stop_at_level() ) {
+		float next_dist_limit = lod_selection_get_visibility_range(node->level+1);
+		if( aabbf_intersect_sphere_sq( &aabb, camera_get_position(), next_dist_limit * next_dist_limit ) ) {
+			bool we_are_completely_in_frustum = frustum_intersection == INSIDE;
+			for( unsigned int i = 0; i < 4; ++i ) {
+				const node_t *sub_node = node_get_sub_node( node, quadtree, i );
+				if( sub_node )
+					sub_results[i] = bench_terrain_select_node( sub_node, quadtree, we_are_completely_in_frustum, buffer );
+			}
+		}
+	}
+	// We don't want to select sub nodes that are invisible (out of frustum) or are selected;
+	// (we DO want to select if they are out of range, since we are not)
+	bool remove_tl = (sub_results[0] == OUTSIDE) || (sub_results[0] == SELECTED);
+	bool remove_tr = (sub_results[1] == OUTSIDE) || (sub_results[1] == SELECTED);
+	bool remove_bl = (sub_results[2] == OUTSIDE) || (sub_results[2] == SELECTED);
+	bool remove_br = (sub_results[3] == OUTSIDE) || (sub_results[3] == SELECTED);
+	// Add node to selection
+	if( !( remove_tl && remove_tr && remove_bl && remove_br ) ) {
+		unsigned int lod_level = lod_selection_get_stop_at_level() - node->level;
+		return lod_selection_add_node( buffer, node, &aabb, lod_level, !remove_tl, !remove_tr, !remove_bl, !remove_br ) ?
+				SELECTED : OUTSIDE;
+	}
+	// if any of child nodes are selected, then return selected -
+	// otherwise all of them are out of frustum, so we're out of frustum too
+	if( (sub_results[0] == SELECTED) || (sub_results[1] == SELECTED) ||
+		(sub_results[2] == SELECTED) || (sub_results[3] == SELECTED) )
+		return SELECTED;
+	else
+		return OUTSIDE;
+}
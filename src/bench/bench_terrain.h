@@ -0,0 +1,39 @@
+/* Tiles, camera and a reference lod selection for the programs that check the selection. Replaces
+ * base/camera.c, which needs a window: link bench_terrain.c instead and move the camera with
+ * bench_terrain_fly(). */
+
+#pragma once
+
+#include "terrain/heightmap.h"
+#include "terrain/lod_selection.h"
+#include "terrain/quadtree.h"
+#include "terrain/terrain_tile.h"
+
+/* Tile of extent^2 heights from bench_fill_heights(), its lower left corner at min_x/min_z. Has the
+ * heights and the min/max pyramid, the quadtree is left to the caller. NULL if out of memory. */
+terrain_tile_t *bench_terrain_create_tile(
+		const unsigned int extent, const unsigned int seed, const float min_x, const float min_z );
+
+// Deletes the quadtree too, if there is one
+void bench_terrain_delete_tile( terrain_tile_t *tile );
+
+// Sets the frustum and recalculates the lod ranges. The far plane is 6000 until then.
+void bench_terrain_set_far_plane( const float far_plane );
+
+/* Places the camera of a frame of a flight over a square of side length size, centered at the
+ * origin. It circles at changing heights and looks down more or less steeply. */
+void bench_terrain_fly( const int frame, const float size );
+
+// A glide jumps to a new path after this many frames
+#define BENCH_TERRAIN_GLIDE_FRAMES 100
+
+/* As bench_terrain_fly(), but the camera moves a few units and turns slightly from one frame to the
+ * next, like a camera steered by a user. Every BENCH_TERRAIN_GLIDE_FRAMES frames it jumps. */
+void bench_terrain_glide( const int frame, const float size );
+
+/* The recursive selection node_lod_select() replaced, as the reference it must match. Selects the
+ * top level nodes row by row, like quadtree_lod_select() over all of them. */
+void bench_terrain_select_recursive( const quadtree_t *const quadtree, lod_selection_buffer_t *buffer );
+
+// Same nodes, lod levels and quadrants in the same order
+bool bench_terrain_is_same_selection( const lod_selection_buffer_t *const one, const lod_selection_buffer_t *const other );
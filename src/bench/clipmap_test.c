@@ -0,0 +1,106 @@
+/* Flies a camera over a virtual heightmap and reads the clipmap back: every window the shader may
+ * sample must hold exactly the source texels of its level. The camera moves in small steps that upload
+ * strips and in jumps that reload whole windows, with the texture uploader running or uploading
+ * directly. Needs 2 * extent^2 bytes of memory.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/clipmap_test.c src/bench/bench.c \
+ *       src/bench/bench_gl.c src/terrain/clipmap.c src/renderer/texture_uploader.c src/renderer/sampler.c \
+ *       src/base/logbook.c extern/glad/glad.c -lEGL -ldl -lm -lpthread
+ * Usage: clipmap_test [extent] [frames] */
+
+#include "bench.h"
+#include "bench_gl.h"
+#include "base/logbook.h"
+#include "terrain/clipmap.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Windows the shader may not sample are moved at least this far off
+#define HIDDEN_ORIGIN_LIMIT ( -( 1 << 28 ) )
+
+// Texels of the resident windows that differ from the source, windows hidden in hidden_levels
+static size_t check_windows( clipmap_t *clipmap, uint16_t *layer, unsigned int *hidden_levels ) {
+	const int *origins = clipmap_get_resident_origins( clipmap );
+	size_t mismatches = 0;
+	for( unsigned int l = 0; l < clipmap->num_levels; ++l ) {
+		// The shader always samples the coarsest level, its window is the whole source
+		const bool is_coarsest = l + 1 == clipmap->num_levels;
+		const int ox = is_coarsest ? 0 : origins[2*l];
+		const int oz = is_coarsest ? 0 : origins[2*l+1];
+		if( ox < HIDDEN_ORIGIN_LIMIT ) {
+			++*hidden_levels;
+			continue;
+		}
+		glGetTextureSubImage( clipmap->texture, 0, 0, 0, (GLint)l, CLIPMAP_SIZE, CLIPMAP_SIZE, 1, GL_RED,
+				GL_UNSIGNED_SHORT, CLIPMAP_SIZE * CLIPMAP_SIZE * sizeof(uint16_t), layer );
+		for( int z = oz; z < oz + CLIPMAP_SIZE; ++z )
+			for( int x = ox; x < ox + CLIPMAP_SIZE; ++x ) {
+				const uint16_t expected = clipmap->height_values[( (size_t)z << l ) * clipmap->extent + ( (size_t)x << l )];
+				mismatches += expected != layer[( z % CLIPMAP_SIZE ) * CLIPMAP_SIZE + x % CLIPMAP_SIZE];
+			}
+	}
+	return mismatches;
+}
+
+static bool fly( const uint16_t *const height_values, const unsigned int extent, const int num_frames,
+		const bool use_uploader ) {
+	if( use_uploader && !texture_uploader_create() )
+		return false;
+	clipmap_t *clipmap = clipmap_create( height_values, extent, NULL );
+	uint16_t *layer = malloc( CLIPMAP_SIZE * CLIPMAP_SIZE * sizeof(uint16_t) );
+	if( !clipmap || !layer ) {
+		puts( "Can't create the clipmap" );
+		return false;
+	}
+	size_t mismatches = 0;
+	unsigned int hidden_levels = 0, not_ready_frames = 0;
+	double update_ms = 0.0;
+	for( int f = 0; f < num_frames; ++f ) {
+		// Circles with a drifting speed, and a jump every 100 frames
+		const float angle = (float)f * 0.01f;
+		const float radius = (float)extent * ( 0.2f + 0.15f * sinf( (float)f * 0.003f ) );
+		float x = (float)extent * 0.5f + radius * cosf( angle );
+		float z = (float)extent * 0.5f + radius * sinf( angle * 1.3f );
+		if( 50 == f % 100 ) {
+			x = (float)extent - x;
+			z = (float)extent - z;
+		}
+		const double start = bench_get_ms();
+		if( clipmap_is_ready( clipmap ) )
+			clipmap_update( clipmap, x, z );
+		else
+			++not_ready_frames;
+		texture_uploader_update();
+		update_ms += bench_get_ms() - start;
+		if( 0 == f % 10 || f == num_frames - 1 )
+			mismatches += check_windows( clipmap, layer, &hidden_levels );
+	}
+	printf( "%s: %d frames, %zu mismatching texels, %u hidden windows checked, %u frames not ready, "
+			"%.1fMtexels uploaded, %.3fms update per frame, gl error 0x%x\n",
+			use_uploader ? "uploader" : "direct", num_frames, mismatches, hidden_levels, not_ready_frames,
+			(double)clipmap->texels_updated * 1e-6, update_ms / num_frames, glGetError() );
+	clipmap_delete( clipmap );
+	texture_uploader_delete();
+	free( layer );
+	return 0 == mismatches;
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 32768;
+	const int num_frames = argc > 2 ? atoi( argv[2] ) : 1000;
+	logbook_init();
+	if( !bench_gl_create_context() )
+		return EXIT_FAILURE;
+	uint16_t *height_values = malloc( (size_t)extent * extent * sizeof(uint16_t) );
+	if( !height_values ) {
+		puts( "Can't allocate the heightmap" );
+		return EXIT_FAILURE;
+	}
+	bench_fill_heights( height_values, extent, 1 );
+	printf( "Extent %u, %u levels of %d\n", extent, clipmap_get_num_levels( extent ), CLIPMAP_SIZE );
+	const bool is_equal = fly( height_values, extent, num_frames, true ) && fly( height_values, extent, num_frames, false );
+	free( height_values );
+	bench_gl_delete_context();
+	logbook_de_init();
+	return is_equal ? EXIT_SUCCESS : EXIT_FAILURE;
+}
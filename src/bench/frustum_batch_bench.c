@@ -0,0 +1,149 @@
+/* Checks the vector versions of the batch frustum test against frustum_batch_classify_boxes_scalar()
+ * and that against frustum_contains_box_masked(), for several frusta and plane masks and with counts
+ * that leave tails. Then compares their throughput with single box calls, in million boxes per second.
+ * frustum_batch.c is included to reach the versions the cpu dispatch hides, don't link it.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/frustum_batch_bench.c src/bench/bench.c \
+ *       src/omath/view_frustum.c src/omath/aabb.c src/omath/vec3.c src/omath/common.c src/base/logbook.c \
+ *       -lm -lpthread
+ * Usage: frustum_batch_bench [boxes] */
+
+#include "bench.h"
+#include "base/logbook.h"
+#include "omath/frustum_batch.c"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNS 20
+#define NUM_FRUSTA 8
+
+typedef struct {
+	const char *name;
+	classify_func_t classify;
+	bool is_supported;
+} version_t;
+
+static float *box_values[6];
+static uint8_t *expected_results, *expected_masks, *results, *masks;
+
+static void set_frustum( const int i, view_frustum_t *frustum ) {
+	const vec3f position = { (float)( i * 700 - 2000 ), 50.0f + (float)( i * 150 ), (float)( i * 300 - 1000 ) };
+	const float angle = (float)i * 0.9f;
+	const vec3f target = { position.x + cosf( angle ), position.y - 0.1f * (float)( i % 4 ), position.z + sinf( angle ) };
+	const vec3f up = { 0.0f, 1.0f, 0.0f };
+	frustum_set_fov( 60.0f, 1.5f, 1.0f, 2000.0f + 1000.0f * (float)i, frustum );
+	frustum_set_camera_vectors( &position, &target, &up, frustum );
+}
+
+// Boxes from 1 to 2000 units in a 10000 units cube around the origin
+static void fill_boxes( const size_t count ) {
+	uint32_t state = 2463534242u;
+	for( size_t i = 0; i < count; ++i )
+		for( int c = 0; c < 3; ++c ) {
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			const float min = (float)( state % 10000 ) - 5000.0f;
+			const float size = 1.0f + (float)( ( state >> 14 ) % ( i % 3 ? 50 : 2000 ) );
+			box_values[c][i] = min;
+			box_values[c+3][i] = min + size;
+		}
+}
+
+// Mismatches of single box calls with the scalar version
+static size_t check_single_boxes( const aabbf_soa_t *const boxes, const size_t count,
+		const view_frustum_t *const frustum, const unsigned int plane_mask ) {
+	size_t mismatches = 0;
+	for( size_t i = 0; i < count; ++i ) {
+		const aabbf box = { { boxes->min_x[i], boxes->min_y[i], boxes->min_z[i] },
+				{ boxes->max_x[i], boxes->max_y[i], boxes->max_z[i] } };
+		unsigned int out_plane_mask = 0, last_plane = FRUSTUM_NEAR;
+		const intersect_t result = frustum_contains_box_masked( &box, frustum, plane_mask, &out_plane_mask, &last_plane );
+		mismatches += result != expected_results[i] || ( OUTSIDE == result ? 0 : out_plane_mask ) != expected_masks[i];
+	}
+	return mismatches;
+}
+
+int main( int argc, char **argv ) {
+	const size_t count = argc > 1 ? (size_t)atoi( argv[1] ) : 100000;
+	logbook_init();
+	for( int c = 0; c < 6; ++c )
+		box_values[c] = malloc( count * sizeof(float) );
+	expected_results = malloc( count );
+	expected_masks = malloc( count );
+	results = malloc( count );
+	masks = malloc( count );
+	fill_boxes( count );
+	const aabbf_soa_t boxes = { box_values[0], box_values[1], box_values[2], box_values[3], box_values[4], box_values[5] };
+	__builtin_cpu_init();
+	version_t versions[] = {
+		{ "scalar", classify_boxes_scalar, true },
+#ifdef FRUSTUM_BATCH_X86
+		{ "sse2", classify_boxes_sse2, __builtin_cpu_supports( "sse2" ) },
+		{ "avx", classify_boxes_avx, __builtin_cpu_supports( "avx" ) },
+#endif
+	};
+	const size_t num_versions = sizeof(versions) / sizeof(versions[0]);
+	size_t mismatches = 0;
+	for( int f = 0; f < NUM_FRUSTA; ++f ) {
+		view_frustum_t frustum;
+		set_frustum( f, &frustum );
+		for( unsigned int plane_mask = 1; plane_mask <= FRUSTUM_ALL_PLANES; plane_mask += 7 ) {
+			frustum_batch_classify_boxes_scalar( &boxes, count, &frustum, plane_mask, expected_results, expected_masks );
+			mismatches += check_single_boxes( &boxes, count, &frustum, plane_mask );
+			batch_plane_t planes[FRUSTUM_NUM_PLANES];
+			const unsigned int num_planes = frustum_batch_setup_planes( &boxes, &frustum, plane_mask, planes );
+			// Counts 1..8 short of the boxes leave every possible tail
+			for( size_t v = 0; v < num_versions; ++v )
+				for( size_t tail = 1; versions[v].is_supported && tail <= 8 && tail < count; ++tail ) {
+					versions[v].classify( planes, num_planes, count - tail, results, masks );
+					for( size_t i = 0; i < count - tail; ++i )
+						mismatches += results[i] != expected_results[i] || masks[i] != expected_masks[i];
+				}
+			frustum_batch_classify_boxes( &boxes, count, &frustum, plane_mask, results, masks );
+			mismatches += 0 != memcmp( results, expected_results, count ) || 0 != memcmp( masks, expected_masks, count );
+		}
+	}
+	printf( "%zu boxes, %d frusta: %zu mismatches, dispatch selects %s\n", count, NUM_FRUSTA, mismatches,
+			frustum_batch_get_isa() );
+	view_frustum_t frustum;
+	set_frustum( 0, &frustum );
+	double best = 1e30;
+	for( int r = 0; r < RUNS; ++r ) {
+		const double start = bench_get_ms();
+		unsigned int last_plane = FRUSTUM_NEAR;
+		for( size_t i = 0; i < count; ++i ) {
+			const aabbf box = { { boxes.min_x[i], boxes.min_y[i], boxes.min_z[i] },
+					{ boxes.max_x[i], boxes.max_y[i], boxes.max_z[i] } };
+			unsigned int out_plane_mask = 0;
+			results[i] = (uint8_t)frustum_contains_box_masked( &box, &frustum, FRUSTUM_ALL_PLANES, &out_plane_mask, &last_plane );
+			masks[i] = (uint8_t)out_plane_mask;
+		}
+		const double ms = bench_get_ms() - start;
+		best = ms < best ? ms : best;
+	}
+	printf( "%-28s %8.1f Mboxes/s\n", "frustum_contains_box_masked", (double)count / best * 1e-3 );
+	batch_plane_t planes[FRUSTUM_NUM_PLANES];
+	const unsigned int num_planes = frustum_batch_setup_planes( &boxes, &frustum, FRUSTUM_ALL_PLANES, planes );
+	for( size_t v = 0; v < num_versions; ++v ) {
+		if( !versions[v].is_supported )
+			continue;
+		best = 1e30;
+		for( int r = 0; r < RUNS; ++r ) {
+			const double start = bench_get_ms();
+			versions[v].classify( planes, num_planes, count, results, masks );
+			const double ms = bench_get_ms() - start;
+			best = ms < best ? ms : best;
+		}
+		printf( "%-28s %8.1f Mboxes/s\n", versions[v].name, (double)count / best * 1e-3 );
+	}
+	for( int c = 0; c < 6; ++c )
+		free( box_values[c] );
+	free( expected_results );
+	free( expected_masks );
+	free( results );
+	free( masks );
+	logbook_de_init();
+	return 0 == mismatches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
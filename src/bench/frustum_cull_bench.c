@@ -0,0 +1,178 @@
+/* The plane test of frustum_contains_box() against the bounding sphere test it replaced, in the
+ * recursive lod selection of a fly-through. Counts the boxes each test culls, and the boxes the sphere
+ * test lets through although they are outside all along one plane. The plane test may only drop
+ * nodes and quadrants the sphere test selects, never add any.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/frustum_cull_bench.c src/bench/bench.c \
+ *       src/bench/bench_terrain.c src/terrain/quadtree.c src/terrain/node.c src/terrain/lod_selection.c \
+ *       src/terrain/minmax_pyramid.c src/terrain/height_kernels.c src/base/logbook.c src/omath/aabb.c \
+ *       src/omath/view_frustum.c src/omath/vec3.c src/omath/common.c -lm -lpthread
+ * Usage: frustum_cull_bench [frames] [far plane] */
+
+#include "bench.h"
+#include "bench_terrain.h"
+#include "base/camera.h"
+#include "base/logbook.h"
+#include "terrain/node.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUNS 5
+#define MAX_TILES 64
+
+typedef intersect_t (*box_test_t)( const aabbf* const box, const view_frustum_t *const view_frustum );
+
+// A box test and what it did in the counted run
+typedef struct {
+	box_test_t test;
+	bool is_counting;
+	size_t tested;
+	size_t culled;
+	// Not culled, but outside of one of the planes
+	size_t false_positives;
+} cull_t;
+
+static terrain_tile_t *tiles[MAX_TILES];
+
+// frustum_contains_box() as it was
+static intersect_t sphere_contains_box( const aabbf* const box, const view_frustum_t *const view_frustum ) {
+	vec3f center = {0.0f,0.0f,0.0f};
+	return frustum_contains_sphere(
+			aabbf_get_center( box, &center ), aabbf_get_diagonal_size( box ) * 0.5f, view_frustum
+	);
+}
+
+// bench_terrain_select_recursive() with the box test of cull
+static intersect_t select_node(
+		const node_t *const node, const quadtree_t *const quadtree, bool parent_completely_in_frustum,
+		cull_t *cull, lod_selection_buffer_t *buffer ) {
+	aabbf aabb;
+	node_get_aabb( node, quadtree->terrain_tile, &aabb );
+	intersect_t frustum_intersection = INSIDE;
+	if( !parent_completely_in_frustum ) {
+		frustum_intersection = cull->test( &aabb, camera_get_view_frustum() );
+		if( cull->is_counting ) {
+			++cull->tested;
+			if( OUTSIDE == frustum_intersection )
+				++cull->culled;
+			else if( OUTSIDE == frustum_contains_box( &aabb, camera_get_view_frustum() ) )
+				++cull->false_positives;
+		}
+	}
+	if( OUTSIDE == frustum_intersection )
+		return OUTSIDE;
+	float dist_limit = lod_selection_get_visibility_range(node->level);
+	if( !aabbf_intersect_sphere_sq( &aabb, camera_get_position(), dist_limit * dist_limit ) )
+		return OUT_OF_RANGE;
+	intersect_t sub_results[4] = { UNDEFINED, UNDEFINED, UNDEFINED, UNDEFINED };
+	if( !node_is_leaf( node ) && node->level != lod_selection_get_stop_at_level() ) {
+		float next_dist_limit = lod_selection_get_visibility_range(node->level+1);
+		if( aabbf_intersect_sphere_sq( &aabb, camera_get_position(), next_dist_limit * next_dist_limit ) )
+			for( unsigned int i = 0; i < 4; ++i ) {
+				const node_t *sub_node = node_get_sub_node( node, quadtree, i );
+				if( sub_node )
+					sub_results[i] = select_node( sub_node, quadtree, frustum_intersection == INSIDE, cull, buffer );
+			}
+	}
+	bool remove[4];
+	bool any_selected = false;
+	for( unsigned int i = 0; i < 4; ++i ) {
+		remove[i] = OUTSIDE == sub_results[i] || SELECTED == sub_results[i];
+		any_selected = any_selected || SELECTED == sub_results[i];
+	}
+	if( !( remove[0] && remove[1] && remove[2] && remove[3] ) )
+		return lod_selection_add_node( buffer, node, &aabb, lod_selection_get_stop_at_level() - node->level,
+				!remove[0], !remove[1], !remove[2], !remove[3] ) ? SELECTED : OUTSIDE;
+	return any_selected ? SELECTED : OUTSIDE;
+}
+
+static void select_tiles( const unsigned int num_tiles, cull_t *cull, lod_selection_buffer_t *buffer ) {
+	lod_selection_buffer_reset( buffer );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		const quadtree_t *quadtree = tiles[t]->quadtree;
+		buffer->tile_index = t;
+		for( unsigned int z = 0; z < quadtree->top_node_count; ++z )
+			for( unsigned int x = 0; x < quadtree->top_node_count; ++x )
+				select_node( quadtree_get_node( quadtree, 0, x, z ), quadtree, false, cull, buffer );
+	}
+}
+
+// Every node of subset is in superset, in the same order, and draws no quadrant superset doesn't
+static bool is_subset( const lod_selection_buffer_t *const subset, const lod_selection_buffer_t *const superset ) {
+	unsigned int j = 0;
+	for( unsigned int i = 0; i < subset->count; ++i ) {
+		const selected_node_t *a = &subset->nodes[i];
+		while( j < superset->count && superset->nodes[j].node != a->node )
+			++j;
+		if( j == superset->count )
+			return false;
+		const selected_node_t *b = &superset->nodes[j];
+		if( ( a->hasTL && !b->hasTL ) || ( a->hasTR && !b->hasTR ) || ( a->hasBL && !b->hasBL ) || ( a->hasBR && !b->hasBR ) )
+			return false;
+	}
+	return true;
+}
+
+static bool bench_grid( const unsigned int extent, const unsigned int tiles_per_side, const int num_frames ) {
+	const unsigned int num_tiles = tiles_per_side * tiles_per_side;
+	const float size = (float)( extent * tiles_per_side );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		tiles[t] = bench_terrain_create_tile( extent, t + 1, (float)( t % tiles_per_side * extent ) - 0.5f * size,
+				(float)( t / tiles_per_side * extent ) - 0.5f * size );
+		if( tiles[t] )
+			tiles[t]->quadtree = quadtree_create( tiles[t], false, NUMBER_OF_THREADS, NULL );
+		if( !tiles[t] || !tiles[t]->quadtree ) {
+			printf( "Can't create tile %u\n", t );
+			return false;
+		}
+	}
+	cull_t culls[2] = { { .test = sphere_contains_box }, { .test = frustum_contains_box } };
+	lod_selection_buffer_t buffers[2] = { 0 };
+	double select_ms[2] = { 0.0, 0.0 };
+	size_t num_selected[2] = { 0, 0 };
+	int num_lost = 0;
+	for( int f = 0; f < num_frames; ++f ) {
+		bench_terrain_fly( f, size );
+		for( int i = 0; i < 2; ++i ) {
+			double best = 1e30;
+			for( int r = 0; r < RUNS; ++r ) {
+				const double start = bench_get_ms();
+				select_tiles( num_tiles, &culls[i], &buffers[i] );
+				const double ms = bench_get_ms() - start;
+				best = ms < best ? ms : best;
+			}
+			select_ms[i] += best;
+			culls[i].is_counting = true;
+			select_tiles( num_tiles, &culls[i], &buffers[i] );
+			culls[i].is_counting = false;
+			num_selected[i] += buffers[i].count;
+		}
+		num_lost += !is_subset( &buffers[1], &buffers[0] );
+	}
+	printf( "%u tiles of %u, %d frames, per frame:\n", num_tiles, extent, num_frames );
+	printf( "  %-8s %10s %10s %16s %10s %10s\n", "test", "boxes", "culled", "false positives", "selected", "ms" );
+	const char *names[2] = { "sphere", "planes" };
+	for( int i = 0; i < 2; ++i )
+		printf( "  %-8s %10.1f %10.1f %16.1f %10.1f %10.4f\n", names[i], (double)culls[i].tested / num_frames,
+				(double)culls[i].culled / num_frames, (double)culls[i].false_positives / num_frames,
+				(double)num_selected[i] / num_frames, select_ms[i] / num_frames );
+	if( num_lost > 0 )
+		printf( "  %d frames with nodes or quadrants the sphere test doesn't select\n", num_lost );
+	for( int i = 0; i < 2; ++i )
+		lod_selection_buffer_delete( &buffers[i] );
+	for( unsigned int t = 0; t < num_tiles; ++t )
+		bench_terrain_delete_tile( tiles[t] );
+	return 0 == num_lost;
+}
+
+int main( int argc, char **argv ) {
+	const int num_frames = argc > 1 ? atoi( argv[1] ) : 500;
+	const float far_plane = argc > 2 ? (float)atof( argv[2] ) : 6000.0f;
+	logbook_init();
+	lod_selection_create( false );
+	bench_terrain_set_far_plane( far_plane );
+	printf( "Frustum culling in the recursive selection, far plane %.0f, best of %d runs\n", (double)far_plane, RUNS );
+	const bool is_lossless = bench_grid( 1024, 8, num_frames ) && bench_grid( 4096, 2, num_frames );
+	lod_selection_delete();
+	logbook_de_init();
+	return is_lossless ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,113 @@
+/* Flies a camera over a grid of tiles and compares the selection of the compute shader with that of
+ * the selection pool in every frame, with gpu_selection_matches_cpu(). Some tiles are not ready and
+ * tiles become ready and unready on the way, so quadtrees are uploaded and freed. Run from the repo
+ * root, the shader is loaded from src/terrain.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/gpu_selection_test.c src/bench/bench.c \
+ *       src/bench/bench_gl.c src/bench/bench_terrain.c src/terrain/gpu_selection.c \
+ *       src/terrain/selection_pool.c src/terrain/quadtree.c src/terrain/node.c src/terrain/lod_selection.c \
+ *       src/terrain/minmax_pyramid.c src/terrain/height_kernels.c src/renderer/shader_program.c \
+ *       src/base/logbook.c src/omath/frustum_batch.c src/omath/aabb.c src/omath/view_frustum.c \
+ *       src/omath/vec3.c src/omath/common.c extern/glad/glad.c -lEGL -ldl -lm -lpthread
+ * Usage: gpu_selection_test [tile extent] [tiles per side] [frames] [far plane]
+ * Besides the defaults, run it with a near tile that selects thousands of nodes and with many tiles
+ * that share the node pool:
+ *   gpu_selection_test 8192 2 60 30000
+ *   gpu_selection_test 2048 16 60 30000 */
+
+#include "bench.h"
+#include "bench_gl.h"
+#include "bench_terrain.h"
+#include "base/logbook.h"
+#include "terrain/gpu_selection.h"
+#include "terrain/gridmesh.h"
+#include "terrain/selection_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TILES_PER_SIDE 16
+// A tile changes between ready and loaded every this many frames
+#define STATUS_PERIOD 50
+
+static tiles_t tiles[MAX_TILES_PER_SIDE * MAX_TILES_PER_SIDE];
+
+static bool create_tiles( const unsigned int extent, const unsigned int tiles_per_side ) {
+	const unsigned int num_tiles = tiles_per_side * tiles_per_side;
+	const float size = (float)( extent * tiles_per_side );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		terrain_tile_t *tile = bench_terrain_create_tile( extent, t + 1,
+				(float)( t % tiles_per_side * extent ) - 0.5f * size, (float)( t / tiles_per_side * extent ) - 0.5f * size );
+		if( tile )
+			tile->quadtree = quadtree_create( tile, false, NUMBER_OF_THREADS, NULL );
+		if( !tile || !tile->quadtree ) {
+			printf( "Can't create tile %u\n", t );
+			bench_terrain_delete_tile( tile );
+			return false;
+		}
+		tiles[t].tile = tile;
+		tiles[t].tile_index = t;
+		tiles[t].aabb = tile->aabb;
+		atomic_init( &tiles[t].status, 3 == t % 7 ? loaded : ready );
+	}
+	return true;
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 1024;
+	unsigned int tiles_per_side = argc > 2 ? (unsigned int)atoi( argv[2] ) : 8;
+	const int num_frames = argc > 3 ? atoi( argv[3] ) : 200;
+	const float far_plane = argc > 4 ? (float)atof( argv[4] ) : 6000.0f;
+	tiles_per_side = tiles_per_side < MAX_TILES_PER_SIDE ? tiles_per_side : MAX_TILES_PER_SIDE;
+	const unsigned int num_tiles = tiles_per_side * tiles_per_side;
+	logbook_init();
+	if( !bench_gl_create_context() ) {
+		printf( "No gl 4.5 context\n" );
+		return EXIT_FAILURE;
+	}
+	lod_selection_create( false );
+	bench_terrain_set_far_plane( far_plane );
+	// Only the quadrant size and index type are used, nothing is drawn
+	gridmesh_t gridmesh;
+	memset( &gridmesh, 0, sizeof(gridmesh) );
+	gridmesh.dimension = GRIDMESH_DIMENSION;
+	gridmesh.end_index_tl = GRIDMESH_DIMENSION * GRIDMESH_DIMENSION / 4 * 6;
+	gridmesh.index_type = GL_UNSIGNED_SHORT;
+	if( !create_tiles( extent, tiles_per_side ) || !selection_pool_create() || !gpu_selection_create( &gridmesh ) ) {
+		printf( "Can't set up the selection\n" );
+		return EXIT_FAILURE;
+	}
+	int num_mismatches = 0;
+	double gpu_ms = 0.0, cpu_ms = 0.0;
+	size_t num_selected = 0;
+	for( int f = 0; f < num_frames; ++f ) {
+		if( STATUS_PERIOD / 2 == f % STATUS_PERIOD ) {
+			tiles_t *t = &tiles[f / STATUS_PERIOD % num_tiles];
+			atomic_store( &t->status, ready == atomic_load( &t->status ) ? loaded : ready );
+		}
+		bench_terrain_fly( f, (float)( extent * tiles_per_side ) );
+		glFinish();
+		double start = bench_get_ms();
+		gpu_selection_select( tiles, num_tiles );
+		glFinish();
+		gpu_ms += bench_get_ms() - start;
+		start = bench_get_ms();
+		selection_pool_select( tiles, num_tiles );
+		lod_selection_sort();
+		cpu_ms += bench_get_ms() - start;
+		num_selected += lod_selection_get_selection_count();
+		num_mismatches += !gpu_selection_matches_cpu( tiles, num_tiles );
+	}
+	const GLenum error = glGetError();
+	printf( "%u tiles of %u, far plane %.0f, %d frames: %.1f nodes, gpu %.3f ms, cpu %.3f ms per frame\n",
+			num_tiles, extent, (double)far_plane, num_frames, (double)num_selected / num_frames,
+			gpu_ms / num_frames, cpu_ms / num_frames );
+	printf( "%d frames with mismatches, gl error 0x%x\n", num_mismatches, error );
+	gpu_selection_delete();
+	selection_pool_delete();
+	for( unsigned int t = 0; t < num_tiles; ++t )
+		bench_terrain_delete_tile( tiles[t].tile );
+	lod_selection_delete();
+	bench_gl_delete_context();
+	logbook_de_init();
+	return 0 == num_mismatches && GL_NO_ERROR == error ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,85 @@
+/* Throughput of the height scan kernels on tiles of 1024^2 to 16384^2 texels, in GB/s of height
+ * values read. Compares the column wise scalar scan the load path used before with the row wise
+ * kernels and the min/max pyramid build that uses them. All scans must find the same min/max.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/height_kernels_bench.c src/bench/bench.c \
+ *       src/terrain/height_kernels.c src/terrain/minmax_pyramid.c src/base/logbook.c -lm -lpthread
+ * Usage: height_kernels_bench [max extent] */
+
+#include "bench.h"
+#include "base/logbook.h"
+#include "terrain/height_kernels.h"
+#include "terrain/minmax_pyramid.h"
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUNS 5
+
+static void scan_columns( const uint16_t *const values, const unsigned int extent, uint16_t *min, uint16_t *max ) {
+	uint16_t mi = UINT16_MAX, ma = 0;
+	for( size_t x = 0; x < extent; ++x )
+		for( size_t z = 0; z < extent; ++z ) {
+			const uint16_t v = values[z * extent + x];
+			mi = v < mi ? v : mi;
+			ma = v > ma ? v : ma;
+		}
+	*min = mi;
+	*max = ma;
+}
+
+static void scan_rows( const uint16_t *const values, const unsigned int extent, uint16_t *min, uint16_t *max ) {
+	*min = UINT16_MAX;
+	*max = 0;
+	for( size_t z = 0; z < extent; ++z )
+		height_kernels_min_max( &values[z * extent], extent, min, max );
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int max_extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 16384;
+	logbook_init();
+	printf( "Height kernels: %s, best of %d runs, GB/s\n", height_kernels_get_isa(), RUNS );
+	printf( "%8s %10s %10s %10s\n", "extent", "columns", "rows", "pyramid" );
+	bool all_equal = true;
+	for( unsigned int extent = 1024; extent <= max_extent; extent *= 2 ) {
+		const size_t bytes = (size_t)extent * extent * sizeof(uint16_t);
+		uint16_t *values = malloc( bytes );
+		if( !values ) {
+			printf( "Can't allocate %zu bytes\n", bytes );
+			return EXIT_FAILURE;
+		}
+		bench_fill_heights( values, extent, extent );
+		double best[3] = { 1e30, 1e30, 1e30 };
+		uint16_t min[3], max[3];
+		for( int r = 0; r < RUNS; ++r ) {
+			double start = bench_get_ms();
+			scan_columns( values, extent, &min[0], &max[0] );
+			double ms = bench_get_ms() - start;
+			best[0] = ms < best[0] ? ms : best[0];
+			start = bench_get_ms();
+			scan_rows( values, extent, &min[1], &max[1] );
+			ms = bench_get_ms() - start;
+			best[1] = ms < best[1] ? ms : best[1];
+			start = bench_get_ms();
+			minmax_pyramid_t *pyramid = minmax_pyramid_create( values, extent, NULL );
+			ms = bench_get_ms() - start;
+			best[2] = ms < best[2] ? ms : best[2];
+			if( !pyramid ) {
+				printf( "Can't create the pyramid of extent %u\n", extent );
+				return EXIT_FAILURE;
+			}
+			const minmax_t total = minmax_pyramid_get_total( pyramid );
+			min[2] = total.min;
+			max[2] = total.max;
+			minmax_pyramid_delete( pyramid );
+		}
+		for( int i = 1; i < 3; ++i )
+			all_equal = all_equal && min[i] == min[0] && max[i] == max[0];
+		printf( "%8u %10.2f %10.2f %10.2f\n", extent, (double)bytes / best[0] * 1e-6,
+				(double)bytes / best[1] * 1e-6, (double)bytes / best[2] * 1e-6 );
+		free( values );
+	}
+	if( !all_equal )
+		printf( "Scans differ in min/max\n" );
+	logbook_de_init();
+	return all_equal ? EXIT_SUCCESS : EXIT_FAILURE;
+}
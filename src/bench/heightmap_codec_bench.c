@@ -0,0 +1,98 @@
+/* Size and decode speed of the compressed format against the 16 bit PNGs it replaces. Every PNG is
+ * compressed to <png>.c16 next to it, decoded on 1 to NUMBER_OF_THREADS threads and compared with the
+ * PNG's texels. The file is removed afterwards.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/heightmap_codec_bench.c src/bench/bench.c \
+ *       src/terrain/heightmap_codec.c src/base/mapped_file.c src/base/logbook.c extern/stb/stb_image.c \
+ *       -lm -lpthread
+ * Usage: heightmap_codec_bench <16 bit png>... */
+
+#include "bench.h"
+#include "base/logbook.h"
+#include "base/mapped_file.h"
+#include "terrain/heightmap_codec.h"
+#include "stb/stb_image.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNS 3
+
+static bool bench_file( const char *png_filename ) {
+	printf( "%s\n", png_filename );
+	mapped_file_t *png = mapped_file_create( png_filename, NULL );
+	if( !png )
+		return false;
+	const size_t png_size = png->size;
+	mapped_file_delete( png );
+	int w = 0, h = 0, channels;
+	uint16_t *values = NULL;
+	double png_ms = 1e30;
+	for( int r = 0; r < RUNS; ++r ) {
+		stbi_image_free( values );
+		const double start = bench_get_ms();
+		values = stbi_load_16( png_filename, &w, &h, &channels, 1 );
+		const double ms = bench_get_ms() - start;
+		png_ms = ms < png_ms ? ms : png_ms;
+	}
+	if( !values || w != h ) {
+		printf( "Not a square 16 bit image\n" );
+		stbi_image_free( values );
+		return false;
+	}
+	const unsigned int extent = (unsigned int)w;
+	const double num_texels = (double)extent * extent;
+	uint16_t min = UINT16_MAX, max = 0;
+	for( size_t i = 0; i < (size_t)extent * extent; ++i ) {
+		min = values[i] < min ? values[i] : min;
+		max = values[i] > max ? values[i] : max;
+	}
+	char codec_filename[MAX_LEN_FILENAMES];
+	snprintf( codec_filename, MAX_LEN_FILENAMES, "%s%s", png_filename, HEIGHTMAP_CODEC_EXTENSION );
+	const double encode_start = bench_get_ms();
+	if( !heightmap_codec_write( values, extent, min, max, codec_filename ) ) {
+		stbi_image_free( values );
+		return false;
+	}
+	const double encode_ms = bench_get_ms() - encode_start;
+	mapped_file_t *file = mapped_file_create( codec_filename, NULL );
+	bool is_equal = file && heightmap_codec_validate( file );
+	printf( "  %-24s %10s %8s %10s %10s\n", "", "bytes", "bits", "ms", "Mtexels/s" );
+	printf( "  %-24s %10zu %8.2f %10.2f %10.2f\n", "png decode", png_size, (double)png_size * 8.0 / num_texels,
+			png_ms, num_texels / png_ms * 1e-3 );
+	if( file )
+		printf( "  %-24s %10zu %8.2f %10.2f %10.2f\n", "codec encode", file->size,
+				(double)file->size * 8.0 / num_texels, encode_ms, num_texels / encode_ms * 1e-3 );
+	for( unsigned int t = 1; t <= NUMBER_OF_THREADS && is_equal; ++t ) {
+		double best = 1e30;
+		for( int r = 0; r < RUNS && is_equal; ++r ) {
+			const double start = bench_get_ms();
+			uint16_t *decoded = heightmap_codec_decode( file, t );
+			const double ms = bench_get_ms() - start;
+			best = ms < best ? ms : best;
+			is_equal = decoded && 0 == memcmp( decoded, values, (size_t)extent * extent * sizeof(uint16_t) );
+			free( decoded );
+		}
+		char label[32];
+		snprintf( label, sizeof(label), "codec decode, %u thr", t );
+		printf( "  %-24s %10s %8s %10.2f %10.2f\n", label, "", "", best, num_texels / best * 1e-3 );
+	}
+	if( !is_equal )
+		printf( "  Decoded texels differ from the png\n" );
+	mapped_file_delete( file );
+	remove( codec_filename );
+	stbi_image_free( values );
+	return is_equal;
+}
+
+int main( int argc, char **argv ) {
+	if( argc < 2 ) {
+		printf( "Usage: %s <16 bit png>...\n", argv[0] );
+		return EXIT_FAILURE;
+	}
+	logbook_init();
+	bool success = true;
+	for( int i = 1; i < argc; ++i )
+		success = bench_file( argv[i] ) && success;
+	logbook_de_init();
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,108 @@
+/* The selection pool refining the last selection against a full selection, on a grid of tiles glided
+ * over with small steps and occasional jumps. The refined selection must be the one quadtree_lod_select()
+ * makes over all top level nodes in every frame. Then the same glide again, with every selection a
+ * full one, for the time.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/lod_refine_bench.c src/bench/bench.c \
+ *       src/bench/bench_terrain.c src/terrain/selection_pool.c src/terrain/quadtree.c src/terrain/node.c \
+ *       src/terrain/lod_selection.c src/terrain/minmax_pyramid.c src/terrain/height_kernels.c \
+ *       src/base/logbook.c src/omath/frustum_batch.c src/omath/aabb.c src/omath/view_frustum.c \
+ *       src/omath/vec3.c src/omath/common.c -lm -lpthread
+ * Usage: lod_refine_bench [tile extent] [tiles per side] [frames] [far plane] */
+
+#include "bench.h"
+#include "bench_terrain.h"
+#include "base/logbook.h"
+#include "terrain/selection_pool.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_TILES_PER_SIDE 16
+
+static tiles_t tiles[MAX_TILES_PER_SIDE * MAX_TILES_PER_SIDE];
+
+static bool create_tiles( const unsigned int extent, const unsigned int tiles_per_side ) {
+	const unsigned int num_tiles = tiles_per_side * tiles_per_side;
+	const float size = (float)( extent * tiles_per_side );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		terrain_tile_t *tile = bench_terrain_create_tile( extent, t + 1,
+				(float)( t % tiles_per_side * extent ) - 0.5f * size, (float)( t / tiles_per_side * extent ) - 0.5f * size );
+		if( tile )
+			tile->quadtree = quadtree_create( tile, false, NUMBER_OF_THREADS, NULL );
+		if( !tile || !tile->quadtree ) {
+			printf( "Can't create tile %u\n", t );
+			bench_terrain_delete_tile( tile );
+			return false;
+		}
+		tiles[t].tile = tile;
+		tiles[t].tile_index = t;
+		tiles[t].aabb = tile->aabb;
+		atomic_init( &tiles[t].status, ready );
+	}
+	return true;
+}
+
+// All top level nodes of all tiles, in tile order
+static void select_all( const unsigned int num_tiles, lod_selection_buffer_t *buffer ) {
+	lod_selection_buffer_reset( buffer );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		const quadtree_t *quadtree = tiles[t].tile->quadtree;
+		buffer->tile_index = t;
+		quadtree_lod_select( quadtree, 0, quadtree->top_node_count * quadtree->top_node_count, buffer, NULL );
+	}
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 4096;
+	unsigned int tiles_per_side = argc > 2 ? (unsigned int)atoi( argv[2] ) : 4;
+	const int num_frames = argc > 3 ? atoi( argv[3] ) : 1000;
+	const float far_plane = argc > 4 ? (float)atof( argv[4] ) : 6000.0f;
+	tiles_per_side = tiles_per_side < MAX_TILES_PER_SIDE ? tiles_per_side : MAX_TILES_PER_SIDE;
+	const unsigned int num_tiles = tiles_per_side * tiles_per_side;
+	const float size = (float)( extent * tiles_per_side );
+	logbook_init();
+	lod_selection_create( false );
+	bench_terrain_set_far_plane( far_plane );
+	if( !create_tiles( extent, tiles_per_side ) || !selection_pool_create() ) {
+		printf( "Can't set up the selection\n" );
+		return EXIT_FAILURE;
+	}
+	lod_selection_buffer_t reference = { 0 };
+	int num_mismatches = 0;
+	double refine_ms = 0.0, full_ms = 0.0;
+	size_t num_selected = 0, num_kept = 0, num_tops = 0;
+	for( int f = 0; f < num_frames; ++f ) {
+		bench_terrain_glide( f, size );
+		const double start = bench_get_ms();
+		selection_pool_select( tiles, num_tiles );
+		refine_ms += bench_get_ms() - start;
+		unsigned int frame_tops;
+		num_kept += selection_pool_get_num_kept_tops( &frame_tops );
+		num_tops += frame_tops;
+		// A view of the selection, before lod_selection_sort() reorders it
+		const unsigned int count = lod_selection_get_selection_count();
+		const lod_selection_buffer_t selection = {
+				.count = count, .capacity = count, .nodes = count > 0 ? lod_selection_get_selected_node( 0 ) : NULL };
+		select_all( num_tiles, &reference );
+		num_selected += count;
+		num_mismatches += !bench_terrain_is_same_selection( &selection, &reference );
+	}
+	for( int f = 0; f < num_frames; ++f ) {
+		bench_terrain_glide( f, size );
+		const double start = bench_get_ms();
+		selection_pool_invalidate();
+		selection_pool_select( tiles, num_tiles );
+		full_ms += bench_get_ms() - start;
+	}
+	printf( "%u tiles of %u, far plane %.0f, %d frames: %.1f nodes, %.1f%% of top level nodes kept\n",
+			num_tiles, extent, (double)far_plane, num_frames, (double)num_selected / num_frames,
+			num_tops > 0 ? 100.0 * (double)num_kept / (double)num_tops : 0.0 );
+	printf( "refined %.4f ms, full %.4f ms per frame, %d frames with mismatches\n",
+			refine_ms / num_frames, full_ms / num_frames, num_mismatches );
+	lod_selection_buffer_delete( &reference );
+	selection_pool_delete();
+	for( unsigned int t = 0; t < num_tiles; ++t )
+		bench_terrain_delete_tile( tiles[t].tile );
+	lod_selection_delete();
+	logbook_de_init();
+	return 0 == num_mismatches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,88 @@
+/* The iterative node_lod_select() against the recursive selection it replaced, on a grid of tiles
+ * flown over with a few far planes. Both must select the same nodes with the same quadrants in the
+ * same order in every frame.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/lod_select_bench.c src/bench/bench.c \
+ *       src/bench/bench_terrain.c src/terrain/quadtree.c src/terrain/node.c src/terrain/lod_selection.c \
+ *       src/terrain/minmax_pyramid.c src/terrain/height_kernels.c src/base/logbook.c src/omath/aabb.c \
+ *       src/omath/view_frustum.c src/omath/vec3.c src/omath/common.c -lm -lpthread
+ * Usage: lod_select_bench [tile extent] [tiles per side] [frames] */
+
+#include "bench.h"
+#include "bench_terrain.h"
+#include "base/logbook.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUNS 5
+#define MAX_TILES_PER_SIDE 16
+
+static terrain_tile_t *tiles[MAX_TILES_PER_SIDE * MAX_TILES_PER_SIDE];
+
+static void select_tiles( const unsigned int num_tiles, const bool is_recursive, lod_selection_buffer_t *buffer ) {
+	lod_selection_buffer_reset( buffer );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		const quadtree_t *quadtree = tiles[t]->quadtree;
+		buffer->tile_index = t;
+		if( is_recursive )
+			bench_terrain_select_recursive( quadtree, buffer );
+		else
+			quadtree_lod_select( quadtree, 0, quadtree->top_node_count * quadtree->top_node_count, buffer, NULL );
+	}
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 4096;
+	unsigned int tiles_per_side = argc > 2 ? (unsigned int)atoi( argv[2] ) : 4;
+	const int num_frames = argc > 3 ? atoi( argv[3] ) : 500;
+	tiles_per_side = tiles_per_side < MAX_TILES_PER_SIDE ? tiles_per_side : MAX_TILES_PER_SIDE;
+	const unsigned int num_tiles = tiles_per_side * tiles_per_side;
+	const float size = (float)( extent * tiles_per_side );
+	logbook_init();
+	lod_selection_create( false );
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		tiles[t] = bench_terrain_create_tile( extent, t + 1, (float)( t % tiles_per_side * extent ) - 0.5f * size,
+				(float)( t / tiles_per_side * extent ) - 0.5f * size );
+		if( tiles[t] )
+			tiles[t]->quadtree = quadtree_create( tiles[t], false, NUMBER_OF_THREADS, NULL );
+		if( !tiles[t] || !tiles[t]->quadtree ) {
+			printf( "Can't create tile %u\n", t );
+			return EXIT_FAILURE;
+		}
+	}
+	printf( "%u tiles of %u, %d frames, best of %d runs\n", num_tiles, extent, num_frames, RUNS );
+	printf( "%10s %12s %14s %14s %10s\n", "far plane", "avg nodes", "recursive ms", "iterative ms", "mismatches" );
+	const float far_planes[] = { 2000.0f, 6000.0f, 12000.0f };
+	lod_selection_buffer_t buffers[2] = { 0 };
+	int num_mismatches = 0;
+	for( size_t p = 0; p < sizeof(far_planes) / sizeof(far_planes[0]); ++p ) {
+		bench_terrain_set_far_plane( far_planes[p] );
+		double select_ms[2] = { 0.0, 0.0 };
+		size_t num_selected = 0;
+		int plane_mismatches = 0;
+		for( int f = 0; f < num_frames; ++f ) {
+			bench_terrain_fly( f, size );
+			for( int i = 0; i < 2; ++i ) {
+				double best = 1e30;
+				for( int r = 0; r < RUNS; ++r ) {
+					const double start = bench_get_ms();
+					select_tiles( num_tiles, 0 == i, &buffers[i] );
+					const double ms = bench_get_ms() - start;
+					best = ms < best ? ms : best;
+				}
+				select_ms[i] += best;
+			}
+			num_selected += buffers[1].count;
+			plane_mismatches += !bench_terrain_is_same_selection( &buffers[0], &buffers[1] );
+		}
+		printf( "%10.0f %12.1f %14.4f %14.4f %10d\n", (double)far_planes[p], (double)num_selected / num_frames,
+				select_ms[0] / num_frames, select_ms[1] / num_frames, plane_mismatches );
+		num_mismatches += plane_mismatches;
+	}
+	for( int i = 0; i < 2; ++i )
+		lod_selection_buffer_delete( &buffers[i] );
+	for( unsigned int t = 0; t < num_tiles; ++t )
+		bench_terrain_delete_tile( tiles[t] );
+	lod_selection_delete();
+	logbook_de_init();
+	return 0 == num_mismatches ? EXIT_SUCCESS : EXIT_FAILURE;
+}
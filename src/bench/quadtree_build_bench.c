@@ -0,0 +1,69 @@
+/* Quadtree build time on 1 to NUMBER_OF_THREADS threads, for tiles of 2048^2 texels up. Every build
+ * must give the same nodes as the one on a single thread. The pyramid is built once per tile and not
+ * timed, on a machine with fewer cores than threads this shows the overhead of the threads.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/quadtree_build_bench.c src/bench/bench.c \
+ *       src/bench/bench_terrain.c src/terrain/quadtree.c src/terrain/node.c src/terrain/lod_selection.c \
+ *       src/terrain/minmax_pyramid.c src/terrain/height_kernels.c src/base/logbook.c src/omath/aabb.c \
+ *       src/omath/view_frustum.c src/omath/vec3.c src/omath/common.c -lm -lpthread
+ * Usage: quadtree_build_bench [max extent] */
+
+#include "bench.h"
+#include "bench_terrain.h"
+#include "base/logbook.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RUNS 5
+
+static bool bench_extent( const unsigned int extent ) {
+	terrain_tile_t *tile = bench_terrain_create_tile( extent, extent, 0.0f, 0.0f );
+	if( !tile ) {
+		printf( "Can't create a tile of extent %u\n", extent );
+		return false;
+	}
+	quadtree_t *serial = quadtree_create( tile, false, 1, NULL );
+	if( !serial ) {
+		bench_terrain_delete_tile( tile );
+		return false;
+	}
+	double best[NUMBER_OF_THREADS];
+	bool is_equal = true;
+	for( unsigned int t = 1; t <= NUMBER_OF_THREADS; ++t ) {
+		best[t-1] = 1e30;
+		for( int r = 0; r < RUNS && is_equal; ++r ) {
+			const double start = bench_get_ms();
+			quadtree_t *quadtree = quadtree_create( tile, false, t, NULL );
+			const double ms = bench_get_ms() - start;
+			best[t-1] = ms < best[t-1] ? ms : best[t-1];
+			is_equal = quadtree && quadtree->node_count == serial->node_count &&
+					0 == memcmp( quadtree->all_nodes, serial->all_nodes, serial->node_count * sizeof(node_t) );
+			quadtree_delete( quadtree );
+		}
+	}
+	// After the build's log lines
+	printf( "%8u %10u", extent, serial->node_count );
+	for( unsigned int t = 1; t <= NUMBER_OF_THREADS; ++t )
+		printf( " %10.2f", best[t-1] );
+	printf( "\n" );
+	if( !is_equal )
+		printf( "Nodes differ from the single threaded build\n" );
+	quadtree_delete( serial );
+	bench_terrain_delete_tile( tile );
+	return is_equal;
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int max_extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 16384;
+	logbook_init();
+	printf( "Quadtree build, best of %d runs, ms by number of threads\n", RUNS );
+	printf( "%8s %10s", "extent", "nodes" );
+	for( unsigned int t = 1; t <= NUMBER_OF_THREADS; ++t )
+		printf( " %10u", t );
+	printf( "\n" );
+	bool is_equal = true;
+	for( unsigned int extent = 2048; extent <= max_extent; extent *= 2 )
+		is_equal = bench_extent( extent ) && is_equal;
+	logbook_de_init();
+	return is_equal ? EXIT_SUCCESS : EXIT_FAILURE;
+}
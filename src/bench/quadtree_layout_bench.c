@@ -0,0 +1,255 @@
+/* The implicit Morton ordered quadtree against the layout it replaced: 16 byte nodes in depth first
+ * order that find their sub nodes by index, with pointers to the top level nodes. Both trees are built
+ * from the same pyramid and walked by the same recursive selection, so the differences in build time,
+ * memory and selection time are the layout's. The selections must be equal, and equal to the one of
+ * quadtree_lod_select().
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/quadtree_layout_bench.c src/bench/bench.c \
+ *       src/bench/bench_terrain.c src/terrain/quadtree.c src/terrain/node.c src/terrain/lod_selection.c \
+ *       src/terrain/minmax_pyramid.c src/terrain/height_kernels.c src/base/logbook.c src/omath/aabb.c \
+ *       src/omath/view_frustum.c src/omath/vec3.c src/omath/common.c -lm -lpthread
+ * Usage: quadtree_layout_bench [max extent] [frames] */
+
+#include "bench.h"
+#include "bench_terrain.h"
+#include "base/camera.h"
+#include "base/logbook.h"
+#include "terrain/node.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define RUNS 5
+#define FAR_PLANE 6000.0f
+
+// node_t as it was
+typedef struct {
+	uint16_t x;
+	uint16_t z;
+	uint16_t min_height;
+	uint16_t max_height;
+	// Index of the first sub node, the existing ones follow in TL, TR, BL, BR order
+	uint32_t first_sub_node;
+	uint8_t level;
+	uint8_t sub_nodes;
+	uint16_t padding;
+} legacy_node_t;
+
+typedef struct {
+	unsigned int top_node_count;
+	unsigned int node_count;
+	legacy_node_t *all_nodes;
+	// [z][x]
+	legacy_node_t ***top_level_nodes;
+	// For the box and to report selected nodes as the nodes of the new tree
+	const quadtree_t *quadtree;
+} legacy_tree_t;
+
+static void legacy_node_create(
+		const unsigned int x, const unsigned int z, const unsigned int level, const heightmap_t *const heightmap,
+		legacy_node_t *all_nodes, unsigned int *last_index, legacy_node_t *node ) {
+	node->x = (uint16_t)( x / LEAF_NODE_SIZE );
+	node->z = (uint16_t)( z / LEAF_NODE_SIZE );
+	node->level = (uint8_t)level;
+	node->sub_nodes = 0;
+	node->first_sub_node = 0;
+	node->padding = 0;
+	const unsigned int size = (unsigned int)LEAF_NODE_SIZE << ( NUMBER_OF_LOD_LEVELS - 1 - level );
+	minmax_pyramid_get_node( heightmap->pyramid, x, z, size, &node->min_height, &node->max_height );
+	if( NUMBER_OF_LOD_LEVELS - 1 == level )
+		return;
+	const unsigned int sub_size = size/2;
+	const bool has_right = x + sub_size < heightmap->extent;
+	const bool has_lower = z + sub_size < heightmap->extent;
+	node->sub_nodes = NODE_SUB_TL | ( has_right ? NODE_SUB_TR : 0 ) | ( has_lower ? NODE_SUB_BL : 0 ) |
+			( has_right && has_lower ? NODE_SUB_BR : 0 );
+	// Siblings side by side, their sub trees behind them
+	node->first_sub_node = *last_index;
+	*last_index += (unsigned int)__builtin_popcount( node->sub_nodes );
+	legacy_node_t *sub_node = &all_nodes[node->first_sub_node];
+	legacy_node_create( x, z, level+1, heightmap, all_nodes, last_index, sub_node++ );
+	if( has_right )
+		legacy_node_create( x+sub_size, z, level+1, heightmap, all_nodes, last_index, sub_node++ );
+	if( has_lower )
+		legacy_node_create( x, z+sub_size, level+1, heightmap, all_nodes, last_index, sub_node++ );
+	if( has_right && has_lower )
+		legacy_node_create( x+sub_size, z+sub_size, level+1, heightmap, all_nodes, last_index, sub_node );
+}
+
+static void legacy_tree_delete( legacy_tree_t *tree ) {
+	if( tree->top_level_nodes )
+		for( unsigned int z = 0; z < tree->top_node_count; ++z )
+			free( tree->top_level_nodes[z] );
+	free( tree->top_level_nodes );
+	free( tree->all_nodes );
+}
+
+static bool legacy_tree_create( const quadtree_t *const quadtree, legacy_tree_t *tree ) {
+	const heightmap_t *heightmap = quadtree->terrain_tile->heightmap;
+	tree->quadtree = quadtree;
+	tree->top_node_count = quadtree->top_node_count;
+	tree->all_nodes = malloc( quadtree->node_count * sizeof(legacy_node_t) );
+	tree->top_level_nodes = calloc( tree->top_node_count, sizeof(legacy_node_t**) );
+	bool is_allocated = tree->all_nodes && tree->top_level_nodes;
+	for( unsigned int z = 0; is_allocated && z < tree->top_node_count; ++z ) {
+		tree->top_level_nodes[z] = malloc( tree->top_node_count * sizeof(legacy_node_t*) );
+		is_allocated = NULL != tree->top_level_nodes[z];
+	}
+	if( !is_allocated ) {
+		legacy_tree_delete( tree );
+		return false;
+	}
+	unsigned int node_counter = 0;
+	for( unsigned int z = 0; z < tree->top_node_count; ++z )
+		for( unsigned int x = 0; x < tree->top_node_count; ++x ) {
+			tree->top_level_nodes[z][x] = &tree->all_nodes[node_counter];
+			++node_counter;
+			legacy_node_create( x * quadtree->top_node_size, z * quadtree->top_node_size, 0, heightmap,
+					tree->all_nodes, &node_counter, tree->top_level_nodes[z][x] );
+		}
+	tree->node_count = node_counter;
+	return true;
+}
+
+static size_t legacy_tree_get_size( const legacy_tree_t *const tree ) {
+	return sizeof(legacy_tree_t) + (size_t)tree->node_count * sizeof(legacy_node_t) +
+			tree->top_node_count * ( sizeof(legacy_node_t**) + tree->top_node_count * sizeof(legacy_node_t*) );
+}
+
+// bench_terrain_select_recursive() on the old layout
+static intersect_t legacy_node_lod_select(
+		const legacy_node_t *const node, const legacy_tree_t *const tree, bool parent_completely_in_frustum,
+		lod_selection_buffer_t *buffer ) {
+	const aabbf *tile_aabb = &tree->quadtree->terrain_tile->aabb;
+	const unsigned int x = (unsigned int)node->x * LEAF_NODE_SIZE;
+	const unsigned int z = (unsigned int)node->z * LEAF_NODE_SIZE;
+	const unsigned int size = (unsigned int)LEAF_NODE_SIZE << ( NUMBER_OF_LOD_LEVELS - 1 - node->level );
+	aabbf aabb;
+	aabb.min.x = tile_aabb->min.x+(float)x;
+	aabb.min.y = (float)node->min_height * HEIGHT_SCALE;
+	aabb.min.z = tile_aabb->min.z+(float)z;
+	aabb.max.x = tile_aabb->min.x+(float)(x+size);
+	aabb.max.y = (float)node->max_height * HEIGHT_SCALE;
+	aabb.max.z = tile_aabb->min.z+(float)(z+size);
+	intersect_t frustum_intersection = parent_completely_in_frustum ?
+			INSIDE : frustum_contains_box( &aabb, camera_get_view_frustum() );
+	if( OUTSIDE == frustum_intersection )
+		return OUTSIDE;
+	float dist_limit = lod_selection_get_visibility_range(node->level);
+	if( !aabbf_intersect_sphere_sq( &aabb, camera_get_position(), dist_limit * dist_limit ) )
+		return OUT_OF_RANGE;
+	intersect_t sub_results[4] = { UNDEFINED, UNDEFINED, UNDEFINED, UNDEFINED };
+	if( 0 != node->sub_nodes && node->level != lod_selection_get_stop_at_level() ) {
+		float next_dist_limit = lod_selection_get_visibility_range(node->level+1);
+		if( aabbf_intersect_sphere_sq( &aabb, camera_get_position(), next_dist_limit * next_dist_limit ) ) {
+			const legacy_node_t *sub_node = &tree->all_nodes[node->first_sub_node];
+			for( unsigned int i = 0; i < 4; ++i )
+				if( node->sub_nodes & ( 1u << i ) )
+					sub_results[i] = legacy_node_lod_select( sub_node++, tree, frustum_intersection == INSIDE, buffer );
+		}
+	}
+	bool remove[4];
+	bool any_selected = false;
+	for( unsigned int i = 0; i < 4; ++i ) {
+		remove[i] = OUTSIDE == sub_results[i] || SELECTED == sub_results[i];
+		any_selected = any_selected || SELECTED == sub_results[i];
+	}
+	if( !( remove[0] && remove[1] && remove[2] && remove[3] ) ) {
+		const unsigned int shift = NUMBER_OF_LOD_LEVELS - 1 - node->level;
+		const node_t *same_node = quadtree_get_node( tree->quadtree, node->level, node->x >> shift, node->z >> shift );
+		return lod_selection_add_node( buffer, same_node, &aabb, lod_selection_get_stop_at_level() - node->level,
+				!remove[0], !remove[1], !remove[2], !remove[3] ) ? SELECTED : OUTSIDE;
+	}
+	return any_selected ? SELECTED : OUTSIDE;
+}
+
+static void legacy_tree_select( const legacy_tree_t *const tree, lod_selection_buffer_t *buffer ) {
+	for( unsigned int z = 0; z < tree->top_node_count; ++z )
+		for( unsigned int x = 0; x < tree->top_node_count; ++x )
+			legacy_node_lod_select( tree->top_level_nodes[z][x], tree, false, buffer );
+}
+
+static bool bench_extent( const unsigned int extent, const int num_frames ) {
+	terrain_tile_t *tile = bench_terrain_create_tile( extent, extent, -0.5f * (float)extent, -0.5f * (float)extent );
+	if( !tile ) {
+		printf( "Can't create a tile of extent %u\n", extent );
+		return false;
+	}
+	legacy_tree_t legacy;
+	double build_ms[2] = { 1e30, 1e30 };
+	for( int r = 0; r < RUNS; ++r ) {
+		tile->quadtree = quadtree_delete( tile->quadtree );
+		double start = bench_get_ms();
+		tile->quadtree = quadtree_create( tile, false, NUMBER_OF_THREADS, tile->quadtree );
+		double ms = bench_get_ms() - start;
+		build_ms[1] = ms < build_ms[1] ? ms : build_ms[1];
+		if( !tile->quadtree ) {
+			bench_terrain_delete_tile( tile );
+			return false;
+		}
+		if( r > 0 )
+			legacy_tree_delete( &legacy );
+		start = bench_get_ms();
+		const bool is_created = legacy_tree_create( tile->quadtree, &legacy );
+		ms = bench_get_ms() - start;
+		build_ms[0] = ms < build_ms[0] ? ms : build_ms[0];
+		if( !is_created ) {
+			bench_terrain_delete_tile( tile );
+			return false;
+		}
+	}
+	const quadtree_t *quadtree = tile->quadtree;
+	lod_selection_buffer_t buffers[3] = { 0 };
+	double select_ms[3] = { 0.0, 0.0, 0.0 };
+	size_t num_selected = 0;
+	int num_mismatches = 0;
+	for( int f = 0; f < num_frames; ++f ) {
+		bench_terrain_fly( f, (float)extent );
+		for( int i = 0; i < 3; ++i ) {
+			double best = 1e30;
+			for( int r = 0; r < RUNS; ++r ) {
+				lod_selection_buffer_reset( &buffers[i] );
+				const double start = bench_get_ms();
+				if( 0 == i )
+					legacy_tree_select( &legacy, &buffers[i] );
+				else if( 1 == i )
+					bench_terrain_select_recursive( quadtree, &buffers[i] );
+				else
+					quadtree_lod_select(
+							quadtree, 0, quadtree->top_node_count * quadtree->top_node_count, &buffers[i], NULL );
+				const double ms = bench_get_ms() - start;
+				best = ms < best ? ms : best;
+			}
+			select_ms[i] += best;
+		}
+		num_selected += buffers[2].count;
+		num_mismatches += !bench_terrain_is_same_selection( &buffers[0], &buffers[1] ) ||
+				!bench_terrain_is_same_selection( &buffers[1], &buffers[2] );
+	}
+	printf( "Extent %u, %u nodes, %d frames of %.1f nodes, %d mismatching frames\n", extent, quadtree->node_count,
+			num_frames, (double)num_selected / num_frames, num_mismatches );
+	printf( "  %-26s %10s %10s %12s\n", "", "build ms", "kbytes", "select ms" );
+	printf( "  %-26s %10.2f %10.1f %12.4f\n", "depth first, recursive", build_ms[0],
+			(double)legacy_tree_get_size( &legacy ) / 1024.0, select_ms[0] / num_frames );
+	printf( "  %-26s %10.2f %10.1f %12.4f\n", "morton, recursive", build_ms[1],
+			(double)quadtree_get_size( quadtree ) / 1024.0, select_ms[1] / num_frames );
+	printf( "  %-26s %10s %10s %12.4f\n", "morton, quadtree_lod_select", "", "", select_ms[2] / num_frames );
+	for( int i = 0; i < 3; ++i )
+		lod_selection_buffer_delete( &buffers[i] );
+	legacy_tree_delete( &legacy );
+	bench_terrain_delete_tile( tile );
+	return 0 == num_mismatches;
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int max_extent = argc > 1 ? (unsigned int)atoi( argv[1] ) : 16384;
+	const int num_frames = argc > 2 ? atoi( argv[2] ) : 200;
+	logbook_init();
+	lod_selection_create( false );
+	bench_terrain_set_far_plane( FAR_PLANE );
+	printf( "Quadtree layouts, best of %d runs, far plane %.0f\n", RUNS, (double)FAR_PLANE );
+	bool is_equal = true;
+	for( unsigned int extent = 2048; extent <= max_extent; extent *= 2 )
+		is_equal = bench_extent( extent, num_frames ) && is_equal;
+	lod_selection_delete();
+	logbook_de_init();
+	return is_equal ? EXIT_SUCCESS : EXIT_FAILURE;
+}
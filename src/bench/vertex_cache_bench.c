@@ -0,0 +1,104 @@
+/* ACMR of a gridmesh quadrant in row order and after vertex_cache_optimize(), for gridmesh
+ * dimensions 16 to 1024 and several cache sizes. The optimizer models an LRU cache of the given size,
+ * the ACMR is measured for a FIFO cache of the same size. The optimized quadrant must hold the same
+ * triangles with the same winding.
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/bench/vertex_cache_bench.c src/bench/bench.c \
+ *       src/renderer/vertex_cache.c -lm
+ * Usage: vertex_cache_bench [max dimension] */
+
+#include "bench.h"
+#include "renderer/vertex_cache.h"
+#include "terrain/settings.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A triangle with its smallest index first, the winding is kept
+typedef struct {
+	GLuint v[3];
+} triangle_t;
+
+static const unsigned int cache_sizes[] = { 16, 24, 32, 64 };
+#define NUM_CACHE_SIZES ( sizeof(cache_sizes) / sizeof(cache_sizes[0]) )
+
+// The top left quadrant of gridmesh_create(), in row order. Returns the number of indices.
+static unsigned int fill_quadrant( const unsigned int dimension, GLuint *indices ) {
+	const unsigned int vertex_dimension = dimension + 1;
+	unsigned int index = 0;
+	for( unsigned int y = 0; y < dimension / 2; ++y )
+		for( unsigned int x = 0; x < dimension / 2; ++x ) {
+			indices[index++] = x + vertex_dimension * y;
+			indices[index++] = x + vertex_dimension * (y + 1);
+			indices[index++] = (x + 1) + vertex_dimension * y;
+			indices[index++] = (x + 1) + vertex_dimension * y;
+			indices[index++] = x + vertex_dimension * (y + 1);
+			indices[index++] = (x + 1) + vertex_dimension * (y + 1);
+		}
+	return index;
+}
+
+static int compare_triangles( const void *a, const void *b ) {
+	const triangle_t *ta = a, *tb = b;
+	for( int i = 0; i < 3; ++i )
+		if( ta->v[i] != tb->v[i] )
+			return ta->v[i] < tb->v[i] ? -1 : 1;
+	return 0;
+}
+
+// Rotates every triangle to start at its smallest index and sorts them
+static void get_triangles( const GLuint *const indices, const unsigned int num_indices, triangle_t *triangles ) {
+	for( unsigned int t = 0; t < num_indices / 3; ++t ) {
+		const GLuint *v = &indices[3*t];
+		const unsigned int first = v[0] < v[1] ? ( v[0] < v[2] ? 0 : 2 ) : ( v[1] < v[2] ? 1 : 2 );
+		for( unsigned int i = 0; i < 3; ++i )
+			triangles[t].v[i] = v[( first + i ) % 3];
+	}
+	qsort( triangles, num_indices / 3, sizeof(triangle_t), compare_triangles );
+}
+
+int main( int argc, char **argv ) {
+	const unsigned int max_dimension = argc > 1 ? (unsigned int)atoi( argv[1] ) : 1024;
+	const size_t max_indices = (size_t)( max_dimension / 2 ) * ( max_dimension / 2 ) * 6;
+	GLuint *row_order = malloc( max_indices * sizeof(GLuint) );
+	GLuint *optimized = malloc( max_indices * sizeof(GLuint) );
+	triangle_t *row_triangles = malloc( max_indices / 3 * sizeof(triangle_t) );
+	triangle_t *optimized_triangles = malloc( max_indices / 3 * sizeof(triangle_t) );
+	if( !row_order || !optimized || !row_triangles || !optimized_triangles ) {
+		printf( "Out of memory\n" );
+		return EXIT_FAILURE;
+	}
+	printf( "ACMR of a gridmesh quadrant, row order / optimized, by FIFO cache size\n" );
+	printf( "%6s %10s", "dim", "triangles" );
+	for( size_t c = 0; c < NUM_CACHE_SIZES; ++c )
+		printf( " %15u", cache_sizes[c] );
+	// Timed at the gridmesh's cache size
+	printf( " %12s\n", "optimize ms" );
+	bool is_same = true;
+	for( unsigned int dimension = 16; dimension <= max_dimension; dimension *= 2 ) {
+		const unsigned int num_indices = fill_quadrant( dimension, row_order );
+		const unsigned int num_vertices = ( dimension + 1 ) * ( dimension + 1 );
+		get_triangles( row_order, num_indices, row_triangles );
+		printf( "%6u %10u", dimension, num_indices / 3 );
+		double optimize_ms = 0.0;
+		for( size_t c = 0; c < NUM_CACHE_SIZES; ++c ) {
+			memcpy( optimized, row_order, num_indices * sizeof(GLuint) );
+			const double start = bench_get_ms();
+			const bool is_optimized = vertex_cache_optimize( optimized, num_indices, num_vertices, cache_sizes[c] );
+			if( GRIDMESH_VERTEX_CACHE_SIZE == cache_sizes[c] )
+				optimize_ms = bench_get_ms() - start;
+			get_triangles( optimized, num_indices, optimized_triangles );
+			is_same = is_same && is_optimized &&
+					0 == memcmp( row_triangles, optimized_triangles, num_indices / 3 * sizeof(triangle_t) );
+			printf( "   %5.3f / %5.3f", (double)vertex_cache_get_acmr( row_order, num_indices, num_vertices, cache_sizes[c] ),
+					(double)vertex_cache_get_acmr( optimized, num_indices, num_vertices, cache_sizes[c] ) );
+		}
+		printf( " %12.1f\n", optimize_ms );
+	}
+	if( !is_same )
+		printf( "The optimizer failed or changed the triangles\n" );
+	free( row_order );
+	free( optimized );
+	free( row_triangles );
+	free( optimized_triangles );
+	return is_same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
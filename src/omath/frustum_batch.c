@@ -0,0 +1,198 @@
+#include "frustum_batch.h"
+#include <stdbool.h>
+#include <threads.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FRUSTUM_BATCH_X86
+#endif
+
+/* A plane to test against, with the box arrays its positive and negative vertices come from.
+ * The normal is the same for all boxes, so the vertex choice is made once per call. */
+typedef struct {
+	unsigned int bit;
+	float nx, ny, nz, distance;
+	const float *px, *py, *pz;
+	const float *nvx, *nvy, *nvz;
+} batch_plane_t;
+
+typedef void (*classify_func_t)(
+		const batch_plane_t *const, const unsigned int, const size_t, uint8_t *, uint8_t * );
+
+static void frustum_batch_select();
+static unsigned int frustum_batch_setup_planes(
+		const aabbf_soa_t *const boxes, const view_frustum_t *const view_frustum, const unsigned int plane_mask,
+		batch_plane_t *planes );
+
+static struct {
+	once_flag once;
+	const char *isa;
+	classify_func_t classify;
+} frustum_batch = { .once = ONCE_FLAG_INIT };
+
+// *** scalar fallback, also handles the tails of the vector versions
+static void classify_scalar( const batch_plane_t *const planes, const unsigned int num_planes,
+		const size_t first, const size_t end, uint8_t *results, uint8_t *plane_masks ) {
+	for( size_t i = first; i < end; ++i ) {
+		bool outside = false;
+		unsigned int intersected = 0;
+		for( unsigned int k = 0; k < num_planes; ++k ) {
+			const batch_plane_t *p = &planes[k];
+			// Same order of operations as vec3f_dot() + distance
+			if( p->nx * p->px[i] + p->ny * p->py[i] + p->nz * p->pz[i] + p->distance < 0.0f )
+				outside = true;
+			if( p->nx * p->nvx[i] + p->ny * p->nvy[i] + p->nz * p->nvz[i] + p->distance < 0.0f )
+				intersected |= p->bit;
+		}
+		results[i] = outside ? OUTSIDE : ( 0 == intersected ? INSIDE : INTERSECTS );
+		if( plane_masks )
+			plane_masks[i] = outside ? 0 : (uint8_t)intersected;
+	}
+}
+
+static void classify_boxes_scalar( const batch_plane_t *const planes, const unsigned int num_planes,
+		const size_t count, uint8_t *results, uint8_t *plane_masks ) {
+	classify_scalar( planes, num_planes, 0, count, results, plane_masks );
+}
+
+#ifdef FRUSTUM_BATCH_X86
+// Writes the lanes of a step, outside and intersected as all ones/plane bits per lane
+static void store_lanes( const int32_t *const outside, const int32_t *const intersected, const unsigned int lanes,
+		uint8_t *results, uint8_t *plane_masks ) {
+	for( unsigned int l = 0; l < lanes; ++l ) {
+		results[l] = outside[l] ? OUTSIDE : ( 0 == intersected[l] ? INSIDE : INTERSECTS );
+		if( plane_masks )
+			plane_masks[l] = outside[l] ? 0 : (uint8_t)intersected[l];
+	}
+}
+
+// *** SSE2, 4 boxes per step
+__attribute__((target("sse2")))
+static void classify_boxes_sse2( const batch_plane_t *const planes, const unsigned int num_planes,
+		const size_t count, uint8_t *results, uint8_t *plane_masks ) {
+	const __m128 zero = _mm_setzero_ps();
+	size_t i = 0;
+	for( ; i + 4 <= count; i += 4 ) {
+		__m128 outside = _mm_setzero_ps();
+		__m128i intersected = _mm_setzero_si128();
+		for( unsigned int k = 0; k < num_planes; ++k ) {
+			const batch_plane_t *p = &planes[k];
+			const __m128 nx = _mm_set1_ps( p->nx );
+			const __m128 ny = _mm_set1_ps( p->ny );
+			const __m128 nz = _mm_set1_ps( p->nz );
+			const __m128 d = _mm_set1_ps( p->distance );
+			const __m128 dp = _mm_add_ps( _mm_add_ps( _mm_add_ps(
+					_mm_mul_ps( nx, _mm_loadu_ps( &p->px[i] ) ), _mm_mul_ps( ny, _mm_loadu_ps( &p->py[i] ) ) ),
+					_mm_mul_ps( nz, _mm_loadu_ps( &p->pz[i] ) ) ), d );
+			const __m128 dn = _mm_add_ps( _mm_add_ps( _mm_add_ps(
+					_mm_mul_ps( nx, _mm_loadu_ps( &p->nvx[i] ) ), _mm_mul_ps( ny, _mm_loadu_ps( &p->nvy[i] ) ) ),
+					_mm_mul_ps( nz, _mm_loadu_ps( &p->nvz[i] ) ) ), d );
+			outside = _mm_or_ps( outside, _mm_cmplt_ps( dp, zero ) );
+			intersected = _mm_or_si128( intersected, _mm_and_si128(
+					_mm_castps_si128( _mm_cmplt_ps( dn, zero ) ), _mm_set1_epi32( (int)p->bit ) ) );
+		}
+		int32_t out_lanes[4], intersected_lanes[4];
+		_mm_storeu_si128( (__m128i *)out_lanes, _mm_castps_si128( outside ) );
+		_mm_storeu_si128( (__m128i *)intersected_lanes, intersected );
+		store_lanes( out_lanes, intersected_lanes, 4, &results[i], plane_masks ? &plane_masks[i] : NULL );
+	}
+	classify_scalar( planes, num_planes, i, count, results, plane_masks );
+}
+
+// *** AVX, 8 boxes per step
+__attribute__((target("avx")))
+static void classify_boxes_avx( const batch_plane_t *const planes, const unsigned int num_planes,
+		const size_t count, uint8_t *results, uint8_t *plane_masks ) {
+	const __m256 zero = _mm256_setzero_ps();
+	size_t i = 0;
+	for( ; i + 8 <= count; i += 8 ) {
+		__m256 outside = _mm256_setzero_ps();
+		// No 256 bit integer ops before avx2, the plane bits are or-ed as floats
+		__m256 intersected = _mm256_setzero_ps();
+		for( unsigned int k = 0; k < num_planes; ++k ) {
+			const batch_plane_t *p = &planes[k];
+			const __m256 nx = _mm256_set1_ps( p->nx );
+			const __m256 ny = _mm256_set1_ps( p->ny );
+			const __m256 nz = _mm256_set1_ps( p->nz );
+			const __m256 d = _mm256_set1_ps( p->distance );
+			const __m256 dp = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps(
+					_mm256_mul_ps( nx, _mm256_loadu_ps( &p->px[i] ) ), _mm256_mul_ps( ny, _mm256_loadu_ps( &p->py[i] ) ) ),
+					_mm256_mul_ps( nz, _mm256_loadu_ps( &p->pz[i] ) ) ), d );
+			const __m256 dn = _mm256_add_ps( _mm256_add_ps( _mm256_add_ps(
+					_mm256_mul_ps( nx, _mm256_loadu_ps( &p->nvx[i] ) ), _mm256_mul_ps( ny, _mm256_loadu_ps( &p->nvy[i] ) ) ),
+					_mm256_mul_ps( nz, _mm256_loadu_ps( &p->nvz[i] ) ) ), d );
+			outside = _mm256_or_ps( outside, _mm256_cmp_ps( dp, zero, _CMP_LT_OQ ) );
+			intersected = _mm256_or_ps( intersected, _mm256_and_ps( _mm256_cmp_ps( dn, zero, _CMP_LT_OQ ),
+					_mm256_castsi256_ps( _mm256_set1_epi32( (int)p->bit ) ) ) );
+		}
+		int32_t out_lanes[8], intersected_lanes[8];
+		_mm256_storeu_si256( (__m256i *)out_lanes, _mm256_castps_si256( outside ) );
+		_mm256_storeu_si256( (__m256i *)intersected_lanes, _mm256_castps_si256( intersected ) );
+		store_lanes( out_lanes, intersected_lanes, 8, &results[i], plane_masks ? &plane_masks[i] : NULL );
+	}
+	classify_scalar( planes, num_planes, i, count, results, plane_masks );
+}
+#endif
+
+inline void frustum_batch_classify_boxes(
+		const aabbf_soa_t *const boxes, const size_t count, const view_frustum_t *const view_frustum,
+		const unsigned int plane_mask, uint8_t *results, uint8_t *plane_masks ) {
+	call_once( &frustum_batch.once, frustum_batch_select );
+	batch_plane_t planes[FRUSTUM_NUM_PLANES];
+	const unsigned int num_planes = frustum_batch_setup_planes( boxes, view_frustum, plane_mask, planes );
+	frustum_batch.classify( planes, num_planes, count, results, plane_masks );
+}
+
+inline void frustum_batch_classify_boxes_scalar(
+		const aabbf_soa_t *const boxes, const size_t count, const view_frustum_t *const view_frustum,
+		const unsigned int plane_mask, uint8_t *results, uint8_t *plane_masks ) {
+	batch_plane_t planes[FRUSTUM_NUM_PLANES];
+	const unsigned int num_planes = frustum_batch_setup_planes( boxes, view_frustum, plane_mask, planes );
+	classify_scalar( planes, num_planes, 0, count, results, plane_masks );
+}
+
+inline const char *frustum_batch_get_isa() {
+	call_once( &frustum_batch.once, frustum_batch_select );
+	return frustum_batch.isa;
+}
+
+// *** static stuff
+// Once per process, for whichever thread classifies boxes first
+void frustum_batch_select() {
+	frustum_batch.isa = "scalar";
+	frustum_batch.classify = classify_boxes_scalar;
+#ifdef FRUSTUM_BATCH_X86
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx" ) ) {
+		frustum_batch.isa = "avx";
+		frustum_batch.classify = classify_boxes_avx;
+	} else if( __builtin_cpu_supports( "sse2" ) ) {
+		frustum_batch.isa = "sse2";
+		frustum_batch.classify = classify_boxes_sse2;
+	}
+#endif
+}
+
+// Picks the vertex arrays per plane like aabbf_get_vertex_positive()/_negative(). Returns the number of planes.
+unsigned int frustum_batch_setup_planes(
+		const aabbf_soa_t *const boxes, const view_frustum_t *const view_frustum, const unsigned int plane_mask,
+		batch_plane_t *planes ) {
+	unsigned int num_planes = 0;
+	for( unsigned int i = 0; i < FRUSTUM_NUM_PLANES; ++i ) {
+		if( !( plane_mask & ( 1u << i ) ) )
+			continue;
+		const vec3f *n = &view_frustum->planes[i].normal;
+		batch_plane_t *p = &planes[num_planes++];
+		p->bit = 1u << i;
+		p->nx = n->x;
+		p->ny = n->y;
+		p->nz = n->z;
+		p->distance = view_frustum->planes[i].distance;
+		p->px = n->x >= 0.0f ? boxes->max_x : boxes->min_x;
+		p->py = n->y >= 0.0f ? boxes->max_y : boxes->min_y;
+		p->pz = n->z >= 0.0f ? boxes->max_z : boxes->min_z;
+		p->nvx = n->x >= 0.0f ? boxes->min_x : boxes->max_x;
+		p->nvy = n->y >= 0.0f ? boxes->min_y : boxes->max_y;
+		p->nvz = n->z >= 0.0f ? boxes->min_z : boxes->max_z;
+	}
+	return num_planes;
+}
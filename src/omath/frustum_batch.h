@@ -0,0 +1,35 @@
+/* Frustum culling of many boxes per call. The boxes are passed as structure of arrays, so whole
+ * arrays of tiles, nodes or objects can be classified in one go. AVX (8 boxes per step) and SSE2
+ * (4 boxes per step) versions are selected at runtime, with a scalar fallback on other cpus.
+ * All versions return the same results as frustum_contains_box_masked(). */
+
+#pragma once
+
+#include "view_frustum.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+// Box i spans min_x[i]..max_x[i], min_y[i]..max_y[i] and min_z[i]..max_z[i]
+typedef struct {
+	const float *min_x;
+	const float *min_y;
+	const float *min_z;
+	const float *max_x;
+	const float *max_y;
+	const float *max_z;
+} aabbf_soa_t;
+
+/* Classifies count boxes against the planes in plane_mask. results[i] gets OUTSIDE, INTERSECTS or
+ * INSIDE. plane_masks[i], if plane_masks isn't NULL, gets the planes box i intersects, 0 if it's
+ * outside. results and plane_masks may not overlap the boxes. */
+extern void frustum_batch_classify_boxes(
+		const aabbf_soa_t *const boxes, const size_t count, const view_frustum_t *const view_frustum,
+		const unsigned int plane_mask, uint8_t *results, uint8_t *plane_masks );
+
+// Scalar version, reference for the vector versions
+extern void frustum_batch_classify_boxes_scalar(
+		const aabbf_soa_t *const boxes, const size_t count, const view_frustum_t *const view_frustum,
+		const unsigned int plane_mask, uint8_t *results, uint8_t *plane_masks );
+
+// Name of the selected instruction set for logging
+extern const char *frustum_batch_get_isa();
@@ -5,6 +5,8 @@
 #include <string.h>
 #include <tgmath.h>
 
+static void frustum_update_planes( view_frustum_t *view_frustum );
+
 view_frustum_t *frustum_set_fov(
 		const float angle, const float ratio, const float near_plane, const float far_plane,
 		view_frustum_t *view_frustum ) {
@@ -20,6 +22,7 @@ view_frustum_t *frustum_set_fov(
 	view_frustum->sphere_factor_y = 1.0f / cos( view_frustum->angle );
 	float anglex = atan( view_frustum->tangens_angle * view_frustum->ratio );
 	view_frustum->sphere_factor_x = 1.0f / cos( anglex );
+	frustum_update_planes( view_frustum );
 	return view_frustum;
 }
 
@@ -31,6 +34,7 @@ view_frustum_t *frustum_set_camera_vectors(
 	vec3f_normalize( vec3f_sub( front, pos, &temp ), &view_frustum->z );
 	vec3f_normalize( vec3f_cross( &view_frustum->z, up, &temp ), &view_frustum->x );
 	vec3f_cross( &view_frustum->x, &view_frustum->z, &view_frustum->y );
+	frustum_update_planes( view_frustum );
 	return view_frustum;
 }
 
@@ -84,12 +88,67 @@ intersect_t frustum_contains_sphere(
 	return result;
 }
 
-intersect_t frustum_contains_box( const aabbf* const box, const view_frustum_t *const view_frustum ) {
-	// @todo I am so lazy ...
-	vec3f center = {0.0f,0.0f,0.0f};
-	return frustum_contains_sphere(
-			aabbf_get_center( box, &center ), aabbf_get_diagonal_size( box ) * 0.5f, view_frustum
-	);
+inline intersect_t frustum_contains_box( const aabbf* const box, const view_frustum_t *const view_frustum ) {
+	unsigned int last_plane = FRUSTUM_NEAR;
+	return frustum_contains_box_masked( box, view_frustum, FRUSTUM_ALL_PLANES, NULL, &last_plane );
+}
+
+intersect_t frustum_contains_box_masked(
+		const aabbf* const box, const view_frustum_t *const view_frustum, const unsigned int plane_mask,
+		unsigned int *out_plane_mask, unsigned int *last_plane ) {
+	unsigned int intersected = 0;
+	for( unsigned int k = 0; k < FRUSTUM_NUM_PLANES; ++k ) {
+		// last_plane swaps places with the first one
+		const unsigned int i = 0 == k ? *last_plane : ( *last_plane == k ? 0 : k );
+		if( !( plane_mask & ( 1u << i ) ) )
+			continue;
+		const frustum_plane_t *plane = &view_frustum->planes[i];
+		// Box corner farthest along the normal. Outside if even that one is behind the plane.
+		vec3f vertex;
+		aabbf_get_vertex_positive( box, &plane->normal, &vertex );
+		if( vec3f_dot( &plane->normal, &vertex ) + plane->distance < 0.0f ) {
+			*last_plane = i;
+			return OUTSIDE;
+		}
+		// The nearest corner decides if the box straddles the plane
+		aabbf_get_vertex_negative( box, &plane->normal, &vertex );
+		if( vec3f_dot( &plane->normal, &vertex ) + plane->distance < 0.0f )
+			intersected |= 1u << i;
+	}
+	if( out_plane_mask )
+		*out_plane_mask = intersected;
+	return 0 == intersected ? INSIDE : INTERSECTS;
+}
+
+intersect_t frustum_contains_box_margin(
+		const aabbf* const box, const view_frustum_t *const view_frustum, const unsigned int plane_mask,
+		unsigned int *out_plane_mask, unsigned int *last_plane, float *margin ) {
+	unsigned int intersected = 0;
+	float closest = *margin;
+	for( unsigned int k = 0; k < FRUSTUM_NUM_PLANES; ++k ) {
+		const unsigned int i = 0 == k ? *last_plane : ( *last_plane == k ? 0 : k );
+		if( !( plane_mask & ( 1u << i ) ) )
+			continue;
+		const frustum_plane_t *plane = &view_frustum->planes[i];
+		vec3f vertex;
+		aabbf_get_vertex_positive( box, &plane->normal, &vertex );
+		const float positive = vec3f_dot( &plane->normal, &vertex ) + plane->distance;
+		if( positive < 0.0f ) {
+			*last_plane = i;
+			*margin = -positive < closest ? -positive : closest;
+			return OUTSIDE;
+		}
+		aabbf_get_vertex_negative( box, &plane->normal, &vertex );
+		const float negative = vec3f_dot( &plane->normal, &vertex ) + plane->distance;
+		if( negative < 0.0f )
+			intersected |= 1u << i;
+		closest = positive < closest ? positive : closest;
+		closest = fabsf( negative ) < closest ? fabsf( negative ) : closest;
+	}
+	if( out_plane_mask )
+		*out_plane_mask = intersected;
+	*margin = closest;
+	return 0 == intersected ? INSIDE : INTERSECTS;
 }
 
 void view_frustum_print( const view_frustum_t *const view_frustum ) {
@@ -116,6 +175,35 @@ void view_frustum_print( const view_frustum_t *const view_frustum ) {
 	logbook_log( LOG_INFO, msg );
 }
 
+// *** static stuff
+// Planes from camera position, orientation and view angles. Side planes pass through the camera position.
+void frustum_update_planes( view_frustum_t *view_frustum ) {
+	const vec3f *p = &view_frustum->camera_position;
+	const vec3f *x = &view_frustum->x;
+	const vec3f *y = &view_frustum->y;
+	const vec3f *z = &view_frustum->z;
+	const float ty = view_frustum->tangens_angle;
+	const float tx = ty * view_frustum->ratio;
+	// Inside: near <= pcz <= far, |pcy| <= pcz * ty and |pcx| <= pcz * tx, see frustum_contains_point()
+	const vec3f normals[FRUSTUM_NUM_PLANES] = {
+			{ z->x, z->y, z->z },
+			{ -z->x, -z->y, -z->z },
+			{ z->x * tx + x->x, z->y * tx + x->y, z->z * tx + x->z },
+			{ z->x * tx - x->x, z->y * tx - x->y, z->z * tx - x->z },
+			{ z->x * ty - y->x, z->y * ty - y->y, z->z * ty - y->z },
+			{ z->x * ty + y->x, z->y * ty + y->y, z->z * ty + y->z }
+	};
+	for( unsigned int i = 0; i < FRUSTUM_NUM_PLANES; ++i ) {
+		frustum_plane_t *plane = &view_frustum->planes[i];
+		// Axes are zero until the camera vectors are set
+		const float length = vec3f_magnitude( &normals[i] );
+		vec3f_mul_s( &normals[i], length > 0.0f ? 1.0f / length : 0.0f, &plane->normal );
+		plane->distance = -vec3f_dot( &plane->normal, p );
+	}
+	view_frustum->planes[FRUSTUM_NEAR].distance -= view_frustum->near_plane;
+	view_frustum->planes[FRUSTUM_FAR].distance += view_frustum->far_plane;
+}
+
 /*
  * box/frustum intersection (fb frustum; ob box)
  * if (fb_xmin > ob_xmax || fb_xmax < ob_xmin || fb_ymin > ob_ymax || fb_ymax < ob_ymin ||
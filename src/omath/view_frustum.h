@@ -13,6 +13,20 @@ typedef enum {
 	OUTSIDE, INTERSECTS, INSIDE, UNDEFINED, OUT_OF_RANGE, SELECTED
 } intersect_t;
 
+// Bits of the planes in a plane mask, see frustum_contains_box_masked()
+#define FRUSTUM_NUM_PLANES 6
+#define FRUSTUM_ALL_PLANES ( ( 1u << FRUSTUM_NUM_PLANES ) - 1u )
+
+typedef enum {
+	FRUSTUM_NEAR = 0, FRUSTUM_FAR, FRUSTUM_LEFT, FRUSTUM_RIGHT, FRUSTUM_TOP, FRUSTUM_BOTTOM
+} frustum_plane_index_t;
+
+// Unit normal points inwards, a point p is inside if dot( normal, p ) + distance >= 0
+typedef struct {
+	vec3f normal;
+	float distance;
+} frustum_plane_t;
+
 typedef struct view_frustum_t view_frustum_t;
 // Store camera position and reference vectors for rapid use in intersection tests
 struct view_frustum_t {
@@ -32,6 +46,8 @@ struct view_frustum_t {
 	// Precomputed angle for sphere intersection test.
 	float sphere_factor_y;
 	float sphere_factor_x;
+	// World space planes, updated by both setters
+	frustum_plane_t planes[FRUSTUM_NUM_PLANES];
 };
 
 // Must be called every time the lookAt matrix changes,
@@ -51,6 +67,23 @@ intersect_t frustum_contains_point( const vec3f* const point, const view_frustum
 intersect_t frustum_contains_sphere(
 		const vec3f* const center, const float radius, const view_frustum_t *const view_frustum );
 
+// Tests the box against the six planes
 intersect_t frustum_contains_box( const aabbf* const box, const view_frustum_t *const view_frustum );
 
+/* Tests the box against the planes in plane_mask only. out_plane_mask gets the planes the box
+ * intersects, it's not touched if the box is outside. A box within this one only needs to be tested
+ * against those, and is inside if there are none.
+ * last_plane is tested first. It's set to the plane that rejects the box, neighbouring boxes are
+ * mostly rejected by the same plane. */
+intersect_t frustum_contains_box_masked(
+		const aabbf* const box, const view_frustum_t *const view_frustum, const unsigned int plane_mask,
+		unsigned int *out_plane_mask, unsigned int *last_plane );
+
+/* As frustum_contains_box_masked(), and lowers margin to the distance of the nearest tested box corner
+ * from its plane. Result and out_plane_mask stay the same as long as no tested plane moves farther
+ * than that relative to the box. */
+intersect_t frustum_contains_box_margin(
+		const aabbf* const box, const view_frustum_t *const view_frustum, const unsigned int plane_mask,
+		unsigned int *out_plane_mask, unsigned int *last_plane, float *margin );
+
 void view_frustum_print( const view_frustum_t *const view_frustum );
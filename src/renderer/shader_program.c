@@ -6,6 +6,7 @@
 
 static bool sp_read_source_file( GLchar** out_source, const char* filename );
 static bool sp_compile( const GLuint shader, const GLchar* shader_source );
+static bool sp_link( const GLuint program );
 
 bool sp_create(
 		const char* vertex_shader_file, const char* fragment_shader_file, GLuint* out_program ) {
@@ -61,18 +62,7 @@ bool sp_create(
 	glAttachShader( *out_program, vertex_shader );
 	glAttachShader( *out_program, fragment_shader );
 	// Linking
-	glLinkProgram( *out_program );
-	GLint linked;
-	glGetProgramiv( *out_program, GL_LINK_STATUS, &linked );
-	if( GL_TRUE != linked ) {
-		GLint len;
-		glGetProgramiv( *out_program, GL_INFO_LOG_LENGTH, &len );
-		GLchar *log = malloc( sizeof(GLchar) * (size_t)(len + 1 ) );
-		glGetProgramInfoLog( *out_program, len, &len, log );
-		snprintf( error_string, MAX_LEN_MESSAGES, "Linker error: '%s'", log );
-		logbook_log( LOG_ERROR, error_string );
-		free( log );
-		glDeleteProgram( *out_program );
+	if( !sp_link( *out_program ) ) {
 		glDeleteShader( vertex_shader );
 		glDeleteShader( fragment_shader );
 		return false;
@@ -83,6 +73,36 @@ bool sp_create(
 	return true;
 }
 
+bool sp_create_compute( const char* compute_shader_file, GLuint* out_program ) {
+	char error_string[MAX_LEN_MESSAGES];
+	snprintf( error_string, MAX_LEN_MESSAGES, "Loading compute shader '%s'", compute_shader_file );
+	logbook_log( LOG_INFO, error_string );
+	GLchar *source_code = NULL;
+	if( !sp_read_source_file( &source_code, compute_shader_file ) ) {
+		snprintf( error_string, MAX_LEN_MESSAGES, "Error reading shader file '%s'", compute_shader_file );
+		logbook_log( LOG_ERROR, error_string );
+		return false;
+	}
+	GLuint compute_shader = glCreateShader( GL_COMPUTE_SHADER );
+	if( !sp_compile( compute_shader, source_code ) ) {
+		free( source_code );
+		return false;
+	}
+	free( source_code );
+	*out_program = glCreateProgram();
+	if( !glIsProgram( *out_program ) ) {
+		glDeleteShader( compute_shader );
+		return false;
+	}
+	glAttachShader( *out_program, compute_shader );
+	if( !sp_link( *out_program ) ) {
+		glDeleteShader( compute_shader );
+		return false;
+	}
+	glDeleteShader( compute_shader );
+	return true;
+}
+
 inline void sp_delete( GLuint program ) {
 	if( glIsProgram( program ) )
 		glDeleteProgram( program );
@@ -196,3 +216,23 @@ static bool sp_compile( const GLuint shader, const GLchar* shader_source ) {
 	}
 	return true;
 }
+
+// Deletes the program if it doesn't link
+static bool sp_link( const GLuint program ) {
+	glLinkProgram( program );
+	GLint linked;
+	glGetProgramiv( program, GL_LINK_STATUS, &linked );
+	if( GL_TRUE != linked ) {
+		GLint len;
+		glGetProgramiv( program, GL_INFO_LOG_LENGTH, &len );
+		GLchar *log = malloc( sizeof(GLchar) * (size_t)(len + 1 ) );
+		glGetProgramInfoLog( program, len, &len, log );
+		char error_string[MAX_LEN_MESSAGES];
+		snprintf( error_string, MAX_LEN_MESSAGES, "Linker error: '%s'", log );
+		logbook_log( LOG_ERROR, error_string );
+		free( log );
+		glDeleteProgram( program );
+		return false;
+	}
+	return true;
+}
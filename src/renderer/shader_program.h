@@ -34,6 +34,9 @@ bool sp_create(
 		const char* vertex_shader_file, const char* fragment_shader_file, GLuint* out_program
 );
 
+// Program of a single compute shader, GL 4.3 and up
+bool sp_create_compute( const char* compute_shader_file, GLuint* out_program );
+
 extern void sp_delete( GLuint program );
 
 extern void sp_set_camera_position( const vec3f *const pos );
@@ -0,0 +1,265 @@
+#include "texture_uploader.h"
+#include "base/logbook.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static size_t texture_uploader_reserve( const size_t size, size_t *out_offset );
+static void texture_uploader_retire_frames();
+static bool texture_uploader_upload_direct( texture_upload_t *upload );
+static void texture_uploader_sub_image(
+		const texture_upload_t *const upload, const GLsizei first_row, const GLsizei num_rows, const void *pixels );
+static double texture_uploader_elapsed_ms( const struct timespec *const start );
+
+// A frame's part of the ring. size includes bytes skipped at the end of the ring on wrap around.
+typedef struct {
+	GLsync fence;
+	size_t end;
+	size_t size;
+} uploader_frame_t;
+
+static struct {
+	bool running;
+	GLuint buffer;
+	unsigned char *mapped;
+	// Ring state, head is the next write position, tail the oldest byte in flight
+	size_t head;
+	size_t tail;
+	size_t used;
+	uploader_frame_t frames[TEXTURE_UPLOADER_MAX_FRAMES];
+	unsigned int first_frame;
+	unsigned int num_frames;
+	texture_upload_t *queue[TEXTURE_UPLOADER_MAX_QUEUED];
+	unsigned int queue_count;
+	texture_uploader_stats_t stats;
+} uploader;
+
+bool texture_uploader_create() {
+	if( uploader.running ) {
+		logbook_log( LOG_WARNING, "Texture uploader already running" );
+		return true;
+	}
+	memset( &uploader, 0, sizeof(uploader) );
+	const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glCreateBuffers( 1, &uploader.buffer );
+	glNamedBufferStorage( uploader.buffer, (GLsizeiptr)TEXTURE_UPLOADER_RING_SIZE, NULL, flags );
+	uploader.mapped = glMapNamedBufferRange( uploader.buffer, 0, (GLsizeiptr)TEXTURE_UPLOADER_RING_SIZE, flags );
+	if( !uploader.mapped ) {
+		logbook_log( LOG_ERROR, "Error mapping texture upload buffer, uploading directly" );
+		glDeleteBuffers( 1, &uploader.buffer );
+		uploader.buffer = 0;
+		return false;
+	}
+	uploader.running = true;
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Texture uploader started. Ring %.2fMb, %.2fMb and %.2fms per frame",
+			(double)TEXTURE_UPLOADER_RING_SIZE / ( 1024.0 * 1024.0 ),
+			(double)TEXTURE_UPLOADER_FRAME_BYTES / ( 1024.0 * 1024.0 ), TEXTURE_UPLOADER_FRAME_MS );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+inline void texture_uploader_delete() {
+	if( !uploader.running )
+		return;
+	texture_uploader_log_stats();
+	for( unsigned int i = 0; i < uploader.num_frames; ++i )
+		glDeleteSync( uploader.frames[( uploader.first_frame + i ) % TEXTURE_UPLOADER_MAX_FRAMES].fence );
+	glUnmapNamedBuffer( uploader.buffer );
+	glDeleteBuffers( 1, &uploader.buffer );
+	memset( &uploader, 0, sizeof(uploader) );
+}
+
+inline bool texture_uploader_is_running() {
+	return uploader.running;
+}
+
+bool texture_uploader_submit( texture_upload_t *upload ) {
+	upload->rows_done = 0;
+	GLint target = GL_TEXTURE_2D;
+	glGetTextureParameteriv( upload->texture, GL_TEXTURE_TARGET, &target );
+	upload->target = (GLenum)target;
+	if( !uploader.running )
+		return texture_uploader_upload_direct( upload );
+	if( uploader.queue_count >= TEXTURE_UPLOADER_MAX_QUEUED ) {
+		logbook_log( LOG_WARNING, "Texture upload queue full" );
+		return false;
+	}
+	uploader.queue[uploader.queue_count++] = upload;
+	return true;
+}
+
+void texture_uploader_cancel( texture_upload_t *upload ) {
+	for( unsigned int i = 0; i < uploader.queue_count; ++i )
+		if( uploader.queue[i] == upload ) {
+			memmove( &uploader.queue[i], &uploader.queue[i+1],
+					( uploader.queue_count - i - 1 ) * sizeof(texture_upload_t *) );
+			--uploader.queue_count;
+			return;
+		}
+}
+
+inline bool texture_uploader_is_done( const texture_upload_t *const upload ) {
+	return upload->rows_done >= upload->height;
+}
+
+void texture_uploader_update() {
+	if( !uploader.running )
+		return;
+	struct timespec start;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	texture_uploader_retire_frames();
+	size_t frame_bytes = 0;
+	bool ring_full = false;
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, uploader.buffer );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	// Oldest upload first, so textures complete one after the other
+	while( uploader.queue_count > 0 && uploader.num_frames < TEXTURE_UPLOADER_MAX_FRAMES ) {
+		texture_upload_t *upload = uploader.queue[0];
+		const size_t row_size = (size_t)upload->width * upload->pixel_size;
+		const size_t rows_left = (size_t)( upload->height - upload->rows_done );
+		const size_t budget_rows = ( TEXTURE_UPLOADER_FRAME_BYTES - frame_bytes ) / row_size;
+		// At least one row per frame, else a row larger than the budget would never go
+		size_t rows = rows_left < budget_rows ? rows_left : budget_rows;
+		if( 0 == rows && 0 == frame_bytes )
+			rows = 1;
+		if( 0 == rows || texture_uploader_elapsed_ms( &start ) >= TEXTURE_UPLOADER_FRAME_MS )
+			break;
+		size_t offset;
+		const size_t ring_rows = texture_uploader_reserve( row_size, &offset );
+		if( 0 == ring_rows ) {
+			ring_full = true;
+			break;
+		}
+		rows = rows < ring_rows ? rows : ring_rows;
+		const size_t size = rows * row_size;
+		if( upload->read_rows )
+			upload->read_rows( upload->pixels, upload->rows_done, (GLsizei)rows, uploader.mapped + offset );
+		else
+			memcpy( uploader.mapped + offset,
+					(const unsigned char *)upload->pixels + (size_t)upload->rows_done * row_size, size );
+		uploader.head = offset + size;
+		uploader.used += size;
+		uploader.frames[( uploader.first_frame + uploader.num_frames ) % TEXTURE_UPLOADER_MAX_FRAMES].size += size;
+		texture_uploader_sub_image( upload, upload->rows_done, (GLsizei)rows, (const void *)offset );
+		upload->rows_done += (GLsizei)rows;
+		frame_bytes += size;
+		++uploader.stats.bands_total;
+		if( texture_uploader_is_done( upload ) ) {
+			++uploader.stats.uploads_completed;
+			texture_uploader_cancel( upload );
+		}
+	}
+	glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	// Close this frame's part of the ring with a fence
+	if( frame_bytes > 0 ) {
+		uploader_frame_t *frame =
+				&uploader.frames[( uploader.first_frame + uploader.num_frames ) % TEXTURE_UPLOADER_MAX_FRAMES];
+		frame->fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+		frame->end = uploader.head;
+		++uploader.num_frames;
+	}
+	uploader.stats.bytes_total += frame_bytes;
+	uploader.stats.bytes_last_frame = frame_bytes;
+	uploader.stats.ms_last_frame = texture_uploader_elapsed_ms( &start );
+	if( ring_full || ( uploader.queue_count > 0 && uploader.num_frames >= TEXTURE_UPLOADER_MAX_FRAMES ) )
+		++uploader.stats.ring_full_frames;
+}
+
+inline const texture_uploader_stats_t *texture_uploader_get_stats() {
+	return &uploader.stats;
+}
+
+void texture_uploader_log_stats() {
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1,
+			"Texture uploader: %d uploads, %.2fMb in %lu bands, %d frames waited for ring space",
+			uploader.stats.uploads_completed, (double)uploader.stats.bytes_total / ( 1024.0 * 1024.0 ),
+			(unsigned long)uploader.stats.bands_total, uploader.stats.ring_full_frames );
+	logbook_log( LOG_INFO, msg );
+}
+
+// *** static stuff
+// Finds contiguous free ring space at the head for whole rows. Returns the number of rows that fit.
+size_t texture_uploader_reserve( const size_t row_size, size_t *out_offset ) {
+	if( 0 == uploader.used ) {
+		// Empty, start over at the beginning for the longest contiguous run
+		uploader.head = uploader.tail = 0;
+		*out_offset = 0;
+		return TEXTURE_UPLOADER_RING_SIZE / row_size;
+	}
+	if( uploader.head > uploader.tail ) {
+		const size_t at_end = TEXTURE_UPLOADER_RING_SIZE - uploader.head;
+		if( at_end >= row_size ) {
+			*out_offset = uploader.head;
+			return at_end / row_size;
+		}
+		// Skip the rest of the ring, it is freed with this frame
+		if( uploader.tail < row_size )
+			return 0;
+		uploader.used += at_end;
+		uploader.frames[( uploader.first_frame + uploader.num_frames ) % TEXTURE_UPLOADER_MAX_FRAMES].size += at_end;
+		uploader.head = 0;
+	}
+	const size_t free_size = uploader.tail - uploader.head;
+	*out_offset = uploader.head;
+	return free_size / row_size;
+}
+
+// Frees the ring space of frames whose fences have signaled
+void texture_uploader_retire_frames() {
+	while( uploader.num_frames > 0 ) {
+		uploader_frame_t *frame = &uploader.frames[uploader.first_frame];
+		const GLenum result = glClientWaitSync( frame->fence, 0, 0 );
+		if( GL_ALREADY_SIGNALED != result && GL_CONDITION_SATISFIED != result )
+			break;
+		glDeleteSync( frame->fence );
+		uploader.tail = frame->end;
+		uploader.used -= frame->size;
+		memset( frame, 0, sizeof(uploader_frame_t) );
+		uploader.first_frame = ( uploader.first_frame + 1 ) % TEXTURE_UPLOADER_MAX_FRAMES;
+		--uploader.num_frames;
+	}
+}
+
+bool texture_uploader_upload_direct( texture_upload_t *upload ) {
+	const size_t size = (size_t)upload->width * (size_t)upload->height * upload->pixel_size;
+	void *pixels = NULL;
+	if( upload->read_rows ) {
+		pixels = malloc(size);
+		if( !pixels ) {
+			logbook_log( LOG_ERROR, "Error allocating rows for a direct texture upload" );
+			return false;
+		}
+		upload->read_rows( upload->pixels, 0, upload->height, pixels );
+	}
+	// Rects may be an odd number of texels wide
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+	texture_uploader_sub_image( upload, 0, upload->height, pixels ? pixels : upload->pixels );
+	glPixelStorei( GL_UNPACK_ALIGNMENT, 4 );
+	free(pixels);
+	upload->rows_done = upload->height;
+	uploader.stats.bytes_total += size;
+	++uploader.stats.bands_total;
+	++uploader.stats.uploads_completed;
+	return true;
+}
+
+// Rows of the upload's rect, from client memory or an offset into the bound unpack buffer
+void texture_uploader_sub_image(
+		const texture_upload_t *const upload, const GLsizei first_row, const GLsizei num_rows, const void *pixels ) {
+	if( GL_TEXTURE_2D_ARRAY == upload->target )
+		glTextureSubImage3D( upload->texture, upload->level, upload->x_offset, upload->y_offset + first_row,
+				upload->layer, upload->width, num_rows, 1, upload->format, upload->type, pixels );
+	else
+		glTextureSubImage2D( upload->texture, upload->level, upload->x_offset, upload->y_offset + first_row,
+				upload->width, num_rows, upload->format, upload->type, pixels );
+}
+
+double texture_uploader_elapsed_ms( const struct timespec *const start ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (double)( now.tv_sec - start->tv_sec ) * 1000.0 + (double)( now.tv_nsec - start->tv_nsec ) * 1e-6;
+}
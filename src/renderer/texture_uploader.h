@@ -0,0 +1,77 @@
+/* Streams texture data through a persistently mapped pixel unpack buffer ring.
+ * Uploads are cut into bands of rows and spread over frames within a byte and time budget,
+ * so a large texture doesn't stall a frame. Ring space is reused when the fence of the frame
+ * that wrote it has signaled. Gl thread only. */
+
+#pragma once
+
+#include "glad/glad.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Size of the staging ring in bytes
+#define TEXTURE_UPLOADER_RING_SIZE ( (size_t)64 * 1024 * 1024 )
+// Max bytes copied and max milliseconds spent per frame
+#define TEXTURE_UPLOADER_FRAME_BYTES ( (size_t)8 * 1024 * 1024 )
+#define TEXTURE_UPLOADER_FRAME_MS 2.0
+// Frames in flight, each holds a fence over its part of the ring
+#define TEXTURE_UPLOADER_MAX_FRAMES 8
+#define TEXTURE_UPLOADER_MAX_QUEUED 64
+
+/* One mip level of a texture, or a rect of it, whole rows. pixels must stay valid until the upload
+ * is done or cancelled. Owned by the caller, the uploader only keeps a pointer while it is queued. */
+typedef struct texture_upload_t {
+	GLuint texture;
+	GLint level;
+	// Where the rect goes in the level, 0 for a whole level. layer is used by array textures only.
+	GLint x_offset;
+	GLint y_offset;
+	GLint layer;
+	GLsizei width;
+	GLsizei height;
+	GLenum format;
+	GLenum type;
+	size_t pixel_size;
+	const void *pixels;
+	/* Optional, writes num_rows whole rows from first_row on to dst instead of copying them from
+	 * pixels, e.g. to decode them on the fly. Gets pixels as source. */
+	void (*read_rows)( const void *source, const GLsizei first_row, const GLsizei num_rows, void *dst );
+	// Rows handed to gl so far
+	GLsizei rows_done;
+	// Texture target, set on submit
+	GLenum target;
+} texture_upload_t;
+
+typedef struct texture_uploader_stats_t {
+	uint64_t bytes_total;
+	uint64_t bands_total;
+	unsigned int uploads_completed;
+	// Frames in which queued work waited for ring space
+	unsigned int ring_full_frames;
+	size_t bytes_last_frame;
+	double ms_last_frame;
+} texture_uploader_stats_t;
+
+// False if the ring can't be created. Uploads then fall back to direct glTextureSubImage2D.
+bool texture_uploader_create();
+
+extern void texture_uploader_delete();
+
+extern bool texture_uploader_is_running();
+
+/* Queues an upload, texture storage must exist. Uploads synchronously if the uploader isn't
+ * running, the upload is done on return then. */
+bool texture_uploader_submit( texture_upload_t *upload );
+
+// Removes a queued upload, e.g. if its texture is deleted before it is done
+void texture_uploader_cancel( texture_upload_t *upload );
+
+extern bool texture_uploader_is_done( const texture_upload_t *const upload );
+
+// Once per frame. Frees ring space of finished frames and feeds queued uploads.
+void texture_uploader_update();
+
+extern const texture_uploader_stats_t *texture_uploader_get_stats();
+
+void texture_uploader_log_stats();
@@ -0,0 +1,180 @@
+#include "vertex_cache.h"
+#include <math.h>
+#include <stdlib.h>
+
+// Forsyth's weights. The last triangle's vertices score a little lower, the next one shouldn't reuse all three.
+#define VERTEX_CACHE_DECAY_POWER 1.5f
+#define VERTEX_CACHE_LAST_TRI_SCORE 0.75f
+#define VERTEX_CACHE_VALENCE_BOOST_SCALE 2.0f
+#define VERTEX_CACHE_VALENCE_BOOST_POWER 0.5f
+// Triangles left per vertex with a precalculated valence score, more are computed
+#define VERTEX_CACHE_MAX_VALENCE 32
+
+typedef struct {
+	// Triangles of the vertex not yet emitted, the first remaining of its run in the adjacency array
+	unsigned int first_tri;
+	unsigned int remaining;
+	int cache_pos;
+	float score;
+} vertex_cache_vertex_t;
+
+static float vertex_cache_score( const int cache_pos, const unsigned int remaining );
+static void vertex_cache_setup_scores( const unsigned int cache_size );
+
+static struct {
+	unsigned int cache_size;
+	float position_scores[VERTEX_CACHE_MAX_SIZE];
+	float valence_scores[VERTEX_CACHE_MAX_VALENCE];
+} vertex_cache;
+
+bool vertex_cache_optimize(
+		GLuint *indices, const unsigned int num_indices, const unsigned int num_vertices, const unsigned int cache_size ) {
+	if( cache_size < 4 || cache_size > VERTEX_CACHE_MAX_SIZE )
+		return false;
+	const unsigned int num_tris = num_indices / 3;
+	if( 0 == num_tris )
+		return true;
+	vertex_cache_vertex_t *vertices = calloc( num_vertices, sizeof(vertex_cache_vertex_t) );
+	unsigned int *adjacency = malloc( num_tris * 3 * sizeof(unsigned int) );
+	float *tri_scores = malloc( num_tris * sizeof(float) );
+	bool *tri_added = calloc( num_tris, sizeof(bool) );
+	GLuint *sorted = malloc( num_tris * 3 * sizeof(GLuint) );
+	if( !vertices || !adjacency || !tri_scores || !tri_added || !sorted ) {
+		free( vertices ); free( adjacency ); free( tri_scores ); free( tri_added ); free( sorted );
+		return false;
+	}
+	vertex_cache_setup_scores( cache_size );
+	// Triangles per vertex, as runs in the adjacency array
+	for( unsigned int i = 0; i < num_tris * 3; ++i )
+		++vertices[indices[i]].remaining;
+	unsigned int offset = 0;
+	for( unsigned int v = 0; v < num_vertices; ++v ) {
+		vertices[v].first_tri = offset;
+		offset += vertices[v].remaining;
+		vertices[v].remaining = 0;
+		vertices[v].cache_pos = -1;
+	}
+	for( unsigned int t = 0; t < num_tris; ++t )
+		for( unsigned int k = 0; k < 3; ++k ) {
+			vertex_cache_vertex_t *v = &vertices[indices[3*t+k]];
+			adjacency[v->first_tri + v->remaining++] = t;
+		}
+	for( unsigned int v = 0; v < num_vertices; ++v )
+		vertices[v].score = vertex_cache_score( -1, vertices[v].remaining );
+	for( unsigned int t = 0; t < num_tris; ++t )
+		tri_scores[t] = vertices[indices[3*t]].score + vertices[indices[3*t+1]].score + vertices[indices[3*t+2]].score;
+	// LRU, most recent first. Room for the three vertices pushed in front of a full cache.
+	unsigned int cache[VERTEX_CACHE_MAX_SIZE + 3], new_cache[VERTEX_CACHE_MAX_SIZE + 3];
+	unsigned int cache_count = 0;
+	// Triangles before it are all emitted
+	unsigned int first_unadded = 0;
+	long best_tri = -1;
+	for( unsigned int out = 0; out < num_tris; ++out ) {
+		// Nothing in the cache has triangles left, start over at the best one anywhere
+		if( best_tri < 0 ) {
+			while( tri_added[first_unadded] )
+				++first_unadded;
+			best_tri = first_unadded;
+			for( unsigned int t = first_unadded + 1; t < num_tris; ++t )
+				if( !tri_added[t] && tri_scores[t] > tri_scores[best_tri] )
+					best_tri = t;
+		}
+		const unsigned int tri = (unsigned int)best_tri;
+		tri_added[tri] = true;
+		unsigned int new_count = 0;
+		for( unsigned int k = 0; k < 3; ++k ) {
+			const GLuint index = indices[3*tri+k];
+			sorted[3*out+k] = index;
+			// Drop the triangle from the vertex's remaining ones
+			vertex_cache_vertex_t *v = &vertices[index];
+			for( unsigned int a = v->first_tri; a < v->first_tri + v->remaining; ++a )
+				if( tri == adjacency[a] ) {
+					adjacency[a] = adjacency[v->first_tri + v->remaining - 1];
+					adjacency[v->first_tri + v->remaining - 1] = tri;
+					--v->remaining;
+					break;
+				}
+			bool is_new = true;
+			for( unsigned int p = 0; p < new_count; ++p )
+				is_new = is_new && index != new_cache[p];
+			if( is_new )
+				new_cache[new_count++] = index;
+		}
+		const unsigned int num_pushed = new_count;
+		for( unsigned int c = 0; c < cache_count; ++c ) {
+			bool is_new = true;
+			for( unsigned int p = 0; p < num_pushed; ++p )
+				is_new = is_new && cache[c] != new_cache[p];
+			if( is_new )
+				new_cache[new_count++] = cache[c];
+		}
+		// Rescore what moved or fell out, the triangle scores follow by difference
+		best_tri = -1;
+		float best_score = -1.0f;
+		for( unsigned int c = 0; c < new_count; ++c ) {
+			vertex_cache_vertex_t *v = &vertices[new_cache[c]];
+			v->cache_pos = c < cache_size ? (int)c : -1;
+			const float score = vertex_cache_score( v->cache_pos, v->remaining );
+			const float delta = score - v->score;
+			v->score = score;
+			for( unsigned int a = v->first_tri; a < v->first_tri + v->remaining; ++a )
+				tri_scores[adjacency[a]] += delta;
+		}
+		for( unsigned int c = 0; c < new_count && c < cache_size; ++c ) {
+			const vertex_cache_vertex_t *v = &vertices[new_cache[c]];
+			for( unsigned int a = v->first_tri; a < v->first_tri + v->remaining; ++a )
+				if( tri_scores[adjacency[a]] > best_score ) {
+					best_score = tri_scores[adjacency[a]];
+					best_tri = adjacency[a];
+				}
+		}
+		cache_count = new_count < cache_size ? new_count : cache_size;
+		for( unsigned int c = 0; c < cache_count; ++c )
+			cache[c] = new_cache[c];
+	}
+	for( unsigned int i = 0; i < num_tris * 3; ++i )
+		indices[i] = sorted[i];
+	free( vertices ); free( adjacency ); free( tri_scores ); free( tri_added ); free( sorted );
+	return true;
+}
+
+float vertex_cache_get_acmr(
+		const GLuint *const indices, const unsigned int num_indices, const unsigned int num_vertices,
+		const unsigned int cache_size ) {
+	if( num_indices < 3 )
+		return 0.0f;
+	// Insertion count + 1 when the vertex last entered the cache, 0 for never
+	unsigned int *entered = calloc( num_vertices, sizeof(unsigned int) );
+	if( !entered )
+		return -1.0f;
+	unsigned int misses = 0;
+	for( unsigned int i = 0; i < num_indices; ++i ) {
+		const GLuint v = indices[i];
+		if( 0 == entered[v] || misses - ( entered[v] - 1 ) > cache_size )
+			entered[v] = ++misses;
+	}
+	free( entered );
+	return (float)misses / (float)( num_indices / 3 );
+}
+
+// *** static stuff
+float vertex_cache_score( const int cache_pos, const unsigned int remaining ) {
+	// Done vertices never come back
+	if( 0 == remaining )
+		return -1.0f;
+	const float position_score = cache_pos < 0 ? 0.0f : vertex_cache.position_scores[cache_pos];
+	return position_score + ( remaining < VERTEX_CACHE_MAX_VALENCE ? vertex_cache.valence_scores[remaining] :
+			VERTEX_CACHE_VALENCE_BOOST_SCALE * powf( (float)remaining, -VERTEX_CACHE_VALENCE_BOOST_POWER ) );
+}
+
+void vertex_cache_setup_scores( const unsigned int cache_size ) {
+	if( cache_size == vertex_cache.cache_size )
+		return;
+	for( unsigned int i = 0; i < cache_size; ++i )
+		vertex_cache.position_scores[i] = i < 3 ? VERTEX_CACHE_LAST_TRI_SCORE :
+				powf( 1.0f - (float)( i - 3 ) / (float)( cache_size - 3 ), VERTEX_CACHE_DECAY_POWER );
+	vertex_cache.valence_scores[0] = 0.0f;
+	for( unsigned int i = 1; i < VERTEX_CACHE_MAX_VALENCE; ++i )
+		vertex_cache.valence_scores[i] = VERTEX_CACHE_VALENCE_BOOST_SCALE * powf( (float)i, -VERTEX_CACHE_VALENCE_BOOST_POWER );
+	vertex_cache.cache_size = cache_size;
+}
@@ -0,0 +1,237 @@
+#include "clipmap.h"
+#include "base/logbook.h"
+#include "renderer/sampler.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Far enough off that the shader never finds a texel in the window
+#define CLIPMAP_HIDDEN_ORIGIN ( INT_MIN / 2 )
+
+static void clipmap_update_level( clipmap_t *clipmap, const unsigned int level, const int new_x, const int new_z );
+static bool clipmap_queue_area(
+		clipmap_t *clipmap, const unsigned int level, const int x0, const int z0, const int x1, const int z1 );
+static bool clipmap_queue_rect(
+		clipmap_t *clipmap, const unsigned int level, const int x, const int z, const int w, const int h );
+static bool clipmap_strips_are_done( const clipmap_t *const clipmap, const unsigned int level );
+static void clipmap_update_resident_origin( clipmap_t *clipmap, const unsigned int level );
+static void clipmap_read_strip_rows( const void *source, const GLsizei first_row, const GLsizei num_rows, void *dst );
+
+clipmap_t *clipmap_create( const uint16_t *const height_values, const unsigned int extent, clipmap_t *clipmap ) {
+	if( clipmap ) {
+		logbook_log( LOG_WARNING, "Non-null pointer passed to clipmap_create" );
+		return clipmap;
+	}
+	if( extent <= CLIPMAP_SIZE ) {
+		logbook_log( LOG_ERROR, "Clipmap source must be larger than CLIPMAP_SIZE" );
+		return NULL;
+	}
+	clipmap = calloc( 1, sizeof(clipmap_t) );
+	if( !clipmap ) {
+		logbook_log( LOG_ERROR, "Error allocating clipmap" );
+		return NULL;
+	}
+	clipmap->extent = extent;
+	clipmap->height_values = height_values;
+	clipmap->num_levels = clipmap_get_num_levels( extent );
+	glCreateTextures( GL_TEXTURE_2D_ARRAY, 1, &clipmap->texture );
+	if( !clipmap->texture ) {
+		logbook_log( LOG_ERROR, "Error creating clipmap texture" );
+		return clipmap_delete( clipmap );
+	}
+	glTextureStorage3D( clipmap->texture, 1, HEIGHTMAP_TEXTURE_FORMAT,
+			CLIPMAP_SIZE, CLIPMAP_SIZE, (GLsizei)clipmap->num_levels );
+	// Levels are point sampled at the grid vertices, repeat wraps around the toroidal windows
+	set_default_sampler( clipmap->texture, NEAREST_REPEAT );
+	for( unsigned int l = 0; l < clipmap->num_levels; ++l )
+		clipmap->resident_origins[l][0] = clipmap->resident_origins[l][1] = CLIPMAP_HIDDEN_ORIGIN;
+	// The coarsest level extent is CLIPMAP_SIZE for pow2 extents
+	clipmap_update_level( clipmap, clipmap->num_levels - 1, 0, 0 );
+	if( !clipmap->is_valid[clipmap->num_levels - 1] ) {
+		logbook_log( LOG_ERROR, "Error queueing the coarsest clipmap level" );
+		return clipmap_delete( clipmap );
+	}
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Clipmap for %d * %d texels, %d levels of %d * %d. Size on gpu %.2fkb",
+			extent, extent, clipmap->num_levels, CLIPMAP_SIZE, CLIPMAP_SIZE,
+			(float)clipmap_get_texture_size( extent ) / 1024.0f );
+	logbook_log( LOG_INFO, msg );
+	return clipmap;
+}
+
+inline clipmap_t *clipmap_delete( clipmap_t *clipmap ) {
+	if( clipmap ) {
+		for( unsigned int l = 0; l < clipmap->num_levels; ++l )
+			for( unsigned int i = 0; i < clipmap->num_strips[l]; ++i )
+				texture_uploader_cancel( &clipmap->strips[l][i].upload );
+		if( clipmap->texture && glIsTexture(clipmap->texture) )
+			glDeleteTextures( 1, &clipmap->texture );
+		free( clipmap );
+		clipmap = NULL;
+	}
+	return clipmap;
+}
+
+void clipmap_update( clipmap_t *clipmap, const float texel_x, const float texel_z ) {
+	const int half = CLIPMAP_SIZE / 2;
+	// The coarsest level never moves
+	for( unsigned int l = 0; l + 1 < clipmap->num_levels; ++l ) {
+		clipmap_update_resident_origin( clipmap, l );
+		if( clipmap->num_strips[l] > 0 )
+			continue;
+		const int level_extent = (int)( clipmap->extent >> l );
+		// Snapped to the granularity so small camera moves don't cause uploads, clamped to the source
+		const int center_x = (int)( texel_x / (float)( 1u << l ) );
+		const int center_z = (int)( texel_z / (float)( 1u << l ) );
+		int x = ( center_x - half ) / CLIPMAP_UPDATE_GRANULARITY * CLIPMAP_UPDATE_GRANULARITY;
+		int z = ( center_z - half ) / CLIPMAP_UPDATE_GRANULARITY * CLIPMAP_UPDATE_GRANULARITY;
+		x = x < 0 ? 0 : ( x > level_extent - CLIPMAP_SIZE ? level_extent - CLIPMAP_SIZE : x );
+		z = z < 0 ? 0 : ( z > level_extent - CLIPMAP_SIZE ? level_extent - CLIPMAP_SIZE : z );
+		clipmap_update_level( clipmap, l, x, z );
+	}
+}
+
+inline void clipmap_bind( const clipmap_t *const clipmap ) {
+	glBindTextureUnit( HEIGHTMAP_CLIPMAP_TEXTURE_UNIT, clipmap->texture );
+}
+
+inline const int *clipmap_get_resident_origins( clipmap_t *clipmap ) {
+	for( unsigned int l = 0; l + 1 < clipmap->num_levels; ++l )
+		clipmap_update_resident_origin( clipmap, l );
+	return &clipmap->resident_origins[0][0];
+}
+
+inline bool clipmap_is_ready( const clipmap_t *const clipmap ) {
+	return clipmap->is_valid[clipmap->num_levels - 1] && clipmap_strips_are_done( clipmap, clipmap->num_levels - 1 );
+}
+
+inline size_t clipmap_get_texture_size( const unsigned int extent ) {
+	const size_t texel_size = GL_R32F == HEIGHTMAP_TEXTURE_FORMAT ? 4 : 2;
+	return (size_t)CLIPMAP_SIZE * CLIPMAP_SIZE * clipmap_get_num_levels( extent ) * texel_size;
+}
+
+inline unsigned int clipmap_get_num_levels( const unsigned int extent ) {
+	unsigned int num_levels = 1;
+	while( ( (unsigned int)CLIPMAP_SIZE << ( num_levels - 1 ) ) < extent && num_levels < CLIPMAP_MAX_LEVELS )
+		++num_levels;
+	return num_levels;
+}
+
+// *** static stuff
+// Queues what became visible when the window moved, or everything if it moved too far
+void clipmap_update_level( clipmap_t *clipmap, const unsigned int level, const int new_x, const int new_z ) {
+	int *origin = clipmap->origins[level];
+	const int dx = new_x - origin[0];
+	const int dz = new_z - origin[1];
+	if( clipmap->is_valid[level] && 0 == dx && 0 == dz )
+		return;
+	bool is_queued = true;
+	if( !clipmap->is_valid[level] || abs(dx) >= CLIPMAP_SIZE || abs(dz) >= CLIPMAP_SIZE ) {
+		is_queued = clipmap_queue_area( clipmap, level, new_x, new_z, new_x + CLIPMAP_SIZE, new_z + CLIPMAP_SIZE );
+	} else {
+		// New columns over the full new height, then new rows over the full new width
+		if( dx > 0 )
+			is_queued = clipmap_queue_area( clipmap, level,
+					origin[0] + CLIPMAP_SIZE, new_z, new_x + CLIPMAP_SIZE, new_z + CLIPMAP_SIZE );
+		else if( dx < 0 )
+			is_queued = clipmap_queue_area( clipmap, level, new_x, new_z, origin[0], new_z + CLIPMAP_SIZE );
+		if( dz > 0 )
+			is_queued = is_queued && clipmap_queue_area( clipmap, level,
+					new_x, origin[1] + CLIPMAP_SIZE, new_x + CLIPMAP_SIZE, new_z + CLIPMAP_SIZE );
+		else if( dz < 0 )
+			is_queued = is_queued && clipmap_queue_area( clipmap, level,
+					new_x, new_z, new_x + CLIPMAP_SIZE, origin[1] );
+	}
+	if( is_queued ) {
+		origin[0] = new_x;
+		origin[1] = new_z;
+		clipmap->is_valid[level] = true;
+	} else {
+		// Upload queue full. Parts may have been written, the whole window goes again with a later update.
+		for( unsigned int i = 0; i < clipmap->num_strips[level]; ++i )
+			texture_uploader_cancel( &clipmap->strips[level][i].upload );
+		clipmap->num_strips[level] = 0;
+		clipmap->is_valid[level] = false;
+	}
+	clipmap_update_resident_origin( clipmap, level );
+}
+
+// Splits an area in level coords where it wraps around the toroidal texture
+bool clipmap_queue_area(
+		clipmap_t *clipmap, const unsigned int level, const int x0, const int z0, const int x1, const int z1 ) {
+	for( int z = z0; z < z1; ) {
+		const int z_end = ( z / CLIPMAP_SIZE + 1 ) * CLIPMAP_SIZE < z1 ? ( z / CLIPMAP_SIZE + 1 ) * CLIPMAP_SIZE : z1;
+		for( int x = x0; x < x1; ) {
+			const int x_end = ( x / CLIPMAP_SIZE + 1 ) * CLIPMAP_SIZE < x1 ? ( x / CLIPMAP_SIZE + 1 ) * CLIPMAP_SIZE : x1;
+			if( !clipmap_queue_rect( clipmap, level, x, z, x_end - x, z_end - z ) )
+				return false;
+			x = x_end;
+		}
+		z = z_end;
+	}
+	return true;
+}
+
+// Queues a rect that doesn't wrap with the texture uploader
+bool clipmap_queue_rect(
+		clipmap_t *clipmap, const unsigned int level, const int x, const int z, const int w, const int h ) {
+	if( clipmap->num_strips[level] >= CLIPMAP_MAX_STRIPS ) {
+		logbook_log( LOG_ERROR, "Too many clipmap strips for a level" );
+		return false;
+	}
+	clipmap_strip_t *strip = &clipmap->strips[level][clipmap->num_strips[level]];
+	memset( strip, 0, sizeof(clipmap_strip_t) );
+	strip->clipmap = clipmap;
+	strip->level = level;
+	strip->x = x;
+	strip->z = z;
+	texture_upload_t *upload = &strip->upload;
+	upload->texture = clipmap->texture;
+	upload->level = 0;
+	upload->x_offset = x % CLIPMAP_SIZE;
+	upload->y_offset = z % CLIPMAP_SIZE;
+	upload->layer = (GLint)level;
+	upload->width = w;
+	upload->height = h;
+	upload->format = GL_RED;
+	upload->type = GL_UNSIGNED_SHORT;
+	upload->pixel_size = sizeof(uint16_t);
+	upload->pixels = strip;
+	upload->read_rows = clipmap_read_strip_rows;
+	if( !texture_uploader_submit( upload ) )
+		return false;
+	++clipmap->num_strips[level];
+	clipmap->texels_updated += (size_t)w * (size_t)h;
+	return true;
+}
+
+bool clipmap_strips_are_done( const clipmap_t *const clipmap, const unsigned int level ) {
+	for( unsigned int i = 0; i < clipmap->num_strips[level]; ++i )
+		if( !texture_uploader_is_done( &clipmap->strips[level][i].upload ) )
+			return false;
+	return true;
+}
+
+// Shows the window to the shader once its strips are uploaded, and frees the strips
+void clipmap_update_resident_origin( clipmap_t *clipmap, const unsigned int level ) {
+	if( !clipmap->is_valid[level] || !clipmap_strips_are_done( clipmap, level ) ) {
+		clipmap->resident_origins[level][0] = clipmap->resident_origins[level][1] = CLIPMAP_HIDDEN_ORIGIN;
+		return;
+	}
+	clipmap->num_strips[level] = 0;
+	clipmap->resident_origins[level][0] = clipmap->origins[level][0];
+	clipmap->resident_origins[level][1] = clipmap->origins[level][1];
+}
+
+// Gathers every (1 << level)th source texel of the strip's rows, called by the uploader
+void clipmap_read_strip_rows( const void *source, const GLsizei first_row, const GLsizei num_rows, void *dst ) {
+	const clipmap_strip_t *strip = source;
+	const clipmap_t *clipmap = strip->clipmap;
+	uint16_t *out = dst;
+	for( GLsizei j = first_row; j < first_row + num_rows; ++j ) {
+		const uint16_t *row = clipmap->height_values + ( (size_t)( strip->z + j ) << strip->level ) * clipmap->extent;
+		for( GLsizei i = 0; i < strip->upload.width; ++i )
+			*out++ = row[(size_t)( strip->x + i ) << strip->level];
+	}
+}
@@ -0,0 +1,75 @@
+/* Height clipmap for heightmaps too large for one texture. A stack of CLIPMAP_SIZE^2 windows,
+ * one layer of a texture array per level, level l holding every (1 << l)th texel of the source.
+ * Windows follow the camera and are updated toroidally: a texel at level coords x/z always lives
+ * at x/z mod CLIPMAP_SIZE, so moving a window only uploads the strips that became visible.
+ * The coarsest level covers the whole source, the vram footprint is fixed by size and levels. */
+
+#pragma once
+
+#include "settings.h"
+#include "renderer/texture_uploader.h"
+#include "glad/glad.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Enough for a source extent of CLIPMAP_SIZE << 15
+#define CLIPMAP_MAX_LEVELS 16
+// Strips of a window that moved along x and z, each split in four where it wraps around
+#define CLIPMAP_MAX_STRIPS 8
+
+typedef struct clipmap_t clipmap_t;
+
+/* A rect of a level window that doesn't wrap around. Its texels are gathered from the source row by
+ * row while the texture uploader streams it. */
+typedef struct clipmap_strip_t {
+	texture_upload_t upload;
+	const clipmap_t *clipmap;
+	unsigned int level;
+	// Lower left corner in level texels
+	int x;
+	int z;
+} clipmap_strip_t;
+
+struct clipmap_t {
+	GLuint texture;
+	unsigned int num_levels;
+	// Of the source in texels
+	unsigned int extent;
+	// Row major source texels, not owned
+	const uint16_t *height_values;
+	// Lower left corner of each window in level texels, valid after the first update
+	int origins[CLIPMAP_MAX_LEVELS][2];
+	bool is_valid[CLIPMAP_MAX_LEVELS];
+	/* The origins for the shader. A window with strips still uploading is moved far off, the shader
+	 * samples a coarser level there. */
+	int resident_origins[CLIPMAP_MAX_LEVELS][2];
+	// Strips queued with the uploader per level
+	clipmap_strip_t strips[CLIPMAP_MAX_LEVELS][CLIPMAP_MAX_STRIPS];
+	unsigned int num_strips[CLIPMAP_MAX_LEVELS];
+	// Texels uploaded in total, for statistics
+	size_t texels_updated;
+};
+
+/* Creates the texture array and queues the coarsest level, which covers the whole source and never
+ * moves. The other windows are filled by the updates. Gl thread only. */
+clipmap_t *clipmap_create( const uint16_t *const height_values, const unsigned int extent, clipmap_t *clipmap );
+
+extern clipmap_t *clipmap_delete( clipmap_t *clipmap );
+
+/* Centers the windows around the camera position in source texels and queues the strips that
+ * became visible. A window moves again once its last strips are uploaded. Gl thread only. */
+void clipmap_update( clipmap_t *clipmap, const float texel_x, const float texel_z );
+
+// Origins for the shader as num_levels x/z pairs, see resident_origins. Gl thread only.
+extern const int *clipmap_get_resident_origins( clipmap_t *clipmap );
+
+// True once the coarsest level is uploaded, the shader can sample everything from then on
+extern bool clipmap_is_ready( const clipmap_t *const clipmap );
+
+extern void clipmap_bind( const clipmap_t *const clipmap );
+
+extern size_t clipmap_get_texture_size( const unsigned int extent );
+
+// Levels needed so that the coarsest window covers the source
+extern unsigned int clipmap_get_num_levels( const unsigned int extent );
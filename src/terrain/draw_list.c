@@ -0,0 +1,187 @@
+#include "draw_list.h"
+#include "gridmesh.h"
+#include "lod_selection.h"
+#include "base/logbook.h"
+#include "omath/vec4.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static bool draw_list_reserve( void **array, unsigned int *capacity, const unsigned int count, const size_t size );
+static void draw_list_add_node( const gridmesh_t *const gridmesh, const selected_node_t *const n );
+
+static struct {
+	bool created;
+	GLuint command_buffer;
+	GLuint node_buffer;
+	// Holds 0..MAX_NUMBER_SELECTED_NODES-1, read per instance from the base instance on
+	GLuint node_index_buffer;
+	// Of the gridmesh's index buffer
+	GLenum index_type;
+	draw_list_command_t *commands;
+	unsigned int num_commands;
+	unsigned int commands_capacity;
+	draw_list_node_t *nodes;
+	unsigned int num_nodes;
+	unsigned int nodes_capacity;
+	// Run of commands per tile, and what they draw
+	unsigned int tile_first_command[TERRAIN_MAX_TILES];
+	unsigned int tile_num_commands[TERRAIN_MAX_TILES];
+	int tile_num_triangles[TERRAIN_MAX_TILES];
+	int tile_num_quadrants[TERRAIN_MAX_TILES];
+	unsigned int num_tiles;
+} draw_list;
+
+bool draw_list_create( const gridmesh_t *const gridmesh ) {
+	if( draw_list.created ) {
+		logbook_log( LOG_WARNING, "Draw list already created" );
+		return true;
+	}
+	GLuint *node_indices = malloc( MAX_NUMBER_SELECTED_NODES * sizeof(GLuint) );
+	if( !node_indices ) {
+		logbook_log( LOG_ERROR, "Error allocating draw list node indices" );
+		return false;
+	}
+	for( GLuint i = 0; i < MAX_NUMBER_SELECTED_NODES; ++i )
+		node_indices[i] = i;
+	glCreateBuffers( 1, &draw_list.node_index_buffer );
+	glNamedBufferStorage( draw_list.node_index_buffer, MAX_NUMBER_SELECTED_NODES * sizeof(GLuint), node_indices, 0 );
+	free( node_indices );
+	glCreateBuffers( 1, &draw_list.command_buffer );
+	glCreateBuffers( 1, &draw_list.node_buffer );
+	// One node index per instance. The gridmesh has its vertices at binding 0.
+	const GLuint binding_index = 1;
+	glVertexArrayVertexBuffer( gridmesh->vertex_array, binding_index, draw_list.node_index_buffer, 0, sizeof(GLuint) );
+	glVertexArrayBindingDivisor( gridmesh->vertex_array, binding_index, 1 );
+	glVertexArrayAttribBinding( gridmesh->vertex_array, DRAW_LIST_NODE_INDEX_LOCATION, binding_index );
+	glVertexArrayAttribIFormat( gridmesh->vertex_array, DRAW_LIST_NODE_INDEX_LOCATION, 1, GL_UNSIGNED_INT, 0 );
+	glEnableVertexArrayAttrib( gridmesh->vertex_array, DRAW_LIST_NODE_INDEX_LOCATION );
+	draw_list.index_type = gridmesh->index_type;
+	draw_list.num_tiles = 0;
+	draw_list.created = true;
+	return true;
+}
+
+void draw_list_delete() {
+	if( !draw_list.created )
+		return;
+	glDeleteBuffers( 1, &draw_list.command_buffer );
+	glDeleteBuffers( 1, &draw_list.node_buffer );
+	glDeleteBuffers( 1, &draw_list.node_index_buffer );
+	free( draw_list.commands );
+	free( draw_list.nodes );
+	draw_list.commands = NULL;
+	draw_list.nodes = NULL;
+	draw_list.commands_capacity = draw_list.nodes_capacity = 0;
+	draw_list.num_commands = draw_list.num_nodes = draw_list.num_tiles = 0;
+	draw_list.created = false;
+}
+
+void draw_list_build( const gridmesh_t *const gridmesh, const unsigned int num_tiles ) {
+	draw_list.num_commands = 0;
+	draw_list.num_nodes = 0;
+	draw_list.num_tiles = 0;
+	const unsigned int count = lod_selection_get_selection_count();
+	// A node is drawn by at most two runs of quadrants, e.g. top left and bottom left
+	if( !draw_list_reserve( (void **)&draw_list.nodes, &draw_list.nodes_capacity, count, sizeof(draw_list_node_t) ) ||
+			!draw_list_reserve( (void **)&draw_list.commands, &draw_list.commands_capacity, 2 * count,
+					sizeof(draw_list_command_t) ) ) {
+		logbook_log( LOG_ERROR, "Error allocating draw list, nothing is drawn" );
+		return;
+	}
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		draw_list.tile_first_command[t] = draw_list.num_commands;
+		draw_list.tile_num_triangles[t] = 0;
+		draw_list.tile_num_quadrants[t] = 0;
+		// Level by level like the buckets, which is where the nodes come from
+		for( unsigned int lod_level = lod_selection_get_min_level();
+				lod_level <= lod_selection_get_max_level(); ++lod_level ) {
+			unsigned int bucket_count;
+			const unsigned int first = lod_selection_get_bucket( t, lod_level, &bucket_count );
+			for( unsigned int i = first; i < first + bucket_count; ++i ) {
+				const selected_node_t *n = lod_selection_get_selected_node(i);
+				draw_list.tile_num_quadrants[t] += n->hasTL && n->hasTR && n->hasBL && n->hasBR ?
+						1 : n->hasTL + n->hasTR + n->hasBL + n->hasBR;
+				draw_list_add_node( gridmesh, n );
+			}
+		}
+		draw_list.tile_num_commands[t] = draw_list.num_commands - draw_list.tile_first_command[t];
+		for( unsigned int c = draw_list.tile_first_command[t]; c < draw_list.num_commands; ++c )
+			draw_list.tile_num_triangles[t] += (int)draw_list.commands[c].count / 3;
+	}
+	draw_list.num_tiles = num_tiles;
+	// Rebuilt only when the selection changes, new storage spares waiting for draws still in flight
+	glNamedBufferData( draw_list.command_buffer, (GLsizeiptr)( draw_list.num_commands * sizeof(draw_list_command_t) ),
+			draw_list.commands, GL_STREAM_DRAW );
+	glNamedBufferData( draw_list.node_buffer, (GLsizeiptr)( draw_list.num_nodes * sizeof(draw_list_node_t) ),
+			draw_list.nodes, GL_STREAM_DRAW );
+}
+
+inline void draw_list_bind() {
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, draw_list.command_buffer );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, DRAW_LIST_NODE_BUFFER_BINDING, draw_list.node_buffer );
+}
+
+void draw_list_draw_tile( const unsigned int tile_index, const GLenum draw_mode, int *num_tris, int *num_nodes ) {
+	*num_tris = 0; *num_nodes = 0;
+	if( tile_index >= draw_list.num_tiles || 0 == draw_list.tile_num_commands[tile_index] )
+		return;
+	glMultiDrawElementsIndirect( draw_mode, draw_list.index_type,
+			(const void *)( (size_t)draw_list.tile_first_command[tile_index] * sizeof(draw_list_command_t) ),
+			(GLsizei)draw_list.tile_num_commands[tile_index], 0 );
+	*num_tris = draw_list.tile_num_triangles[tile_index];
+	*num_nodes = draw_list.tile_num_quadrants[tile_index];
+}
+
+// *** static stuff
+// Grows an array geometrically to hold at least count elements. False if that fails, it keeps its size then.
+bool draw_list_reserve( void **array, unsigned int *capacity, const unsigned int count, const size_t size ) {
+	if( count <= *capacity )
+		return true;
+	unsigned int new_capacity = *capacity > 0 ? *capacity : LOD_SELECTION_INITIAL_CAPACITY;
+	while( new_capacity < count )
+		new_capacity *= 2;
+	void *new_array = realloc( *array, new_capacity * size );
+	if( !new_array )
+		return false;
+	*array = new_array;
+	*capacity = new_capacity;
+	return true;
+}
+
+/* Adds the node's data and a command per run of drawn quadrants. The quadrants are consecutive in the
+ * index buffer in the order top left, top right, bottom left, bottom right, and are equal in size. */
+void draw_list_add_node( const gridmesh_t *const gridmesh, const selected_node_t *const n ) {
+	const GLuint node_index = draw_list.num_nodes++;
+	draw_list_node_t *node = &draw_list.nodes[node_index];
+	const aabbf *const bb = &n->aabb;
+	node->offset[0] = bb->min.x;
+	node->offset[1] = ( bb->min.y + bb->max.y ) * 0.5f;
+	node->offset[2] = bb->min.z;
+	node->offset[3] = 0.0f;
+	node->scale[0] = bb->max.x - bb->min.x;
+	node->scale[1] = 0.0f;
+	node->scale[2] = bb->max.z - bb->min.z;
+	node->scale[3] = (float)n->lod_level;
+	const vec4f morph_consts = lod_selection_get_morph_consts( n->lod_level-1 );
+	node->morph_consts[0] = morph_consts.x;
+	node->morph_consts[1] = morph_consts.y;
+	node->morph_consts[2] = morph_consts.z;
+	node->morph_consts[3] = morph_consts.w;
+	const bool has_quadrant[4] = { n->hasTL, n->hasTR, n->hasBL, n->hasBR };
+	const GLuint quadrant_size = (GLuint)gridmesh->end_index_tl;
+	for( unsigned int q = 0; q < 4; ) {
+		if( !has_quadrant[q] ) {
+			++q;
+			continue;
+		}
+		const unsigned int first_quadrant = q;
+		while( q < 4 && has_quadrant[q] )
+			++q;
+		draw_list_command_t *command = &draw_list.commands[draw_list.num_commands++];
+		command->count = ( q - first_quadrant ) * quadrant_size;
+		command->instance_count = 1;
+		command->first_index = first_quadrant * quadrant_size;
+		command->base_vertex = 0;
+		command->base_instance = node_index;
+	}
+}
@@ -0,0 +1,50 @@
+
+/* The lod selection as indirect draw commands. Every selected node becomes one command per run of
+ * drawn quadrants, so a whole node is one command. The node's offset, scale, level and morph constants
+ * go into a shader storage buffer. A command's base instance is its node's index in that buffer, and
+ * reaches the vertex shader through an instanced identity attribute; gl_DrawID would need GL 4.6.
+ * The commands of a tile are a run, a tile is drawn with one glMultiDrawElementsIndirect().
+ * Built when the selection changes, after lod_selection_sort(). Gl thread only. */
+
+#pragma once
+
+#include "settings.h"
+#include "glad/glad.h"
+#include <stdbool.h>
+
+// Binding of the node buffer and location of the node index attribute in the terrain vertex shader
+#define DRAW_LIST_NODE_BUFFER_BINDING 0
+#define DRAW_LIST_NODE_INDEX_LOCATION 1
+
+// Layout given by glMultiDrawElementsIndirect()
+typedef struct draw_list_command_t {
+	GLuint count;
+	GLuint instance_count;
+	GLuint first_index;
+	GLint base_vertex;
+	GLuint base_instance;
+} draw_list_command_t;
+
+// One selected node, std430 layout of node_data_t in the terrain vertex shader
+typedef struct draw_list_node_t {
+	// x and z hold horizontal minimums, y the vertical center of the bounding box
+	GLfloat offset[4];
+	// x and z hold the horizontal size of the bounding box, w the lod level
+	GLfloat scale[4];
+	GLfloat morph_consts[4];
+} draw_list_node_t;
+
+/* Creates the buffers and adds the node index attribute to the gridmesh's vertex array.
+ * False if the buffers can't be created. */
+bool draw_list_create( const gridmesh_t *const gridmesh );
+
+void draw_list_delete();
+
+// Packs the bucketed selection of tiles 0..num_tiles-1 into commands and node data, and uploads them
+void draw_list_build( const gridmesh_t *const gridmesh, const unsigned int num_tiles );
+
+// Binds the command and node buffers. Once before the tiles are drawn.
+extern void draw_list_bind();
+
+// Draws the selected nodes of a tile. The tile's uniforms and heightmap must be set.
+void draw_list_draw_tile( const unsigned int tile_index, const GLenum draw_mode, int *num_tris, int *num_nodes );
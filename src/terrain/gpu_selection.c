@@ -0,0 +1,470 @@
+#include "gpu_selection.h"
+#include "draw_list.h"
+#include "gridmesh.h"
+#include "quadtree.h"
+#include "terrain_tile.h"
+#include "lod_selection.h"
+#include "selection_pool.h"
+#include "base/camera.h"
+#include "base/logbook.h"
+#include "omath/frustum_batch.h"
+#include "renderer/shader_program.h"
+#include <limits.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GPU_SELECTION_NO_SLOT UINT_MAX
+
+// Buffer bindings of lod_select.comp.glsl
+enum { TREE_BINDING, ITEM_BINDING, STATE_BINDING, SLOT_BINDING, COMMAND_BINDING, NODE_BINDING };
+
+/* std430 layout of state_buffer. Counts and dispatches are reset per tile, the overflows and the nodes
+ * taken from the shared node buffer per selection. */
+typedef struct gpu_selection_state_t {
+	GLuint item_counts[GPU_SELECTION_MAX_LEVELS];
+	GLuint dispatches[GPU_SELECTION_MAX_LEVELS][4];
+	GLuint overflows;
+	GLuint node_count;
+} gpu_selection_state_t;
+
+// A selected node as compared with the cpu selection
+typedef struct gpu_selection_key_t {
+	GLfloat offset[3];
+	GLfloat scale[4];
+	unsigned int quadrants;
+} gpu_selection_key_t;
+
+static void gpu_selection_cull_tiles( const tiles_t *const tiles, const unsigned int num_tiles );
+static bool gpu_selection_update_tree( const unsigned int tile_index, const quadtree_t *const quadtree );
+static void gpu_selection_free_tree( const unsigned int tile_index );
+static void gpu_selection_set_uniforms();
+static void gpu_selection_select_tile( const unsigned int tile_index, const quadtree_t *const quadtree );
+static void gpu_selection_read_counts();
+static void gpu_selection_report_overflow();
+static int gpu_selection_compare_keys( const void *a, const void *b );
+
+static struct {
+	bool created;
+	GLuint program;
+	GLuint item_buffer;
+	GLuint state_buffer;
+	GLuint slot_buffer;
+	GLuint command_buffer;
+	GLuint node_buffer;
+	// Nodes the item buffer can hold per level run, the largest quadtree uploaded
+	unsigned int item_capacity;
+	GLuint quadrant_size;
+	GLenum index_type;
+	// Per tile, the uploaded quadtree and its buffer
+	GLuint tree_buffers[TERRAIN_MAX_TILES];
+	const quadtree_t *tree_sources[TERRAIN_MAX_TILES];
+	// Per tile of the last selection, its slot in the command and node buffers
+	unsigned int tile_slots[TERRAIN_MAX_TILES];
+	unsigned int num_tiles;
+	unsigned int num_slots;
+	bool has_selection;
+	// Read back once the selection is done: nodes per slot and the first of them in the node buffer
+	bool has_counts;
+	GLuint slot_counts[TERRAIN_MAX_TILES];
+	unsigned int slot_firsts[TERRAIN_MAX_TILES];
+	unsigned int num_nodes;
+	// Selections made and overflowed, selection count at the last report
+	unsigned int selections;
+	unsigned int overflows;
+	unsigned int overflow_reported_at;
+	// Ready tiles and their boxes for culling
+	unsigned int num_ready;
+	unsigned int ready_tiles[TERRAIN_MAX_TILES];
+	float tile_min_x[TERRAIN_MAX_TILES];
+	float tile_min_y[TERRAIN_MAX_TILES];
+	float tile_min_z[TERRAIN_MAX_TILES];
+	float tile_max_x[TERRAIN_MAX_TILES];
+	float tile_max_y[TERRAIN_MAX_TILES];
+	float tile_max_z[TERRAIN_MAX_TILES];
+	uint8_t tile_results[TERRAIN_MAX_TILES];
+	// Uniform locations
+	GLint u_planes;
+	GLint u_camera_position;
+	GLint u_ranges_sq;
+	GLint u_morph_consts;
+	GLint u_num_levels;
+	GLint u_stop_at_level;
+	GLint u_leaf_node_size;
+	GLint u_height_scale;
+	GLint u_quadrant_size;
+	GLint u_node_capacity;
+	GLint u_tile_min;
+	GLint u_level_offsets;
+	GLint u_level_extents;
+	GLint u_slot;
+	GLint u_level;
+} gpu_selection;
+
+bool gpu_selection_create( const gridmesh_t *const gridmesh ) {
+	if( gpu_selection.created ) {
+		logbook_log( LOG_WARNING, "Gpu selection already created" );
+		return true;
+	}
+	if( !sp_create_compute( "src/terrain/lod_select.comp.glsl", &gpu_selection.program ) ) {
+		logbook_log( LOG_ERROR, "Gpu selection shader not created" );
+		return false;
+	}
+	const GLuint p = gpu_selection.program;
+	gpu_selection.u_planes = glGetUniformLocation( p, "u_planes" );
+	gpu_selection.u_camera_position = glGetUniformLocation( p, "u_camera_position" );
+	gpu_selection.u_ranges_sq = glGetUniformLocation( p, "u_ranges_sq" );
+	gpu_selection.u_morph_consts = glGetUniformLocation( p, "u_morph_consts" );
+	gpu_selection.u_num_levels = glGetUniformLocation( p, "u_num_levels" );
+	gpu_selection.u_stop_at_level = glGetUniformLocation( p, "u_stop_at_level" );
+	gpu_selection.u_leaf_node_size = glGetUniformLocation( p, "u_leaf_node_size" );
+	gpu_selection.u_height_scale = glGetUniformLocation( p, "u_height_scale" );
+	gpu_selection.u_quadrant_size = glGetUniformLocation( p, "u_quadrant_size" );
+	gpu_selection.u_node_capacity = glGetUniformLocation( p, "u_node_capacity" );
+	gpu_selection.u_tile_min = glGetUniformLocation( p, "u_tile_min" );
+	gpu_selection.u_level_offsets = glGetUniformLocation( p, "u_level_offsets" );
+	gpu_selection.u_level_extents = glGetUniformLocation( p, "u_level_extents" );
+	gpu_selection.u_slot = glGetUniformLocation( p, "u_slot" );
+	gpu_selection.u_level = glGetUniformLocation( p, "u_level" );
+	// The tiles take their nodes from one pool of MAX_NUMBER_SELECTED_NODES, the buffers are sized for that once
+	glCreateBuffers( 1, &gpu_selection.item_buffer );
+	glCreateBuffers( 1, &gpu_selection.state_buffer );
+	glNamedBufferStorage( gpu_selection.state_buffer, sizeof(gpu_selection_state_t), NULL, GL_DYNAMIC_STORAGE_BIT );
+	glCreateBuffers( 1, &gpu_selection.slot_buffer );
+	glNamedBufferStorage( gpu_selection.slot_buffer, TERRAIN_MAX_TILES * sizeof(GLuint), NULL, 0 );
+	glCreateBuffers( 1, &gpu_selection.command_buffer );
+	glNamedBufferStorage( gpu_selection.command_buffer,
+			2 * MAX_NUMBER_SELECTED_NODES * sizeof(draw_list_command_t), NULL, 0 );
+	glCreateBuffers( 1, &gpu_selection.node_buffer );
+	glNamedBufferStorage( gpu_selection.node_buffer, MAX_NUMBER_SELECTED_NODES * sizeof(draw_list_node_t), NULL, 0 );
+	gpu_selection.item_capacity = 0;
+	gpu_selection.quadrant_size = (GLuint)gridmesh->end_index_tl;
+	gpu_selection.index_type = gridmesh->index_type;
+	for( unsigned int i = 0; i < TERRAIN_MAX_TILES; ++i ) {
+		gpu_selection.tree_buffers[i] = 0;
+		gpu_selection.tree_sources[i] = NULL;
+	}
+	gpu_selection.num_tiles = gpu_selection.num_slots = 0;
+	gpu_selection.has_selection = false;
+	gpu_selection.selections = gpu_selection.overflows = gpu_selection.overflow_reported_at = 0;
+	gpu_selection.created = true;
+	return true;
+}
+
+void gpu_selection_delete() {
+	if( !gpu_selection.created )
+		return;
+	for( unsigned int i = 0; i < TERRAIN_MAX_TILES; ++i )
+		gpu_selection_free_tree( i );
+	glDeleteBuffers( 1, &gpu_selection.item_buffer );
+	glDeleteBuffers( 1, &gpu_selection.state_buffer );
+	glDeleteBuffers( 1, &gpu_selection.slot_buffer );
+	glDeleteBuffers( 1, &gpu_selection.command_buffer );
+	glDeleteBuffers( 1, &gpu_selection.node_buffer );
+	sp_delete( gpu_selection.program );
+	gpu_selection.num_tiles = gpu_selection.num_slots = 0;
+	gpu_selection.created = false;
+}
+
+void gpu_selection_select( const tiles_t *const tiles, const unsigned int num_tiles ) {
+	if( gpu_selection.has_selection )
+		gpu_selection_report_overflow();
+	++gpu_selection.selections;
+	gpu_selection_cull_tiles( tiles, num_tiles );
+	for( unsigned int i = 0; i < num_tiles; ++i )
+		gpu_selection.tile_slots[i] = GPU_SELECTION_NO_SLOT;
+	gpu_selection.num_tiles = num_tiles;
+	gpu_selection.num_slots = 0;
+	gpu_selection.num_nodes = 0;
+	// Upload what's new and give every tile in the frustum a slot
+	unsigned int max_node_count = 0;
+	for( unsigned int r = 0; r < gpu_selection.num_ready; ++r ) {
+		const unsigned int i = gpu_selection.ready_tiles[r];
+		const quadtree_t *quadtree = tiles[i].tile->quadtree;
+		if( OUTSIDE == gpu_selection.tile_results[r] || !gpu_selection_update_tree( i, quadtree ) )
+			continue;
+		gpu_selection.tile_slots[i] = gpu_selection.num_slots++;
+		max_node_count = quadtree->node_count > max_node_count ? quadtree->node_count : max_node_count;
+	}
+	for( unsigned int i = 0; i < TERRAIN_MAX_TILES; ++i )
+		if( i >= num_tiles || ready != atomic_load( &tiles[i].status ) )
+			gpu_selection_free_tree( i );
+	gpu_selection.has_selection = true;
+	gpu_selection.has_counts = 0 == gpu_selection.num_slots;
+	// Cleared even if nothing is selected, or the last overflow would be reported again
+	const GLuint zero = 0;
+	glClearNamedBufferSubData( gpu_selection.state_buffer, GL_R32UI, offsetof( gpu_selection_state_t, overflows ),
+			2 * sizeof(GLuint), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero );
+	if( 0 == gpu_selection.num_slots )
+		return;
+	if( max_node_count > gpu_selection.item_capacity ) {
+		glNamedBufferData( gpu_selection.item_buffer, (GLsizeiptr)( max_node_count * 2 * sizeof(GLuint) ),
+				NULL, GL_DYNAMIC_COPY );
+		gpu_selection.item_capacity = max_node_count;
+	}
+	glClearNamedBufferSubData( gpu_selection.slot_buffer, GL_R32UI, 0,
+			(GLsizeiptr)( gpu_selection.num_slots * sizeof(GLuint) ), GL_RED_INTEGER, GL_UNSIGNED_INT, &zero );
+	glUseProgram( gpu_selection.program );
+	gpu_selection_set_uniforms();
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, ITEM_BINDING, gpu_selection.item_buffer );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, STATE_BINDING, gpu_selection.state_buffer );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, SLOT_BINDING, gpu_selection.slot_buffer );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, COMMAND_BINDING, gpu_selection.command_buffer );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, NODE_BINDING, gpu_selection.node_buffer );
+	glBindBuffer( GL_DISPATCH_INDIRECT_BUFFER, gpu_selection.state_buffer );
+	for( unsigned int i = 0; i < num_tiles; ++i )
+		if( GPU_SELECTION_NO_SLOT != gpu_selection.tile_slots[i] )
+			gpu_selection_select_tile( i, tiles[i].tile->quadtree );
+	// The draws read the commands and the vertex shader the nodes
+	glMemoryBarrier( GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT );
+}
+
+inline void gpu_selection_bind() {
+	glBindBuffer( GL_DRAW_INDIRECT_BUFFER, gpu_selection.command_buffer );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, DRAW_LIST_NODE_BUFFER_BINDING, gpu_selection.node_buffer );
+}
+
+void gpu_selection_draw_tile( const unsigned int tile_index, const GLenum draw_mode, int *num_tris, int *num_nodes ) {
+	*num_tris = 0; *num_nodes = 0;
+	if( tile_index >= gpu_selection.num_tiles || GPU_SELECTION_NO_SLOT == gpu_selection.tile_slots[tile_index] )
+		return;
+	gpu_selection_read_counts();
+	const unsigned int slot = gpu_selection.tile_slots[tile_index];
+	if( 0 == gpu_selection.slot_counts[slot] )
+		return;
+	*num_nodes = (int)gpu_selection.slot_counts[slot];
+	const size_t first_command = (size_t)gpu_selection.slot_firsts[slot] * 2;
+	glMultiDrawElementsIndirect( draw_mode, gpu_selection.index_type,
+			(const void *)( first_command * sizeof(draw_list_command_t) ), (GLsizei)( gpu_selection.slot_counts[slot] * 2 ), 0 );
+}
+
+bool gpu_selection_matches_cpu( const tiles_t *const tiles, const unsigned int num_tiles ) {
+	char msg[MAX_LEN_MESSAGES];
+	if( !gpu_selection.has_selection || num_tiles != gpu_selection.num_tiles ) {
+		logbook_log( LOG_WARNING, "Gpu selection not compared, no selection of these tiles" );
+		return false;
+	}
+	gpu_selection_read_counts();
+	const unsigned int num_nodes = gpu_selection.num_nodes;
+	draw_list_command_t *commands = malloc( ( 2 * num_nodes + 1 ) * sizeof(draw_list_command_t) );
+	draw_list_node_t *nodes = malloc( ( num_nodes + 1 ) * sizeof(draw_list_node_t) );
+	gpu_selection_key_t *gpu_keys = malloc( ( num_nodes + 1 ) * sizeof(gpu_selection_key_t) );
+	gpu_selection_key_t *cpu_keys = malloc( ( MAX_NUMBER_SELECTED_NODES + 1 ) * sizeof(gpu_selection_key_t) );
+	if( !commands || !nodes || !gpu_keys || !cpu_keys ) {
+		logbook_log( LOG_ERROR, "Error allocating gpu selection readback" );
+		free( commands ); free( nodes ); free( gpu_keys ); free( cpu_keys );
+		return false;
+	}
+	glGetNamedBufferSubData( gpu_selection.command_buffer, 0,
+			(GLsizeiptr)( 2 * num_nodes * sizeof(draw_list_command_t) ), commands );
+	glGetNamedBufferSubData( gpu_selection.node_buffer, 0, (GLsizeiptr)( num_nodes * sizeof(draw_list_node_t) ), nodes );
+	selection_pool_select( tiles, num_tiles );
+	lod_selection_sort();
+	unsigned int mismatches = 0;
+	for( unsigned int t = 0; t < num_tiles; ++t ) {
+		const unsigned int slot = gpu_selection.tile_slots[t];
+		unsigned int gpu_count = 0;
+		if( GPU_SELECTION_NO_SLOT != slot ) {
+			gpu_count = gpu_selection.slot_counts[slot];
+			for( unsigned int k = 0; k < gpu_count; ++k ) {
+				const unsigned int n = gpu_selection.slot_firsts[slot] + k;
+				gpu_selection_key_t *key = &gpu_keys[k];
+				for( unsigned int c = 0; c < 3; ++c )
+					key->offset[c] = nodes[n].offset[c];
+				for( unsigned int c = 0; c < 4; ++c )
+					key->scale[c] = nodes[n].scale[c];
+				key->quadrants = 0;
+				for( unsigned int c = 2 * n; c < 2 * n + 2; ++c )
+					for( GLuint q = 0; q < commands[c].count / gpu_selection.quadrant_size; ++q )
+						key->quadrants |= 1u << ( commands[c].first_index / gpu_selection.quadrant_size + q );
+			}
+		}
+		unsigned int cpu_count;
+		const unsigned int first = lod_selection_get_tile_nodes( t, &cpu_count );
+		for( unsigned int k = 0; k < cpu_count; ++k ) {
+			const selected_node_t *s = lod_selection_get_selected_node( first + k );
+			gpu_selection_key_t *key = &cpu_keys[k];
+			// As draw_list_add_node()
+			key->offset[0] = s->aabb.min.x;
+			key->offset[1] = ( s->aabb.min.y + s->aabb.max.y ) * 0.5f;
+			key->offset[2] = s->aabb.min.z;
+			key->scale[0] = s->aabb.max.x - s->aabb.min.x;
+			key->scale[1] = 0.0f;
+			key->scale[2] = s->aabb.max.z - s->aabb.min.z;
+			key->scale[3] = (float)s->lod_level;
+			key->quadrants = ( s->hasTL ? 1u : 0 ) | ( s->hasTR ? 2u : 0 ) | ( s->hasBL ? 4u : 0 ) | ( s->hasBR ? 8u : 0 );
+		}
+		qsort( gpu_keys, gpu_count, sizeof(gpu_selection_key_t), gpu_selection_compare_keys );
+		qsort( cpu_keys, cpu_count, sizeof(gpu_selection_key_t), gpu_selection_compare_keys );
+		bool same = gpu_count == cpu_count;
+		for( unsigned int k = 0; same && k < gpu_count; ++k )
+			same = 0 == gpu_selection_compare_keys( &gpu_keys[k], &cpu_keys[k] );
+		if( !same ) {
+			++mismatches;
+			snprintf( msg, MAX_LEN_MESSAGES-1, "Gpu selection of tile %d differs, %d gpu and %d cpu nodes",
+					t, gpu_count, cpu_count );
+			logbook_log( LOG_WARNING, msg );
+		}
+	}
+	free( commands ); free( nodes ); free( gpu_keys ); free( cpu_keys );
+	return 0 == mismatches;
+}
+
+// *** static stuff
+// Classifies the quadtree boxes of the ready tiles against the view frustum, as the selection pool does
+void gpu_selection_cull_tiles( const tiles_t *const tiles, const unsigned int num_tiles ) {
+	gpu_selection.num_ready = 0;
+	for( unsigned int i = 0; i < num_tiles; ++i ) {
+		if( ready != atomic_load( &tiles[i].status ) )
+			continue;
+		aabbf tile_aabb;
+		const aabbf *aabb = quadtree_get_aabb( tiles[i].tile->quadtree, &tile_aabb );
+		const unsigned int r = gpu_selection.num_ready++;
+		gpu_selection.ready_tiles[r] = i;
+		gpu_selection.tile_min_x[r] = aabb->min.x;
+		gpu_selection.tile_min_y[r] = aabb->min.y;
+		gpu_selection.tile_min_z[r] = aabb->min.z;
+		gpu_selection.tile_max_x[r] = aabb->max.x;
+		gpu_selection.tile_max_y[r] = aabb->max.y;
+		gpu_selection.tile_max_z[r] = aabb->max.z;
+	}
+	const aabbf_soa_t boxes = {
+			gpu_selection.tile_min_x, gpu_selection.tile_min_y, gpu_selection.tile_min_z,
+			gpu_selection.tile_max_x, gpu_selection.tile_max_y, gpu_selection.tile_max_z
+	};
+	frustum_batch_classify_boxes( &boxes, gpu_selection.num_ready, camera_get_view_frustum(),
+			FRUSTUM_ALL_PLANES, gpu_selection.tile_results, NULL );
+}
+
+/* Uploads a tile's nodes unless they already are. node_t is 12 bytes without holes, the shader reads
+ * it as 3 words. False if the buffer can't be created. */
+bool gpu_selection_update_tree( const unsigned int tile_index, const quadtree_t *const quadtree ) {
+	if( quadtree == gpu_selection.tree_sources[tile_index] )
+		return true;
+	gpu_selection_free_tree( tile_index );
+	glCreateBuffers( 1, &gpu_selection.tree_buffers[tile_index] );
+	glNamedBufferStorage( gpu_selection.tree_buffers[tile_index], (GLsizeiptr)( quadtree->node_count * sizeof(node_t) ),
+			quadtree->all_nodes, 0 );
+	if( GL_NO_ERROR != glGetError() ) {
+		char msg[MAX_LEN_MESSAGES];
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error uploading the quadtree of tile %d, it isn't drawn", tile_index );
+		logbook_log( LOG_ERROR, msg );
+		gpu_selection_free_tree( tile_index );
+		return false;
+	}
+	gpu_selection.tree_sources[tile_index] = quadtree;
+	return true;
+}
+
+void gpu_selection_free_tree( const unsigned int tile_index ) {
+	if( 0 != gpu_selection.tree_buffers[tile_index] )
+		glDeleteBuffers( 1, &gpu_selection.tree_buffers[tile_index] );
+	gpu_selection.tree_buffers[tile_index] = 0;
+	gpu_selection.tree_sources[tile_index] = NULL;
+}
+
+// Camera, ranges and layout, the same for all tiles of a selection
+void gpu_selection_set_uniforms() {
+	const view_frustum_t *frustum = camera_get_view_frustum();
+	GLfloat planes[FRUSTUM_NUM_PLANES][4];
+	for( unsigned int i = 0; i < FRUSTUM_NUM_PLANES; ++i ) {
+		planes[i][0] = frustum->planes[i].normal.x;
+		planes[i][1] = frustum->planes[i].normal.y;
+		planes[i][2] = frustum->planes[i].normal.z;
+		planes[i][3] = frustum->planes[i].distance;
+	}
+	glUniform4fv( gpu_selection.u_planes, FRUSTUM_NUM_PLANES, &planes[0][0] );
+	glUniform3fv( gpu_selection.u_camera_position, 1, (const float *)camera_get_position() );
+	glUniform1fv( gpu_selection.u_ranges_sq, NUMBER_OF_LOD_LEVELS, lod_selection_get_visibility_ranges_sq() );
+	vec4f morph_consts[NUMBER_OF_LOD_LEVELS];
+	for( unsigned int i = 0; i < NUMBER_OF_LOD_LEVELS; ++i )
+		morph_consts[i] = lod_selection_get_morph_consts( i );
+	glUniform4fv( gpu_selection.u_morph_consts, NUMBER_OF_LOD_LEVELS, (const float *)morph_consts );
+	glUniform1ui( gpu_selection.u_num_levels, NUMBER_OF_LOD_LEVELS );
+	glUniform1ui( gpu_selection.u_stop_at_level, lod_selection_get_stop_at_level() );
+	glUniform1ui( gpu_selection.u_leaf_node_size, LEAF_NODE_SIZE );
+	glUniform1f( gpu_selection.u_height_scale, HEIGHT_SCALE );
+	glUniform1ui( gpu_selection.u_quadrant_size, gpu_selection.quadrant_size );
+	glUniform1ui( gpu_selection.u_node_capacity, MAX_NUMBER_SELECTED_NODES );
+}
+
+/* Runs the levels of a tile. The top level is dispatched over all top level nodes, the others over the
+ * nodes the level above appended. Barriers make a level see the items and dispatch size of the last. */
+void gpu_selection_select_tile( const unsigned int tile_index, const quadtree_t *const quadtree ) {
+	gpu_selection_state_t reset = { { 0 }, { { 0 } }, 0, 0 };
+	for( unsigned int l = 0; l < GPU_SELECTION_MAX_LEVELS; ++l ) {
+		reset.dispatches[l][1] = 1;
+		reset.dispatches[l][2] = 1;
+	}
+	glNamedBufferSubData( gpu_selection.state_buffer, 0, offsetof( gpu_selection_state_t, overflows ), &reset );
+	glBindBufferBase( GL_SHADER_STORAGE_BUFFER, TREE_BINDING, gpu_selection.tree_buffers[tile_index] );
+	const aabbf *tile_aabb = &quadtree->terrain_tile->aabb;
+	glUniform2f( gpu_selection.u_tile_min, tile_aabb->min.x, tile_aabb->min.z );
+	glUniform1uiv( gpu_selection.u_level_offsets, NUMBER_OF_LOD_LEVELS, quadtree->level_offsets );
+	glUniform1uiv( gpu_selection.u_level_extents, NUMBER_OF_LOD_LEVELS, quadtree->level_extents );
+	glUniform1ui( gpu_selection.u_slot, gpu_selection.tile_slots[tile_index] );
+	glUniform1ui( gpu_selection.u_level, 0 );
+	const unsigned int num_tops = quadtree->top_node_count * quadtree->top_node_count;
+	glDispatchCompute( ( num_tops + GPU_SELECTION_WORKGROUP_SIZE - 1 ) / GPU_SELECTION_WORKGROUP_SIZE, 1, 1 );
+	for( unsigned int l = 1; l < NUMBER_OF_LOD_LEVELS; ++l ) {
+		glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT );
+		glUniform1ui( gpu_selection.u_level, l );
+		glDispatchComputeIndirect( (GLintptr)offsetof( gpu_selection_state_t, dispatches[l] ) );
+	}
+	// The next tile resets the state and reuses the items
+	glMemoryBarrier( GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT );
+}
+
+/* Waits for the selection and reads the nodes per slot, once per selection. The slots were selected in
+ * order, each took its nodes from the pool after those of the last. GL 4.5 has no indirect draw count,
+ * so the draws need the counts on the cpu. */
+void gpu_selection_read_counts() {
+	if( gpu_selection.has_counts )
+		return;
+	glMemoryBarrier( GL_BUFFER_UPDATE_BARRIER_BIT );
+	glGetNamedBufferSubData( gpu_selection.slot_buffer, 0,
+			(GLsizeiptr)( gpu_selection.num_slots * sizeof(GLuint) ), gpu_selection.slot_counts );
+	unsigned int first = 0;
+	for( unsigned int s = 0; s < gpu_selection.num_slots; ++s ) {
+		gpu_selection.slot_firsts[s] = first;
+		first += gpu_selection.slot_counts[s];
+	}
+	gpu_selection.num_nodes = first;
+	gpu_selection.has_counts = true;
+}
+
+// Reads the overflows of the last selection, which is done by now. Reported like the cpu selection's.
+void gpu_selection_report_overflow() {
+	GLuint overflows = 0;
+	glGetNamedBufferSubData( gpu_selection.state_buffer, offsetof( gpu_selection_state_t, overflows ),
+			sizeof(GLuint), &overflows );
+	if( 0 == overflows )
+		return;
+	++gpu_selection.overflows;
+	if( gpu_selection.overflows > 1 &&
+			gpu_selection.selections - gpu_selection.overflow_reported_at < LOD_SELECTION_OVERFLOW_REPORT_INTERVAL )
+		return;
+	gpu_selection.overflow_reported_at = gpu_selection.selections;
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1,
+			"Gpu lod selection exceeded %d nodes in %d of %d selections. Some nodes will not be drawn",
+			MAX_NUMBER_SELECTED_NODES, gpu_selection.overflows, gpu_selection.selections );
+	logbook_log( LOG_WARNING, msg );
+}
+
+// Orders by lod level, then position. Floats compare exactly, the selections must be bit identical.
+int gpu_selection_compare_keys( const void *a, const void *b ) {
+	const gpu_selection_key_t *ka = a;
+	const gpu_selection_key_t *kb = b;
+	if( ka->scale[3] != kb->scale[3] )
+		return ka->scale[3] < kb->scale[3] ? -1 : 1;
+	for( unsigned int c = 0; c < 3; ++c )
+		if( ka->offset[c] != kb->offset[c] )
+			return ka->offset[c] < kb->offset[c] ? -1 : 1;
+	for( unsigned int c = 0; c < 3; ++c )
+		if( ka->scale[c] != kb->scale[c] )
+			return ka->scale[c] < kb->scale[c] ? -1 : 1;
+	if( ka->quadrants != kb->quadrants )
+		return ka->quadrants < kb->quadrants ? -1 : 1;
+	return 0;
+}
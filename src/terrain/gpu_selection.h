@@ -0,0 +1,43 @@
+/* Lod selection in a compute shader, the nodes never come back to the cpu. The quadtree of every
+ * ready tile is held in a shader storage buffer. The selection runs level by level: the top level
+ * nodes are dispatched directly, every level appends the sub nodes to traverse to the next one, which
+ * is dispatched indirectly. The tests are those of node_lod_select() on the same floats, and use only
+ * +, - and *, which GLSL rounds correctly and precise keeps from being fused. So the same nodes with the
+ * same quadrants are selected, bench/gpu_selection_test.c checks that.
+ * Selected nodes are written as draw_list_node_t and draw_list_command_t. All tiles take them from one
+ * pool of MAX_NUMBER_SELECTED_NODES, as the cpu selection does, and a tile's nodes are one run of it.
+ * GL 4.5 has no indirect draw count, so the node count of every tile is read back before the first
+ * draw. Only tiles in the frustum are selected, they are culled on the cpu.
+ * Uses the node index attribute set up by draw_list_create(). Gl thread only. */
+
+#pragma once
+
+#include "terrain.h"
+#include "glad/glad.h"
+#include <stdbool.h>
+
+// Must match lod_select.comp.glsl
+#define GPU_SELECTION_WORKGROUP_SIZE 64
+#define GPU_SELECTION_MAX_LEVELS 16
+
+// Compiles the compute shader and creates the buffers. False if that fails.
+bool gpu_selection_create( const gridmesh_t *const gridmesh );
+
+// Also frees the buffers of the tiles' quadtrees
+void gpu_selection_delete();
+
+/* Selects from the ready tiles. The quadtrees of tiles that became ready are uploaded, those of tiles
+ * that aren't ready any more are freed. Overflows of the previous selection are reported. */
+void gpu_selection_select( const tiles_t *const tiles, const unsigned int num_tiles );
+
+// Binds the command and node buffers. Once before the tiles are drawn.
+extern void gpu_selection_bind();
+
+/* Draws the selected nodes of a tile. The tile's uniforms and heightmap must be set. The first draw
+ * after a selection waits for it. The triangles stay on the gpu, num_tris is 0. */
+void gpu_selection_draw_tile( const unsigned int tile_index, const GLenum draw_mode, int *num_tris, int *num_nodes );
+
+/* Debugging: reads the last gpu selection back and compares it tile by tile with the cpu selection
+ * for the same camera and tiles, which replaces the current cpu selection. Differences are logged.
+ * True if both selected the same nodes with the same quadrants. Stalls the pipeline. */
+bool gpu_selection_matches_cpu( const tiles_t *const tiles, const unsigned int num_tiles );
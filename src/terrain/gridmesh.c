@@ -2,9 +2,14 @@
 #include "gridmesh.h"
 #include "base/logbook.h"
 #include "omath/vec3.h"
+#include "renderer/vertex_cache.h"
 #include <stdlib.h>
 #include <stdio.h>
 
+static void gridmesh_add_quadrant(
+		const unsigned int x_begin, const unsigned int x_end, const unsigned int z_begin, const unsigned int z_end,
+		const unsigned int vertex_dimension, GLuint *indices, unsigned int *index, float *acmr, float *row_acmr );
+
 gridmesh_t *gridmesh_create( const unsigned int dimension, gridmesh_t *gridmesh ) {
 	if( !is_pow2u(dimension) || dimension < 16 || dimension > 1024 ) {
 		logbook_log( LOG_ERROR, "gridmesh dimension must be power of 2 and between 16 and 1024" );
@@ -18,7 +23,18 @@ gridmesh_t *gridmesh_create( const unsigned int dimension, gridmesh_t *gridmesh
 	gridmesh->dimension = dimension;
 	unsigned int total_vertices = ( dimension + 1 ) * ( dimension + 1 );
 	gridmesh->num_indices = (GLsizei)(dimension * dimension * 2 * 3);
-	vec3f vertices[total_vertices];
+	// 16 bit indices halve the index fetches where they suffice, up to dimension 128
+	gridmesh->index_type = total_vertices <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+	// Too large for the stack at the larger dimensions
+	vec3f *vertices = malloc( total_vertices * sizeof(vec3f) );
+	GLuint *indices = malloc( (size_t)gridmesh->num_indices * sizeof(GLuint) );
+	if( !vertices || !indices ) {
+		logbook_log( LOG_ERROR, "error allocating gridmesh vertices" );
+		free( vertices );
+		free( indices );
+		free( gridmesh );
+		return NULL;
+	}
 	unsigned int vertex_dimension = dimension + 1;
 	for( unsigned int y = 0; y < vertex_dimension; ++y )
 		for( unsigned int x = 0; x < vertex_dimension; ++x ) {
@@ -27,8 +43,8 @@ gridmesh_t *gridmesh_create( const unsigned int dimension, gridmesh_t *gridmesh
 		}
 	glCreateVertexArrays( 1, &gridmesh->vertex_array );
 	glCreateBuffers( 1, &gridmesh->vertex_buffer );
-	// total_vertices * sizeof(vec3f)
-	glNamedBufferData( gridmesh->vertex_buffer, (GLsizeiptr)sizeof(vertices), vertices, GL_STATIC_DRAW );
+	glNamedBufferData( gridmesh->vertex_buffer, (GLsizeiptr)( total_vertices * sizeof(vec3f) ), vertices, GL_STATIC_DRAW );
+	free( vertices );
 	glVertexArrayVertexBuffer(
 			// array, buffer binding index, buffer, offset, stride
 			gridmesh->vertex_array, 0, gridmesh->vertex_buffer, 0, sizeof(vec3f)
@@ -37,70 +53,44 @@ gridmesh_t *gridmesh_create( const unsigned int dimension, gridmesh_t *gridmesh
 	glVertexArrayAttribBinding( gridmesh->vertex_array, attrib_index, binding_index );
 	glVertexArrayAttribFormat( gridmesh->vertex_array, attrib_index, 3, GL_FLOAT, GL_FALSE, 0 );
 	glEnableVertexArrayAttrib( gridmesh->vertex_array, attrib_index );
-	GLuint indices[gridmesh->num_indices];
 	unsigned int index = 0;
 	unsigned int half_d = vertex_dimension / 2;
+	float acmr = 0.0f, row_acmr = 0.0f;
 	//Top Left
-	for( unsigned int y = 0; y < half_d; ++y ) {
-		for( unsigned int x = 0; x < half_d; ++x ) {
-			indices[index++] = x + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * (y + 1);
-		}
-	}
+	gridmesh_add_quadrant( 0, half_d, 0, half_d, vertex_dimension, indices, &index, &acmr, &row_acmr );
 	gridmesh->end_index_tl = (GLsizei)index;
 	//Top Right
-	for( unsigned int y = 0; y < half_d; ++y ) {
-		for( unsigned int x = half_d; x < dimension; ++x ) {
-			indices[index++] = x + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * (y + 1);
-		}
-	}
+	gridmesh_add_quadrant( half_d, dimension, 0, half_d, vertex_dimension, indices, &index, &acmr, &row_acmr );
 	gridmesh->end_index_tr = (GLsizei)index;
 	//Bottom Left
-	for( unsigned int y = half_d; y < dimension; ++y ) {
-		for( unsigned int x = 0; x < half_d; ++x ) {
-			indices[index++] = x + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * (y + 1);
-		}
-	}
+	gridmesh_add_quadrant( 0, half_d, half_d, dimension, vertex_dimension, indices, &index, &acmr, &row_acmr );
 	gridmesh->end_index_bl = (GLsizei)index;
 	//Bottom Right
-	for( unsigned int y = half_d; y < dimension; ++y ) {
-		for( unsigned int x = half_d; x < dimension; ++x ) {
-			indices[index++] = x + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = (x + 1) + vertex_dimension * y;
-			indices[index++] = x + vertex_dimension * (y + 1);
-			indices[index++] = (x + 1) + vertex_dimension * (y + 1);
-		}
-	}
+	gridmesh_add_quadrant( half_d, dimension, half_d, dimension, vertex_dimension, indices, &index, &acmr, &row_acmr );
 	gridmesh->end_index_br = (GLsizei)index;
 	if( gridmesh->num_indices != (GLsizei)index-- ) {
 		char msg[MAX_LEN_MESSAGES-1];
 		sprintf( msg, "Gridmesh: number of indices (%d) != precalc number (%d)", gridmesh->num_indices, index-- );
 		logbook_log( LOG_ERROR, msg );
+		free(indices);
 		free(gridmesh);
 		return NULL;
 	}
 	glCreateBuffers( 1, &gridmesh->index_buffer );
-	// sizeof * gridmesh->num_indices
-	glNamedBufferData( gridmesh->index_buffer, (GLsizeiptr)sizeof(indices), indices, GL_STATIC_DRAW );
+	if( GL_UNSIGNED_SHORT == gridmesh->index_type ) {
+		// Narrowed in place, front to back
+		GLushort *short_indices = (GLushort *)indices;
+		for( GLsizei i = 0; i < gridmesh->num_indices; ++i )
+			short_indices[i] = (GLushort)indices[i];
+	}
+	glNamedBufferData( gridmesh->index_buffer, (GLsizeiptr)gridmesh->num_indices * gridmesh_get_index_size( gridmesh ),
+			indices, GL_STATIC_DRAW );
+	free(indices);
 	glVertexArrayElementBuffer( gridmesh->vertex_array, gridmesh->index_buffer );
 	char msg[MAX_LEN_MESSAGES-1];
-	sprintf( msg, "Gridmesh dimension %d created", gridmesh->dimension );
+	sprintf( msg, "Gridmesh dimension %d created, %d bit indices, ACMR %.3f (row order %.3f) for %d cache entries",
+			gridmesh->dimension, GL_UNSIGNED_SHORT == gridmesh->index_type ? 16 : 32,
+			(double)acmr * 0.25, (double)row_acmr * 0.25, GRIDMESH_VERTEX_CACHE_SIZE );
 	logbook_log( LOG_INFO, msg );
 	return gridmesh;
 }
@@ -121,3 +111,49 @@ inline gridmesh_t *gridmesh_delete( gridmesh_t *gridmesh ) {
 inline void gridmesh_bind( const gridmesh_t *const gridmesh ) {
 	glBindVertexArray( gridmesh->vertex_array );
 }
+
+inline GLsizei gridmesh_get_index_size( const gridmesh_t *const gridmesh ) {
+	return GL_UNSIGNED_SHORT == gridmesh->index_type ? (GLsizei)sizeof(GLushort) : (GLsizei)sizeof(GLuint);
+}
+
+// *** static stuff
+/* Adds the triangles of the cells x_begin..x_end-1, z_begin..z_end-1 in row order, then reorders them
+ * for the vertex cache. The quadrant stays a run of its own. The order with fewer misses in a cache
+ * of GRIDMESH_VERTEX_CACHE_SIZE entries is kept, for small quadrants two rows fit and row order wins.
+ * Adds the quadrant's ACMR of both orders. */
+void gridmesh_add_quadrant(
+		const unsigned int x_begin, const unsigned int x_end, const unsigned int z_begin, const unsigned int z_end,
+		const unsigned int vertex_dimension, GLuint *indices, unsigned int *index, float *acmr, float *row_acmr ) {
+	GLuint *quadrant = &indices[*index];
+	for( unsigned int y = z_begin; y < z_end; ++y ) {
+		for( unsigned int x = x_begin; x < x_end; ++x ) {
+			indices[(*index)++] = x + vertex_dimension * y;
+			indices[(*index)++] = x + vertex_dimension * (y + 1);
+			indices[(*index)++] = (x + 1) + vertex_dimension * y;
+			indices[(*index)++] = (x + 1) + vertex_dimension * y;
+			indices[(*index)++] = x + vertex_dimension * (y + 1);
+			indices[(*index)++] = (x + 1) + vertex_dimension * (y + 1);
+		}
+	}
+	const unsigned int count = (unsigned int)( &indices[*index] - quadrant );
+	const unsigned int num_vertices = vertex_dimension * vertex_dimension;
+	const float quadrant_row_acmr = vertex_cache_get_acmr( quadrant, count, num_vertices, GRIDMESH_VERTEX_CACHE_SIZE );
+	*row_acmr += quadrant_row_acmr;
+	GLuint *optimized = malloc( count * sizeof(GLuint) );
+	if( !optimized ) {
+		*acmr += quadrant_row_acmr;
+		return;
+	}
+	for( unsigned int i = 0; i < count; ++i )
+		optimized[i] = quadrant[i];
+	float optimized_acmr = quadrant_row_acmr;
+	if( vertex_cache_optimize( optimized, count, num_vertices, GRIDMESH_VERTEX_CACHE_SIZE ) )
+		optimized_acmr = vertex_cache_get_acmr( optimized, count, num_vertices, GRIDMESH_VERTEX_CACHE_SIZE );
+	if( optimized_acmr >= 0.0f && optimized_acmr < quadrant_row_acmr ) {
+		for( unsigned int i = 0; i < count; ++i )
+			quadrant[i] = optimized[i];
+		*acmr += optimized_acmr;
+	} else
+		*acmr += quadrant_row_acmr;
+	free( optimized );
+}
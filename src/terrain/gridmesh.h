@@ -1,5 +1,6 @@
 /* A rectangular, [0.0..1.0] clamped regular flat mesh.
- * X and Z are the horizontal dimensions. Y will be extruded by the heightmap. */
+ * X and Z are the horizontal dimensions. Y will be extruded by the heightmap.
+ * The indices are 4 equal runs of quadrants, each ordered for the post transform vertex cache. */
 
 #pragma once
 
@@ -13,6 +14,8 @@ struct gridmesh_t {
 	GLsizei end_index_bl;
 	GLsizei end_index_br;
 	GLsizei num_indices;
+	// GL_UNSIGNED_SHORT if 16 bits index all vertices, else GL_UNSIGNED_INT
+	GLenum index_type;
 	GLuint vertex_array;
 	GLuint index_buffer;
 	GLuint vertex_buffer;
@@ -23,3 +26,6 @@ gridmesh_t *gridmesh_create( const unsigned int dimension, gridmesh_t *gridmesh
 extern gridmesh_t *gridmesh_delete( gridmesh_t *gridmesh );
 
 extern void gridmesh_bind( const gridmesh_t *const gridmesh );
+
+// Bytes per index of the index buffer
+extern GLsizei gridmesh_get_index_size( const gridmesh_t *const gridmesh );
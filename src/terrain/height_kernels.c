@@ -0,0 +1,142 @@
+#include "height_kernels.h"
+#include <threads.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEIGHT_KERNELS_X86
+#endif
+
+typedef void (*min_max_func_t)( const uint16_t *const, const size_t, uint16_t *, uint16_t * );
+
+static void height_kernels_select();
+
+static struct {
+	once_flag once;
+	const char *isa;
+	min_max_func_t min_max;
+	min_max_func_t accumulate_min_max;
+} height_kernels = { .once = ONCE_FLAG_INIT };
+
+// *** scalar fallback, also handles the tails of the vector versions
+static void min_max_scalar( const uint16_t *const values, const size_t count, uint16_t *min, uint16_t *max ) {
+	uint16_t mi = *min, ma = *max;
+	for( size_t i = 0; i < count; ++i ) {
+		mi = values[i] < mi ? values[i] : mi;
+		ma = values[i] > ma ? values[i] : ma;
+	}
+	*min = mi;
+	*max = ma;
+}
+
+static void accumulate_min_max_scalar(
+		const uint16_t *const values, const size_t count, uint16_t *acc_min, uint16_t *acc_max ) {
+	for( size_t i = 0; i < count; ++i ) {
+		acc_min[i] = values[i] < acc_min[i] ? values[i] : acc_min[i];
+		acc_max[i] = values[i] > acc_max[i] ? values[i] : acc_max[i];
+	}
+}
+
+#ifdef HEIGHT_KERNELS_X86
+// *** SSE4.1, 8 values per step
+__attribute__((target("sse4.1")))
+static void min_max_sse41( const uint16_t *const values, const size_t count, uint16_t *min, uint16_t *max ) {
+	size_t i = 0;
+	if( count >= 8 ) {
+		__m128i vmin = _mm_set1_epi16( (short)*min );
+		__m128i vmax = _mm_set1_epi16( (short)*max );
+		for( ; i + 8 <= count; i += 8 ) {
+			const __m128i v = _mm_loadu_si128( (const __m128i *)&values[i] );
+			vmin = _mm_min_epu16( vmin, v );
+			vmax = _mm_max_epu16( vmax, v );
+		}
+		// minpos gives the horizontal min, max via the complement
+		*min = (uint16_t)_mm_cvtsi128_si32( _mm_minpos_epu16( vmin ) );
+		*max = (uint16_t)~_mm_cvtsi128_si32( _mm_minpos_epu16( _mm_xor_si128( vmax, _mm_set1_epi16( -1 ) ) ) );
+	}
+	min_max_scalar( &values[i], count - i, min, max );
+}
+
+__attribute__((target("sse4.1")))
+static void accumulate_min_max_sse41(
+		const uint16_t *const values, const size_t count, uint16_t *acc_min, uint16_t *acc_max ) {
+	size_t i = 0;
+	for( ; i + 8 <= count; i += 8 ) {
+		const __m128i v = _mm_loadu_si128( (const __m128i *)&values[i] );
+		__m128i *pmin = (__m128i *)&acc_min[i];
+		__m128i *pmax = (__m128i *)&acc_max[i];
+		_mm_storeu_si128( pmin, _mm_min_epu16( _mm_loadu_si128( pmin ), v ) );
+		_mm_storeu_si128( pmax, _mm_max_epu16( _mm_loadu_si128( pmax ), v ) );
+	}
+	accumulate_min_max_scalar( &values[i], count - i, &acc_min[i], &acc_max[i] );
+}
+
+// *** AVX2, 16 values per step
+__attribute__((target("avx2")))
+static void min_max_avx2( const uint16_t *const values, const size_t count, uint16_t *min, uint16_t *max ) {
+	size_t i = 0;
+	if( count >= 16 ) {
+		__m256i vmin = _mm256_set1_epi16( (short)*min );
+		__m256i vmax = _mm256_set1_epi16( (short)*max );
+		for( ; i + 16 <= count; i += 16 ) {
+			const __m256i v = _mm256_loadu_si256( (const __m256i *)&values[i] );
+			vmin = _mm256_min_epu16( vmin, v );
+			vmax = _mm256_max_epu16( vmax, v );
+		}
+		const __m128i min128 = _mm_min_epu16( _mm256_castsi256_si128( vmin ), _mm256_extracti128_si256( vmin, 1 ) );
+		const __m128i max128 = _mm_max_epu16( _mm256_castsi256_si128( vmax ), _mm256_extracti128_si256( vmax, 1 ) );
+		*min = (uint16_t)_mm_cvtsi128_si32( _mm_minpos_epu16( min128 ) );
+		*max = (uint16_t)~_mm_cvtsi128_si32( _mm_minpos_epu16( _mm_xor_si128( max128, _mm_set1_epi16( -1 ) ) ) );
+	}
+	min_max_scalar( &values[i], count - i, min, max );
+}
+
+__attribute__((target("avx2")))
+static void accumulate_min_max_avx2(
+		const uint16_t *const values, const size_t count, uint16_t *acc_min, uint16_t *acc_max ) {
+	size_t i = 0;
+	for( ; i + 16 <= count; i += 16 ) {
+		const __m256i v = _mm256_loadu_si256( (const __m256i *)&values[i] );
+		__m256i *pmin = (__m256i *)&acc_min[i];
+		__m256i *pmax = (__m256i *)&acc_max[i];
+		_mm256_storeu_si256( pmin, _mm256_min_epu16( _mm256_loadu_si256( pmin ), v ) );
+		_mm256_storeu_si256( pmax, _mm256_max_epu16( _mm256_loadu_si256( pmax ), v ) );
+	}
+	accumulate_min_max_scalar( &values[i], count - i, &acc_min[i], &acc_max[i] );
+}
+#endif
+
+inline void height_kernels_min_max(
+		const uint16_t *const values, const size_t count, uint16_t *min, uint16_t *max ) {
+	call_once( &height_kernels.once, height_kernels_select );
+	height_kernels.min_max( values, count, min, max );
+}
+
+inline void height_kernels_accumulate_min_max(
+		const uint16_t *const values, const size_t count, uint16_t *acc_min, uint16_t *acc_max ) {
+	call_once( &height_kernels.once, height_kernels_select );
+	height_kernels.accumulate_min_max( values, count, acc_min, acc_max );
+}
+
+inline const char *height_kernels_get_isa() {
+	call_once( &height_kernels.once, height_kernels_select );
+	return height_kernels.isa;
+}
+
+// *** static stuff
+// Once per process, tile loader and codec threads may call the kernels first
+void height_kernels_select() {
+	height_kernels.isa = "scalar";
+	height_kernels.min_max = min_max_scalar;
+	height_kernels.accumulate_min_max = accumulate_min_max_scalar;
+#ifdef HEIGHT_KERNELS_X86
+	__builtin_cpu_init();
+	if( __builtin_cpu_supports( "avx2" ) ) {
+		height_kernels.isa = "avx2";
+		height_kernels.min_max = min_max_avx2;
+		height_kernels.accumulate_min_max = accumulate_min_max_avx2;
+	} else if( __builtin_cpu_supports( "sse4.1" ) ) {
+		height_kernels.isa = "sse4.1";
+		height_kernels.min_max = min_max_sse41;
+		height_kernels.accumulate_min_max = accumulate_min_max_sse41;
+	}
+#endif
+}
@@ -0,0 +1,19 @@
+/* Scan kernels over contiguous runs of 16 bit height values. AVX2 and SSE4.1 versions are
+ * selected at runtime by cpu feature detection, with a scalar fallback on other cpus.
+ * Callers should pass whole rows of row major data, not strided columns. */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// Min/max of count values. Leaves min/max untouched if count is 0.
+extern void height_kernels_min_max(
+		const uint16_t *const values, const size_t count, uint16_t *min, uint16_t *max );
+
+// Element wise min/max of values into the accumulators, e.g. to reduce a block of rows
+extern void height_kernels_accumulate_min_max(
+		const uint16_t *const values, const size_t count, uint16_t *acc_min, uint16_t *acc_max );
+
+// Name of the selected instruction set for logging
+extern const char *height_kernels_get_isa();
@@ -1,5 +1,6 @@
-
 #include "heightmap.h"
+#include "height_kernels.h"
+#include "heightmap_codec.h"
 #include "base/logbook.h"
 #include "stb/stb_image.h"
 #include "renderer/sampler.h"
@@ -7,8 +8,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+static heightmap_t *heightmap_allocate( const char *filename );
+static bool heightmap_load_raw( const size_t offset, heightmap_t *heightmap );
+static bool heightmap_load_image( const char *filename, heightmap_t *heightmap );
+static bool heightmap_load_compressed( const char *filename, const unsigned int num_threads, heightmap_t *heightmap );
+static double heightmap_get_seconds( const struct timespec *const start );
+static void heightmap_read_packed_rows(
+		const void *source, const GLsizei first_row, const GLsizei num_rows, void *dst );
+static bool heightmap_check_writable( const heightmap_t *const heightmap );
+static void heightmap_free_height_values( heightmap_t *heightmap );
+static heightmap_t *heightmap_create_pyramid( heightmap_t *heightmap );
 
-heightmap_t *heightmap_create( const char *filename, heightmap_t *heightmap ) {
+heightmap_t *heightmap_create( const char *filename, const unsigned int num_threads, heightmap_t *heightmap ) {
 	char msg[MAX_LEN_MESSAGES];
 	if( strlen(filename) >= MAX_LEN_FILENAMES-1 ) {
 		snprintf( msg, MAX_LEN_MESSAGES-1, "Filename too long for heightmap texture '%s'", filename );
@@ -19,75 +32,55 @@ heightmap_t *heightmap_create( const char *filename, heightmap_t *heightmap ) {
 		logbook_log( LOG_WARNING, "Non-null pointer passed to heightmap create" );
 		return heightmap;
 	}
-	heightmap = malloc(sizeof(heightmap_t));
-	if( !heightmap ) {
-		logbook_log( LOG_ERROR, "Error allocating heightmap" );
+	heightmap = heightmap_allocate( filename );
+	if( !heightmap )
 		return heightmap;
-	}
-	// stbi_set_flip_vertically_on_load( true );
-	int w, h, channels;
-	// load the data, single channel 16bit
-	heightmap->height_values = stbi_load_16( filename, &w, &h, &channels, 1 );
-	if( !heightmap->height_values ) {
-		snprintf( msg, MAX_LEN_MESSAGES-1, "Could not read heightmap texture '%s'", filename );
-		logbook_log( LOG_ERROR, msg );
+	if( heightmap_is_raw_file( filename ) ) {
+		heightmap->mapped_file = mapped_file_create( filename, heightmap->mapped_file );
+		if( !heightmap->mapped_file || !heightmap_load_raw( 0, heightmap ) )
+			return heightmap_delete(heightmap);
+	} else if( heightmap_codec_is_codec_file( filename ) ) {
+		if( !heightmap_load_compressed( filename, num_threads, heightmap ) )
+			return heightmap_delete(heightmap);
+	} else if( !heightmap_load_image( filename, heightmap ) )
 		return heightmap_delete(heightmap);
+	return heightmap_create_pyramid( heightmap );
+}
+
+heightmap_t *heightmap_create_mapped(
+		mapped_file_t *file, const size_t offset, minmax_pyramid_t *pyramid, heightmap_t *heightmap ) {
+	if( heightmap ) {
+		logbook_log( LOG_WARNING, "Non-null pointer passed to heightmap_create_mapped" );
+		mapped_file_delete( file );
+		minmax_pyramid_delete( pyramid );
+		return heightmap;
 	}
-	if( channels != 1 ) {
-		snprintf( msg, MAX_LEN_MESSAGES-1, "Error reading heightmap texture '%s'. Not monochrome", filename );
-		logbook_log( LOG_ERROR, msg );
-		return heightmap_delete(heightmap);
+	heightmap = heightmap_allocate( file->filename );
+	if( !heightmap ) {
+		mapped_file_delete( file );
+		minmax_pyramid_delete( pyramid );
+		return heightmap;
 	}
-	strncpy( heightmap->filename, filename, MAX_LEN_FILENAMES-1 );
-	heightmap->extent = (unsigned int)w;
-	size_t num_pixels = (size_t)(w * h);
-	// Unclamped values are allways stored as 16 bit integers
-	GLfloat *valuesf = malloc(num_pixels*sizeof(GLfloat));
-	if( !valuesf ) {
-		snprintf(
-				msg, MAX_LEN_MESSAGES-1,
-				"Error allocating mem to store height values of heightmap texture '%s'", filename
-		);
-		logbook_log( LOG_ERROR, msg );
+	heightmap->mapped_file = file;
+	heightmap->pyramid = pyramid;
+	if( !heightmap_load_raw( offset, heightmap ) )
+		return heightmap_delete(heightmap);
+	if( pyramid && pyramid->extent != heightmap->extent ) {
+		logbook_log( LOG_ERROR, "Min/max pyramid does not match the heightmap extent" );
 		return heightmap_delete(heightmap);
 	}
-	// find min/max values and assign normalized values
-	heightmap->min_height_value = UINT16_MAX;
-	heightmap->max_height_value = 0;
-	for( unsigned int x = 0; x < heightmap->extent; ++x ) {
-		for( unsigned int y = 0; y < heightmap->extent; ++y ) {
-			uint16_t t = heightmap->height_values[x+heightmap->extent*y];
-			heightmap->min_height_value = t < heightmap->min_height_value ? t : heightmap->min_height_value;
-			heightmap->max_height_value = t > heightmap->max_height_value ? t : heightmap->max_height_value;
-			valuesf[x+heightmap->extent*y] = (GLfloat)t / 65535.0f;
-		}
-	}
-	// There's only float data 0..1 from now on
-	glCreateTextures( GL_TEXTURE_2D, 1, &heightmap->texture );
-	// no mip levels @todo 16bit floats, compression ?
-	glTextureStorage2D(
-			heightmap->texture, 1, GL_R32F, (GLsizei)heightmap->extent, (GLsizei)heightmap->extent
-	);
-	glTextureSubImage2D( heightmap->texture, 0,								// texture and mip level
-			0, 0, (GLsizei)heightmap->extent, (GLsizei)heightmap->extent,	// offset and size
-			GL_RED, GL_FLOAT, valuesf );
-	glBindTextureUnit( HEIGHTMAP_TEXTURE_UNIT, heightmap->texture );
-	// set the default sampler for the heightmap texture
-	set_default_sampler( heightmap->texture, LINEAR_CLAMP );
-	// release mem
-	free(valuesf);
-	// @todo: query texture size ! sizeof(heightmap->height_values_normalized)
-	float total_size = (float)( sizeof(heightmap_t) + num_pixels * sizeof(uint16_t) ) / 1024.0f;
-	snprintf(
-			msg, MAX_LEN_MESSAGES-1, "Heightmap '%s', texture unit %d, %d * %d, loaded. Size in memory %.2fkb",
-			filename, HEIGHTMAP_TEXTURE_UNIT, heightmap->extent, heightmap->extent, total_size
-	);
-	logbook_log( LOG_INFO, msg );
-	return heightmap;
+	return pyramid ? heightmap : heightmap_create_pyramid( heightmap );
 }
 
 inline uint16_t heightmap_get_height_at(
 		const unsigned int x, const unsigned int y, const heightmap_t *const heightmap ) {
+	if( heightmap->packed_heights )
+		return packed_heights_get( heightmap->packed_heights, x, y );
+	if( !heightmap->height_values ) {
+		uint16_t min, max;
+		minmax_pyramid_get_area( heightmap->pyramid, x, y, 1, 1, &min, &max );
+		return (uint16_t)( ( (unsigned int)min + max ) / 2 );
+	}
 	return heightmap->height_values[x + y*heightmap->extent];
 }
 
@@ -96,20 +89,34 @@ void heightmap_get_min_max_height_area(
 		uint16_t *min, uint16_t *max, const heightmap_t *const heightmap ) {
 	*min = UINT16_MAX;
 	*max = 0;
-	for( unsigned int i = x; i < x + w; ++i )
-	    for( unsigned int j = z; j < z + h; ++j ) {
-	    	const uint16_t new_val = heightmap_get_height_at( i, j, heightmap );
-	    	*min = new_val < *min ? new_val : *min;
-	    	*max = new_val > *max ? new_val : *max;
-	    }
+	if( heightmap->packed_heights ) {
+		// Unpacked in runs that stay in the cache
+		uint16_t run[256];
+		for( unsigned int j = z; j < z + h; ++j )
+			for( unsigned int i = x; i < x + w; i += 256 ) {
+				const unsigned int count = x + w - i < 256 ? x + w - i : 256;
+				packed_heights_get_row( heightmap->packed_heights, i, j, count, run );
+				height_kernels_min_max( run, count, min, max );
+			}
+		return;
+	}
+	if( !heightmap->height_values ) {
+		minmax_pyramid_get_area( heightmap->pyramid, x, z, w, h, min, max );
+		return;
+	}
+	// row by row, rows are contiguous
+	for( unsigned int j = z; j < z + h; ++j )
+		height_kernels_min_max( &heightmap->height_values[x + (size_t)j*heightmap->extent], w, min, max );
 }
 
 inline heightmap_t *heightmap_delete( heightmap_t *heightmap ) {
 	if( heightmap ) {
-		if( glIsTexture(heightmap->texture) )
-			glDeleteTextures( 1, &heightmap->texture );
-		if( heightmap->height_values )
-			stbi_image_free(heightmap->height_values);
+		// Never uploaded if it failed or was dropped on a loader thread
+		if( heightmap->texture || heightmap->clipmap )
+			heightmap_release_texture( heightmap );
+		heightmap->pyramid = minmax_pyramid_delete( heightmap->pyramid );
+		heightmap->packed_heights = packed_heights_delete( heightmap->packed_heights );
+		heightmap_free_height_values( heightmap );
 		char msg[MAX_LEN_MESSAGES];
 		sprintf( msg, "Heightmap '%s' destroyed", heightmap->filename );
 		logbook_log( LOG_INFO, msg );
@@ -119,6 +126,378 @@ inline heightmap_t *heightmap_delete( heightmap_t *heightmap ) {
 	return heightmap;
 }
 
+inline bool heightmap_is_uploaded( const heightmap_t *const heightmap ) {
+	if( heightmap->clipmap )
+		return clipmap_is_ready( heightmap->clipmap );
+	return heightmap->texture && texture_uploader_is_done( &heightmap->upload );
+}
+
+inline bool heightmap_is_virtual( const heightmap_t *const heightmap ) {
+	return heightmap->extent > HEIGHTMAP_MAX_TEXTURE_EXTENT;
+}
+
+inline void heightmap_update( heightmap_t *heightmap, const float texel_x, const float texel_z ) {
+	if( heightmap->clipmap )
+		clipmap_update( heightmap->clipmap, texel_x, texel_z );
+}
+
+inline void heightmap_release_texture( heightmap_t *heightmap ) {
+	heightmap->clipmap = clipmap_delete( heightmap->clipmap );
+	texture_uploader_cancel( &heightmap->upload );
+	if( heightmap->texture && glIsTexture(heightmap->texture) )
+		glDeleteTextures( 1, &heightmap->texture );
+	heightmap->texture = 0;
+}
+
+bool heightmap_pack( heightmap_t *heightmap ) {
+	if( heightmap->packed_heights )
+		return true;
+	if( heightmap_is_virtual( heightmap ) ) {
+		logbook_log( LOG_WARNING, "Virtual heightmaps are not packed" );
+		return false;
+	}
+	heightmap->packed_heights = packed_heights_create(
+			heightmap->height_values, heightmap->extent, heightmap->packed_heights );
+	if( !heightmap->packed_heights )
+		return false;
+	heightmap_free_height_values( heightmap );
+	return true;
+}
+
+bool heightmap_drop_height_values( heightmap_t *heightmap ) {
+	if( !heightmap_has_height_values( heightmap ) )
+		return true;
+	if( heightmap_is_virtual( heightmap ) || !heightmap->texture || !texture_uploader_is_done( &heightmap->upload ) )
+		return false;
+	heightmap->packed_heights = packed_heights_delete( heightmap->packed_heights );
+	heightmap_free_height_values( heightmap );
+	minmax_pyramid_drop_levels( heightmap->pyramid, HEIGHTMAP_GPU_ONLY_CELL_SIZE );
+	return true;
+}
+
+inline bool heightmap_has_height_values( const heightmap_t *const heightmap ) {
+	return heightmap->height_values || heightmap->packed_heights;
+}
+
+inline void heightmap_prefault( const heightmap_t *const heightmap ) {
+	if( heightmap->mapped_file )
+		mapped_file_prefault( heightmap->mapped_file,
+				(size_t)( (const char *)heightmap->height_values - (const char *)heightmap->mapped_file->data ),
+				(size_t)heightmap->extent * heightmap->extent * sizeof(uint16_t) );
+}
+
 inline void heightmap_bind( const heightmap_t *const heightmap ) {
+	if( heightmap->clipmap )
+		clipmap_bind( heightmap->clipmap );
+	else
+		glBindTextureUnit( HEIGHTMAP_TEXTURE_UNIT, heightmap->texture );
+}
+
+bool heightmap_write_raw( const heightmap_t *const heightmap, const char *filename ) {
+	char msg[MAX_LEN_MESSAGES];
+	FILE *f = fopen( filename, "wb" );
+	if( !f ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Could not open raw heightmap '%s' for writing", filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	bool success = heightmap_fwrite_raw( heightmap, f );
+	success = ( 0 == fclose(f) ) && success;
+	if( !success ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error writing raw heightmap '%s'", filename );
+		logbook_log( LOG_ERROR, msg );
+		remove( filename );
+		return false;
+	}
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Raw heightmap '%s' written", filename );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+inline bool heightmap_write_compressed( const heightmap_t *const heightmap, const char *filename ) {
+	if( !heightmap_check_writable( heightmap ) )
+		return false;
+	return heightmap_codec_write( heightmap->height_values, heightmap->extent,
+			heightmap->min_height_value, heightmap->max_height_value, filename );
+}
+
+bool heightmap_fwrite_raw( const heightmap_t *const heightmap, FILE *file ) {
+	if( !heightmap_check_writable( heightmap ) )
+		return false;
+	heightmap_raw_header_t header;
+	memcpy( header.magic, HEIGHTMAP_RAW_MAGIC, sizeof(header.magic) );
+	header.version = HEIGHTMAP_RAW_VERSION;
+	header.extent = heightmap->extent;
+	header.min_height_value = heightmap->min_height_value;
+	header.max_height_value = heightmap->max_height_value;
+	const size_t num_pixels = (size_t)heightmap->extent * heightmap->extent;
+	return 1 == fwrite( &header, sizeof(header), 1, file ) &&
+			num_pixels == fwrite( heightmap->height_values, sizeof(uint16_t), num_pixels, file );
+}
+
+inline size_t heightmap_get_raw_size( const heightmap_t *const heightmap ) {
+	return sizeof(heightmap_raw_header_t) + (size_t)heightmap->extent * heightmap->extent * sizeof(uint16_t);
+}
+
+inline size_t heightmap_get_texture_size( const heightmap_t *const heightmap ) {
+	if( heightmap_is_virtual( heightmap ) )
+		return clipmap_get_texture_size( heightmap->extent );
+	const size_t texel_size = GL_R32F == HEIGHTMAP_TEXTURE_FORMAT ? 4 : 2;
+	return (size_t)heightmap->extent * heightmap->extent * texel_size;
+}
+
+inline size_t heightmap_get_memory_size( const heightmap_t *const heightmap ) {
+	size_t size = sizeof(heightmap_t);
+	if( heightmap->packed_heights )
+		size += packed_heights_get_size( heightmap->packed_heights );
+	else if( heightmap->mapped_file )
+		size += heightmap->mapped_file->size;
+	else if( heightmap->height_values )
+		size += (size_t)heightmap->extent * heightmap->extent * sizeof(uint16_t);
+	if( heightmap->pyramid )
+		size += sizeof(minmax_pyramid_t) + heightmap->pyramid->num_cells * sizeof(minmax_t);
+	return size;
+}
+
+inline bool heightmap_is_raw_file( const char *filename ) {
+	const size_t len = strlen(filename);
+	const size_t ext_len = strlen(HEIGHTMAP_RAW_EXTENSION);
+	return len > ext_len && 0 == strcmp( filename + len - ext_len, HEIGHTMAP_RAW_EXTENSION );
+}
+
+// Queues the height values straight from the 16 bit texels. GL normalizes the unsigned shorts to
+// 0..1 for all formats. Mapped pages should have been prefaulted, see heightmap_prefault().
+bool heightmap_upload( heightmap_t *heightmap ) {
+	char msg[MAX_LEN_MESSAGES];
+	const bool is_mapped = NULL != heightmap->mapped_file;
+	if( heightmap->texture || heightmap->clipmap ) {
+		logbook_log( LOG_WARNING, "Heightmap already uploaded" );
+		return true;
+	}
+	if( !heightmap_has_height_values( heightmap ) ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Heightmap '%s' has no height values left to upload", heightmap->filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	if( heightmap_is_virtual( heightmap ) ) {
+		heightmap->clipmap = clipmap_create( heightmap->height_values, heightmap->extent, heightmap->clipmap );
+		return NULL != heightmap->clipmap;
+	}
+	glCreateTextures( GL_TEXTURE_2D, 1, &heightmap->texture );
+	if( !heightmap->texture ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error creating texture for heightmap '%s'", heightmap->filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	// no mip levels @todo compression ?
+	glTextureStorage2D(
+			heightmap->texture, 1, HEIGHTMAP_TEXTURE_FORMAT, (GLsizei)heightmap->extent, (GLsizei)heightmap->extent
+	);
+	texture_upload_t *upload = &heightmap->upload;
+	upload->texture = heightmap->texture;
+	upload->level = 0;
+	upload->width = upload->height = (GLsizei)heightmap->extent;
+	upload->format = GL_RED;
+	upload->type = GL_UNSIGNED_SHORT;
+	upload->pixel_size = sizeof(uint16_t);
+	upload->pixels = heightmap->height_values;
+	upload->read_rows = NULL;
+	if( heightmap->packed_heights ) {
+		upload->pixels = heightmap->packed_heights;
+		upload->read_rows = heightmap_read_packed_rows;
+	}
+	if( !texture_uploader_submit( upload ) ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error queueing upload of heightmap '%s'", heightmap->filename );
+		logbook_log( LOG_ERROR, msg );
+		heightmap_release_texture( heightmap );
+		return false;
+	}
 	glBindTextureUnit( HEIGHTMAP_TEXTURE_UNIT, heightmap->texture );
+	// set the default sampler for the heightmap texture
+	set_default_sampler( heightmap->texture, LINEAR_CLAMP );
+	float total_size = (float)heightmap_get_memory_size( heightmap ) / 1024.0f;
+	snprintf(
+			msg, MAX_LEN_MESSAGES-1,
+			"Heightmap '%s', texture unit %d, %d * %d, upload queued%s. Size in memory %.2fkb, on gpu %.2fkb",
+			heightmap->filename, HEIGHTMAP_TEXTURE_UNIT, heightmap->extent, heightmap->extent,
+			is_mapped ? " (mapped)" : heightmap->packed_heights ? " (packed)" : "", total_size,
+			(float)heightmap_get_texture_size( heightmap ) / 1024.0f
+	);
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+// *** static stuff
+heightmap_t *heightmap_allocate( const char *filename ) {
+	heightmap_t *heightmap = malloc(sizeof(heightmap_t));
+	if( !heightmap ) {
+		logbook_log( LOG_ERROR, "Error allocating heightmap" );
+		return heightmap;
+	}
+	strncpy( heightmap->filename, filename, MAX_LEN_FILENAMES-1 );
+	heightmap->filename[MAX_LEN_FILENAMES-1] = 0;
+	heightmap->texture = 0;
+	memset( &heightmap->upload, 0, sizeof(texture_upload_t) );
+	heightmap->clipmap = NULL;
+	heightmap->height_values = NULL;
+	heightmap->mapped_file = NULL;
+	heightmap->is_decoded = false;
+	heightmap->packed_heights = NULL;
+	heightmap->pyramid = NULL;
+	return heightmap;
+}
+
+// Points the height values at the texels behind the raw header at offset in the mapped file
+bool heightmap_load_raw( const size_t offset, heightmap_t *heightmap ) {
+	char msg[MAX_LEN_MESSAGES];
+	const mapped_file_t *file = heightmap->mapped_file;
+	const heightmap_raw_header_t *header = (const heightmap_raw_header_t *)( (const char *)file->data + offset );
+	if( offset % sizeof(uint16_t) != 0 || file->size < offset + sizeof(heightmap_raw_header_t) ||
+		0 != memcmp( header->magic, HEIGHTMAP_RAW_MAGIC, sizeof(header->magic) ) ||
+		HEIGHTMAP_RAW_VERSION != header->version ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Raw heightmap '%s' has no valid header", file->filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	const size_t num_pixels = (size_t)header->extent * header->extent;
+	if( 0 == header->extent ||
+		file->size != offset + sizeof(heightmap_raw_header_t) + num_pixels * sizeof(uint16_t) ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Raw heightmap '%s' size does not match extent %d",
+				file->filename, header->extent );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	heightmap->extent = header->extent;
+	heightmap->min_height_value = header->min_height_value;
+	heightmap->max_height_value = header->max_height_value;
+	heightmap->height_values = (uint16_t *)( header + 1 );
+	return true;
+}
+
+// Decodes a 16 bit monochrome image through stb
+bool heightmap_load_image( const char *filename, heightmap_t *heightmap ) {
+	char msg[MAX_LEN_MESSAGES];
+	// stbi_set_flip_vertically_on_load( true );
+	int w, h, channels;
+	struct timespec start;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	// load the data, single channel 16bit
+	heightmap->height_values = stbi_load_16( filename, &w, &h, &channels, 1 );
+	if( !heightmap->height_values ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Could not read heightmap texture '%s'", filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	if( channels != 1 ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error reading heightmap texture '%s'. Not monochrome", filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	if( w != h ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error reading heightmap texture '%s'. Not square", filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	heightmap->extent = (unsigned int)w;
+	const double seconds = heightmap_get_seconds( &start );
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Heightmap image '%s' decoded in %.2fms, %.2fMtexels/s",
+			filename, seconds * 1000.0, seconds > 0.0 ? (double)w * h / seconds / 1e6 : 0.0 );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+// Decodes all blocks of a compressed file in parallel. The file is only mapped while decoding.
+bool heightmap_load_compressed( const char *filename, const unsigned int num_threads, heightmap_t *heightmap ) {
+	char msg[MAX_LEN_MESSAGES];
+	mapped_file_t *file = mapped_file_create( filename, NULL );
+	if( !file )
+		return false;
+	if( !heightmap_codec_validate( file ) ) {
+		mapped_file_delete( file );
+		return false;
+	}
+	const heightmap_codec_header_t *header = file->data;
+	struct timespec start;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	mapped_file_advise_sequential( file );
+	heightmap->height_values = heightmap_codec_decode( file, num_threads );
+	if( !heightmap->height_values ) {
+		mapped_file_delete( file );
+		return false;
+	}
+	heightmap->is_decoded = true;
+	heightmap->extent = header->extent;
+	heightmap->min_height_value = header->min_height_value;
+	heightmap->max_height_value = header->max_height_value;
+	const double seconds = heightmap_get_seconds( &start );
+	const double num_texels = (double)header->extent * header->extent;
+	snprintf( msg, MAX_LEN_MESSAGES-1,
+			"Compressed heightmap '%s' decoded in %.2fms, %.2fMtexels/s, %.2f bits per texel",
+			filename, seconds * 1000.0, seconds > 0.0 ? num_texels / seconds / 1e6 : 0.0,
+			(double)file->size * 8.0 / num_texels );
+	logbook_log( LOG_INFO, msg );
+	mapped_file_delete( file );
+	return true;
+}
+
+// Builds the min/max pyramid from the loaded texels, which also gives the total min/max.
+// Deletes the heightmap on failure.
+heightmap_t *heightmap_create_pyramid( heightmap_t *heightmap ) {
+	char msg[MAX_LEN_MESSAGES];
+	struct timespec start;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	heightmap->pyramid = minmax_pyramid_create( heightmap->height_values, heightmap->extent, heightmap->pyramid );
+	if( !heightmap->pyramid ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error creating min/max pyramid of heightmap '%s'", heightmap->filename );
+		logbook_log( LOG_ERROR, msg );
+		return heightmap_delete(heightmap);
+	}
+	const double seconds = heightmap_get_seconds( &start );
+	const minmax_t total = minmax_pyramid_get_total( heightmap->pyramid );
+	heightmap->min_height_value = total.min;
+	heightmap->max_height_value = total.max;
+	const size_t bytes = (size_t)heightmap->extent * heightmap->extent * sizeof(uint16_t);
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Heightmap '%s' min/max pyramid built in %.2fms, %.2fGB/s (%s)",
+			heightmap->filename, seconds * 1000.0, seconds > 0.0 ? (double)bytes / seconds / 1e9 : 0.0,
+			height_kernels_get_isa() );
+	logbook_log( LOG_INFO, msg );
+	return heightmap;
+}
+
+// Since start, for the load statistics
+double heightmap_get_seconds( const struct timespec *const start ) {
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return (double)( now.tv_sec - start->tv_sec ) + (double)( now.tv_nsec - start->tv_nsec ) * 1e-9;
+}
+
+// Decodes whole rows of packed heights into the upload staging memory
+void heightmap_read_packed_rows( const void *source, const GLsizei first_row, const GLsizei num_rows, void *dst ) {
+	const packed_heights_t *packed = source;
+	uint16_t *rows = dst;
+	for( GLsizei j = 0; j < num_rows; ++j )
+		packed_heights_get_row( packed, 0, (unsigned int)( first_row + j ), packed->extent,
+				rows + (size_t)j * packed->extent );
+}
+
+// Raw and compressed files are written from the unpacked texels only
+bool heightmap_check_writable( const heightmap_t *const heightmap ) {
+	if( heightmap->height_values )
+		return true;
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Heightmap '%s' has no unpacked height values to write", heightmap->filename );
+	logbook_log( LOG_ERROR, msg );
+	return false;
+}
+
+// Unmaps or frees the unpacked texels, whoever owns them
+void heightmap_free_height_values( heightmap_t *heightmap ) {
+	if( heightmap->mapped_file )
+		heightmap->mapped_file = mapped_file_delete( heightmap->mapped_file );
+	else if( heightmap->is_decoded )
+		free(heightmap->height_values);
+	else if( heightmap->height_values )
+		stbi_image_free(heightmap->height_values);
+	heightmap->height_values = NULL;
+	heightmap->is_decoded = false;
 }
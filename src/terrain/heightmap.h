@@ -2,31 +2,130 @@
 #pragma once
 
 #include "settings.h"
+#include "minmax_pyramid.h"
+#include "packed_heights.h"
+#include "base/mapped_file.h"
+#include "renderer/texture_uploader.h"
+#include "clipmap.h"
 #include "glad/glad.h"
 #include <inttypes.h>
+#include <stdio.h>
+
+/* Native raw heightmap format: the header below, followed by extent*extent little endian
+ * uint16_t height values in row major order. The file is memory mapped and the texels are
+ * handed to the texture upload as they are, no decoding or intermediate copy. */
+#define HEIGHTMAP_RAW_EXTENSION ".r16"
+#define HEIGHTMAP_RAW_MAGIC "OR16"
+#define HEIGHTMAP_RAW_VERSION 1
+
+typedef struct heightmap_raw_header_t {
+	char magic[4];
+	uint32_t version;
+	uint32_t extent;
+	uint16_t min_height_value;
+	uint16_t max_height_value;
+} heightmap_raw_header_t;
 
 struct heightmap_t {
 	char filename[MAX_LEN_FILENAMES];
 	// Height/width of texture file in pixels. Texture of a tile is square.
 	unsigned int extent;
 	GLuint texture;
+	// Texels go to the texture over several frames, see texture_uploader.h
+	texture_upload_t upload;
+	// Instead of the texture if the extent is above HEIGHTMAP_MAX_TEXTURE_EXTENT
+	clipmap_t *clipmap;
 	uint16_t min_height_value;
 	uint16_t max_height_value;
 	uint16_t *height_values;
+	// Non-null if height values point into a mapped raw file, else they are owned by stb
+	mapped_file_t *mapped_file;
+	// Height values were decoded from a compressed file and are freed with free()
+	bool is_decoded;
+	// Replaces the height values after heightmap_pack()
+	packed_heights_t *packed_heights;
+	// For node and area min/max queries without rescanning the texels
+	minmax_pyramid_t *pyramid;
 };
 
-heightmap_t *heightmap_create( const char *filename, heightmap_t *heightmap );
+/* Loads 16 bit monochrome images through stb or, by extension, raw (HEIGHTMAP_RAW_EXTENSION) or
+ * compressed (HEIGHTMAP_CODEC_EXTENSION) files. Compressed files are decoded on num_threads threads,
+ * the calling one included. Makes no gl calls and may run on a loader thread; the texture is created
+ * by heightmap_upload(). */
+heightmap_t *heightmap_create( const char *filename, const unsigned int num_threads, heightmap_t *heightmap );
+
+/* Creates the heightmap from a raw image embedded at offset in a mapped file, e.g. a tile bundle.
+ * Takes ownership of the mapping and the pyramid, they are released with the heightmap or on failure.
+ * If pyramid is NULL it is built from the texels. */
+heightmap_t *heightmap_create_mapped(
+		mapped_file_t *file, const size_t offset, minmax_pyramid_t *pyramid, heightmap_t *heightmap );
 
+// Only touches gl if the heightmap has been uploaded
 extern heightmap_t *heightmap_delete( heightmap_t *heightmap );
 
+/* Creates the texture and queues the height values for upload. Virtual heightmaps get a clipmap
+ * instead, filled by heightmap_update(). Gl thread only. */
+bool heightmap_upload( heightmap_t *heightmap );
+
+// True when all texels have been handed to gl, or the clipmap exists
+extern bool heightmap_is_uploaded( const heightmap_t *const heightmap );
+
+// Too large for a single texture, rendered from a clipmap
+extern bool heightmap_is_virtual( const heightmap_t *const heightmap );
+
+// Per frame work on the gl thread. Moves the clipmap of a virtual heightmap to the camera position in texels.
+extern void heightmap_update( heightmap_t *heightmap, const float texel_x, const float texel_z );
+
+/* Deletes the texture or clipmap and cancels a pending upload, but keeps the height values, so the
+ * heightmap can be uploaded again. Gl thread only. */
+extern void heightmap_release_texture( heightmap_t *heightmap );
+
+/* Packs the height values and releases the originals, a mapping is closed. Height queries and
+ * uploads read the packed values from then on, writing raw or compressed files is no longer possible.
+ * Not for virtual heightmaps, their clipmap reads the texel rows directly. */
+bool heightmap_pack( heightmap_t *heightmap );
+
+/* Frees texels, packed or not, once they are on the gpu, and the finer pyramid levels, see
+ * HEIGHTMAP_GPU_ONLY. Height queries are approximate from then on and the texture can't be uploaded
+ * again. False if not uploaded yet or virtual. */
+bool heightmap_drop_height_values( heightmap_t *heightmap );
+
+// False after heightmap_drop_height_values()
+extern bool heightmap_has_height_values( const heightmap_t *const heightmap );
+
+// Faults the pages of a mapped heightmap in, so the upload doesn't wait for the disk
+extern void heightmap_prefault( const heightmap_t *const heightmap );
+
 extern void heightmap_bind( const heightmap_t *const heightmap );
 
-// returns min/max values in the world range of 0.0f..65535.0f
+// Writes the height values in the raw format. Used to convert decoded images for faster loading
+bool heightmap_write_raw( const heightmap_t *const heightmap, const char *filename );
+
+// Writes the height values in the compressed format, see heightmap_codec.h
+bool heightmap_write_compressed( const heightmap_t *const heightmap, const char *filename );
+
+// Writes header and texels at the current position of an open file
+bool heightmap_fwrite_raw( const heightmap_t *const heightmap, FILE *file );
+
+// Size in bytes of header and texels as written by heightmap_fwrite_raw()
+extern size_t heightmap_get_raw_size( const heightmap_t *const heightmap );
+
+// Size of the texture or clipmap in video memory in bytes, whether uploaded or not
+extern size_t heightmap_get_texture_size( const heightmap_t *const heightmap );
+
+// Bytes in main memory: texels, packed or the whole mapping if mapped, and the pyramid
+extern size_t heightmap_get_memory_size( const heightmap_t *const heightmap );
+
+// True if filename ends with HEIGHTMAP_RAW_EXTENSION
+extern bool heightmap_is_raw_file( const char *filename );
+
+// returns min/max values in the world range of 0.0f..65535.0f. Scans the texels, for
+// node sized or approximate queries use the pyramid. Conservative from the pyramid if the texels were dropped.
 void heightmap_get_min_max_height_area(
 		const unsigned int x, const unsigned int z, const unsigned int w, const unsigned int h,
 		uint16_t *min, uint16_t *max, const heightmap_t *const heightmap );
 
-// returns the real world height value at coords
+// returns the real world height value at coords. Mid range of a pyramid cell if the texels were dropped.
 extern uint16_t heightmap_get_height_at(
 		const unsigned int x, const unsigned int y, const heightmap_t *const heightmap
 );
@@ -0,0 +1,326 @@
+#include "heightmap_codec.h"
+#include "base/logbook.h"
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+// Rice quotients from this on are escaped and followed by the raw 16 bit value
+#define CODEC_ESCAPE_QUOTIENT 16
+// Halves the adaptation statistics, keeps them local
+#define CODEC_RESET_COUNT 32
+
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	size_t capacity;
+	uint64_t bits;
+	unsigned int num_bits;
+} bit_writer_t;
+
+typedef struct {
+	const uint8_t *data;
+	size_t size;
+	size_t position;
+	uint64_t bits;
+	unsigned int num_bits;
+	bool overrun;
+} bit_reader_t;
+
+typedef struct {
+	const mapped_file_t *file;
+	uint16_t *out;
+	atomic_uint next_block;
+	atomic_bool failed;
+} decode_job_t;
+
+static bool codec_encode_block(
+		const uint16_t *const values, const size_t stride, const unsigned int w, const unsigned int h,
+		bit_writer_t *writer );
+static bool codec_decode_block(
+		const uint8_t *const data, const size_t size, const unsigned int w, const unsigned int h,
+		uint16_t *out, const size_t stride );
+static int codec_decode_worker( void *arg );
+static const heightmap_codec_header_t *codec_get_header( const mapped_file_t *const file );
+static const uint64_t *codec_get_offsets( const mapped_file_t *const file );
+
+bool heightmap_codec_write(
+		const uint16_t *const height_values, const unsigned int extent,
+		const uint16_t min_height_value, const uint16_t max_height_value, const char *filename ) {
+	char msg[MAX_LEN_MESSAGES];
+	heightmap_codec_header_t header;
+	memcpy( header.magic, HEIGHTMAP_CODEC_MAGIC, sizeof(header.magic) );
+	header.version = HEIGHTMAP_CODEC_VERSION;
+	header.extent = extent;
+	header.block_size = HEIGHTMAP_CODEC_BLOCK_SIZE;
+	header.min_height_value = min_height_value;
+	header.max_height_value = max_height_value;
+	header.blocks_per_side = ( extent + HEIGHTMAP_CODEC_BLOCK_SIZE - 1 ) / HEIGHTMAP_CODEC_BLOCK_SIZE;
+	const size_t num_blocks = (size_t)header.blocks_per_side * header.blocks_per_side;
+	uint64_t *offsets = malloc( ( num_blocks + 1 ) * sizeof(uint64_t) );
+	bit_writer_t writer = { NULL, 0, 0, 0, 0 };
+	if( !offsets ) {
+		logbook_log( LOG_ERROR, "Error allocating codec block table" );
+		return false;
+	}
+	// Blocks are appended to one buffer, offsets are relative to the file start
+	const uint64_t payload_offset = sizeof(header) + ( num_blocks + 1 ) * sizeof(uint64_t);
+	bool success = true;
+	for( unsigned int bz = 0; bz < header.blocks_per_side && success; ++bz )
+		for( unsigned int bx = 0; bx < header.blocks_per_side && success; ++bx ) {
+			const unsigned int x = bx * HEIGHTMAP_CODEC_BLOCK_SIZE, z = bz * HEIGHTMAP_CODEC_BLOCK_SIZE;
+			const unsigned int w = extent - x < HEIGHTMAP_CODEC_BLOCK_SIZE ? extent - x : HEIGHTMAP_CODEC_BLOCK_SIZE;
+			const unsigned int h = extent - z < HEIGHTMAP_CODEC_BLOCK_SIZE ? extent - z : HEIGHTMAP_CODEC_BLOCK_SIZE;
+			offsets[bz * header.blocks_per_side + bx] = payload_offset + writer.size;
+			success = codec_encode_block( height_values + (size_t)z * extent + x, extent, w, h, &writer );
+		}
+	offsets[num_blocks] = payload_offset + writer.size;
+	FILE *f = success ? fopen( filename, "wb" ) : NULL;
+	if( f ) {
+		success = 1 == fwrite( &header, sizeof(header), 1, f ) &&
+				num_blocks + 1 == fwrite( offsets, sizeof(uint64_t), num_blocks + 1, f ) &&
+				writer.size == fwrite( writer.data, 1, writer.size, f );
+		success = ( 0 == fclose(f) ) && success;
+		if( !success )
+			remove( filename );
+	} else
+		success = false;
+	if( success ) {
+		const size_t raw_size = (size_t)extent * extent * sizeof(uint16_t);
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Compressed heightmap '%s' written, %.2f bits per texel, ratio %.2f",
+				filename, (double)( offsets[num_blocks] * 8 ) / ( (double)extent * extent ),
+				(double)raw_size / (double)offsets[num_blocks] );
+		logbook_log( LOG_INFO, msg );
+	} else {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error writing compressed heightmap '%s'", filename );
+		logbook_log( LOG_ERROR, msg );
+	}
+	free( writer.data );
+	free( offsets );
+	return success;
+}
+
+bool heightmap_codec_validate( const mapped_file_t *const file ) {
+	char msg[MAX_LEN_MESSAGES];
+	const heightmap_codec_header_t *header = codec_get_header( file );
+	if( file->size < sizeof(heightmap_codec_header_t) ||
+		0 != memcmp( header->magic, HEIGHTMAP_CODEC_MAGIC, sizeof(header->magic) ) ||
+		HEIGHTMAP_CODEC_VERSION != header->version || 0 == header->extent || 0 == header->block_size ||
+		header->blocks_per_side != ( header->extent + header->block_size - 1 ) / header->block_size ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Compressed heightmap '%s' has no valid header", file->filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	const size_t num_blocks = (size_t)header->blocks_per_side * header->blocks_per_side;
+	const uint64_t *offsets = codec_get_offsets( file );
+	const uint64_t payload_offset = sizeof(heightmap_codec_header_t) + ( num_blocks + 1 ) * sizeof(uint64_t);
+	bool valid = file->size >= payload_offset && offsets[0] == payload_offset && offsets[num_blocks] <= file->size;
+	for( size_t i = 0; i < num_blocks && valid; ++i )
+		valid = offsets[i] <= offsets[i+1];
+	if( !valid ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Compressed heightmap '%s' has a corrupt block table", file->filename );
+		logbook_log( LOG_ERROR, msg );
+	}
+	return valid;
+}
+
+uint16_t *heightmap_codec_decode( const mapped_file_t *const file, unsigned int num_threads ) {
+	const heightmap_codec_header_t *header = codec_get_header( file );
+	decode_job_t job;
+	job.file = file;
+	job.out = malloc( (size_t)header->extent * header->extent * sizeof(uint16_t) );
+	if( !job.out ) {
+		logbook_log( LOG_ERROR, "Error allocating decoded heightmap" );
+		return NULL;
+	}
+	atomic_init( &job.next_block, 0 );
+	atomic_init( &job.failed, false );
+	const unsigned int num_blocks = header->blocks_per_side * header->blocks_per_side;
+	num_threads = num_threads < NUMBER_OF_THREADS ? num_threads : NUMBER_OF_THREADS;
+	num_threads = num_threads < num_blocks ? num_threads : num_blocks;
+	thrd_t threads[NUMBER_OF_THREADS];
+	unsigned int num_started = 0;
+	// The calling thread works, too
+	for( unsigned int i = 1; i < num_threads; ++i, ++num_started )
+		if( thrd_success != thrd_create( &threads[num_started], codec_decode_worker, &job ) )
+			break;
+	codec_decode_worker( &job );
+	for( unsigned int i = 0; i < num_started; ++i )
+		thrd_join( threads[i], NULL );
+	if( atomic_load( &job.failed ) ) {
+		char msg[MAX_LEN_MESSAGES];
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Compressed heightmap '%s' has a corrupt block", file->filename );
+		logbook_log( LOG_ERROR, msg );
+		free( job.out );
+		return NULL;
+	}
+	return job.out;
+}
+
+bool heightmap_codec_decode_block(
+		const mapped_file_t *const file, const unsigned int block_x, const unsigned int block_z,
+		uint16_t *out, const size_t out_stride ) {
+	const heightmap_codec_header_t *header = codec_get_header( file );
+	if( block_x >= header->blocks_per_side || block_z >= header->blocks_per_side )
+		return false;
+	const uint64_t *offsets = codec_get_offsets( file );
+	const size_t index = (size_t)block_z * header->blocks_per_side + block_x;
+	const unsigned int x = block_x * header->block_size, z = block_z * header->block_size;
+	const unsigned int w = header->extent - x < header->block_size ? header->extent - x : header->block_size;
+	const unsigned int h = header->extent - z < header->block_size ? header->extent - z : header->block_size;
+	return codec_decode_block( (const uint8_t *)file->data + offsets[index],
+			(size_t)( offsets[index+1] - offsets[index] ), w, h, out, out_stride );
+}
+
+inline bool heightmap_codec_is_codec_file( const char *filename ) {
+	const size_t len = strlen(filename);
+	const size_t ext_len = strlen(HEIGHTMAP_CODEC_EXTENSION);
+	return len > ext_len && 0 == strcmp( filename + len - ext_len, HEIGHTMAP_CODEC_EXTENSION );
+}
+
+// *** static stuff
+static inline bool bit_writer_put( bit_writer_t *writer, const uint32_t value, const unsigned int num_bits ) {
+	writer->bits = ( writer->bits << num_bits ) | value;
+	writer->num_bits += num_bits;
+	while( writer->num_bits >= 8 ) {
+		if( writer->size == writer->capacity ) {
+			const size_t capacity = writer->capacity ? writer->capacity * 2 : 1 << 16;
+			uint8_t *data = realloc( writer->data, capacity );
+			if( !data )
+				return false;
+			writer->data = data;
+			writer->capacity = capacity;
+		}
+		writer->num_bits -= 8;
+		writer->data[writer->size++] = (uint8_t)( writer->bits >> writer->num_bits );
+	}
+	return true;
+}
+
+static inline void bit_reader_refill( bit_reader_t *reader ) {
+	while( reader->num_bits <= 56 ) {
+		uint64_t byte = 0;
+		if( reader->position < reader->size )
+			byte = reader->data[reader->position];
+		else
+			reader->overrun = reader->overrun || reader->position > reader->size + 8;
+		++reader->position;
+		reader->bits |= byte << ( 56 - reader->num_bits );
+		reader->num_bits += 8;
+	}
+}
+
+static inline uint32_t bit_reader_get( bit_reader_t *reader, const unsigned int num_bits ) {
+	if( 0 == num_bits )
+		return 0;
+	const uint32_t value = (uint32_t)( reader->bits >> ( 64 - num_bits ) );
+	reader->bits <<= num_bits;
+	reader->num_bits -= num_bits;
+	return value;
+}
+
+// Median edge detector of LOCO-I. left, up, up left; border texels only have one neighbour.
+static inline int codec_predict( const uint16_t *p, const size_t stride, const unsigned int x, const unsigned int z ) {
+	if( 0 == z )
+		return 0 == x ? 0 : p[-1];
+	if( 0 == x )
+		return p[-(ptrdiff_t)stride];
+	const int a = p[-1], b = p[-(ptrdiff_t)stride], c = p[-(ptrdiff_t)stride - 1];
+	const int max_ab = a > b ? a : b, min_ab = a < b ? a : b;
+	return c >= max_ab ? min_ab : ( c <= min_ab ? max_ab : a + b - c );
+}
+
+static inline unsigned int codec_rice_parameter( const uint32_t sum, const uint32_t count ) {
+	unsigned int k = 0;
+	while( ( count << k ) < sum && k < 15 )
+		++k;
+	return k;
+}
+
+bool codec_encode_block(
+		const uint16_t *const values, const size_t stride, const unsigned int w, const unsigned int h,
+		bit_writer_t *writer ) {
+	uint32_t sum = 4, count = 1;
+	for( unsigned int z = 0; z < h; ++z )
+		for( unsigned int x = 0; x < w; ++x ) {
+			const uint16_t *p = values + (size_t)z * stride + x;
+			// Residual mod 2^16 as signed, zigzagged to 0..65535
+			const int16_t residual = (int16_t)(uint16_t)( *p - codec_predict( p, stride, x, z ) );
+			const uint32_t u = (uint16_t)( ( (uint32_t)(uint16_t)residual << 1 ) ^ ( residual < 0 ? 0xffffu : 0u ) );
+			const unsigned int k = codec_rice_parameter( sum, count );
+			const uint32_t q = u >> k;
+			bool ok;
+			if( q < CODEC_ESCAPE_QUOTIENT )
+				ok = bit_writer_put( writer, ( ( 1u << q ) - 1 ) << 1, q + 1 ) &&
+						bit_writer_put( writer, u & ( ( 1u << k ) - 1 ), k );
+			else
+				ok = bit_writer_put( writer, ( 1u << CODEC_ESCAPE_QUOTIENT ) - 1, CODEC_ESCAPE_QUOTIENT ) &&
+						bit_writer_put( writer, u, 16 );
+			if( !ok )
+				return false;
+			sum += u;
+			if( ++count == CODEC_RESET_COUNT ) {
+				sum >>= 1;
+				count >>= 1;
+			}
+		}
+	// Pad to a byte, blocks start byte aligned
+	return 0 == writer->num_bits % 8 || bit_writer_put( writer, 0, 8 - writer->num_bits % 8 );
+}
+
+bool codec_decode_block(
+		const uint8_t *const data, const size_t size, const unsigned int w, const unsigned int h,
+		uint16_t *out, const size_t stride ) {
+	bit_reader_t reader = { data, size, 0, 0, 0, false };
+	uint32_t sum = 4, count = 1;
+	for( unsigned int z = 0; z < h; ++z )
+		for( unsigned int x = 0; x < w; ++x ) {
+			bit_reader_refill( &reader );
+			uint16_t *p = out + (size_t)z * stride + x;
+			const unsigned int k = codec_rice_parameter( sum, count );
+			// Count leading ones of the unary quotient, escape after CODEC_ESCAPE_QUOTIENT
+			const uint32_t top = (uint32_t)( reader.bits >> 32 );
+			unsigned int q = ~top ? (unsigned int)__builtin_clz( ~top ) : 32;
+			uint32_t u;
+			if( q < CODEC_ESCAPE_QUOTIENT ) {
+				bit_reader_get( &reader, q + 1 );
+				u = ( q << k ) | bit_reader_get( &reader, k );
+			} else {
+				bit_reader_get( &reader, CODEC_ESCAPE_QUOTIENT );
+				u = bit_reader_get( &reader, 16 );
+			}
+			const int16_t residual = (int16_t)( ( u >> 1 ) ^ ( 0u - ( u & 1 ) ) );
+			*p = (uint16_t)( codec_predict( p, stride, x, z ) + residual );
+			sum += u;
+			if( ++count == CODEC_RESET_COUNT ) {
+				sum >>= 1;
+				count >>= 1;
+			}
+		}
+	return !reader.overrun && reader.position - reader.num_bits / 8 <= size;
+}
+
+// Takes blocks until all are decoded or one failed
+int codec_decode_worker( void *arg ) {
+	decode_job_t *job = arg;
+	const heightmap_codec_header_t *header = codec_get_header( job->file );
+	const unsigned int num_blocks = header->blocks_per_side * header->blocks_per_side;
+	for(;;) {
+		const unsigned int i = atomic_fetch_add( &job->next_block, 1 );
+		if( i >= num_blocks || atomic_load( &job->failed ) )
+			return 0;
+		const unsigned int bx = i % header->blocks_per_side, bz = i / header->blocks_per_side;
+		uint16_t *out = job->out + (size_t)bz * header->block_size * header->extent + (size_t)bx * header->block_size;
+		if( !heightmap_codec_decode_block( job->file, bx, bz, out, header->extent ) )
+			atomic_store( &job->failed, true );
+	}
+}
+
+const heightmap_codec_header_t *codec_get_header( const mapped_file_t *const file ) {
+	return (const heightmap_codec_header_t *)file->data;
+}
+
+const uint64_t *codec_get_offsets( const mapped_file_t *const file ) {
+	return (const uint64_t *)( (const uint8_t *)file->data + sizeof(heightmap_codec_header_t) );
+}
@@ -0,0 +1,50 @@
+/* Lossless compressed heightmap format. The heightmap is cut into square blocks that are coded
+ * independently, so they can be decoded in parallel or one at a time for random access.
+ * Within a block each texel is predicted from its left, upper and upper left neighbours
+ * (median edge detector), the zigzagged residuals are Rice coded with an adaptive parameter.
+ * Layout: header, num_blocks+1 block offsets from the start of the file, block payloads. */
+
+#pragma once
+
+#include "settings.h"
+#include "base/mapped_file.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define HEIGHTMAP_CODEC_EXTENSION ".c16"
+#define HEIGHTMAP_CODEC_MAGIC "OC16"
+#define HEIGHTMAP_CODEC_VERSION 1
+// Texels per side of a block. Larger blocks compress slightly better, smaller ones decode finer grained.
+#define HEIGHTMAP_CODEC_BLOCK_SIZE 64
+
+typedef struct heightmap_codec_header_t {
+	char magic[4];
+	uint32_t version;
+	uint32_t extent;
+	uint32_t block_size;
+	uint16_t min_height_value;
+	uint16_t max_height_value;
+	// Blocks per side
+	uint32_t blocks_per_side;
+} heightmap_codec_header_t;
+
+// Compresses row major texels and writes them. False on error, a partial file is removed.
+bool heightmap_codec_write(
+		const uint16_t *const height_values, const unsigned int extent,
+		const uint16_t min_height_value, const uint16_t max_height_value, const char *filename );
+
+// Checks header and block table of a mapped compressed file
+bool heightmap_codec_validate( const mapped_file_t *const file );
+
+/* Decodes all blocks on num_threads threads, the calling one included and at most NUMBER_OF_THREADS,
+ * into a row major extent^2 array allocated with malloc(). NULL on error. */
+uint16_t *heightmap_codec_decode( const mapped_file_t *const file, const unsigned int num_threads );
+
+// Decodes a single block into out, which is row major with stride out_stride texels
+bool heightmap_codec_decode_block(
+		const mapped_file_t *const file, const unsigned int block_x, const unsigned int block_z,
+		uint16_t *out, const size_t out_stride );
+
+// True if filename ends with HEIGHTMAP_CODEC_EXTENSION
+extern bool heightmap_codec_is_codec_file( const char *filename );
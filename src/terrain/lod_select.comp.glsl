@@ -0,0 +1,243 @@
+
+#version 450 core
+
+// One quadtree level of the lod selection, see gpu_selection.h. Mirrors node_lod_select() test for
+// test: a node that passed its parent's early outs either draws all quadrants, if it's not refined,
+// or passes sub nodes in range and frustum on to the next level and draws the other quadrants.
+
+#define WORKGROUP_SIZE 64
+#define MAX_LEVELS 16
+#define OUTSIDE 0u
+#define ALL_PLANES 63u
+
+layout( local_size_x = WORKGROUP_SIZE ) in;
+
+// The tile's quadtree, node_t as 3 words: x | z << 16, min | max height << 16, level | sub nodes << 8
+layout( std430, binding = 0 ) readonly buffer tree_buffer {
+	uint tree[];
+};
+// Nodes to visit per level, at the level's node offset: node index and frustum planes left to test
+layout( std430, binding = 1 ) buffer item_buffer {
+	uvec2 items[];
+};
+// Items per level and the indirect dispatch of each level, reset per tile. Overflows and nodes of all
+// tiles, reset per selection.
+layout( std430, binding = 2 ) buffer state_buffer {
+	uint item_counts[MAX_LEVELS];
+	uvec4 dispatches[MAX_LEVELS];
+	uint overflows;
+	uint node_count;
+};
+// Nodes per tile slot. The tiles run one after the other, so a slot's nodes follow those of the last.
+layout( std430, binding = 3 ) buffer slot_buffer {
+	uint slot_counts[];
+};
+// Same layouts as draw_list_command_t and draw_list_node_t
+struct command_t {
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+layout( std430, binding = 4 ) writeonly buffer command_buffer {
+	command_t commands[];
+};
+struct node_data_t {
+	vec4 offset;
+	vec4 scale;
+	vec4 morph_consts;
+};
+layout( std430, binding = 5 ) writeonly buffer node_buffer {
+	node_data_t nodes[];
+};
+
+// --- Per selection ---
+// Normal and distance, a point is inside if dot( normal, p ) + distance >= 0
+uniform vec4 u_planes[6];
+uniform vec3 u_camera_position;
+uniform float u_ranges_sq[MAX_LEVELS];
+// By lod level - 1
+uniform vec4 u_morph_consts[MAX_LEVELS];
+uniform uint u_num_levels;
+uniform uint u_stop_at_level;
+uniform uint u_leaf_node_size;
+uniform float u_height_scale;
+uniform uint u_quadrant_size;
+// Nodes of all tiles, 2 commands per node
+uniform uint u_node_capacity;
+// --- Per tile ---
+uniform vec2 u_tile_min;
+uniform uint u_level_offsets[MAX_LEVELS];
+uniform uint u_level_extents[MAX_LEVELS];
+uniform uint u_slot;
+// --- Per dispatch ---
+uniform uint u_level;
+
+struct box_t {
+	vec3 min;
+	vec3 max;
+};
+
+// Same operations and order as node_get_aabb()
+box_t node_box( uint node_index, out uint level, out uint sub_nodes ) {
+	const uint w0 = tree[node_index * 3u];
+	const uint w1 = tree[node_index * 3u + 1u];
+	const uint w2 = tree[node_index * 3u + 2u];
+	level = w2 & 0xffu;
+	sub_nodes = ( w2 >> 8 ) & 0xffu;
+	const uint x = ( w0 & 0xffffu ) * u_leaf_node_size;
+	const uint z = ( w0 >> 16 ) * u_leaf_node_size;
+	const uint size = u_leaf_node_size << ( u_num_levels - 1u - level );
+	precise box_t box;
+	box.min.x = u_tile_min.x + float( x );
+	box.min.y = float( w1 & 0xffffu ) * u_height_scale;
+	box.min.z = u_tile_min.y + float( z );
+	box.max.x = u_tile_min.x + float( x + size );
+	box.max.y = float( w1 >> 16 ) * u_height_scale;
+	box.max.z = u_tile_min.y + float( z + size );
+	return box;
+}
+
+// As aabbf_min_distance_from_point_sq()
+float min_distance_sq( box_t box ) {
+	const vec3 p = u_camera_position;
+	precise float dist = 0.0f;
+	precise float d;
+	if( p.x < box.min.x ) {
+		d = p.x - box.min.x;
+		dist += d * d;
+	} else if( p.x > box.max.x ) {
+		d = p.x - box.max.x;
+		dist += d * d;
+	}
+	if( p.y < box.min.y ) {
+		d = p.y - box.min.y;
+		dist += d * d;
+	} else if( p.y > box.max.y ) {
+		d = p.y - box.max.y;
+		dist += d * d;
+	}
+	if( p.z < box.min.z ) {
+		d = p.z - box.min.z;
+		dist += d * d;
+	} else if( p.z > box.max.z ) {
+		d = p.z - box.max.z;
+		dist += d * d;
+	}
+	return dist;
+}
+
+// As frustum_contains_box_masked(), OUTSIDE or the planes the box intersects
+bool contains_box( box_t box, uint plane_mask, out uint out_plane_mask ) {
+	out_plane_mask = 0u;
+	for( uint i = 0u; i < 6u; ++i ) {
+		if( 0u == ( plane_mask & ( 1u << i ) ) )
+			continue;
+		const vec3 n = u_planes[i].xyz;
+		const bvec3 positive = greaterThanEqual( n, vec3( 0.0f ) );
+		const vec3 p = mix( box.min, box.max, positive );
+		const vec3 q = mix( box.max, box.min, positive );
+		precise float dp = n.x * p.x + n.y * p.y + n.z * p.z + u_planes[i].w;
+		if( dp < 0.0f )
+			return false;
+		precise float dq = n.x * q.x + n.y * q.y + n.z * q.z + u_planes[i].w;
+		if( dq < 0.0f )
+			out_plane_mask |= 1u << i;
+	}
+	return true;
+}
+
+// As quadtree_morton_encode()
+uint morton_encode( uint x, uint z ) {
+	uvec2 code = uvec2( x, z );
+	code = ( code | ( code << 8 ) ) & 0x00ff00ffu;
+	code = ( code | ( code << 4 ) ) & 0x0f0f0f0fu;
+	code = ( code | ( code << 2 ) ) & 0x33333333u;
+	code = ( code | ( code << 1 ) ) & 0x55555555u;
+	return code.x | ( code.y << 1 );
+}
+
+// Node data and a command per run of quadrants, as draw_list_add_node()
+void emit_node( box_t box, uint level, bool drawn[4] ) {
+	const uint node_index = atomicAdd( node_count, 1u );
+	if( node_index >= u_node_capacity ) {
+		atomicAdd( overflows, 1u );
+		return;
+	}
+	atomicAdd( slot_counts[u_slot], 1u );
+	const uint lod_level = u_stop_at_level - level;
+	nodes[node_index].offset = vec4( box.min.x, ( box.min.y + box.max.y ) * 0.5f, box.min.z, 0.0f );
+	nodes[node_index].scale = vec4( box.max.x - box.min.x, 0.0f, box.max.z - box.min.z, float( lod_level ) );
+	nodes[node_index].morph_consts = u_morph_consts[lod_level - 1u];
+	// At most two runs, an unused command draws nothing
+	uint c = node_index * 2u;
+	for( uint q = 0u; q < 4u; ) {
+		if( !drawn[q] ) {
+			++q;
+			continue;
+		}
+		const uint first_quadrant = q;
+		while( q < 4u && drawn[q] )
+			++q;
+		commands[c].count = ( q - first_quadrant ) * u_quadrant_size;
+		commands[c].instance_count = 1u;
+		commands[c].first_index = first_quadrant * u_quadrant_size;
+		commands[c].base_vertex = 0;
+		commands[c].base_instance = node_index;
+		++c;
+	}
+	if( c == node_index * 2u + 1u )
+		commands[c] = command_t( 0u, 0u, 0u, 0, 0u );
+}
+
+void main() {
+	const uint id = gl_GlobalInvocationID.x;
+	uint node_index, plane_mask, level, sub_nodes;
+	box_t box;
+	if( 0u == u_level ) {
+		// Top level nodes are tested here, the others were tested as sub nodes of their parents
+		if( id >= u_level_extents[0] * u_level_extents[0] )
+			return;
+		node_index = u_level_offsets[0] + id;
+		box = node_box( node_index, level, sub_nodes );
+		if( min_distance_sq( box ) > u_ranges_sq[0] || !contains_box( box, ALL_PLANES, plane_mask ) )
+			return;
+	} else {
+		if( id >= item_counts[u_level] )
+			return;
+		const uvec2 item = items[u_level_offsets[u_level] + id];
+		node_index = item.x;
+		plane_mask = item.y;
+		box = node_box( node_index, level, sub_nodes );
+	}
+	// A quadrant is drawn by this node unless its sub node is outside the frustum or traversed
+	bool drawn[4] = bool[4]( true, true, true, true );
+	const uint sub_level = level + 1u;
+	if( sub_level < u_num_levels && level != u_stop_at_level && min_distance_sq( box ) <= u_ranges_sq[sub_level] ) {
+		const uint shift = u_num_levels - 1u - level;
+		const uint tree_x = ( tree[node_index * 3u] & 0xffffu ) >> shift;
+		const uint tree_z = ( tree[node_index * 3u] >> 16 ) >> shift;
+		// Siblings are adjacent in Morton order
+		const uint first_sub = u_level_offsets[sub_level] + morton_encode( tree_x * 2u, tree_z * 2u );
+		for( uint i = 0u; i < 4u; ++i ) {
+			if( 0u == ( sub_nodes & ( 1u << i ) ) )
+				continue;
+			uint sub_level_unused, sub_sub_nodes;
+			const box_t sub_box = node_box( first_sub + i, sub_level_unused, sub_sub_nodes );
+			uint sub_plane_mask = 0u;
+			if( 0u != plane_mask && !contains_box( sub_box, plane_mask, sub_plane_mask ) ) {
+				drawn[i] = false;
+				continue;
+			}
+			if( min_distance_sq( sub_box ) > u_ranges_sq[sub_level] )
+				continue;
+			drawn[i] = false;
+			const uint k = atomicAdd( item_counts[sub_level], 1u );
+			items[u_level_offsets[sub_level] + k] = uvec2( first_sub + i, sub_plane_mask );
+			atomicMax( dispatches[sub_level].x, k / WORKGROUP_SIZE + 1u );
+		}
+	}
+	if( drawn[0] || drawn[1] || drawn[2] || drawn[3] )
+		emit_node( box, level, drawn );
+}
@@ -6,16 +6,38 @@
 #include <tgmath.h>
 #include "omath/aabb.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static bool lod_selection_reserve( selected_node_t **nodes, unsigned int *capacity, const unsigned int count );
+static void lod_selection_report_overflow();
+static void lod_selection_build_buckets();
+
+// Lod levels run from 1 at the leaves to stop_at_level, see node_select_finish()
+#define LOD_SELECTION_LEVELS_PER_TILE ( NUMBER_OF_LOD_LEVELS + 1 )
 
 static struct {
 	bool sort_by_distance;
 	unsigned int stop_at_level;
-	unsigned int current_tile_index;
 	unsigned int selection_count;
-	selected_node_t selected_nodes[MAX_NUMBER_SELECTED_NODES];
+	unsigned int capacity;
+	selected_node_t *selected_nodes;
+	// The current selection dropped nodes
+	bool has_overflowed;
+	// Selection count at the last overflow report
+	unsigned int overflow_reported_at;
+	lod_selection_stats_t stats;
 	unsigned int max_selected_lod_level;
 	unsigned int min_selected_lod_level;
+	// Tile and level buckets. The selection is grouped by tile, then level, into the spare array, which
+	// then becomes the selection. Bucket b of the tiles first_tile..end_tile-1 starts at bucket_starts[b].
+	selected_node_t *spare_nodes;
+	unsigned int spare_capacity;
+	unsigned int bucket_first_tile;
+	unsigned int bucket_end_tile;
+	unsigned int bucket_starts[TERRAIN_MAX_TILES * LOD_SELECTION_LEVELS_PER_TILE + 1];
 	float visibility_ranges[NUMBER_OF_LOD_LEVELS];
+	float visibility_ranges_sq[NUMBER_OF_LOD_LEVELS];
 	float morph_start[NUMBER_OF_LOD_LEVELS];
 	float morph_end[NUMBER_OF_LOD_LEVELS];
 } lod_selection;
@@ -23,18 +45,30 @@ static struct {
 inline void lod_selection_create( bool sort_by_distance ) {
 	lod_selection.sort_by_distance = sort_by_distance;
 	lod_selection.stop_at_level = NUMBER_OF_LOD_LEVELS;
-	// @todo a million tiles should be out of the question ...
-	lod_selection.current_tile_index = 1000000;
 	lod_selection.selection_count = 0;
 	lod_selection.max_selected_lod_level = 0;
 	lod_selection.min_selected_lod_level = NUMBER_OF_LOD_LEVELS;
 	lod_selection_calculate_ranges();
 }
 
+void lod_selection_delete() {
+	free( lod_selection.selected_nodes );
+	lod_selection.selected_nodes = NULL;
+	lod_selection.capacity = 0;
+	lod_selection.selection_count = 0;
+	free( lod_selection.spare_nodes );
+	lod_selection.spare_nodes = NULL;
+	lod_selection.spare_capacity = 0;
+	lod_selection.bucket_first_tile = lod_selection.bucket_end_tile = 0;
+}
+
 inline void lod_selection_reset() {
 	lod_selection.selection_count = 0;
 	lod_selection.max_selected_lod_level = 0;
 	lod_selection.min_selected_lod_level = NUMBER_OF_LOD_LEVELS;
+	lod_selection.has_overflowed = false;
+	lod_selection.bucket_first_tile = lod_selection.bucket_end_tile = 0;
+	++lod_selection.stats.selections;
 }
 
 void lod_selection_calculate_ranges() {
@@ -50,6 +84,7 @@ void lod_selection_calculate_ranges() {
 	for( unsigned int i = 0; i < NUMBER_OF_LOD_LEVELS; ++i ) {
 		lod_selection.visibility_ranges[NUMBER_OF_LOD_LEVELS-i-1] = prev_pos + sect * current_detail_balance;
 		prev_pos = lod_selection.visibility_ranges[NUMBER_OF_LOD_LEVELS-i-1];
+		lod_selection.visibility_ranges_sq[NUMBER_OF_LOD_LEVELS-i-1] = prev_pos * prev_pos;
 		current_detail_balance *= LOD_LEVEL_DISTANCE_RATIO;
 	}
 	prev_pos = camera_get_near_plane();
@@ -87,12 +122,12 @@ inline float lod_selection_get_visibility_range( const unsigned int level ) {
 	return lod_selection.visibility_ranges[level];
 }
 
-inline unsigned int lod_selection_get_stop_at_level() {
-	return lod_selection.stop_at_level;
+inline const float *lod_selection_get_visibility_ranges_sq() {
+	return lod_selection.visibility_ranges_sq;
 }
 
-inline void lod_selection_set_tile_index( const unsigned int index ) {
-	lod_selection.current_tile_index = index;
+inline unsigned int lod_selection_get_stop_at_level() {
+	return lod_selection.stop_at_level;
 }
 
 void lod_selection_print() {
@@ -104,8 +139,8 @@ void lod_selection_print() {
 		selected_node_t *n = &lod_selection.selected_nodes[i];
 		snprintf( msg, MAX_LEN_MESSAGES-1,
 				"Node aabb ((%.2f/%.2f/%.2f)/(%.2f/%.2f/%.2f)), tile %d; lvl %d; distance %.2f",
-				n->node->aabb.min.x, n->node->aabb.min.y, n->node->aabb.min.z,
-				n->node->aabb.max.x, n->node->aabb.max.y, n->node->aabb.max.z,
+				n->aabb.min.x, n->aabb.min.y, n->aabb.min.z,
+				n->aabb.max.x, n->aabb.max.y, n->aabb.max.z,
 				n->tile_index, n->lod_level, n->min_distance_to_camera
 		);
 		logbook_log( LOG_INFO, msg );
@@ -118,32 +153,124 @@ static inline int lod_selection_compare_closer_first( const void *arg1, const vo
 	return a->min_distance_to_camera > b->min_distance_to_camera;
 }
 
-// @todo sort by tile index and distance
 inline void lod_selection_sort() {
-	if( !lod_selection.sort_by_distance )
-		return;
-	qsort( lod_selection.selected_nodes, lod_selection.selection_count,
-			sizeof( *lod_selection.selected_nodes ), lod_selection_compare_closer_first );
-}
-
-inline void lod_selection_add_node( node_t *node, unsigned int level, bool tl, bool tr, bool bl, bool br ) {
-	lod_selection.selected_nodes[lod_selection.selection_count].node = node;
-	lod_selection.selected_nodes[lod_selection.selection_count].tile_index = lod_selection.current_tile_index;
-	lod_selection.selected_nodes[lod_selection.selection_count].lod_level = level;
-	lod_selection.selected_nodes[lod_selection.selection_count].hasTL = tl;
-	lod_selection.selected_nodes[lod_selection.selection_count].hasTR = tr;
-	lod_selection.selected_nodes[lod_selection.selection_count].hasBL = bl;
-	lod_selection.selected_nodes[lod_selection.selection_count].hasBR = br;
-	//lod_selection.selected_nodes[lod_selection.selection_count].min_distance_to_camera =
-	lod_selection.min_selected_lod_level = lod_selection.min_selected_lod_level < level ?
-			lod_selection.min_selected_lod_level : level;
-	lod_selection.max_selected_lod_level = lod_selection.max_selected_lod_level > level ?
-			lod_selection.max_selected_lod_level : level;
-	// Set tile index, min distance and min/max levels for sorting
 	if( lod_selection.sort_by_distance )
-		lod_selection.selected_nodes[lod_selection.selection_count].min_distance_to_camera =
-				sqrt( aabbf_min_distance_from_point_sq( &node->aabb, camera_get_position() ) );
-	lod_selection.selection_count++;
+		qsort( lod_selection.selected_nodes, lod_selection.selection_count,
+				sizeof( *lod_selection.selected_nodes ), lod_selection_compare_closer_first );
+	lod_selection_build_buckets();
+}
+
+inline unsigned int lod_selection_get_bucket(
+		const unsigned int tile_index, const unsigned int lod_level, unsigned int *count ) {
+	if( tile_index < lod_selection.bucket_first_tile || tile_index >= lod_selection.bucket_end_tile ||
+			lod_level >= LOD_SELECTION_LEVELS_PER_TILE ) {
+		*count = 0;
+		return 0;
+	}
+	const unsigned int b = ( tile_index - lod_selection.bucket_first_tile ) * LOD_SELECTION_LEVELS_PER_TILE + lod_level;
+	*count = lod_selection.bucket_starts[b+1] - lod_selection.bucket_starts[b];
+	return lod_selection.bucket_starts[b];
+}
+
+inline unsigned int lod_selection_get_tile_nodes( const unsigned int tile_index, unsigned int *count ) {
+	if( tile_index < lod_selection.bucket_first_tile || tile_index >= lod_selection.bucket_end_tile ) {
+		*count = 0;
+		return 0;
+	}
+	const unsigned int b = ( tile_index - lod_selection.bucket_first_tile ) * LOD_SELECTION_LEVELS_PER_TILE;
+	*count = lod_selection.bucket_starts[b+LOD_SELECTION_LEVELS_PER_TILE] - lod_selection.bucket_starts[b];
+	return lod_selection.bucket_starts[b];
+}
+
+inline void lod_selection_buffer_reset( lod_selection_buffer_t *buffer ) {
+	buffer->count = 0;
+	buffer->has_overflowed = false;
+	buffer->max_selected_lod_level = 0;
+	buffer->min_selected_lod_level = NUMBER_OF_LOD_LEVELS;
+}
+
+inline void lod_selection_buffer_delete( lod_selection_buffer_t *buffer ) {
+	free( buffer->nodes );
+	buffer->nodes = NULL;
+	buffer->capacity = 0;
+	buffer->count = 0;
+}
+
+inline bool lod_selection_add_node( lod_selection_buffer_t *buffer,
+		const node_t *const node, const aabbf *const aabb, unsigned int level, bool tl, bool tr, bool bl, bool br ) {
+	if( buffer->has_overflowed )
+		return false;
+	if( buffer->count == buffer->capacity &&
+			!lod_selection_reserve( &buffer->nodes, &buffer->capacity, buffer->count + 1 ) ) {
+		buffer->has_overflowed = true;
+		return false;
+	}
+	selected_node_t *n = &buffer->nodes[buffer->count];
+	n->node = node;
+	n->aabb = *aabb;
+	n->tile_index = buffer->tile_index;
+	n->lod_level = level;
+	n->hasTL = tl;
+	n->hasTR = tr;
+	n->hasBL = bl;
+	n->hasBR = br;
+	buffer->min_selected_lod_level = buffer->min_selected_lod_level < level ?
+			buffer->min_selected_lod_level : level;
+	buffer->max_selected_lod_level = buffer->max_selected_lod_level > level ?
+			buffer->max_selected_lod_level : level;
+	// Set min distance for sorting
+	if( lod_selection.sort_by_distance )
+		n->min_distance_to_camera = sqrt( aabbf_min_distance_from_point_sq( aabb, camera_get_position() ) );
+	buffer->count++;
+	return true;
+}
+
+void lod_selection_append( const lod_selection_buffer_t *const buffer ) {
+	// Nothing goes after a dropped node, the selection must stay the first nodes in order
+	if( lod_selection.has_overflowed )
+		return;
+	unsigned int count = buffer->count;
+	if( !lod_selection_reserve( &lod_selection.selected_nodes, &lod_selection.capacity,
+			lod_selection.selection_count + count ) )
+		count = lod_selection.capacity - lod_selection.selection_count;
+	if( count < buffer->count || buffer->has_overflowed )
+		lod_selection_report_overflow();
+	if( 0 == count )
+		return;
+	memcpy( &lod_selection.selected_nodes[lod_selection.selection_count], buffer->nodes, count * sizeof(selected_node_t) );
+	lod_selection.selection_count += count;
+	if( lod_selection.selection_count > lod_selection.stats.high_water_mark ) {
+		lod_selection.stats.high_water_mark = lod_selection.selection_count;
+		lod_selection.stats.capacity = lod_selection.capacity;
+	}
+	unsigned int min_level = buffer->min_selected_lod_level;
+	unsigned int max_level = buffer->max_selected_lod_level;
+	// Only the levels of the nodes that made it
+	if( count < buffer->count ) {
+		min_level = NUMBER_OF_LOD_LEVELS;
+		max_level = 0;
+		for( unsigned int i = 0; i < count; ++i ) {
+			min_level = min_level < buffer->nodes[i].lod_level ? min_level : buffer->nodes[i].lod_level;
+			max_level = max_level > buffer->nodes[i].lod_level ? max_level : buffer->nodes[i].lod_level;
+		}
+	}
+	lod_selection.min_selected_lod_level = lod_selection.min_selected_lod_level < min_level ?
+			lod_selection.min_selected_lod_level : min_level;
+	lod_selection.max_selected_lod_level = lod_selection.max_selected_lod_level > max_level ?
+			lod_selection.max_selected_lod_level : max_level;
+}
+
+inline const lod_selection_stats_t *lod_selection_get_stats() {
+	return &lod_selection.stats;
+}
+
+void lod_selection_log_stats() {
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1,
+			"Lod selection: %d selections, at most %d nodes (capacity %d), %d overflowed",
+			lod_selection.stats.selections, lod_selection.stats.high_water_mark,
+			lod_selection.stats.capacity, lod_selection.stats.overflows );
+	logbook_log( LOG_INFO, msg );
 }
 
 inline vec4f lod_selection_get_morph_consts( const unsigned int lod_level ) {
@@ -155,3 +282,82 @@ inline vec4f lod_selection_get_morph_consts( const unsigned int lod_level ) {
 	vec4f v = { start, 1.0f / d, end / d, 1.0f / d };
 	return v;
 }
+
+// *** static stuff
+/* Grows an array of selected nodes geometrically to hold at least count nodes, up to
+ * MAX_NUMBER_SELECTED_NODES. False if it can't hold them, it keeps its size then. */
+bool lod_selection_reserve( selected_node_t **nodes, unsigned int *capacity, const unsigned int count ) {
+	if( count <= *capacity )
+		return true;
+	if( *capacity >= MAX_NUMBER_SELECTED_NODES )
+		return false;
+	unsigned int new_capacity = *capacity > 0 ? *capacity : LOD_SELECTION_INITIAL_CAPACITY;
+	while( new_capacity < count && new_capacity < MAX_NUMBER_SELECTED_NODES )
+		new_capacity *= 2;
+	new_capacity = new_capacity < MAX_NUMBER_SELECTED_NODES ? new_capacity : MAX_NUMBER_SELECTED_NODES;
+	selected_node_t *new_nodes = realloc( *nodes, new_capacity * sizeof(selected_node_t) );
+	if( !new_nodes )
+		return false;
+	*nodes = new_nodes;
+	*capacity = new_capacity;
+	return count <= new_capacity;
+}
+
+// Logs the first overflow, and again after LOD_SELECTION_OVERFLOW_REPORT_INTERVAL selections while they go on
+void lod_selection_report_overflow() {
+	lod_selection.has_overflowed = true;
+	++lod_selection.stats.overflows;
+	if( lod_selection.stats.overflows > 1 &&
+			lod_selection.stats.selections - lod_selection.overflow_reported_at < LOD_SELECTION_OVERFLOW_REPORT_INTERVAL )
+		return;
+	lod_selection.overflow_reported_at = lod_selection.stats.selections;
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1,
+			"Lod selection exceeded %d nodes in %d of %d selections. Some nodes will not be drawn",
+			MAX_NUMBER_SELECTED_NODES, lod_selection.stats.overflows, lod_selection.stats.selections );
+	logbook_log( LOG_WARNING, msg );
+}
+
+/* Counting sort of the selection by tile, then lod level. It's stable, so a distance sort holds
+ * within the buckets. Only the buckets of the tiles from the lowest to the highest selected one are
+ * counted. Without memory for the sorted copy there are no buckets, and nothing is drawn. */
+void lod_selection_build_buckets() {
+	lod_selection.bucket_first_tile = lod_selection.bucket_end_tile = 0;
+	const unsigned int count = lod_selection.selection_count;
+	if( 0 == count )
+		return;
+	if( !lod_selection_reserve( &lod_selection.spare_nodes, &lod_selection.spare_capacity, count ) ) {
+		logbook_log( LOG_ERROR, "Lod selection not grouped by tile and level, out of memory" );
+		return;
+	}
+	const selected_node_t *nodes = lod_selection.selected_nodes;
+	unsigned int first_tile = nodes[0].tile_index;
+	unsigned int last_tile = nodes[0].tile_index;
+	for( unsigned int i = 1; i < count; ++i ) {
+		first_tile = nodes[i].tile_index < first_tile ? nodes[i].tile_index : first_tile;
+		last_tile = nodes[i].tile_index > last_tile ? nodes[i].tile_index : last_tile;
+	}
+	unsigned int *starts = lod_selection.bucket_starts;
+	const unsigned int num_buckets = ( last_tile - first_tile + 1 ) * LOD_SELECTION_LEVELS_PER_TILE;
+	memset( starts, 0, ( num_buckets + 1 ) * sizeof(*starts) );
+	// Count into the next bucket's slot, so the prefix sum gives each bucket's start
+	for( unsigned int i = 0; i < count; ++i )
+		++starts[( nodes[i].tile_index - first_tile ) * LOD_SELECTION_LEVELS_PER_TILE + nodes[i].lod_level + 1];
+	for( unsigned int b = 0; b < num_buckets; ++b )
+		starts[b+1] += starts[b];
+	// Scattering moves each start to the bucket's end, which is the next bucket's start
+	for( unsigned int i = 0; i < count; ++i ) {
+		const unsigned int b = ( nodes[i].tile_index - first_tile ) * LOD_SELECTION_LEVELS_PER_TILE + nodes[i].lod_level;
+		lod_selection.spare_nodes[starts[b]++] = nodes[i];
+	}
+	memmove( &starts[1], &starts[0], num_buckets * sizeof(*starts) );
+	starts[0] = 0;
+	selected_node_t *sorted_nodes = lod_selection.spare_nodes;
+	const unsigned int sorted_capacity = lod_selection.spare_capacity;
+	lod_selection.spare_nodes = lod_selection.selected_nodes;
+	lod_selection.spare_capacity = lod_selection.capacity;
+	lod_selection.selected_nodes = sorted_nodes;
+	lod_selection.capacity = sorted_capacity;
+	lod_selection.bucket_first_tile = first_tile;
+	lod_selection.bucket_end_tile = last_tile + 1;
+}
@@ -9,7 +9,9 @@
 #include <stdbool.h>
 
 typedef struct selected_node_t {
-	node_t *node;
+	const node_t *node;
+	// World space box of the node, see node_get_aabb()
+	aabbf aabb;
 	unsigned int lod_level;
 	bool hasTL;
 	bool hasTR;
@@ -21,9 +23,54 @@ typedef struct selected_node_t {
 	float min_distance_to_camera;
 } selected_node_t;
 
+/* Nodes selected by one thread. The selection of the frame is made of buffers appended in the order
+ * of the tiles and their top level nodes, so it doesn't depend on how the work was split.
+ * The nodes are held in memory that grows with the buffer and is reused by the next frames, so
+ * there are no allocations once the largest selection has been seen. Zero initialized is empty. */
+struct lod_selection_buffer_t {
+	// Tile of the nodes added next
+	unsigned int tile_index;
+	unsigned int count;
+	unsigned int capacity;
+	// A node didn't fit, because of MAX_NUMBER_SELECTED_NODES or a failed allocation
+	bool has_overflowed;
+	unsigned int max_selected_lod_level;
+	unsigned int min_selected_lod_level;
+	selected_node_t *nodes;
+};
+
+typedef struct lod_selection_stats_t {
+	unsigned int selections;
+	// Largest selection so far, and the capacity it took
+	unsigned int high_water_mark;
+	unsigned int capacity;
+	// Selections that had to drop nodes
+	unsigned int overflows;
+} lod_selection_stats_t;
+
 extern void lod_selection_create( bool sort_by_distance );
 
-extern void lod_selection_add_node( node_t *node, unsigned int level, bool tl, bool tr, bool bl, bool br );
+// Frees the selection, the ranges stay
+void lod_selection_delete();
+
+extern void lod_selection_buffer_reset( lod_selection_buffer_t *buffer );
+
+extern void lod_selection_buffer_delete( lod_selection_buffer_t *buffer );
+
+/* Grows the buffer if needed. False if the node doesn't fit, the buffer takes no more nodes then.
+ * Thread safe for different buffers. */
+extern bool lod_selection_add_node( lod_selection_buffer_t *buffer,
+		const node_t *const node, const aabbf *const aabb, unsigned int level, bool tl, bool tr, bool bl, bool br );
+
+/* Appends the nodes of a buffer to the selection. Nodes only get lost when the buffer or the selection
+ * is full, which leaves the first nodes in selection order. So appending the buffers in order gives
+ * the same selection as a single buffer would. An overflow is logged once, see
+ * LOD_SELECTION_OVERFLOW_REPORT_INTERVAL. */
+void lod_selection_append( const lod_selection_buffer_t *const buffer );
+
+extern const lod_selection_stats_t *lod_selection_get_stats();
+
+void lod_selection_log_stats();
 
 // Called when camera near or far plane changed to recalc visibility and morph ranges.
 void lod_selection_calculate_ranges();
@@ -38,14 +85,26 @@ extern unsigned int lod_selection_get_min_level();
 
 extern float lod_selection_get_visibility_range( const unsigned int level );
 
+// Squared visibility ranges of all levels, for the selection kernel. Ranges shrink with the level.
+extern const float *lod_selection_get_visibility_ranges_sq();
+
 extern vec4f lod_selection_get_morph_consts( const unsigned int lod_level );
 
 extern unsigned int lod_selection_get_stop_at_level();
 
+/* Sorts by distance if asked for at creation, then groups the selection by tile and lod level.
+ * Call once the selection is complete, the buckets are gone with the next reset. */
 extern void lod_selection_sort();
 
+/* Nodes of a tile at a lod level, a run of the selection from the returned index on. count gets the
+ * number of nodes, 0 for tiles and levels that weren't selected. */
+extern unsigned int lod_selection_get_bucket(
+		const unsigned int tile_index, const unsigned int lod_level, unsigned int *count );
+
+// All nodes of a tile, the buckets of its levels in a row
+extern unsigned int lod_selection_get_tile_nodes( const unsigned int tile_index, unsigned int *count );
+
+// Starts a new selection
 extern void lod_selection_reset();
 
 void lod_selection_print();
-
-extern void lod_selection_set_tile_index( const unsigned int index );
@@ -0,0 +1,218 @@
+#include "minmax_pyramid.h"
+#include "height_kernels.h"
+#include "base/logbook.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static minmax_pyramid_t *minmax_pyramid_allocate( const unsigned int extent );
+static inline unsigned int minmax_pyramid_log2( unsigned int val );
+static inline const minmax_t *minmax_pyramid_get_cell(
+		const minmax_pyramid_t *const pyramid, const unsigned int level, const unsigned int x, const unsigned int z );
+
+minmax_pyramid_t *minmax_pyramid_create(
+		const uint16_t *const height_values, const unsigned int extent, minmax_pyramid_t *pyramid ) {
+	if( pyramid ) {
+		logbook_log( LOG_WARNING, "Non-null pointer passed to minmax_pyramid_create" );
+		return pyramid;
+	}
+	pyramid = minmax_pyramid_allocate( extent );
+	if( !pyramid )
+		return NULL;
+	// Level 0, one cell row at a time. The texel rows of a cell row, including the first row of
+	// the next one, are reduced element wise into a column min/max row, which is then reduced per
+	// cell including the first column of the next cell. Cells include the first texel of their neighbours.
+	const unsigned int base = MINMAX_PYRAMID_BASE_SIZE;
+	const unsigned int cells = pyramid->level_extents[0];
+	uint16_t *column_min = malloc(extent * sizeof(uint16_t));
+	uint16_t *column_max = malloc(extent * sizeof(uint16_t));
+	if( !column_min || !column_max ) {
+		logbook_log( LOG_ERROR, "Error allocating min/max pyramid scan rows" );
+		free(column_min);
+		free(column_max);
+		return minmax_pyramid_delete( pyramid );
+	}
+	for( unsigned int j = 0; j < cells; ++j ) {
+		for( unsigned int x = 0; x < extent; ++x ) {
+			column_min[x] = UINT16_MAX;
+			column_max[x] = 0;
+		}
+		const unsigned int z_end = j * base + base < extent - 1 ? j * base + base : extent - 1;
+		for( unsigned int z = j * base; z <= z_end; ++z )
+			height_kernels_accumulate_min_max( &height_values[(size_t)z * extent], extent, column_min, column_max );
+		minmax_t *cell_row = &pyramid->cells[(size_t)j * cells];
+		for( unsigned int i = 0; i < cells; ++i ) {
+			const unsigned int x_end = i * base + base < extent - 1 ? i * base + base : extent - 1;
+			uint16_t cell_min = UINT16_MAX;
+			uint16_t cell_max = 0;
+			for( unsigned int x = i * base; x <= x_end; ++x ) {
+				cell_min = column_min[x] < cell_min ? column_min[x] : cell_min;
+				cell_max = column_max[x] > cell_max ? column_max[x] : cell_max;
+			}
+			cell_row[i].min = cell_min;
+			cell_row[i].max = cell_max;
+		}
+	}
+	free(column_min);
+	free(column_max);
+	// Higher levels from the up to four cells below
+	for( unsigned int l = 1; l < pyramid->num_levels; ++l ) {
+		const unsigned int child_extent = pyramid->level_extents[l-1];
+		const minmax_t *children = &pyramid->cells[pyramid->level_offsets[l-1]];
+		minmax_t *parents = &pyramid->cells[pyramid->level_offsets[l]];
+		for( unsigned int z = 0; z < pyramid->level_extents[l]; ++z )
+			for( unsigned int x = 0; x < pyramid->level_extents[l]; ++x ) {
+				minmax_t p = { UINT16_MAX, 0 };
+				for( unsigned int cz = 2*z; cz < 2*z+2 && cz < child_extent; ++cz )
+					for( unsigned int cx = 2*x; cx < 2*x+2 && cx < child_extent; ++cx ) {
+						const minmax_t *c = &children[(size_t)cz * child_extent + cx];
+						p.min = c->min < p.min ? c->min : p.min;
+						p.max = c->max > p.max ? c->max : p.max;
+					}
+				parents[(size_t)z * pyramid->level_extents[l] + x] = p;
+			}
+	}
+	return pyramid;
+}
+
+minmax_pyramid_t *minmax_pyramid_create_from_cells(
+		const minmax_t *const cells, const size_t num_cells, const unsigned int extent, minmax_pyramid_t *pyramid ) {
+	if( pyramid ) {
+		logbook_log( LOG_WARNING, "Non-null pointer passed to minmax_pyramid_create_from_cells" );
+		return pyramid;
+	}
+	pyramid = minmax_pyramid_allocate( extent );
+	if( !pyramid )
+		return NULL;
+	if( pyramid->num_cells != num_cells ) {
+		char msg[MAX_LEN_MESSAGES];
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Min/max pyramid cell count %lu does not match extent %d",
+				(unsigned long)num_cells, extent );
+		logbook_log( LOG_ERROR, msg );
+		return minmax_pyramid_delete( pyramid );
+	}
+	memcpy( pyramid->cells, cells, num_cells * sizeof(minmax_t) );
+	return pyramid;
+}
+
+inline minmax_pyramid_t *minmax_pyramid_delete( minmax_pyramid_t *pyramid ) {
+	if( pyramid ) {
+		free( pyramid->cells );
+		free( pyramid );
+		pyramid = NULL;
+	}
+	return pyramid;
+}
+
+void minmax_pyramid_drop_levels( minmax_pyramid_t *pyramid, const unsigned int cell_size ) {
+	const unsigned int base_shift = minmax_pyramid_log2( MINMAX_PYRAMID_BASE_SIZE );
+	const unsigned int shift = minmax_pyramid_log2( cell_size );
+	unsigned int first_level = shift > base_shift ? shift - base_shift : 0;
+	// Keep the top cell at least
+	if( first_level >= pyramid->num_levels )
+		first_level = pyramid->num_levels - 1;
+	if( first_level <= pyramid->first_level )
+		return;
+	const size_t dropped = pyramid->level_offsets[first_level] - pyramid->level_offsets[pyramid->first_level];
+	memmove( pyramid->cells, pyramid->cells + dropped, ( pyramid->num_cells - dropped ) * sizeof(minmax_t) );
+	pyramid->num_cells -= dropped;
+	for( unsigned int l = first_level; l < pyramid->num_levels; ++l )
+		pyramid->level_offsets[l] -= dropped;
+	pyramid->first_level = first_level;
+	// Shrinking never fails for real, keep the old block if it does
+	minmax_t *cells = realloc( pyramid->cells, pyramid->num_cells * sizeof(minmax_t) );
+	if( cells )
+		pyramid->cells = cells;
+}
+
+inline void minmax_pyramid_get_node(
+		const minmax_pyramid_t *const pyramid, const unsigned int x, const unsigned int z,
+		const unsigned int size, uint16_t *min, uint16_t *max ) {
+	const unsigned int shift = minmax_pyramid_log2( size );
+	unsigned int level = shift - minmax_pyramid_log2( MINMAX_PYRAMID_BASE_SIZE );
+	// A node larger than the heightmap is covered by the single top cell
+	if( level >= pyramid->num_levels )
+		level = pyramid->num_levels - 1;
+	// A node smaller than the cells held lies in one of them, nodes don't straddle cells
+	if( level < pyramid->first_level )
+		level = pyramid->first_level;
+	const unsigned int cell_shift = minmax_pyramid_log2( MINMAX_PYRAMID_BASE_SIZE ) + level;
+	const minmax_t *cell = minmax_pyramid_get_cell( pyramid, level, x >> cell_shift, z >> cell_shift );
+	*min = cell->min;
+	*max = cell->max;
+}
+
+void minmax_pyramid_get_area(
+		const minmax_pyramid_t *const pyramid, const unsigned int x, const unsigned int z,
+		const unsigned int w, const unsigned int h, uint16_t *min, uint16_t *max ) {
+	*min = UINT16_MAX;
+	*max = 0;
+	if( 0 == w || 0 == h )
+		return;
+	// Coarsest level whose cells are not larger than the shorter side of the area
+	const unsigned int shorter = w < h ? w : h;
+	unsigned int level = pyramid->first_level;
+	while( level + 1 < pyramid->num_levels && ( (unsigned int)MINMAX_PYRAMID_BASE_SIZE << (level+1) ) <= shorter )
+		++level;
+	const unsigned int shift = minmax_pyramid_log2( MINMAX_PYRAMID_BASE_SIZE ) + level;
+	const unsigned int last = pyramid->level_extents[level] - 1;
+	const unsigned int x_end = ( x + w - 1 ) >> shift < last ? ( x + w - 1 ) >> shift : last;
+	const unsigned int z_end = ( z + h - 1 ) >> shift < last ? ( z + h - 1 ) >> shift : last;
+	for( unsigned int cz = z >> shift; cz <= z_end; ++cz )
+		for( unsigned int cx = x >> shift; cx <= x_end; ++cx ) {
+			const minmax_t *cell = minmax_pyramid_get_cell( pyramid, level, cx, cz );
+			*min = cell->min < *min ? cell->min : *min;
+			*max = cell->max > *max ? cell->max : *max;
+		}
+}
+
+inline minmax_t minmax_pyramid_get_total( const minmax_pyramid_t *const pyramid ) {
+	return pyramid->cells[pyramid->num_cells-1];
+}
+
+// *** static stuff
+// Calculates the level layout and allocates the cells, which are not initialized
+minmax_pyramid_t *minmax_pyramid_allocate( const unsigned int extent ) {
+	if( extent < 2 ) {
+		logbook_log( LOG_ERROR, "Min/max pyramid needs a heightmap extent of at least 2" );
+		return NULL;
+	}
+	minmax_pyramid_t *pyramid = malloc(sizeof(minmax_pyramid_t));
+	if( !pyramid ) {
+		logbook_log( LOG_ERROR, "Error allocating min/max pyramid" );
+		return NULL;
+	}
+	pyramid->extent = extent;
+	pyramid->num_levels = 0;
+	pyramid->first_level = 0;
+	pyramid->num_cells = 0;
+	unsigned int cells = ( extent + MINMAX_PYRAMID_BASE_SIZE - 1 ) / MINMAX_PYRAMID_BASE_SIZE;
+	while( pyramid->num_levels < MINMAX_PYRAMID_MAX_LEVELS ) {
+		pyramid->level_extents[pyramid->num_levels] = cells;
+		pyramid->level_offsets[pyramid->num_levels] = pyramid->num_cells;
+		pyramid->num_cells += (size_t)cells * cells;
+		++pyramid->num_levels;
+		if( 1 == cells )
+			break;
+		cells = ( cells + 1 ) / 2;
+	}
+	pyramid->cells = malloc(pyramid->num_cells * sizeof(minmax_t));
+	if( !pyramid->cells ) {
+		logbook_log( LOG_ERROR, "Error allocating min/max pyramid cells" );
+		free(pyramid);
+		return NULL;
+	}
+	return pyramid;
+}
+
+static inline unsigned int minmax_pyramid_log2( unsigned int val ) {
+	unsigned int l = 0;
+	while( val >>= 1 )
+		++l;
+	return l;
+}
+
+static inline const minmax_t *minmax_pyramid_get_cell(
+		const minmax_pyramid_t *const pyramid, const unsigned int level, const unsigned int x, const unsigned int z ) {
+	return &pyramid->cells[pyramid->level_offsets[level] + (size_t)z * pyramid->level_extents[level] + x];
+}
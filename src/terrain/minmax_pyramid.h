@@ -0,0 +1,62 @@
+/* Hierarchical min/max height pyramid of a heightmap, built bottom up once per tile.
+ * A cell at level l covers (MINMAX_PYRAMID_BASE_SIZE << l) texels per side plus the first texel
+ * row and column of its right and lower neighbours, just like a quadtree node of that size.
+ * So the min/max of a node is a single lookup, and arbitrary areas are answered from a few
+ * cells instead of rescanning the heightmap. */
+
+#pragma once
+
+#include "settings.h"
+#include <inttypes.h>
+#include <stddef.h>
+
+// Enough for an extent of MINMAX_PYRAMID_BASE_SIZE << 31
+#define MINMAX_PYRAMID_MAX_LEVELS 32
+
+typedef struct minmax_t {
+	uint16_t min;
+	uint16_t max;
+} minmax_t;
+
+typedef struct minmax_pyramid_t {
+	// Extent of the heightmap in texels
+	unsigned int extent;
+	unsigned int num_levels;
+	// Finest level still held, see minmax_pyramid_drop_levels(). Queries below it are answered from it.
+	unsigned int first_level;
+	// cells per side and first cell per level. Level 0 is the finest, the last level is a single cell.
+	unsigned int level_extents[MINMAX_PYRAMID_MAX_LEVELS];
+	size_t level_offsets[MINMAX_PYRAMID_MAX_LEVELS];
+	size_t num_cells;
+	minmax_t *cells;
+} minmax_pyramid_t;
+
+// Scans the row major height values once
+minmax_pyramid_t *minmax_pyramid_create(
+		const uint16_t *const height_values, const unsigned int extent, minmax_pyramid_t *pyramid );
+
+// Restores a pyramid from cells saved in level order. Returns NULL if num_cells doesn't fit the extent.
+minmax_pyramid_t *minmax_pyramid_create_from_cells(
+		const minmax_t *const cells, const size_t num_cells, const unsigned int extent, minmax_pyramid_t *pyramid );
+
+extern minmax_pyramid_t *minmax_pyramid_delete( minmax_pyramid_t *pyramid );
+
+/* Frees the levels with cells smaller than cell_size texels, cell_size a power of 2. Node and area
+ * queries stay conservative but get coarser. The pyramid can't be saved to a bundle any more. */
+void minmax_pyramid_drop_levels( minmax_pyramid_t *pyramid, const unsigned int cell_size );
+
+/* Exact min/max of the square area of a node: texels x..x+size and z..z+size, clamped to the extent.
+ * x and z must be multiples of size, size a power of 2 and >= MINMAX_PYRAMID_BASE_SIZE.
+ * Conservative if the node is smaller than the cells of the first level held. */
+extern void minmax_pyramid_get_node(
+		const minmax_pyramid_t *const pyramid, const unsigned int x, const unsigned int z,
+		const unsigned int size, uint16_t *min, uint16_t *max );
+
+/* Min/max of the texels x..x+w-1 and z..z+h-1. The result is conservative: it encloses the
+ * true range but may be wider because whole cells are evaluated. */
+void minmax_pyramid_get_area(
+		const minmax_pyramid_t *const pyramid, const unsigned int x, const unsigned int z,
+		const unsigned int w, const unsigned int h, uint16_t *min, uint16_t *max );
+
+// Min/max of the whole heightmap
+extern minmax_t minmax_pyramid_get_total( const minmax_pyramid_t *const pyramid );
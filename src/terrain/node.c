@@ -2,119 +2,242 @@
 #include "heightmap.h"
 #include "terrain_tile.h"
 #include "base/camera.h"
-#include "base/logbook.h"
 #include "lod_selection.h"
 #include "node.h"
+#include "quadtree.h"
+#include <math.h>
+
+// Positions are stored in units of leaf nodes
+_Static_assert( TERRAIN_TILE_MAX_EXTENT / LEAF_NODE_SIZE <= UINT16_MAX + 1u, "Node positions don't fit 16 bits" );
+_Static_assert( sizeof(node_t) == 12, "Unexpected node size" );
+
+// A node on the selection stack and the early out results of its sub nodes
+typedef struct {
+	const node_t *node;
+	aabbf aabb;
+	// Frustum planes the box intersects, none if it is inside
+	unsigned int plane_mask;
+	// The box is completely inside the visibility ranges of the levels below inside_levels
+	unsigned int inside_levels;
+	unsigned int next_sub;
+	/* TL, TR, BL, BR. UNDEFINED if there is no sub node or it wasn't tested, INSIDE or INTERSECTS
+	 * (the frustum) if it is still to be traversed, else the outcome. */
+	intersect_t sub_results[4];
+	// Siblings are adjacent in Morton order, sub node i is first_sub_node + i
+	const node_t *first_sub_node;
+	aabbf sub_aabbs[4];
+	unsigned int sub_plane_masks[4];
+} select_frame_t;
+
+static void node_select_sub_nodes(
+		select_frame_t *frame, const quadtree_t *const quadtree, const unsigned int stop_at_level,
+		const view_frustum_t *const frustum, const vec3f *const camera_position, const float *const ranges_sq,
+		unsigned int *last_plane, float *margin );
+static intersect_t node_select_finish(
+		const select_frame_t *const frame, const unsigned int stop_at_level, lod_selection_buffer_t *buffer );
+static intersect_t node_contains_box(
+		const aabbf *const box, const view_frustum_t *const frustum, const unsigned int plane_mask,
+		unsigned int *out_plane_mask, unsigned int *last_plane, float *margin );
+static void node_lower_margin( const float distance_sq, const unsigned int level, float *margin );
 
 void node_create(
-		const unsigned int x, const unsigned int z, const unsigned short size, const unsigned short level,
-		const terrain_tile_t *const tile, node_t *all_nodes, unsigned  int *last_index, node_t *node ) {
-	node->x = x;
-	node->z = z;
-	node->level = level;
-	node->size = size;
-	node->subBL = NULL;
-	node->subTL = NULL;
-	node->subBR = NULL;
-	node->subTR = NULL;
+		const unsigned int x, const unsigned int z, const unsigned int level,
+		const terrain_tile_t *const tile, node_t *node ) {
+	node->x = (uint16_t)( x / LEAF_NODE_SIZE );
+	node->z = (uint16_t)( z / LEAF_NODE_SIZE );
+	node->level = (uint8_t)level;
+	node->sub_nodes = 0;
+	node->padding = 0;
 	const heightmap_t *heightmap = tile->heightmap;
-	// Find min/max heights at this patch of terrain
-	const unsigned int limit_x = heightmap->extent <= x+size+1 ? heightmap->extent : x+size+1;
-	// z = y-axis of heightmap
-	const unsigned int limit_z = heightmap->extent <= z+size+1 ? heightmap->extent : z+size+1;
-	heightmap_get_min_max_height_area(
-			x, z, limit_x-x, limit_z-z, &node->min_height, &node->max_height, tile->heightmap
-	);
-	// Get bounding box in world coords @todo: the box is relative to heightmap for now
-	// also @todo: real height values
-	node->aabb.min.x = tile->aabb.min.x+(float)x;
-	node->aabb.min.y = (float)node->min_height / 65535.0f * HEIGHT_FACTOR;
-	node->aabb.min.z = tile->aabb.min.z+(float)z;
-	node->aabb.max.x = tile->aabb.min.x+(float)(x+size);
-	node->aabb.max.y = (float)node->max_height / 65535.0f * HEIGHT_FACTOR;
-	node->aabb.max.z = tile->aabb.min.z+(float)(z+size);
+	const unsigned int size = node_get_size( node );
+	// Find min/max heights at this patch of terrain, texels x..x+size and z..z+size (z = y-axis of heightmap)
+	minmax_pyramid_get_node( heightmap->pyramid, x, z, size, &node->min_height, &node->max_height );
 	// Highest level reached already ?
-	if( size == LEAF_NODE_SIZE ) {
-		if( level != NUMBER_OF_LOD_LEVELS-1 ) {
-			logbook_log( LOG_ERROR, "Lowest lod level != number lod levels while creating nodes. Good luck rendering" );
-			return;
-		}
-		// Mark leaf node
-		node->is_leaf = true;
-	} else {
-		unsigned short sub_size = size/2;
-		node->subTL = &all_nodes[(*last_index)++];
-		node_create( x, z, sub_size, level+1, tile, all_nodes, last_index, node->subTL );
-		if( ( x+sub_size ) < heightmap->extent) {
-			node->subTR = &all_nodes[(*last_index)++];
-			node_create( x+sub_size, z, sub_size, level+1, tile, all_nodes, last_index, node->subTR );
-		}
-		if( (z+sub_size) < heightmap->extent ) {
-			node->subBL = &all_nodes[(*last_index)++];
-			node_create( x, z+sub_size, sub_size, level+1, tile, all_nodes, last_index, node->subBL );
-		}
-		if( ((x+sub_size) < heightmap->extent) && ((z+sub_size) < heightmap->extent) ) {
-			node->subBR = &all_nodes[(*last_index)++];
-			node_create( x+sub_size, z+sub_size, sub_size, level+1, tile, all_nodes, last_index, node->subBR );
+	if( node_is_leaf( node ) )
+		return;
+	const unsigned int sub_size = size/2;
+	const bool has_right = x + sub_size < heightmap->extent;
+	const bool has_lower = z + sub_size < heightmap->extent;
+	node->sub_nodes = NODE_SUB_TL | ( has_right ? NODE_SUB_TR : 0 ) | ( has_lower ? NODE_SUB_BL : 0 ) |
+			( has_right && has_lower ? NODE_SUB_BR : 0 );
+}
+
+void node_lod_select(
+		const node_t *const node, const quadtree_t *const quadtree, lod_selection_buffer_t *buffer, float *margin ) {
+	const view_frustum_t *frustum = camera_get_view_frustum();
+	const vec3f *camera_position = camera_get_position();
+	const float *ranges_sq = lod_selection_get_visibility_ranges_sq();
+	const unsigned int stop_at_level = lod_selection_get_stop_at_level();
+	// Post order traversal, one frame per level. The frame of a node is pushed once it passed the early outs.
+	select_frame_t stack[NUMBER_OF_LOD_LEVELS];
+	unsigned int top = 0;
+	stack[0].node = node;
+	node_get_aabb( node, quadtree->terrain_tile, &stack[0].aabb );
+	// Nobody asks why a top level node was dropped, so the cheaper range test goes first
+	const float distance_sq = aabbf_min_distance_from_point_sq( &stack[0].aabb, camera_position );
+	node_lower_margin( distance_sq, node->level, margin );
+	if( distance_sq > ranges_sq[node->level] )
+		return;
+	stack[0].inside_levels = 0;
+	// Plane that rejected the last box, the next one is likely rejected by the same
+	unsigned int last_plane = FRUSTUM_NEAR;
+	if( OUTSIDE == node_contains_box(
+			&stack[0].aabb, frustum, FRUSTUM_ALL_PLANES, &stack[0].plane_mask, &last_plane, margin ) )
+		return;
+	node_select_sub_nodes(
+			&stack[0], quadtree, stop_at_level, frustum, camera_position, ranges_sq, &last_plane, margin );
+	for(;;) {
+		select_frame_t *frame = &stack[top];
+		// Next sub node that passed the early outs
+		while( frame->next_sub < 4 && INSIDE != frame->sub_results[frame->next_sub] &&
+				INTERSECTS != frame->sub_results[frame->next_sub] )
+			++frame->next_sub;
+		if( frame->next_sub < 4 ) {
+			const unsigned int i = frame->next_sub++;
+			select_frame_t *sub_frame = &stack[++top];
+			sub_frame->node = frame->first_sub_node + i;
+			sub_frame->aabb = frame->sub_aabbs[i];
+			sub_frame->plane_mask = frame->sub_plane_masks[i];
+			sub_frame->inside_levels = frame->inside_levels;
+			node_select_sub_nodes(
+					sub_frame, quadtree, stop_at_level, frustum, camera_position, ranges_sq, &last_plane, margin );
+			continue;
 		}
+		const intersect_t result = node_select_finish( frame, stop_at_level, buffer );
+		if( 0 == top )
+			return;
+		--top;
+		stack[top].sub_results[stack[top].next_sub - 1] = result;
 	}
 }
 
-intersect_t node_lod_select( node_t *node, bool parent_completely_in_frustum ) {
-	// Test early outs
-	intersect_t frustum_intersection = parent_completely_in_frustum ?
-			INSIDE : frustum_contains_box( &node->aabb, camera_get_view_frustum() );
-	if( OUTSIDE == frustum_intersection )
-		return OUTSIDE;
-	float dist_limit = lod_selection_get_visibility_range(node->level);
-	if( !aabbf_intersect_sphere_sq( &node->aabb, camera_get_position(), dist_limit * dist_limit ) )
-		return OUT_OF_RANGE;
-	intersect_t sub_tl_res = UNDEFINED;
-	intersect_t sub_tr_res = UNDEFINED;
-	intersect_t sub_bl_res = UNDEFINED;
-	intersect_t sub_br_res = UNDEFINED;
-	// Stop at one below number of lod levels
-	if( node->level != lod_selection_get_stop_at_level() ) {
-		float next_dist_limit = lod_selection_get_visibility_range(node->level+1);
-		if( aabbf_intersect_sphere_sq( &node->aabb, camera_get_position(), next_dist_limit * next_dist_limit ) ) {
-			bool we_are_completely_in_frustum = frustum_intersection == INSIDE;
-			if( node->subTL != NULL )
-				sub_tl_res = node_lod_select( node->subTL, we_are_completely_in_frustum );
-			if( node->subTR != NULL )
-				sub_tr_res = node_lod_select( node->subTR, we_are_completely_in_frustum );
-			if( node->subBL != NULL )
-				sub_bl_res = node_lod_select( node->subBL, we_are_completely_in_frustum );
-			if( node->subBR != NULL )
-				sub_br_res = node_lod_select( node->subBR, we_are_completely_in_frustum );
-		}
+inline unsigned int node_get_size( const node_t *const node ) {
+	return (unsigned int)LEAF_NODE_SIZE << ( NUMBER_OF_LOD_LEVELS - 1 - node->level );
+}
+
+inline bool node_is_leaf( const node_t *const node ) {
+	return NUMBER_OF_LOD_LEVELS - 1 == node->level;
+}
+
+inline const node_t *node_get_sub_node( const node_t *const node, const quadtree_t *const quadtree, const unsigned int i ) {
+	if( !( node->sub_nodes & ( 1u << i ) ) )
+		return NULL;
+	// Cell of the node on its level, the sub node cells are twice that plus the quadrant
+	const unsigned int shift = NUMBER_OF_LOD_LEVELS - 1 - node->level;
+	const unsigned int x = ( (unsigned int)node->x >> shift ) * 2 + ( i & 1 );
+	const unsigned int z = ( (unsigned int)node->z >> shift ) * 2 + ( i >> 1 );
+	return quadtree_get_node( quadtree, node->level + 1u, x, z );
+}
+
+// @todo: the box is relative to heightmap for now, also @todo: real height values
+inline void node_get_aabb( const node_t *const node, const terrain_tile_t *const tile, aabbf *aabb ) {
+	const unsigned int x = (unsigned int)node->x * LEAF_NODE_SIZE;
+	const unsigned int z = (unsigned int)node->z * LEAF_NODE_SIZE;
+	const unsigned int size = node_get_size( node );
+	aabb->min.x = tile->aabb.min.x+(float)x;
+	aabb->min.y = (float)node->min_height * HEIGHT_SCALE;
+	aabb->min.z = tile->aabb.min.z+(float)z;
+	aabb->max.x = tile->aabb.min.x+(float)(x+size);
+	aabb->max.y = (float)node->max_height * HEIGHT_SCALE;
+	aabb->max.z = tile->aabb.min.z+(float)(z+size);
+}
+
+bool node_is_valid( const node_t *const node ) {
+	if( node->level >= NUMBER_OF_LOD_LEVELS || node->sub_nodes > 0xf || node->min_height > node->max_height )
+		return false;
+	if( node_is_leaf( node ) )
+		return 0 == node->sub_nodes;
+	// The top left sub node always exists
+	return 0 != ( node->sub_nodes & NODE_SUB_TL );
+}
+
+// *** static stuff
+/* Runs the early outs of all four sub nodes of the frame's node at once, if it is to be refined.
+ * A box completely inside the range of a level stays so for the sub nodes and the greater ranges
+ * above, their range tests are skipped then. That holds while the box stays inside the smallest of
+ * these ranges, which bounds the margin of the skipped tests. */
+void node_select_sub_nodes(
+		select_frame_t *frame, const quadtree_t *const quadtree, const unsigned int stop_at_level,
+		const view_frustum_t *const frustum, const vec3f *const camera_position, const float *const ranges_sq,
+		unsigned int *last_plane, float *margin ) {
+	const node_t *node = frame->node;
+	frame->next_sub = 0;
+	for( unsigned int i = 0; i < 4; ++i )
+		frame->sub_results[i] = UNDEFINED;
+	// Stop at one below number of lod levels. Leaves have no range for the next level.
+	if( node_is_leaf( node ) || node->level == stop_at_level )
+		return;
+	const unsigned int sub_level = node->level + 1u;
+	if( frame->inside_levels <= sub_level ) {
+		const float distance_sq = aabbf_min_distance_from_point_sq( &frame->aabb, camera_position );
+		node_lower_margin( distance_sq, sub_level, margin );
+		if( distance_sq > ranges_sq[sub_level] )
+			return;
+		const float max_distance_sq = aabb_max_distance_from_point_sq( &frame->aabb, camera_position );
+		const unsigned int inside_levels = frame->inside_levels;
+		while( frame->inside_levels < NUMBER_OF_LOD_LEVELS && max_distance_sq <= ranges_sq[frame->inside_levels] )
+			++frame->inside_levels;
+		if( frame->inside_levels > inside_levels )
+			node_lower_margin( max_distance_sq, frame->inside_levels - 1, margin );
+	}
+	// The top left sub node always exists
+	frame->first_sub_node = node_get_sub_node( node, quadtree, 0 );
+	for( unsigned int i = 0; i < 4; ++i ) {
+		if( !( node->sub_nodes & ( 1u << i ) ) )
+			continue;
+		node_get_aabb( frame->first_sub_node + i, quadtree->terrain_tile, &frame->sub_aabbs[i] );
+		// Sub nodes are within their parent, only the planes it intersects are left to test
+		frame->sub_plane_masks[i] = 0;
+		frame->sub_results[i] = 0 == frame->plane_mask ? INSIDE : node_contains_box(
+				&frame->sub_aabbs[i], frustum, frame->plane_mask, &frame->sub_plane_masks[i], last_plane, margin );
+		if( OUTSIDE == frame->sub_results[i] || frame->inside_levels > sub_level )
+			continue;
+		const float distance_sq = aabbf_min_distance_from_point_sq( &frame->sub_aabbs[i], camera_position );
+		node_lower_margin( distance_sq, sub_level, margin );
+		if( distance_sq > ranges_sq[sub_level] )
+			frame->sub_results[i] = OUT_OF_RANGE;
 	}
+}
 
+// Selects the frame's node for the quadrants its sub nodes don't cover, once they are done
+intersect_t node_select_finish(
+		const select_frame_t *const frame, const unsigned int stop_at_level, lod_selection_buffer_t *buffer ) {
 	// We don't want to select sub nodes that are invisible (out of frustum) or are selected;
 	// (we DO want to select if they are out of range, since we are not)
-	bool remove_tl = (sub_tl_res == OUTSIDE) || (sub_tl_res == SELECTED);
-	bool remove_tr = (sub_tr_res == OUTSIDE) || (sub_tr_res == SELECTED);
-	bool remove_bl = (sub_bl_res == OUTSIDE) || (sub_bl_res == SELECTED);
-	bool remove_br = (sub_br_res == OUTSIDE) || (sub_br_res == SELECTED);
-
-	if( lod_selection_get_selection_count() >= MAX_NUMBER_SELECTED_NODES ) {
-		logbook_log( LOG_WARNING, "Maximum selection count exceeded by lod. Some nodes will not be drawn" );
-		return OUTSIDE;
+	bool remove[4];
+	bool any_selected = false;
+	for( unsigned int i = 0; i < 4; ++i ) {
+		remove[i] = OUTSIDE == frame->sub_results[i] || SELECTED == frame->sub_results[i];
+		any_selected = any_selected || SELECTED == frame->sub_results[i];
 	}
-	// Add node to selection
-	if( !( remove_tl && remove_tr && remove_bl && remove_br ) &&
-		 ( lod_selection_get_selection_count() < MAX_NUMBER_SELECTED_NODES ) ) {
-		unsigned int lod_level = lod_selection_get_stop_at_level() - node->level;
-		// mind current tile index and node pointer
-		lod_selection_add_node( node, lod_level, !remove_tl, !remove_tr, !remove_bl, !remove_br );
-		return SELECTED;
+	// Add node to selection. A full buffer takes nothing more, it's reported when the buffers are merged.
+	if( !( remove[0] && remove[1] && remove[2] && remove[3] ) ) {
+		unsigned int lod_level = stop_at_level - frame->node->level;
+		return lod_selection_add_node(
+				buffer, frame->node, &frame->aabb, lod_level, !remove[0], !remove[1], !remove[2], !remove[3] ) ?
+				SELECTED : OUTSIDE;
 	}
 	// if any of child nodes are selected, then return selected -
 	// otherwise all of them are out of frustum, so we're out of frustum too
-	if( (sub_tl_res == SELECTED) || (sub_tr_res == SELECTED) ||
-		(sub_bl_res == SELECTED) || (sub_br_res == SELECTED) )
-		return SELECTED;
-	else
-		return OUTSIDE;
+	return any_selected ? SELECTED : OUTSIDE;
+}
+
+// The frustum test, with the margin if it is tracked
+intersect_t node_contains_box(
+		const aabbf *const box, const view_frustum_t *const frustum, const unsigned int plane_mask,
+		unsigned int *out_plane_mask, unsigned int *last_plane, float *margin ) {
+	return margin ?
+			frustum_contains_box_margin( box, frustum, plane_mask, out_plane_mask, last_plane, margin ) :
+			frustum_contains_box_masked( box, frustum, plane_mask, out_plane_mask, last_plane );
+}
+
+/* Lowers the margin, if it is tracked, to how far the camera can move before a box at that distance
+ * crosses the visibility range of the level */
+void node_lower_margin( const float distance_sq, const unsigned int level, float *margin ) {
+	if( !margin )
+		return;
+	const float distance = fabsf( sqrtf( distance_sq ) - lod_selection_get_visibility_range( level ) );
+	*margin = distance < *margin ? distance : *margin;
 }
 
 /* 	    // Find heights for 4 corner points (used for approx ray casting)
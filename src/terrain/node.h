@@ -6,27 +6,52 @@
 #include "omath/view_frustum.h"
 #include <inttypes.h>
 
+// Bits in node_t::sub_nodes
+#define NODE_SUB_TL 0x1
+#define NODE_SUB_TR 0x2
+#define NODE_SUB_BL 0x4
+#define NODE_SUB_BR 0x8
+
+/* 12 bytes, pointer free, so a tile's nodes are a single array that can be saved and mapped as is.
+ * Size, leaf state and the bounding box follow from the other fields and the tile, sub nodes are
+ * found by their position in the quadtree, see quadtree_get_node(). */
 struct node_t {
-	unsigned int x;
-	unsigned int z;
-	unsigned short size;
-	bool is_leaf;
-	/* Level 0 is a root node, and level 'lod_level-1' is a leaf node. So the actual
-	 * LOD level equals 'lod_level_count - 1 - node.level' */
-	unsigned short level;
+	// Position in units of LEAF_NODE_SIZE texels
+	uint16_t x;
+	uint16_t z;
 	uint16_t min_height;
 	uint16_t max_height;
-	node_t *subTL;
-	node_t *subTR;
-	node_t *subBL;
-	node_t *subBR;
-	aabbf aabb;
+	/* Level 0 is a root node, and level 'lod_level-1' is a leaf node. So the actual
+	 * LOD level equals 'lod_level_count - 1 - node.level' */
+	uint8_t level;
+	// NODE_SUB_* bits of the existing sub nodes, 0 for leaves
+	uint8_t sub_nodes;
+	uint16_t padding;
 };
 
-// worldPositionCellsize: .x = lower left latitude, .y = longitude, .z = cellsize
+// Creates the node at x/z in texels. Sub nodes are created on their own.
 void node_create(
-		const unsigned int x, const unsigned int z, const unsigned short size, const unsigned short level,
-		const terrain_tile_t *const tile, node_t *all_nodes, unsigned int *last_index, node_t *node
+		const unsigned int x, const unsigned int z, const unsigned int level,
+		const terrain_tile_t *const tile, node_t *node
 );
 
-intersect_t node_lod_select( node_t *node, bool parent_completely_in_frustum );
+/* Adds the nodes to draw from the sub tree of a top level node to a selection buffer. Iterative,
+ * the early outs of the four sub nodes of a node are run together.
+ * margin, if not NULL, is lowered to the distance from the camera to the nearest range boundary or
+ * frustum plane any test of the sub tree met. Tests that are skipped are bounded by those done. */
+void node_lod_select(
+		const node_t *const node, const quadtree_t *const quadtree, lod_selection_buffer_t *buffer, float *margin );
+
+// Side length in texels
+extern unsigned int node_get_size( const node_t *const node );
+
+extern bool node_is_leaf( const node_t *const node );
+
+// Sub node 0..3 (TL, TR, BL, BR) or NULL if it doesn't exist
+extern const node_t *node_get_sub_node( const node_t *const node, const quadtree_t *const quadtree, const unsigned int i );
+
+// World space bounding box, rebuilt from position, size and heights
+extern void node_get_aabb( const node_t *const node, const terrain_tile_t *const tile, aabbf *aabb );
+
+// Checks level, heights and sub nodes of a node that was read from a file
+bool node_is_valid( const node_t *const node );
@@ -0,0 +1,156 @@
+#include "packed_heights.h"
+#include "height_kernels.h"
+#include "base/logbook.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static inline unsigned int packed_heights_bit_width( const unsigned int range );
+static inline uint16_t packed_heights_read( const uint64_t *const words, const size_t bit, const unsigned int bits );
+
+packed_heights_t *packed_heights_create(
+		const uint16_t *const height_values, const unsigned int extent, packed_heights_t *packed ) {
+	char msg[MAX_LEN_MESSAGES];
+	if( packed ) {
+		logbook_log( LOG_WARNING, "Non-null pointer passed to packed_heights_create" );
+		return packed;
+	}
+	if( 0 == extent || extent % PACKED_HEIGHTS_BLOCK_SIZE != 0 ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Extent %d can't be packed, not a multiple of %d",
+				extent, PACKED_HEIGHTS_BLOCK_SIZE );
+		logbook_log( LOG_ERROR, msg );
+		return NULL;
+	}
+	packed = malloc(sizeof(packed_heights_t));
+	if( !packed ) {
+		logbook_log( LOG_ERROR, "Error allocating packed heights" );
+		return NULL;
+	}
+	packed->extent = extent;
+	packed->blocks_per_side = extent / PACKED_HEIGHTS_BLOCK_SIZE;
+	packed->words = NULL;
+	const size_t num_blocks = (size_t)packed->blocks_per_side * packed->blocks_per_side;
+	packed->blocks = malloc(num_blocks * sizeof(packed_block_t));
+	if( !packed->blocks ) {
+		logbook_log( LOG_ERROR, "Error allocating packed height blocks" );
+		return packed_heights_delete( packed );
+	}
+	// First pass: range and size of every block
+	const unsigned int block_size = PACKED_HEIGHTS_BLOCK_SIZE;
+	const size_t words_per_bit = (size_t)block_size * block_size / 64;
+	size_t num_words = 0;
+	for( unsigned int bz = 0; bz < packed->blocks_per_side; ++bz )
+		for( unsigned int bx = 0; bx < packed->blocks_per_side; ++bx ) {
+			uint16_t min = UINT16_MAX;
+			uint16_t max = 0;
+			for( unsigned int z = 0; z < block_size; ++z )
+				height_kernels_min_max( &height_values[(size_t)( bz * block_size + z ) * extent + bx * block_size],
+						block_size, &min, &max );
+			packed_block_t *block = &packed->blocks[(size_t)bz * packed->blocks_per_side + bx];
+			block->word_offset = (uint32_t)num_words;
+			block->base = min;
+			block->bits = (uint8_t)packed_heights_bit_width( (unsigned int)( max - min ) );
+			block->padding = 0;
+			num_words += words_per_bit * block->bits;
+			if( num_words > UINT32_MAX ) {
+				logbook_log( LOG_ERROR, "Too many height values to pack" );
+				return packed_heights_delete( packed );
+			}
+		}
+	packed->num_words = num_words + 1;
+	packed->words = calloc( packed->num_words, sizeof(uint64_t) );
+	if( !packed->words ) {
+		logbook_log( LOG_ERROR, "Error allocating packed height values" );
+		return packed_heights_delete( packed );
+	}
+	// Second pass: deltas, a block's bits start word aligned and never share a word with the next
+	for( unsigned int bz = 0; bz < packed->blocks_per_side; ++bz )
+		for( unsigned int bx = 0; bx < packed->blocks_per_side; ++bx ) {
+			const packed_block_t *block = &packed->blocks[(size_t)bz * packed->blocks_per_side + bx];
+			if( 0 == block->bits )
+				continue;
+			size_t bit = (size_t)block->word_offset * 64;
+			for( unsigned int z = 0; z < block_size; ++z ) {
+				const uint16_t *row = &height_values[(size_t)( bz * block_size + z ) * extent + bx * block_size];
+				for( unsigned int x = 0; x < block_size; ++x, bit += block->bits ) {
+					const uint64_t delta = (uint64_t)( row[x] - block->base );
+					const unsigned int shift = (unsigned int)( bit & 63 );
+					packed->words[bit >> 6] |= delta << shift;
+					if( shift + block->bits > 64 )
+						packed->words[( bit >> 6 ) + 1] |= delta >> ( 64 - shift );
+				}
+			}
+		}
+	const double num_texels = (double)extent * extent;
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Height values packed to %.2f bits per texel, %.2fkb",
+			(double)packed_heights_get_size( packed ) * 8.0 / num_texels,
+			(double)packed_heights_get_size( packed ) / 1024.0 );
+	logbook_log( LOG_INFO, msg );
+	return packed;
+}
+
+inline packed_heights_t *packed_heights_delete( packed_heights_t *packed ) {
+	if( packed ) {
+		free(packed->blocks);
+		free(packed->words);
+		free(packed);
+		packed = NULL;
+	}
+	return packed;
+}
+
+inline uint16_t packed_heights_get( const packed_heights_t *const packed, const unsigned int x, const unsigned int z ) {
+	const unsigned int block_size = PACKED_HEIGHTS_BLOCK_SIZE;
+	const packed_block_t *block =
+			&packed->blocks[(size_t)( z / block_size ) * packed->blocks_per_side + x / block_size];
+	if( 0 == block->bits )
+		return block->base;
+	const size_t index = ( z % block_size ) * block_size + x % block_size;
+	return (uint16_t)( block->base +
+			packed_heights_read( packed->words, (size_t)block->word_offset * 64 + index * block->bits, block->bits ) );
+}
+
+void packed_heights_get_row(
+		const packed_heights_t *const packed, const unsigned int x, const unsigned int z,
+		const unsigned int count, uint16_t *out ) {
+	const unsigned int block_size = PACKED_HEIGHTS_BLOCK_SIZE;
+	const packed_block_t *block_row = &packed->blocks[(size_t)( z / block_size ) * packed->blocks_per_side];
+	const size_t row_index = (size_t)( z % block_size ) * block_size;
+	unsigned int i = x;
+	const unsigned int end = x + count;
+	// One block at a time, the deltas of a block row are contiguous
+	while( i < end ) {
+		const packed_block_t *block = &block_row[i / block_size];
+		const unsigned int block_end = ( i / block_size + 1 ) * block_size;
+		const unsigned int run_end = block_end < end ? block_end : end;
+		if( 0 == block->bits ) {
+			for( ; i < run_end; ++i )
+				*out++ = block->base;
+			continue;
+		}
+		size_t bit = (size_t)block->word_offset * 64 + ( row_index + i % block_size ) * block->bits;
+		for( ; i < run_end; ++i, bit += block->bits )
+			*out++ = (uint16_t)( block->base + packed_heights_read( packed->words, bit, block->bits ) );
+	}
+}
+
+inline size_t packed_heights_get_size( const packed_heights_t *const packed ) {
+	return sizeof(packed_heights_t) +
+			(size_t)packed->blocks_per_side * packed->blocks_per_side * sizeof(packed_block_t) +
+			packed->num_words * sizeof(uint64_t);
+}
+
+// *** static stuff
+// Bits needed to store 0..range
+unsigned int packed_heights_bit_width( const unsigned int range ) {
+	return 0 == range ? 0 : 32 - (unsigned int)__builtin_clz( range );
+}
+
+// A delta may straddle two words. The padding word at the end keeps the second read in bounds.
+uint16_t packed_heights_read( const uint64_t *const words, const size_t bit, const unsigned int bits ) {
+	const size_t index = bit >> 6;
+	const unsigned int shift = (unsigned int)( bit & 63 );
+	// Shifted in two steps, a shift by 64 would be undefined
+	const uint64_t value = ( words[index] >> shift ) | ( ( words[index + 1] << 1 ) << ( 63 - shift ) );
+	return (uint16_t)( value & ( ( 1u << bits ) - 1 ) );
+}
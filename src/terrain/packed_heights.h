@@ -0,0 +1,47 @@
+/* Compact in-memory height values with constant time random access, for cpu side height and area
+ * queries after the texels went to the gpu. The extent is cut into square blocks, each stores its
+ * minimum as base and the texels as deltas to it with as many bits as the range of the block needs.
+ * Smooth terrain gets by with a few bits per texel, flat blocks with none. */
+
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Texels per block side. Power of 2, the extent must be a multiple.
+#define PACKED_HEIGHTS_BLOCK_SIZE 16
+
+typedef struct packed_block_t {
+	// Start of the block's deltas in 64 bit words
+	uint32_t word_offset;
+	uint16_t base;
+	// Bits per delta, 0..16
+	uint8_t bits;
+	uint8_t padding;
+} packed_block_t;
+
+typedef struct packed_heights_t {
+	unsigned int extent;
+	unsigned int blocks_per_side;
+	packed_block_t *blocks;
+	// Deltas of all blocks, row major within a block. One word of padding at the end.
+	uint64_t *words;
+	size_t num_words;
+} packed_heights_t;
+
+// Packs the row major height values. The extent must be a multiple of PACKED_HEIGHTS_BLOCK_SIZE.
+packed_heights_t *packed_heights_create(
+		const uint16_t *const height_values, const unsigned int extent, packed_heights_t *packed );
+
+extern packed_heights_t *packed_heights_delete( packed_heights_t *packed );
+
+extern uint16_t packed_heights_get( const packed_heights_t *const packed, const unsigned int x, const unsigned int z );
+
+// Unpacks count texels of row z starting at x
+void packed_heights_get_row(
+		const packed_heights_t *const packed, const unsigned int x, const unsigned int z,
+		const unsigned int count, uint16_t *out );
+
+// Bytes in main memory
+extern size_t packed_heights_get_size( const packed_heights_t *const packed );
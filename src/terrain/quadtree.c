@@ -1,114 +1,270 @@
-
 #include "node.h"
 #include "quadtree.h"
 #include "heightmap.h"
 #include "terrain_tile.h"
 #include "base/logbook.h"
+#include "omath/common.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+
+// Top level nodes first_top..end_top-1 with their sub trees
+typedef struct {
+	quadtree_t *quadtree;
+	unsigned int first_top;
+	unsigned int end_top;
+} build_job_t;
+
+static quadtree_t *quadtree_allocate( terrain_tile_t *tile, unsigned int *out_total_node_count );
+static void quadtree_log_nodes( const quadtree_t *const quadtree, const bool list_nodes, const double build_ms );
+static int quadtree_build_worker( void *arg );
+static void quadtree_update_height_range( quadtree_t *quadtree );
+static inline uint32_t quadtree_morton_encode( const unsigned int x, const unsigned int z );
+static inline unsigned int quadtree_morton_compact( uint32_t code );
 
-quadtree_t *quadtree_create( terrain_tile_t *tile, const bool list_nodes, quadtree_t *quadtree ) {
+quadtree_t *quadtree_create(
+		terrain_tile_t *tile, const bool list_nodes, const unsigned int num_threads, quadtree_t *quadtree ) {
 	if( quadtree ) {
 		logbook_log( LOG_WARNING, "Non null pointer passed to quadtree_create" );
 		return quadtree;
 	}
-	quadtree = malloc(sizeof(quadtree_t));
+	struct timespec start, end;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	unsigned int total_node_count;
+	quadtree = quadtree_allocate( tile, &total_node_count );
+	if( !quadtree )
+		return NULL;
+	// Create tree nodes, and extract min/max Ys (heights). Every node is independent and the slots
+	// of a sub tree are known up front, so the threads need no synchronization but the join.
+	const unsigned int num_tops = quadtree->top_node_count * quadtree->top_node_count;
+	unsigned int num_jobs = total_node_count / QUADTREE_BUILD_MIN_NODES_PER_THREAD;
+	num_jobs = num_jobs < num_threads ? num_jobs : num_threads;
+	num_jobs = num_jobs < NUMBER_OF_THREADS ? num_jobs : NUMBER_OF_THREADS;
+	num_jobs = num_jobs < num_tops ? num_jobs : num_tops;
+	num_jobs = num_jobs > 0 ? num_jobs : 1;
+	build_job_t jobs[NUMBER_OF_THREADS];
+	thrd_t threads[NUMBER_OF_THREADS];
+	bool is_started[NUMBER_OF_THREADS];
+	for( unsigned int i = 0; i < num_jobs; ++i ) {
+		jobs[i].quadtree = quadtree;
+		jobs[i].first_top = num_tops * i / num_jobs;
+		jobs[i].end_top = num_tops * ( i + 1 ) / num_jobs;
+		// The calling thread takes the first job, and any a thread couldn't be started for
+		is_started[i] = i > 0 && thrd_success == thrd_create( &threads[i], quadtree_build_worker, &jobs[i] );
+	}
+	for( unsigned int i = 0; i < num_jobs; ++i )
+		if( !is_started[i] )
+			quadtree_build_worker( &jobs[i] );
+	for( unsigned int i = 0; i < num_jobs; ++i )
+		if( is_started[i] )
+			thrd_join( threads[i], NULL );
+	quadtree->node_count = total_node_count;
+	quadtree_update_height_range( quadtree );
+	clock_gettime( CLOCK_MONOTONIC, &end );
+	const double build_ms =
+			(double)( end.tv_sec - start.tv_sec ) * 1000.0 + (double)( end.tv_nsec - start.tv_nsec ) * 1e-6;
+	quadtree_log_nodes( quadtree, list_nodes, build_ms );
+	return quadtree;
+}
+
+quadtree_t *quadtree_create_from_nodes(
+		terrain_tile_t *tile, const node_t *const nodes, const unsigned int node_count, quadtree_t *quadtree ) {
+	if( quadtree ) {
+		logbook_log( LOG_WARNING, "Non null pointer passed to quadtree_create_from_nodes" );
+		return quadtree;
+	}
+	unsigned int total_node_count;
+	quadtree = quadtree_allocate( tile, &total_node_count );
+	if( !quadtree )
+		return NULL;
+	char msg[MAX_LEN_MESSAGES];
+	if( node_count != total_node_count ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1,
+				"Quadtree not restored. Node count (%d) does not equal pre-calculated node count (%d)",
+				node_count, total_node_count );
+		logbook_log( LOG_ERROR, msg );
+		return quadtree_delete(quadtree);
+	}
+	memcpy( quadtree->all_nodes, nodes, node_count * sizeof(node_t) );
+	// Every node must sit in the slot of its level and cell, and its sub nodes must exist
+	for( unsigned int l = 0; l < NUMBER_OF_LOD_LEVELS; ++l ) {
+		const unsigned int shift = NUMBER_OF_LOD_LEVELS - 1 - l;
+		const unsigned int num_cells = quadtree->level_extents[l] * quadtree->level_extents[l];
+		for( unsigned int i = 0; i < num_cells; ++i ) {
+			const node_t *node = &quadtree->all_nodes[quadtree->level_offsets[l] + i];
+			bool is_valid = node_is_valid( node ) && node->level == l &&
+					(unsigned int)node->x == quadtree_morton_compact( i ) << shift &&
+					(unsigned int)node->z == quadtree_morton_compact( i >> 1 ) << shift;
+			for( unsigned int s = 0; is_valid && s < 4; ++s )
+				is_valid = !( node->sub_nodes & ( 1u << s ) ) || NULL != node_get_sub_node( node, quadtree, s );
+			if( !is_valid ) {
+				logbook_log( LOG_ERROR, "Quadtree not restored. Invalid node or sub node out of the grid" );
+				return quadtree_delete(quadtree);
+			}
+		}
+	}
+	quadtree->node_count = node_count;
+	quadtree_update_height_range( quadtree );
+	quadtree_log_nodes( quadtree, false, 0.0 );
+	return quadtree;
+}
+
+inline quadtree_t *quadtree_delete( quadtree_t *quadtree ) {
+	if( quadtree ) {
+		free(quadtree->all_nodes);
+		free(quadtree); quadtree = NULL;
+	}
+	return quadtree;
+}
+
+inline size_t quadtree_get_size( const quadtree_t *const quadtree ) {
+	return sizeof(quadtree_t) + (size_t)quadtree->node_count * sizeof(node_t);
+}
+
+inline aabbf *quadtree_get_aabb( const quadtree_t *const quadtree, aabbf *aabb ) {
+	const aabbf *tile_aabb = &quadtree->terrain_tile->aabb;
+	const float size = (float)( quadtree->top_node_count * quadtree->top_node_size );
+	aabb->min.x = tile_aabb->min.x;
+	aabb->min.y = (float)quadtree->min_height * HEIGHT_SCALE;
+	aabb->min.z = tile_aabb->min.z;
+	aabb->max.x = tile_aabb->min.x + size;
+	aabb->max.y = (float)quadtree->max_height * HEIGHT_SCALE;
+	aabb->max.z = tile_aabb->min.z + size;
+	return aabb;
+}
+
+inline const node_t *quadtree_get_node(
+		const quadtree_t *const quadtree, const unsigned int level, const unsigned int x, const unsigned int z ) {
+	if( level >= NUMBER_OF_LOD_LEVELS || x >= quadtree->level_extents[level] || z >= quadtree->level_extents[level] )
+		return NULL;
+	return &quadtree->all_nodes[quadtree->level_offsets[level] + quadtree_morton_encode( x, z )];
+}
+
+void quadtree_lod_select(
+		const quadtree_t *const quadtree, const unsigned int first_top, const unsigned int end_top,
+		lod_selection_buffer_t *buffer, float *margins ) {
+	for( unsigned int i = first_top; i < end_top; ++i )
+		node_lod_select( quadtree_get_node( quadtree, 0, i % quadtree->top_node_count, i / quadtree->top_node_count ),
+				quadtree, buffer, margins ? &margins[i-first_top] : NULL );
+}
+
+// *** static stuff
+// Determines how many nodes will be used, the size of the top (root) tree node and the level
+// layout and allocates the node memory. Nodes are not initialized.
+quadtree_t *quadtree_allocate( terrain_tile_t *tile, unsigned int *out_total_node_count ) {
+	// shortcut
+	const unsigned int raster_size = tile->heightmap->extent;
+	if( !is_pow2u( raster_size ) ) {
+		char msg[MAX_LEN_MESSAGES];
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Quadtree needs a power of 2 extent, '%s' has %d", tile->filename, raster_size );
+		logbook_log( LOG_ERROR, msg );
+		return NULL;
+	}
+	quadtree_t *quadtree = malloc(sizeof(quadtree_t));
 	if( !quadtree ) {
 		logbook_log( LOG_ERROR, "Error allocating quadtree memory" );
 		return NULL;
 	}
 	quadtree->terrain_tile = tile;
-	// shortcut
-	const unsigned int raster_size = quadtree->terrain_tile->heightmap->extent;
-	// Determine how many nodes will we use, and the size of the top (root) tree node.
+	quadtree->all_nodes = NULL;
+	quadtree->node_count = 0;
+	quadtree->top_node_size = LEAF_NODE_SIZE << ( NUMBER_OF_LOD_LEVELS - 1 );
+	// Power of 2 grids, a level has twice the cells per side of the one above unless the nodes are
+	// larger than the heightmap
 	unsigned int total_node_count = 0;
-	quadtree->top_node_size = LEAF_NODE_SIZE;
-	for( int i = 0; i < NUMBER_OF_LOD_LEVELS; i++ ) {
-		if( i != 0 )
-			quadtree->top_node_size *= 2;
-		const unsigned int node_count = (raster_size-1) / quadtree->top_node_size + 1;
-		total_node_count += node_count * node_count;
+	for( unsigned int l = 0; l < NUMBER_OF_LOD_LEVELS; ++l ) {
+		const unsigned int size = (unsigned int)quadtree->top_node_size >> l;
+		quadtree->level_extents[l] = (raster_size-1) / size + 1;
+		quadtree->level_offsets[l] = total_node_count;
+		total_node_count += quadtree->level_extents[l] * quadtree->level_extents[l];
 	}
-	// Initialize the tree memory, create tree nodes, and extract min/max Ys (heights)
+	quadtree->top_node_count = quadtree->level_extents[0];
+	*out_total_node_count = total_node_count;
 	quadtree->all_nodes = malloc(total_node_count*sizeof(node_t));
 	if( !quadtree->all_nodes ) {
 		logbook_log( LOG_ERROR, "Error allocating node memory in quadtree_create" );
 		return quadtree_delete(quadtree);
 	}
-	unsigned int node_counter = 0;
-	quadtree->top_node_count = (raster_size-1) / quadtree->top_node_size + 1;
-	quadtree->top_level_nodes = malloc(quadtree->top_node_count*sizeof(node_t*));
-	if( !quadtree->top_level_nodes ) {
-		logbook_log( LOG_ERROR, "Error allocating quadtree memory" );
-		return quadtree_delete(quadtree);
-	}
-	for( unsigned int z = 0; z < quadtree->top_node_count; ++z ) {
-		quadtree->top_level_nodes[z] = malloc(quadtree->top_node_count*sizeof(node_t*));
-		if( !quadtree->top_level_nodes ) {
-			logbook_log( LOG_ERROR, "Error allocating quadtree memory" );
-			// @todo this is going to crash if memory runs out in mid looping. Try malloc beforehand
-			return quadtree_delete(quadtree);
-		}
-		for( unsigned int x = 0; x < quadtree->top_node_count; ++x ) {
-			quadtree->top_level_nodes[z][x] = &quadtree->all_nodes[node_counter];
-			++node_counter;
-			node_create(
-					x*quadtree->top_node_size, z*quadtree->top_node_size, quadtree->top_node_size, 0,
-					quadtree->terrain_tile, quadtree->all_nodes, &node_counter, quadtree->top_level_nodes[z][x]
-			);
-		}
-	}
-	quadtree->node_count = node_counter;
-	char msg[MAX_LEN_MESSAGES];
-	if( quadtree->node_count != total_node_count ) {
-		snprintf( msg, MAX_LEN_MESSAGES-1,
-				"Quadtree not built. Node counter (%d) does not equal pre-calculated node count (%d)",
-				quadtree->node_count, total_node_count );
-		logbook_log( LOG_ERROR, msg );
-		return quadtree_delete(quadtree);
-	}
+	return quadtree;
+}
 
-	// Debug output - summary and list of nodes
-	const float size_in_memory = (float)(quadtree->node_count*(sizeof(node_t)+sizeof(aabbf))+sizeof(quadtree_t));
+// Debug output - summary and list of nodes
+void quadtree_log_nodes( const quadtree_t *const quadtree, const bool list_nodes, const double build_ms ) {
+	char msg[MAX_LEN_MESSAGES];
+	const float size_in_memory = (float)quadtree_get_size( quadtree );
 	snprintf( msg, MAX_LEN_MESSAGES-1,
-			"Quadtree created. %d nodes, size in memory %.2fkb, %d*%d top level nodes",
-			quadtree->node_count, size_in_memory/1024.0f, quadtree->top_node_count, quadtree->top_node_count );
+			"Quadtree created in %.2fms. %d nodes, size in memory %.2fkb, %d*%d top level nodes",
+			build_ms, quadtree->node_count, size_in_memory/1024.0f, quadtree->top_node_count, quadtree->top_node_count );
 	logbook_log( LOG_INFO, msg );
 	// Debug: List of all Nodes
 	if( list_nodes ) {
 		for( unsigned int i = 0; i < quadtree->node_count; ++i ) {
 			const node_t *n = &quadtree->all_nodes[i];
-			if( !n->is_leaf )
+			aabbf aabb;
+			node_get_aabb( n, quadtree->terrain_tile, &aabb );
+			if( !node_is_leaf( n ) )
 				snprintf( msg, MAX_LEN_MESSAGES-1,
-						"Node %d, level %d, aabb (%.2f/%.2f/%.2f)/(%.2f/%.2f/%.2f), leaves (%d/%d/%d/%d)", i,
-						n->level, n->aabb.min.x, n->aabb.min.y, n->aabb.min.z, n->aabb.max.x, n->aabb.max.y,
-						n->aabb.max.z, n->subTL->level, n->subTR->level, n->subBL->level, n->subBR->level );
+						"Node %d, level %d, aabb (%.2f/%.2f/%.2f)/(%.2f/%.2f/%.2f), sub nodes (mask %x)", i,
+						n->level, aabb.min.x, aabb.min.y, aabb.min.z, aabb.max.x, aabb.max.y,
+						aabb.max.z, n->sub_nodes );
 			else
 				snprintf( msg, MAX_LEN_MESSAGES-1,
 						"Node %d, level %d, aabb (%.2f/%.2f/%.2f)/(%.2f/%.2f/%.2f), is leaf", i, n->level,
-						n->aabb.min.x, n->aabb.min.y, n->aabb.min.z, n->aabb.max.x, n->aabb.max.y, n->aabb.max.z );
+						aabb.min.x, aabb.min.y, aabb.min.z, aabb.max.x, aabb.max.y, aabb.max.z );
 			logbook_log( LOG_INFO, msg );
 		}
 	}
-	return quadtree;
 }
 
-inline quadtree_t *quadtree_delete( quadtree_t *quadtree ) {
-	if( quadtree ) {
-		if( quadtree->all_nodes )
-			free(quadtree->all_nodes);
-		if( quadtree->top_level_nodes ) {
-			for( unsigned int y = 0; y < quadtree->top_node_count; ++y )
-				free(quadtree->top_level_nodes[y]);
-			free(quadtree->top_level_nodes);
-		}
-		free(quadtree); quadtree = NULL;
+// Creates the nodes of a job's top level nodes on all levels. The nodes below a top level node
+// fill one run of (cells per side on the level / top level cells per side)^2 slots per level.
+int quadtree_build_worker( void *arg ) {
+	const build_job_t *job = arg;
+	const quadtree_t *quadtree = job->quadtree;
+	for( unsigned int l = 0; l < NUMBER_OF_LOD_LEVELS; ++l ) {
+		const unsigned int size = (unsigned int)quadtree->top_node_size >> l;
+		const unsigned int ratio = quadtree->level_extents[l] / quadtree->level_extents[0];
+		const unsigned int cells_per_top = ratio * ratio;
+		node_t *level_nodes = &quadtree->all_nodes[quadtree->level_offsets[l]];
+		for( unsigned int i = job->first_top * cells_per_top; i < job->end_top * cells_per_top; ++i )
+			node_create( quadtree_morton_compact( i ) * size, quadtree_morton_compact( i >> 1 ) * size, l,
+					quadtree->terrain_tile, &level_nodes[i] );
 	}
-	return quadtree;
+	return 0;
+}
+
+// Interleaves the bits of x (even) and z (odd). 16 bits each, enough for TERRAIN_TILE_MAX_EXTENT.
+uint32_t quadtree_morton_encode( const unsigned int x, const unsigned int z ) {
+	uint32_t code[2] = { x & 0xffff, z & 0xffff };
+	for( int i = 0; i < 2; ++i ) {
+		code[i] = ( code[i] | ( code[i] << 8 ) ) & 0x00ff00ff;
+		code[i] = ( code[i] | ( code[i] << 4 ) ) & 0x0f0f0f0f;
+		code[i] = ( code[i] | ( code[i] << 2 ) ) & 0x33333333;
+		code[i] = ( code[i] | ( code[i] << 1 ) ) & 0x55555555;
+	}
+	return code[0] | ( code[1] << 1 );
+}
+
+// Gathers the even bits of code, x of a Morton code. code >> 1 gives z.
+unsigned int quadtree_morton_compact( uint32_t code ) {
+	code &= 0x55555555;
+	code = ( code | ( code >> 1 ) ) & 0x33333333;
+	code = ( code | ( code >> 2 ) ) & 0x0f0f0f0f;
+	code = ( code | ( code >> 4 ) ) & 0x00ff00ff;
+	code = ( code | ( code >> 8 ) ) & 0x0000ffff;
+	return code;
 }
 
-void quadtree_lod_select( const quadtree_t *const quadtree ) {
-	for( unsigned int z = 0; z < quadtree->top_node_count; ++z )
-		for( unsigned int x = 0; x < quadtree->top_node_count; ++x )
-			node_lod_select( quadtree->top_level_nodes[z][x], false );
+// Sub nodes lie within their parents, so the top level holds the whole range
+void quadtree_update_height_range( quadtree_t *quadtree ) {
+	quadtree->min_height = UINT16_MAX;
+	quadtree->max_height = 0;
+	const unsigned int num_tops = quadtree->top_node_count * quadtree->top_node_count;
+	for( unsigned int i = 0; i < num_tops; ++i ) {
+		const node_t *node = &quadtree->all_nodes[quadtree->level_offsets[0] + i];
+		quadtree->min_height = node->min_height < quadtree->min_height ? node->min_height : quadtree->min_height;
+		quadtree->max_height = node->max_height > quadtree->max_height ? node->max_height : quadtree->max_height;
+	}
 }
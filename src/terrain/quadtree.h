@@ -2,21 +2,58 @@
 #pragma once
 
 #include "settings.h"
+#include "node.h"
 #include <stdbool.h>
 
+// A build thread gets at least this many nodes
+#define QUADTREE_BUILD_MIN_NODES_PER_THREAD 4096
+
+/* Implicit quadtree in a single node array. The nodes are stored level by level, top level first,
+ * and in Z-order (Morton order) within a level. So the node of a cell is found by arithmetic from
+ * level and cell position, and a sub tree occupies one contiguous run per level.
+ * The extent of the heightmap must be a power of 2, every level is then a power of 2 grid. */
 struct quadtree_t {
 	unsigned short top_node_size;
 	unsigned int top_node_count;
 	unsigned int node_count;
+	// Cells per side and index of the first node per level
+	unsigned int level_extents[NUMBER_OF_LOD_LEVELS];
+	unsigned int level_offsets[NUMBER_OF_LOD_LEVELS];
 	node_t *all_nodes;
-	node_t ***top_level_nodes;
 	terrain_tile_t *terrain_tile;
+	// Height range of all nodes, from the top level
+	uint16_t min_height;
+	uint16_t max_height;
 };
 
-// list_nodes, when true, caues a list of nodes and their bounding boxes to be printed to logbook
-quadtree_t *quadtree_create( terrain_tile_t *tile, const bool list_nodes, quadtree_t *quadtree );
+/* Builds the sub trees of the top level nodes on up to num_threads threads, the calling one included.
+ * Fewer are used for small trees, and no more than NUMBER_OF_THREADS. The result doesn't depend on
+ * the number of threads. list_nodes, when true, caues a list of nodes and their bounding boxes to be
+ * printed to logbook */
+quadtree_t *quadtree_create(
+		terrain_tile_t *tile, const bool list_nodes, const unsigned int num_threads, quadtree_t *quadtree );
+
+/* Restores a quadtree from the node array as saved in a tile bundle. The nodes are copied and checked.
+ * Nothing is recomputed, the heightmap is only used for its extent. */
+quadtree_t *quadtree_create_from_nodes(
+		terrain_tile_t *tile, const node_t *const nodes, const unsigned int node_count, quadtree_t *quadtree );
 
 extern quadtree_t *quadtree_delete( quadtree_t *quadtree );
 
-// tile index is saved in selection list for sorting by tile and distance
-void quadtree_lod_select( const quadtree_t *const quadtree );
+// Bytes allocated for the nodes
+extern size_t quadtree_get_size( const quadtree_t *const quadtree );
+
+// Bounding box of all nodes, for culling the tile as a whole. Can exceed the tile's bounding box.
+extern aabbf *quadtree_get_aabb( const quadtree_t *const quadtree, aabbf *aabb );
+
+/* Node of cell x/z at a level, in cells of that level. NULL outside of the grid.
+ * Parents and neighbours are at x/2, z/2 one level up and at x+-1, z+-1. */
+extern const node_t *quadtree_get_node(
+		const quadtree_t *const quadtree, const unsigned int level, const unsigned int x, const unsigned int z );
+
+/* Selects from the top level nodes first_top..end_top-1, counted row by row. The buffer's tile index
+ * is saved in the selection for sorting by tile and distance. margins, if not NULL, has one entry per
+ * top level node, each is lowered as by node_lod_select(). */
+void quadtree_lod_select(
+		const quadtree_t *const quadtree, const unsigned int first_top, const unsigned int end_top,
+		lod_selection_buffer_t *buffer, float *margins );
@@ -0,0 +1,395 @@
+#include "selection_pool.h"
+#include "terrain_tile.h"
+#include "quadtree.h"
+#include "lod_selection.h"
+#include "base/camera.h"
+#include "omath/frustum_batch.h"
+#include "base/logbook.h"
+#include <threads.h>
+#include <float.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Quadtree of a ready tile and the number of top level nodes of the tiles before it
+typedef struct {
+	const quadtree_t *quadtree;
+	unsigned int tile_index;
+	unsigned int first_top;
+} selection_item_t;
+
+/* A selection kept for the next one. Per top level node the nodes it selected and its margin, how far
+ * the camera may move before one of the tests of its sub tree flips, see node_lod_select(). */
+typedef struct {
+	// Nodes are complete and margins known
+	bool is_valid;
+	view_frustum_t frustum;
+	// Per tile the quadtree selected from and its first top level node, NULL if it wasn't
+	unsigned int num_tiles;
+	const quadtree_t *quadtrees[TERRAIN_MAX_TILES];
+	unsigned int first_tops[TERRAIN_MAX_TILES];
+	unsigned int num_tops;
+	// Of margins and firsts
+	unsigned int top_capacity;
+	float *margins;
+	// Nodes of top level node t are nodes[firsts[t]] up to nodes[firsts[t+1]]
+	unsigned int *firsts;
+	unsigned int node_capacity;
+	selected_node_t *nodes;
+} selection_state_t;
+
+static int selection_pool_worker( void *arg );
+static void selection_pool_run_job( const unsigned int job );
+static void selection_pool_cull_tiles( const tiles_t *const tiles, const unsigned int num_tiles );
+static bool selection_pool_get_movement(
+		const view_frustum_t *const last, const view_frustum_t *const frustum, float *way, float *turn );
+static bool selection_pool_reserve_tops( selection_state_t *state, const unsigned int num_tops );
+static bool selection_pool_keep_top(
+		const selection_item_t *const item, const unsigned int top, lod_selection_buffer_t *buffer );
+static void selection_pool_keep( selection_state_t *state, const view_frustum_t *const frustum );
+
+static struct {
+	bool running;
+	// Started workers, worker i runs job i+1
+	unsigned int num_threads;
+	thrd_t threads[LOD_SELECTION_NUM_THREADS];
+	mtx_t mutex;
+	cnd_t start_condition;
+	cnd_t done_condition;
+	// Counts the selections handed to the workers
+	unsigned int generation;
+	unsigned int num_jobs;
+	unsigned int num_pending;
+	unsigned int num_items;
+	unsigned int num_tops;
+	selection_item_t items[TERRAIN_MAX_TILES];
+	// Bounding boxes of the ready tiles, culled in one batch before the selection
+	unsigned int num_ready;
+	unsigned int ready_tiles[TERRAIN_MAX_TILES];
+	float tile_min_x[TERRAIN_MAX_TILES];
+	float tile_min_y[TERRAIN_MAX_TILES];
+	float tile_min_z[TERRAIN_MAX_TILES];
+	float tile_max_x[TERRAIN_MAX_TILES];
+	float tile_max_y[TERRAIN_MAX_TILES];
+	float tile_max_z[TERRAIN_MAX_TILES];
+	uint8_t tile_results[TERRAIN_MAX_TILES];
+	lod_selection_buffer_t buffers[LOD_SELECTION_NUM_THREADS];
+	// The one written by the next selection, the other is the last one
+	unsigned int state;
+	selection_state_t states[2];
+	// The last selection is refined, see selection_pool_get_movement()
+	bool is_refining;
+	float way;
+	float turn;
+	// Top level nodes per job whose nodes were kept
+	unsigned int num_kept[LOD_SELECTION_NUM_THREADS];
+} selection_pool;
+
+bool selection_pool_create() {
+	if( selection_pool.running ) {
+		logbook_log( LOG_WARNING, "Selection pool already running" );
+		return true;
+	}
+	selection_pool.num_threads = 0;
+	selection_pool.generation = 0;
+	if( thrd_success != mtx_init( &selection_pool.mutex, mtx_plain ) )
+		return false;
+	if( thrd_success != cnd_init( &selection_pool.start_condition ) ) {
+		mtx_destroy( &selection_pool.mutex );
+		return false;
+	}
+	if( thrd_success != cnd_init( &selection_pool.done_condition ) ) {
+		cnd_destroy( &selection_pool.start_condition );
+		mtx_destroy( &selection_pool.mutex );
+		return false;
+	}
+	selection_pool.running = true;
+	for( unsigned int i = 0; i + 1 < LOD_SELECTION_NUM_THREADS; ++i ) {
+		if( thrd_success != thrd_create(
+				&selection_pool.threads[i], selection_pool_worker, (void *)(uintptr_t)( i + 1 ) ) )
+			break;
+		++selection_pool.num_threads;
+	}
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Selection pool started with %d workers", selection_pool.num_threads );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+void selection_pool_delete() {
+	// The buffers are used without workers too
+	for( unsigned int i = 0; i < LOD_SELECTION_NUM_THREADS; ++i )
+		lod_selection_buffer_delete( &selection_pool.buffers[i] );
+	for( unsigned int i = 0; i < 2; ++i ) {
+		selection_state_t *state = &selection_pool.states[i];
+		free( state->margins );
+		free( state->firsts );
+		free( state->nodes );
+		memset( state, 0, sizeof(selection_state_t) );
+	}
+	if( !selection_pool.running )
+		return;
+	mtx_lock( &selection_pool.mutex );
+	selection_pool.running = false;
+	cnd_broadcast( &selection_pool.start_condition );
+	mtx_unlock( &selection_pool.mutex );
+	for( unsigned int i = 0; i < selection_pool.num_threads; ++i )
+		thrd_join( selection_pool.threads[i], NULL );
+	selection_pool.num_threads = 0;
+	cnd_destroy( &selection_pool.done_condition );
+	cnd_destroy( &selection_pool.start_condition );
+	mtx_destroy( &selection_pool.mutex );
+}
+
+void selection_pool_select( const tiles_t *const tiles, const unsigned int num_tiles ) {
+	selection_pool_cull_tiles( tiles, num_tiles );
+	selection_state_t *state = &selection_pool.states[selection_pool.state];
+	const selection_state_t *last = &selection_pool.states[1 - selection_pool.state];
+	selection_pool.num_items = 0;
+	selection_pool.num_tops = 0;
+	state->num_tiles = num_tiles;
+	for( unsigned int i = 0; i < num_tiles; ++i )
+		state->quadtrees[i] = NULL;
+	for( unsigned int r = 0; r < selection_pool.num_ready; ++r ) {
+		// None of the nodes of a tile outside the frustum would be selected
+		if( OUTSIDE == selection_pool.tile_results[r] )
+			continue;
+		const unsigned int i = selection_pool.ready_tiles[r];
+		const quadtree_t *quadtree = tiles[i].tile->quadtree;
+		selection_item_t *item = &selection_pool.items[selection_pool.num_items++];
+		item->quadtree = quadtree;
+		item->tile_index = i;
+		item->first_top = selection_pool.num_tops;
+		selection_pool.num_tops += quadtree->top_node_count * quadtree->top_node_count;
+		state->quadtrees[i] = quadtree;
+		state->first_tops[i] = item->first_top;
+	}
+	const view_frustum_t *frustum = camera_get_view_frustum();
+	state->is_valid = LOD_SELECTION_REFINE && selection_pool_reserve_tops( state, selection_pool.num_tops );
+	selection_pool.is_refining = state->is_valid && last->is_valid &&
+			selection_pool_get_movement( &last->frustum, frustum, &selection_pool.way, &selection_pool.turn );
+	unsigned int num_jobs = selection_pool.num_tops / SELECTION_POOL_MIN_TOP_NODES_PER_THREAD;
+	num_jobs = num_jobs < selection_pool.num_threads + 1 ? num_jobs : selection_pool.num_threads + 1;
+	num_jobs = num_jobs > 0 ? num_jobs : 1;
+	selection_pool.num_jobs = num_jobs;
+	if( num_jobs > 1 ) {
+		mtx_lock( &selection_pool.mutex );
+		selection_pool.num_pending = num_jobs - 1;
+		++selection_pool.generation;
+		cnd_broadcast( &selection_pool.start_condition );
+		mtx_unlock( &selection_pool.mutex );
+	}
+	selection_pool_run_job( 0 );
+	if( num_jobs > 1 ) {
+		mtx_lock( &selection_pool.mutex );
+		while( selection_pool.num_pending > 0 )
+			cnd_wait( &selection_pool.done_condition, &selection_pool.mutex );
+		mtx_unlock( &selection_pool.mutex );
+	}
+	lod_selection_reset();
+	for( unsigned int i = 0; i < num_jobs; ++i )
+		lod_selection_append( &selection_pool.buffers[i] );
+	if( state->is_valid )
+		selection_pool_keep( state, frustum );
+	selection_pool.state = 1 - selection_pool.state;
+}
+
+void selection_pool_invalidate() {
+	selection_pool.states[1 - selection_pool.state].is_valid = false;
+}
+
+unsigned int selection_pool_get_num_kept_tops( unsigned int *num_tops ) {
+	unsigned int num_kept = 0;
+	for( unsigned int i = 0; i < selection_pool.num_jobs; ++i )
+		num_kept += selection_pool.num_kept[i];
+	*num_tops = selection_pool.num_tops;
+	return num_kept;
+}
+
+// *** static stuff
+// Runs one job per selection until the pool is stopped
+int selection_pool_worker( void *arg ) {
+	const unsigned int job = (unsigned int)(uintptr_t)arg;
+	// Starts at 0 too, so a worker that comes up late doesn't miss the first selection
+	unsigned int generation = 0;
+	mtx_lock( &selection_pool.mutex );
+	for(;;) {
+		while( selection_pool.running && generation == selection_pool.generation )
+			cnd_wait( &selection_pool.start_condition, &selection_pool.mutex );
+		if( !selection_pool.running )
+			break;
+		generation = selection_pool.generation;
+		if( job >= selection_pool.num_jobs )
+			continue;
+		mtx_unlock( &selection_pool.mutex );
+		selection_pool_run_job( job );
+		mtx_lock( &selection_pool.mutex );
+		if( 0 == --selection_pool.num_pending )
+			cnd_signal( &selection_pool.done_condition );
+	}
+	mtx_unlock( &selection_pool.mutex );
+	return 0;
+}
+
+// Selects the job's run of top level nodes into the job's buffer
+void selection_pool_run_job( const unsigned int job ) {
+	lod_selection_buffer_t *buffer = &selection_pool.buffers[job];
+	lod_selection_buffer_reset( buffer );
+	selection_state_t *state = &selection_pool.states[selection_pool.state];
+	selection_pool.num_kept[job] = 0;
+	const unsigned int first = selection_pool.num_tops * job / selection_pool.num_jobs;
+	const unsigned int end = selection_pool.num_tops * ( job + 1 ) / selection_pool.num_jobs;
+	unsigned int i = 0;
+	while( i + 1 < selection_pool.num_items && selection_pool.items[i+1].first_top <= first )
+		++i;
+	for( ; i < selection_pool.num_items && selection_pool.items[i].first_top < end; ++i ) {
+		const selection_item_t *item = &selection_pool.items[i];
+		const unsigned int num_tops = item->quadtree->top_node_count * item->quadtree->top_node_count;
+		const unsigned int first_top = first > item->first_top ? first - item->first_top : 0;
+		const unsigned int end_top = end - item->first_top < num_tops ? end - item->first_top : num_tops;
+		buffer->tile_index = item->tile_index;
+		if( !state->is_valid ) {
+			quadtree_lod_select( item->quadtree, first_top, end_top, buffer, NULL );
+			continue;
+		}
+		// One top level node at a time, to know its nodes and margin
+		for( unsigned int t = first_top; t < end_top; ++t ) {
+			const unsigned int top = item->first_top + t;
+			const unsigned int count = buffer->count;
+			if( selection_pool_keep_top( item, t, buffer ) )
+				++selection_pool.num_kept[job];
+			else {
+				state->margins[top] = FLT_MAX;
+				quadtree_lod_select( item->quadtree, t, t + 1, buffer, &state->margins[top] );
+			}
+			// Summed up by selection_pool_keep()
+			state->firsts[top + 1] = buffer->count - count;
+		}
+	}
+}
+
+// Classifies the bounding boxes of the ready tiles against the view frustum
+void selection_pool_cull_tiles( const tiles_t *const tiles, const unsigned int num_tiles ) {
+	selection_pool.num_ready = 0;
+	for( unsigned int i = 0; i < num_tiles; ++i ) {
+		if( ready != atomic_load( &tiles[i].status ) )
+			continue;
+		// Node boxes use the quadtree's extent and height scale, not the tile's bounding box
+		aabbf tile_aabb;
+		const aabbf *aabb = quadtree_get_aabb( tiles[i].tile->quadtree, &tile_aabb );
+		const unsigned int r = selection_pool.num_ready++;
+		selection_pool.ready_tiles[r] = i;
+		selection_pool.tile_min_x[r] = aabb->min.x;
+		selection_pool.tile_min_y[r] = aabb->min.y;
+		selection_pool.tile_min_z[r] = aabb->min.z;
+		selection_pool.tile_max_x[r] = aabb->max.x;
+		selection_pool.tile_max_y[r] = aabb->max.y;
+		selection_pool.tile_max_z[r] = aabb->max.z;
+	}
+	const aabbf_soa_t boxes = {
+			selection_pool.tile_min_x, selection_pool.tile_min_y, selection_pool.tile_min_z,
+			selection_pool.tile_max_x, selection_pool.tile_max_y, selection_pool.tile_max_z
+	};
+	frustum_batch_classify_boxes( &boxes, selection_pool.num_ready, camera_get_view_frustum(),
+			FRUSTUM_ALL_PLANES, selection_pool.tile_results, NULL );
+}
+
+/* How far box corners tested by the last selection can have moved relative to a frustum plane or to
+ * the camera since: way, the camera's way, plus turn, the largest turn of a plane normal, times the
+ * distance of the corner from the camera. False if the near or far plane changed, the visibility
+ * ranges differ then. */
+bool selection_pool_get_movement(
+		const view_frustum_t *const last, const view_frustum_t *const frustum, float *way, float *turn ) {
+	if( last->near_plane != frustum->near_plane || last->far_plane != frustum->far_plane )
+		return false;
+	vec3f d;
+	*way = vec3f_magnitude( vec3f_sub( &frustum->camera_position, &last->camera_position, &d ) );
+	*turn = 0.0f;
+	for( unsigned int i = 0; i < FRUSTUM_NUM_PLANES; ++i ) {
+		const float length = vec3f_magnitude( vec3f_sub( &frustum->planes[i].normal, &last->planes[i].normal, &d ) );
+		*turn = length > *turn ? length : *turn;
+	}
+	return true;
+}
+
+// Grows margins and firsts. False if that failed, the selection isn't kept then.
+bool selection_pool_reserve_tops( selection_state_t *state, const unsigned int num_tops ) {
+	state->num_tops = num_tops;
+	if( num_tops + 1 <= state->top_capacity )
+		return true;
+	float *margins = realloc( state->margins, ( num_tops + 1 ) * sizeof(float) );
+	if( margins )
+		state->margins = margins;
+	unsigned int *firsts = realloc( state->firsts, ( num_tops + 1 ) * sizeof(unsigned int) );
+	if( firsts )
+		state->firsts = firsts;
+	if( !margins || !firsts ) {
+		logbook_log( LOG_ERROR, "Out of memory for the kept selection, selecting all nodes" );
+		return false;
+	}
+	state->top_capacity = num_tops + 1;
+	return true;
+}
+
+/* Adds the nodes the top level node selected last time, if none of its tests can have flipped since.
+ * Its box bounds the distance of the corners tested, its margin shrinks by their movement. The
+ * quadtree must be the same, a tile that went away in between wasn't in the last selection. */
+bool selection_pool_keep_top(
+		const selection_item_t *const item, const unsigned int top, lod_selection_buffer_t *buffer ) {
+	const selection_state_t *last = &selection_pool.states[1 - selection_pool.state];
+	if( !selection_pool.is_refining || item->tile_index >= last->num_tiles ||
+			last->quadtrees[item->tile_index] != item->quadtree )
+		return false;
+	const unsigned int last_top = last->first_tops[item->tile_index] + top;
+	const quadtree_t *quadtree = item->quadtree;
+	aabbf aabb;
+	node_get_aabb( quadtree_get_node( quadtree, 0, top % quadtree->top_node_count, top / quadtree->top_node_count ),
+			quadtree->terrain_tile, &aabb );
+	const float reach = sqrtf( aabb_max_distance_from_point_sq( &aabb, camera_get_position() ) );
+	const float margin = last->margins[last_top] - selection_pool.way - selection_pool.turn * reach;
+	if( margin < LOD_SELECTION_REFINE_SLACK )
+		return false;
+	for( unsigned int i = last->firsts[last_top]; i < last->firsts[last_top + 1]; ++i ) {
+		const selected_node_t *n = &last->nodes[i];
+		lod_selection_add_node( buffer, n->node, &n->aabb, n->lod_level, n->hasTL, n->hasTR, n->hasBL, n->hasBR );
+	}
+	selection_pool.states[selection_pool.state].margins[item->first_top + top] = margin;
+	return true;
+}
+
+/* Keeps the selection for the next one: sums the node counts of the top level nodes up to their
+ * firsts and copies the nodes of the job buffers. Not kept if a buffer overflowed, nodes are missing
+ * then. */
+void selection_pool_keep( selection_state_t *state, const view_frustum_t *const frustum ) {
+	state->frustum = *frustum;
+	state->firsts[0] = 0;
+	for( unsigned int t = 0; t < state->num_tops; ++t )
+		state->firsts[t + 1] += state->firsts[t];
+	const unsigned int num_nodes = state->firsts[state->num_tops];
+	for( unsigned int i = 0; i < selection_pool.num_jobs; ++i )
+		state->is_valid = state->is_valid && !selection_pool.buffers[i].has_overflowed;
+	if( !state->is_valid )
+		return;
+	if( num_nodes > state->node_capacity ) {
+		unsigned int capacity = state->node_capacity > 0 ? state->node_capacity : LOD_SELECTION_INITIAL_CAPACITY;
+		while( capacity < num_nodes )
+			capacity *= 2;
+		selected_node_t *nodes = realloc( state->nodes, capacity * sizeof(selected_node_t) );
+		if( !nodes ) {
+			logbook_log( LOG_ERROR, "Out of memory for the kept selection, selecting all nodes" );
+			state->is_valid = false;
+			return;
+		}
+		state->nodes = nodes;
+		state->node_capacity = capacity;
+	}
+	unsigned int first = 0;
+	for( unsigned int i = 0; i < selection_pool.num_jobs; ++i ) {
+		const lod_selection_buffer_t *buffer = &selection_pool.buffers[i];
+		if( buffer->count > 0 )
+			memcpy( &state->nodes[first], buffer->nodes, buffer->count * sizeof(selected_node_t) );
+		first += buffer->count;
+	}
+}
@@ -0,0 +1,33 @@
+/* Spreads the lod selection of the ready tiles over worker threads. The top level nodes of all tiles,
+ * in tile order, are cut into one contiguous run per thread, and every thread selects into a buffer
+ * of its own. The buffers are appended in run order, so the selection is the same as on one thread.
+ * With LOD_SELECTION_REFINE the selection is kept with the margins of its top level nodes, see
+ * node_lod_select(). After a small camera move only the top level nodes whose margin it used up are
+ * selected again, the others add their kept nodes. A change of the near or far plane, or a selection
+ * that overflowed, selects all of them.
+ * Render thread only. */
+
+#pragma once
+
+#include "terrain.h"
+#include <stdbool.h>
+
+// Fewer top level nodes per run aren't worth waking a thread for
+#define SELECTION_POOL_MIN_TOP_NODES_PER_THREAD 64
+
+// Starts LOD_SELECTION_NUM_THREADS-1 workers, the render thread takes the first run
+extern bool selection_pool_create();
+
+// Also frees the selection buffers
+extern void selection_pool_delete();
+
+/* Resets the lod selection and selects from the quadtrees of the ready tiles. Tiles outside the view
+ * frustum are culled as a whole first. Without workers, or for few top level nodes, the render thread
+ * does it alone. */
+extern void selection_pool_select( const tiles_t *const tiles, const unsigned int num_tiles );
+
+// The next selection selects all top level nodes, as if there was no last one
+extern void selection_pool_invalidate();
+
+// Top level nodes the last selection kept the nodes of. num_tops gets all of its top level nodes.
+extern unsigned int selection_pool_get_num_kept_tops( unsigned int *num_tops );
@@ -6,11 +6,27 @@
 #define NUMBER_OF_LOD_LEVELS 5
 // @todo what's that for ?
 #define NUMBER_OF_GRID_MESHES (NUMBER_OF_LOD_LEVELS+1)
-// @todo should depend on node size and lod levels
-#define MAX_NUMBER_SELECTED_NODES 1024
+// Selection buffers start with this many nodes and double when full. They keep their size across frames.
+#define LOD_SELECTION_INITIAL_CAPACITY 1024
+// Hard limit of a selection, the nodes beyond it are not drawn
+#define MAX_NUMBER_SELECTED_NODES ( 64 * 1024 )
+// A selection that keeps overflowing is reported again after this many selections
+#define LOD_SELECTION_OVERFLOW_REPORT_INTERVAL 1000
+// Threads the lod selection is spread over, the render thread included. See selection_pool.h
+#define LOD_SELECTION_NUM_THREADS 4
+/* 1 keeps the nodes of the top level nodes no test of which a small camera move could flip, and
+ * reselects the others only. See selection_pool.h */
+#define LOD_SELECTION_REFINE 1
+// A kept top level node is reselected once its margin falls below this, for rounding
+#define LOD_SELECTION_REFINE_SLACK 0.5f
+/* 1 selects the lod nodes in a compute shader and draws them from the buffers it writes, see
+ * gpu_selection.h. Falls back to the cpu selection if the shader can't be created. */
+#define LOD_SELECTION_ON_GPU 0
 // @todo: calc from number of lod levels and heightmap size. Memory usage rises for small nodes.
 // Must be power of 2.
 #define LEAF_NODE_SIZE 32
+// Texels per side of the finest min/max pyramid cell. Power of 2, not larger than LEAF_NODE_SIZE.
+#define MINMAX_PYRAMID_BASE_SIZE 8
 /* Determines rendering LOD level distribution based on distance from the viewer.
  * Value of 2.0 should result in equal number of triangles displayed on screen (in
  * average) for all distances. Values above 2.0 will result in less triangles
@@ -22,16 +38,53 @@
 // texel to grid ratio
 #define RENDER_GRID_RESULUTION_MULT 2
 #define GRIDMESH_DIMENSION (LEAF_NODE_SIZE * RENDER_GRID_RESULUTION_MULT)
+// Post transform cache entries the gridmesh's triangle order is optimized for, between 4 and 64
+#define GRIDMESH_VERTEX_CACHE_SIZE 32
 // Temporary, magic number to keep things visible
 #define HEIGHT_FACTOR (655.35f*2.0f)
+// World height of a 16 bit height step. Bounds are height * HEIGHT_SCALE, one multiply that rounds
+// the same on the cpu and in lod_select.comp.glsl.
+#define HEIGHT_SCALE ( HEIGHT_FACTOR / 65535.0f )
 
 // heightmap texture is bound to this texture unit, shader expects it
 #define HEIGHTMAP_TEXTURE_UNIT 0
+/* GPU storage of the heightmap, all sample as 0..1 in the shader. GL_R16 (default) keeps the full
+ * 16 bit precision at half the memory of GL_R32F. GL_R16F has 11 bits of mantissa only. */
+#define HEIGHTMAP_TEXTURE_FORMAT GL_R16
+/* 1 keeps the cpu copy of loaded tiles packed, see packed_heights.h. Less resident memory, but
+ * uploads decode the rows into the staging ring and height queries decode single texels. */
+#define HEIGHTMAP_PACK_HEIGHTS 0
+/* 1 drops the cpu copy of a tile's texels once they are on the gpu. Only the min/max pyramid down to
+ * cells of HEIGHTMAP_GPU_ONLY_CELL_SIZE texels is kept for approximate height queries. A tile that
+ * leaves the gpu is reloaded from disk. Virtual heightmaps always keep their texels. */
+#define HEIGHTMAP_GPU_ONLY 0
+#define HEIGHTMAP_GPU_ONLY_CELL_SIZE LEAF_NODE_SIZE
+// Larger heightmaps are not uploaded as one texture but streamed through a clipmap, see clipmap.h
+#define HEIGHTMAP_MAX_TEXTURE_EXTENT 16384
+// Largest tile extent at all, the largest the clipmap was checked with, see bench/clipmap_test.c
+#define TERRAIN_TILE_MAX_EXTENT (1u << 15)
+// Texels per side of a clipmap level. Power of 2, must cover the visibility range of a lod level.
+#define CLIPMAP_SIZE 1024
+// Windows move in steps of this many level texels, fewer but larger strip uploads
+#define CLIPMAP_UPDATE_GRANULARITY 16
+// The clipmap texture array is bound to this unit, shader expects it
+#define HEIGHTMAP_CLIPMAP_TEXTURE_UNIT 1
 
-#define TERRAIN_MAX_TILES 1
+// Tiles known to the terrain. Only the ones near the camera are held in memory, see tile_cache.h
+#define TERRAIN_MAX_TILES 1024
+// Optional list of tiles, one "heightmap bounding_box_file" pair per line
+#define TERRAIN_TILE_LIST "resources/terrain/tiles.txt"
+// Tile uploads started per frame. Bytes per frame are bounded by the texture uploader.
+#define TILE_UPLOADS_PER_FRAME 1
+// Budgets of the tile cache in bytes. Main memory includes mapped files.
+#define TILE_CACHE_MEMORY_BUDGET ((size_t)2048 * 1024 * 1024)
+#define TILE_CACHE_GPU_BUDGET ((size_t)1024 * 1024 * 1024)
+// Tiles closer than far plane * factor are loaded, the rest is only kept while the budgets allow
+#define TILE_CACHE_RANGE_FACTOR 1.25f
 
 typedef struct gridmesh_t gridmesh_t;
 typedef struct heightmap_t heightmap_t;
+typedef struct lod_selection_buffer_t lod_selection_buffer_t;
 typedef struct node_t node_t;
 typedef struct quadtree_t quadtree_t;
 typedef struct terrain_tile_t terrain_tile_t;
@@ -6,7 +6,13 @@
 #include "lod_selection.h"
 #include "gridmesh.h"
 #include "base/logbook.h"
+#include "base/mapped_file.h"
 #include "heightmap.h"
+#include "tile_loader.h"
+#include "tile_cache.h"
+#include "selection_pool.h"
+#include "draw_list.h"
+#include "gpu_selection.h"
 #include "base/camera.h"
 #include "base/window.h"
 #include "omath/common.h"
@@ -14,10 +20,15 @@
 #include "renderer/color.h"
 #include "renderer/shader_program.h"
 #include "renderer/sampler.h"
+#include "renderer/texture_uploader.h"
+#include "renderer/vertex_cache.h"
 #include <stddef.h>
 #include <string.h>
+#include <stdio.h>
 
 static void debug_draw_boxes();
+static bool add_tile( const char *filename, const char *bb_file );
+static bool add_tiles_from_list( const char *list_filename );
 static inline bool check_params();
 static inline void set_shader_uniform_locations();
 
@@ -33,27 +44,38 @@ bool terrain_create( const bool list_nodes ) {
 	terrain.gridmesh = gridmesh_create( GRIDMESH_DIMENSION, terrain.gridmesh );
 	if( !terrain.gridmesh )
 		return false;
-	terrain.tiles[0] = terrain_tile_create(
-			"resources/terrain/area_52_06/tile_4096_1.png", "resources/terrain/area_52_06/tile_4096_1.bb",
-			list_nodes, terrain.tiles[0]
-	);
-	if( !terrain.tiles[0] ) {
+	if( !draw_list_create( terrain.gridmesh ) ) {
 		terrain_delete();
 		return false;
 	}
-	const unsigned int size = terrain.tiles[0]->heightmap->extent;
-	if( !is_pow2u(size) || size < 2 * LEAF_NODE_SIZE || size > 16384 ) {
-		logbook_log( LOG_ERROR, "Terrain tile extent must be pow2 and between 2*LEAF_NODE_SIZE and 16384" );
-		terrain_delete();
-		return false;
-	}
-	terrain.num_tiles = 1;
+	terrain.gpu_selection = LOD_SELECTION_ON_GPU && gpu_selection_create( terrain.gridmesh );
+	if( LOD_SELECTION_ON_GPU && !terrain.gpu_selection )
+		logbook_log( LOG_WARNING, "Lod selection falls back to the cpu" );
 	// Create terrain shaders
 	if( !sp_create( "src/terrain/terrain.vert.glsl", "src/terrain/terrain.frag.glsl", &terrain.shader ) ) {
 		terrain_delete();
 		return false;
 	}
 	set_shader_uniform_locations();
+	// Not fatal, textures are uploaded directly then
+	texture_uploader_create();
+	// Tiles are only registered here. The cache requests them from the loader when in range.
+	if( !tile_loader_create( list_nodes ) ) {
+		terrain_delete();
+		return false;
+	}
+	tile_cache_create( TILE_CACHE_MEMORY_BUDGET, TILE_CACHE_GPU_BUDGET );
+	// Not fatal either, the render thread selects alone then
+	selection_pool_create();
+	terrain.num_tiles = 0;
+	const bool has_tiles = mapped_file_exists( TERRAIN_TILE_LIST ) ?
+			add_tiles_from_list( TERRAIN_TILE_LIST ) :
+			add_tile( "resources/terrain/area_52_06/tile_4096_1.png", "resources/terrain/area_52_06/tile_4096_1.bb" );
+	if( !has_tiles || 0 == terrain.num_tiles ) {
+		logbook_log( LOG_ERROR, "No terrain tiles" );
+		terrain_delete();
+		return false;
+	}
 	return true;
 }
 
@@ -67,14 +89,11 @@ bool terrain_setup() {
 	// @todo Should be sorted by tileIndex, distanceToCamera and lodLevel
 	const bool sort_selection = false;
 	lod_selection_create(sort_selection);
+	terrain.has_selection = false;
 	// Set global shader uniforms valid for all tiles
 	glUseProgram(terrain.shader);
-	// Set global shader uniforms for this quadtree/heightmap; tile extent = heightmap extent for now
-	const float extent = (float)terrain.tiles[0]->heightmap->extent;
-	// Used to clamp edges to correct terrain extent (only max-es needs clamping, min-s are clamped implicitly)
-	glUniform2f( terrain.u_tile_to_texture, (extent-1.0f)/extent, (extent-1.0f)/extent );
-	glUniform4f( terrain.u_heightmap_texture_info, extent, extent, 1.0f/extent, 1.0f/extent );
 	glUniform1f( terrain.u_height_factor, (GLfloat)HEIGHT_FACTOR );
+	glUniform2f( terrain.u_clipmap_info, (float)CLIPMAP_SIZE, 1.0f / (float)CLIPMAP_SIZE );
 	const float dim = (float)GRIDMESH_DIMENSION;
 	glUniform3f( terrain.u_griddim, dim, dim*0.5f, 2.0f/dim );
 	// Global lighting
@@ -92,17 +111,39 @@ void terrain_render( const bool draw_boxes, const bool draw_terrain ) {
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
 
-	lod_selection_reset();
+	tile_cache_update( terrain.tiles, terrain.num_tiles, camera_get_position(),
+			camera_get_far_plane() * TILE_CACHE_RANGE_FACTOR );
+
+	/* Reselect only when the camera moved or tiles became ready or went away since the last selection.
+	 * After a small move the selection pool selects again only the top level nodes the move could
+	 * change, see selection_pool.h. The gpu selection is always a full one. */
+	bool needs_selection = !terrain.has_selection || terrain.selection_camera_version != camera_get_version();
 	for( unsigned int i = 0; i < terrain.num_tiles; ++i ) {
-		lod_selection_set_tile_index(i);
-		quadtree_lod_select(terrain.tiles[i]->quadtree);
+		const bool is_ready = ready == atomic_load( &terrain.tiles[i].status );
+		if( is_ready )
+			terrain_tile_update( terrain.tiles[i].tile, camera_get_position() );
+		needs_selection = needs_selection || is_ready != terrain.tiles[i].is_selected;
+		terrain.tiles[i].is_selected = is_ready;
+	}
+	// After the tile updates, so clipmap strips queued this frame usually go with it
+	texture_uploader_update();
+	if( needs_selection ) {
+		if( terrain.gpu_selection )
+			gpu_selection_select( terrain.tiles, terrain.num_tiles );
+		else {
+			selection_pool_select( terrain.tiles, terrain.num_tiles );
+			lod_selection_sort();
+			draw_list_build( terrain.gridmesh, terrain.num_tiles );
+		}
+		terrain.has_selection = true;
+		terrain.selection_camera_version = camera_get_version();
 	}
-	lod_selection_sort();
+	// A gpu selection isn't on the cpu to print or show
 	const bool print_selection = false;
-	if( print_selection )
+	if( print_selection && !terrain.gpu_selection )
 		lod_selection_print();
 
-	if( draw_boxes )
+	if( draw_boxes && !terrain.gpu_selection )
 		debug_draw_boxes();
 	if( !draw_terrain )
 		return;
@@ -122,15 +163,32 @@ void terrain_render( const bool draw_boxes, const bool draw_terrain ) {
 	glUniformMatrix3fv( terrain.u_normal_matrix, 1, GL_FALSE, (float*)&normal_matrix );
 	// Matrices and uniforms for terrain CDLOD
 	glUniform3fv( terrain.u_camera_position, 1, (float*)camera_get_position() );
-	// Draw tile by tile
+	// Draw tile by tile, nodes are in the draw list's or the gpu selection's buffers
+	if( terrain.gpu_selection )
+		gpu_selection_bind();
+	else
+		draw_list_bind();
 	const GLenum draw_mode = window_get_draw_mode();
 	for( unsigned int i = 0; i < terrain.num_tiles; ++i ) {
+		if( ready != atomic_load( &terrain.tiles[i].status ) )
+			continue;
+		const terrain_tile_t *tile = terrain.tiles[i].tile;
 		// set tile world coords
-		glUniform2f( terrain.u_tile_max, terrain.tiles[i]->aabb.max.x, terrain.tiles[i]->aabb.max.z );
+		glUniform2f( terrain.u_tile_max, tile->aabb.max.x, tile->aabb.max.z );
 		vec3f tile_scale;
-		vec3f_sub( &terrain.tiles[i]->aabb.max, &terrain.tiles[i]->aabb.min, &tile_scale );
+		vec3f_sub( &tile->aabb.max, &tile->aabb.min, &tile_scale );
 		glUniform3fv( terrain.u_tile_scale, 1, (float*)&tile_scale );
-		glUniform3fv( terrain.u_tile_offset, 1, (float*)&terrain.tiles[i]->aabb.min );
+		glUniform3fv( terrain.u_tile_offset, 1, (float*)&tile->aabb.min );
+		// tile extent = heightmap extent for now
+		const float extent = (float)tile->heightmap->extent;
+		// Used to clamp edges to correct terrain extent (only max-es needs clamping, min-s are clamped implicitly)
+		glUniform2f( terrain.u_tile_to_texture, (extent-1.0f)/extent, (extent-1.0f)/extent );
+		glUniform4f( terrain.u_heightmap_texture_info, extent, extent, 1.0f/extent, 1.0f/extent );
+		// Virtual heightmaps are sampled from the clipmap windows
+		clipmap_t *clipmap = tile->heightmap->clipmap;
+		glUniform1i( terrain.u_clipmap_levels, clipmap ? (GLint)clipmap->num_levels : 0 );
+		if( clipmap )
+			glUniform2iv( terrain.u_clipmap_origins, (GLsizei)clipmap->num_levels, clipmap_get_resident_origins( clipmap ) );
 		int num_tris, num_nodes;
 		terrain_tile_render( &terrain, i, draw_mode, &num_tris, &num_nodes );
 		num_rendered_triangles += num_tris;
@@ -141,11 +199,20 @@ void terrain_render( const bool draw_boxes, const bool draw_terrain ) {
 void terrain_cleanup() {}
 
 void terrain_delete() {
+	// Workers must be gone before their tiles are touched
+	tile_loader_delete();
+	selection_pool_delete();
+	lod_selection_log_stats();
+	lod_selection_delete();
+	draw_list_delete();
+	gpu_selection_delete();
+	terrain.gpu_selection = false;
 	if( terrain.gridmesh )
 		terrain.gridmesh = gridmesh_delete(terrain.gridmesh);
-	if( terrain.num_tiles > 0 )
-		for( unsigned int i = 0; i < terrain.num_tiles; ++i )
-			terrain.tiles[i] = terrain_tile_delete(terrain.tiles[i]);
+	for( unsigned int i = 0; i < terrain.num_tiles; ++i )
+		terrain.tiles[i].tile = terrain_tile_delete(terrain.tiles[i].tile);
+	terrain.num_tiles = 0;
+	texture_uploader_delete();
 	if( glIsProgram(terrain.shader) )
 		glDeleteProgram(terrain.shader);
 	draw_aabb_delete();
@@ -156,36 +223,99 @@ void debug_draw_boxes() {
 	// To keep the below less verbose
 	glUseProgram(draw_abb_get_program());
 	sp_set_uniform_mat4f( draw_abb_get_program(), "projViewMatrix", camera_get_view_projection_matrix() );
-	for( unsigned int i = 0; i < terrain.num_tiles; ++i ) {
-		for( unsigned int i = 0; i < lod_selection_get_selection_count(); ++i ) {
+	for( unsigned int t = 0; t < terrain.num_tiles; ++t ) {
+		unsigned int count;
+		const unsigned int first = lod_selection_get_tile_nodes( t, &count );
+		const terrain_tile_t *tile = terrain.tiles[t].tile;
+		for( unsigned int i = first; i < first + count; ++i ) {
 			const selected_node_t *n = lod_selection_get_selected_node(i);
 			const bool draw_full = n->hasTL && n->hasTR && n->hasBL && n->hasBR;
 			if( draw_full )
 				// expand by -0.003f
-				draw_aabb( &n->node->aabb, &color_rainbow[n->node->level] );
+				draw_aabb( &n->aabb, &color_rainbow[n->node->level] );
 			else {
-				if( n->hasTL )
-					// expand by -0.002f
-					draw_aabb( &n->node->subTL->aabb, &color_rainbow[n->node->subTL->level] );
-				if( n->hasTR )
-					// expand by -0.002f
-					draw_aabb( &n->node->subTR->aabb, &color_rainbow[n->node->subTR->level] );
-				if( n->hasBL )
-					// expand by -0.002f
-					draw_aabb( &n->node->subBL->aabb, &color_rainbow[n->node->subBL->level] );
-				if( n->hasBR )
-					// expand by -0.002f
-					draw_aabb( &n->node->subBR->aabb, &color_rainbow[n->node->subBR->level] );
+				// expand by -0.002f
+				const bool has_sub[4] = { n->hasTL, n->hasTR, n->hasBL, n->hasBR };
+				for( unsigned int s = 0; s < 4; ++s ) {
+					const node_t *sub_node = node_get_sub_node( n->node, tile->quadtree, s );
+					if( !has_sub[s] || !sub_node )
+						continue;
+					aabbf aabb;
+					node_get_aabb( sub_node, tile, &aabb );
+					draw_aabb( &aabb, &color_rainbow[sub_node->level] );
+				}
 			}
 		}
 	}
 }
 
+// Registers a tile, it is loaded by the tile cache when in range
+bool add_tile( const char *filename, const char *bb_file ) {
+	char msg[MAX_LEN_MESSAGES];
+	if( terrain.num_tiles >= TERRAIN_MAX_TILES ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Tile '%s' not added, more than %d tiles", filename, TERRAIN_MAX_TILES );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	if( strlen(filename) >= MAX_LEN_FILENAMES-1 || strlen(bb_file) >= MAX_LEN_FILENAMES-1 ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Tile filename '%s' too long", filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	tiles_t *entry = &terrain.tiles[terrain.num_tiles];
+	if( !terrain_tile_read_aabb( bb_file, &entry->aabb ) )
+		return false;
+	entry->tile = NULL;
+	entry->tile_index = terrain.num_tiles;
+	strcpy( entry->filename, filename );
+	strcpy( entry->bb_file, bb_file );
+	entry->last_used_frame = 0;
+	entry->distance_to_camera = 0.0f;
+	entry->is_selected = false;
+	atomic_init( &entry->status, unloaded );
+	++terrain.num_tiles;
+	return true;
+}
+
+// One "heightmap bounding_box_file" pair per line. Tiles that can't be added are skipped.
+bool add_tiles_from_list( const char *list_filename ) {
+	char msg[MAX_LEN_MESSAGES];
+	FILE *list = fopen( list_filename, "r" );
+	if( !list ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error opening tile list '%s'", list_filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	char filename[MAX_LEN_FILENAMES], bb_file[MAX_LEN_FILENAMES];
+	// width = MAX_LEN_FILENAMES-1
+	while( 2 == fscanf( list, "%99s %99s", filename, bb_file ) )
+		add_tile( filename, bb_file );
+	fclose( list );
+	snprintf( msg, MAX_LEN_MESSAGES-1, "%d tiles listed in '%s'", terrain.num_tiles, list_filename );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
 bool check_params() {
 	if( !is_pow2u(LEAF_NODE_SIZE) || LEAF_NODE_SIZE < 8 || LEAF_NODE_SIZE > 1024 ) {
 		logbook_log( LOG_ERROR, "Settings LEAF_NODE_SIZE must be power of 2 and between 2 and 1024" );
 		return false;
 	}
+	if( HEIGHTMAP_TEXTURE_FORMAT != GL_R16 && HEIGHTMAP_TEXTURE_FORMAT != GL_R16F &&
+			HEIGHTMAP_TEXTURE_FORMAT != GL_R32F ) {
+		logbook_log( LOG_ERROR, "Settings HEIGHTMAP_TEXTURE_FORMAT must be GL_R16, GL_R16F or GL_R32F" );
+		return false;
+	}
+	if( !is_pow2u(MINMAX_PYRAMID_BASE_SIZE) || MINMAX_PYRAMID_BASE_SIZE > LEAF_NODE_SIZE ) {
+		logbook_log( LOG_ERROR, "Settings MINMAX_PYRAMID_BASE_SIZE must be power of 2 and not larger than LEAF_NODE_SIZE" );
+		return false;
+	}
+	if( !is_pow2u(CLIPMAP_SIZE) || CLIPMAP_SIZE < 4 * CLIPMAP_UPDATE_GRANULARITY ||
+			CLIPMAP_SIZE > HEIGHTMAP_MAX_TEXTURE_EXTENT ) {
+		logbook_log( LOG_ERROR,
+				"Settings CLIPMAP_SIZE must be power of 2, at least 4*CLIPMAP_UPDATE_GRANULARITY and not larger than HEIGHTMAP_MAX_TEXTURE_EXTENT" );
+		return false;
+	}
 	if( !is_pow2u(RENDER_GRID_RESULUTION_MULT) ||
 			RENDER_GRID_RESULUTION_MULT<1 || RENDER_GRID_RESULUTION_MULT>LEAF_NODE_SIZE ) {
 		logbook_log( LOG_ERROR,
@@ -204,6 +334,10 @@ bool check_params() {
 		logbook_log( LOG_ERROR, "Gridmesh dimension must be power of 2 and > 8 and < 1024." );
 		return false;
 	}
+	if( GRIDMESH_VERTEX_CACHE_SIZE < 4 || GRIDMESH_VERTEX_CACHE_SIZE > VERTEX_CACHE_MAX_SIZE ) {
+		logbook_log( LOG_ERROR, "Settings GRIDMESH_VERTEX_CACHE_SIZE must be between 4 and VERTEX_CACHE_MAX_SIZE" );
+		return false;
+	}
 	return true;
 }
 
@@ -215,10 +349,10 @@ static inline void set_shader_uniform_locations() {
 	terrain.u_tile_max = glGetUniformLocation( terrain.shader, "u_tile_max" );
 	terrain.u_tile_to_texture = glGetUniformLocation( terrain.shader, "u_tile_to_texture" );
 	terrain.u_heightmap_texture_info = glGetUniformLocation( terrain.shader, "u_heightmap_texture_info" );
+	terrain.u_clipmap_levels = glGetUniformLocation( terrain.shader, "u_clipmap_levels" );
+	terrain.u_clipmap_info = glGetUniformLocation( terrain.shader, "u_clipmap_info" );
+	terrain.u_clipmap_origins = glGetUniformLocation( terrain.shader, "u_clipmap_origins" );
 	terrain.u_griddim = glGetUniformLocation( terrain.shader, "u_griddim" );
-	terrain.u_node_offset = glGetUniformLocation( terrain.shader, "u_node_offset" );
-	terrain.u_node_scale = glGetUniformLocation( terrain.shader, "u_node_scale" );
-	terrain.u_morph_consts = glGetUniformLocation( terrain.shader, "u_morph_consts" );
 	terrain.u_camera_position = glGetUniformLocation( terrain.shader, "u_camera_position" );
 	terrain.u_view_projection_matrix = glGetUniformLocation( terrain.shader, "u_view_projection_matrix" );
 	terrain.u_model_view_matrix = glGetUniformLocation( terrain.shader, "u_model_view_matrix" );
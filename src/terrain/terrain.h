@@ -2,21 +2,42 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include "settings.h"
+#include "glad/glad.h"
+#include "omath/aabb.h"
 
-typedef enum { requested, loading, ready } tile_status_t;
+/* requested -> loading -> loaded are set by the tile loader, loaded -> uploading -> ready by the
+ * render thread while the texture upload runs. Only ready tiles are selected and drawn. The tile
+ * cache demotes uploading or ready -> loaded and evicts loaded -> unloaded. */
+typedef enum { unloaded, requested, loading, loaded, uploading, ready, failed } tile_status_t;
 
 typedef struct tiles_t {
+	// Owned by the loader thread until the status is loaded
 	terrain_tile_t *tile;
 	unsigned int tile_index;
-	tile_status_t status;
+	char filename[MAX_LEN_FILENAMES];
+	char bb_file[MAX_LEN_FILENAMES];
+	// Read from bb_file on registration, for distances before the tile is loaded
+	aabbf aabb;
+	// For the tile cache's eviction order
+	unsigned int last_used_frame;
+	float distance_to_camera;
+	// Was ready when the current lod selection was made. Render thread only.
+	bool is_selected;
+	_Atomic tile_status_t status;
 } tiles_t;
 
 struct terrain_t {
 	gridmesh_t *gridmesh;
-	// @todo data structure, loading and unloading
+	// @todo unloading
 	unsigned int num_tiles;
-	terrain_tile_t *tiles[TERRAIN_MAX_TILES];
+	tiles_t tiles[TERRAIN_MAX_TILES];
+	// The lod selection is kept while the camera and the ready tiles stay the same
+	bool has_selection;
+	unsigned int selection_camera_version;
+	// Nodes are selected and drawn by gpu_selection.h, see LOD_SELECTION_ON_GPU
+	bool gpu_selection;
 	GLuint shader;
 	// Is identity
 	//mat4f model_matrix;
@@ -27,10 +48,10 @@ struct terrain_t {
 	GLint u_tile_max;
 	GLint u_tile_to_texture;
 	GLint u_heightmap_texture_info;
+	GLint u_clipmap_levels;
+	GLint u_clipmap_info;
+	GLint u_clipmap_origins;
 	GLint u_griddim;
-	GLint u_node_offset;
-	GLint u_node_scale;
-	GLint u_morph_consts;
 	GLint u_camera_position;
 	// Is identical to vp-matrix GLint u_model_view_projection_matrix;
 	GLint u_view_projection_matrix;
@@ -44,7 +65,8 @@ struct terrain_t {
 	GLint u_terrain_color;
 };
 
-// list_nodes, when true, causes verbose logging put of quadtree built nodes and lod_selection nodes
+/* list_nodes, when true, causes verbose logging put of quadtree built nodes and lod_selection nodes
+ * Tiles are only requested here, they are loaded in the background and show up when ready. */
 bool terrain_create( const bool list_nodes );
 
 void terrain_delete();
@@ -4,8 +4,19 @@
 // This is the position in the grid mesh, not world position !
 layout( location = 0 ) in vec3 position;
 
-// Texture with height values 0..1 ( * 65535 for real world values) above reference ellipsoid
+// Texture with height values 0..1 ( * 65535 for real world values) above reference ellipsoid.
+// Stored as 16 bit unorm (or 16/32 bit float), all formats sample normalized to 0..1.
 layout( binding = 0 ) uniform sampler2D s_tile_heightmap;
+// Heightmaps larger than a texture are sampled from a clipmap instead, see clipmap.h.
+// Layer l holds every (1 << l)th texel around the camera, stored toroidally.
+#define CLIPMAP_MAX_LEVELS 16
+layout( binding = 1 ) uniform sampler2DArray s_tile_clipmap;
+// 0 means the heightmap is a single texture
+uniform int u_clipmap_levels = 0;
+// .x = texels per side of a level, .y = 1/.x
+uniform vec2 u_clipmap_info;
+// Lower left corner of each level's window in level texels
+uniform ivec2 u_clipmap_origins[CLIPMAP_MAX_LEVELS];
 
 uniform float u_height_factor = 1.0f;
 
@@ -23,17 +34,27 @@ uniform vec2 u_tile_to_texture;
 // width, height, 1/width, 1/height in number of posts
 uniform vec4 u_heightmap_texture_info;
 
-// --- Node specific data. Set in the render loop for every npde ---
-// @todo: these could be constants if all tiles are the same !
 // .x = gridDim, .y = gridDimHalf, .z = oneOverGridDimHalf
 uniform vec3 u_griddim;
-// x and z hold horizontal minimums, .y holds the y center of the bounding box
-uniform vec3 u_node_offset;
-// x and z hold the horizontal scale of the bb in world size, .w holds the current lod level
-uniform vec4 u_node_scale;
-// distances for current lod level for begin and end of morphing
-// @todo: These are static in the application for now. Make them dynamic.
-uniform vec4 u_morph_consts;
+
+// --- Node specific data, one entry per selected node. See draw_list.h ---
+struct node_data_t {
+	// x and z hold horizontal minimums, .y holds the y center of the bounding box
+	vec4 offset;
+	// x and z hold the horizontal scale of the bb in world size, .w holds the current lod level
+	vec4 scale;
+	// distances for current lod level for begin and end of morphing
+	vec4 morph_consts;
+};
+layout( std430, binding = 0 ) readonly buffer node_buffer {
+	node_data_t nodes[];
+};
+// The draw command's base instance, read through an instanced attribute
+layout( location = 1 ) in uint node_index;
+// Of the node being drawn, set first thing in main()
+vec3 node_offset;
+vec4 node_scale;
+vec4 morph_consts;
 
 uniform vec3 u_camera_position;
 // Is equal to mvp matrix because terrain model m. is identity
@@ -59,7 +80,7 @@ out VERTEX_OUTPUT {
 
 // Returns position relative to current tile fur texture lookup. Y value unsued.
 vec3 get_tile_vertex_pos( vec3 position ) {
-	vec3 ret_val = position * u_node_scale.xyz + u_node_offset;
+	vec3 ret_val = position * node_scale.xyz + node_offset;
 	ret_val.xz = min( ret_val.xz, u_tile_max );
 	return ret_val;
 }
@@ -75,13 +96,32 @@ vec2 calculate_uv( vec2 vertex ) {
 // morphs vertex .xy from high to low detailed mesh position
 vec2 morph_vertex( vec3 pos, vec2 vertex, float morph_lerp_k ) {
 	vec2 decimals = ( fract( pos.xz * vec2( u_griddim.y, u_griddim.y ) ) * 
-					vec2( u_griddim.z, u_griddim.z ) ) * u_node_scale.xz;
+					vec2( u_griddim.z, u_griddim.z ) ) * node_scale.xz;
 	return vertex - decimals * morph_lerp_k;
 }
 
-// Assumes linear filtering being enabled in sampler
+// Texel is in heightmap texels. Starts at the level matching the grid spacing of the node's lod level
+// and falls back to coarser levels if the texel is not in the window, or the window is still uploading
+// and moved far off. Levels are point sampled.
+float sample_clipmap( vec2 texel ) {
+	int level = clamp( int( node_scale.w ) - 2, 0, u_clipmap_levels - 1 );
+	for( ; level < u_clipmap_levels - 1; ++level ) {
+		vec2 window_texel = texel / float( 1 << level ) - vec2( u_clipmap_origins[level] );
+		if( all( greaterThanEqual( window_texel, vec2( 0.0f ) ) ) &&
+			all( lessThan( window_texel, vec2( u_clipmap_info.x - 1.0f ) ) ) )
+			break;
+	}
+	// The coarsest level covers the whole heightmap. Repeat wrap does the toroidal addressing.
+	vec2 level_uv = ( texel / float( 1 << level ) + 0.5f ) * u_clipmap_info.y;
+	return texture( s_tile_clipmap, vec3( level_uv, float( level ) ) ).r;
+}
+
+// Assumes linear filtering being enabled in sampler. Unorm texels are filtered in
+// normalized space, so the result is the same 0..1 height as with float storage.
 float sample_heightmap( vec2 uv ) {
-	return texture( s_tile_heightmap, uv ).r;
+	if( 0 == u_clipmap_levels )
+		return texture( s_tile_heightmap, uv ).r;
+	return sample_clipmap( uv * u_heightmap_texture_info.xy - 0.5f );
 }
 
 // calculate vertex normal via central difference
@@ -108,7 +148,7 @@ void cdlod_vertex() {
 	vec2 pre_uv = calculate_uv( vertex.xz );
 	vertex.y = sample_heightmap( pre_uv ) * u_height_factor;
 	float eyeDistance = distance( vertex, u_camera_position );
-	vert_out.morph_lerp_k = 1.0f - clamp( u_morph_consts.z - eyeDistance * u_morph_consts.w, 0.0f, 1.0f );
+	vert_out.morph_lerp_k = 1.0f - clamp( morph_consts.z - eyeDistance * morph_consts.w, 0.0f, 1.0f );
 	vertex.xz = morph_vertex( position, vertex.xz, vert_out.morph_lerp_k );
 	vert_out.heightmap_uv = calculate_uv( vertex.xz );
 	vertex.y = sample_heightmap( vert_out.heightmap_uv ) * u_height_factor;
@@ -122,6 +162,9 @@ void cdlod_vertex() {
 }
 
 void main() {
+	node_offset = nodes[node_index].offset.xyz;
+	node_scale = nodes[node_index].scale;
+	morph_consts = nodes[node_index].morph_consts;
 	cdlod_vertex();
 	// This would be the mvp matrix, but m-matrix is identity
     gl_Position = u_view_projection_matrix * vert_out.vertex_position;
@@ -2,16 +2,24 @@
 #include "heightmap.h"
 #include "quadtree.h"
 #include "gridmesh.h"
-#include "lod_selection.h"
+#include "draw_list.h"
+#include "gpu_selection.h"
 #include "terrain_tile.h"
+#include "tile_bundle.h"
 #include "base/logbook.h"
 #include "renderer/shader_program.h"
+#include "omath/common.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
+static bool terrain_tile_build(
+		const char *aabb_filename, const bool list_nodes, const unsigned int num_threads, terrain_tile_t *tile );
+static bool terrain_tile_replace_extension( const char *filename, const char *extension, char *out_filename );
+
 terrain_tile_t *terrain_tile_create(
-		const char *texture_filename, const char *aabb_filename, const bool list_nodes, terrain_tile_t *tile ) {
+		const char *texture_filename, const char *aabb_filename, const bool list_nodes,
+		const unsigned int num_threads, terrain_tile_t *tile ) {
 	if( tile ) {
 		logbook_log( LOG_ERROR, "Non null pointer passed to terrain_tile_create" );
 		return tile;
@@ -24,41 +32,35 @@ terrain_tile_t *terrain_tile_create(
 	tile->heightmap = NULL;
 	tile->quadtree = NULL;
 	strncpy( tile->filename, texture_filename, MAX_LEN_FILENAMES-1 );
-	// Load the heightmap and tile relative and world min/max coords for the bounding boxes
-	// @todo: check if size == terrain::TILE_SIZE !
-	tile->heightmap = heightmap_create( texture_filename, tile->heightmap );
-	char msg[MAX_LEN_MESSAGES];
-	if( !tile->heightmap ) {
-		snprintf( msg, MAX_LEN_MESSAGES-1, "Error loading heightmap texture '%s'", texture_filename );
-		logbook_log( LOG_ERROR, msg );
-		return terrain_tile_delete(tile);
+	tile->filename[MAX_LEN_FILENAMES-1] = 0;
+	strncpy( tile->bb_file, aabb_filename, MAX_LEN_FILENAMES-1 );
+	tile->bb_file[MAX_LEN_FILENAMES-1] = 0;
+	// A bundle next to the heightmap holds everything precomputed. Else build and save one for the next start.
+	char bundle_filename[MAX_LEN_FILENAMES];
+	const bool has_bundle_name =
+			terrain_tile_replace_extension( texture_filename, TILE_BUNDLE_EXTENSION, bundle_filename );
+	if( !( has_bundle_name && tile_bundle_load( bundle_filename, tile ) ) ) {
+		if( !terrain_tile_build( aabb_filename, list_nodes, num_threads, tile ) )
+			return terrain_tile_delete(tile);
+		// A bundle would duplicate the texels of a virtual heightmap, the raw file is mapped directly anyway
+		if( has_bundle_name && !heightmap_is_virtual( tile->heightmap ) )
+			tile_bundle_write( tile, bundle_filename );
 	}
-	FILE *bb = fopen( aabb_filename, "r" );
-	if( !bb ) {
-		snprintf( msg, MAX_LEN_MESSAGES-1,
-				"Error loading heightmap bounding box file '%s'", aabb_filename );
-		logbook_log( LOG_ERROR, msg );
-		return terrain_tile_delete(tile);
-	}
-	if( 6 != fscanf( bb, "%f %f %f %f %f %f",
-			&tile->aabb.min.x, &tile->aabb.min.y, &tile->aabb.min.z,
-			&tile->aabb.max.x, &tile->aabb.max.y, &tile->aabb.max.z ) ) {
+	char msg[MAX_LEN_MESSAGES];
+	const unsigned int size = tile->heightmap->extent;
+	if( !is_pow2u(size) || size < 2 * LEAF_NODE_SIZE || size > TERRAIN_TILE_MAX_EXTENT ) {
 		snprintf( msg, MAX_LEN_MESSAGES-1,
-				"Error reading heightmap bounding box '%s'. Wrong format ?", aabb_filename );
+				"Terrain tile '%s' extent must be pow2 and between 2*LEAF_NODE_SIZE and TERRAIN_TILE_MAX_EXTENT",
+				tile->filename );
 		logbook_log( LOG_ERROR, msg );
-		fclose(bb);
 		return terrain_tile_delete(tile);
 	}
-	fclose(bb);
-
-	// Build quadtree with nodes and their bounding boxes.
-	tile->quadtree = quadtree_create( tile, list_nodes, tile->quadtree );
-	if( !tile->quadtree ) {
-		snprintf( msg, MAX_LEN_MESSAGES-1, "Error '%s' could not be loaded because quadtree error", tile->filename );
-		logbook_log( LOG_ERROR, msg );
-		return terrain_tile_delete(tile);
-	}
-
+	// Have the texels in memory before the tile is handed to the gl thread. Packing reads them all anyway,
+	// the bundle has been written and the quadtree is built, nothing needs the raw texels any more.
+	const bool is_packed = HEIGHTMAP_PACK_HEIGHTS && !heightmap_is_virtual( tile->heightmap ) &&
+			heightmap_pack( tile->heightmap );
+	if( !is_packed )
+		heightmap_prefault( tile->heightmap );
 	// report success
 	snprintf( msg, MAX_LEN_MESSAGES-1,
 			"Terrain tile '%s' loaded. Bounding box (%.2f/%.2f/%.2f)/(%.2f/%.2f/%.2f)",
@@ -82,65 +84,113 @@ inline terrain_tile_t *terrain_tile_delete( terrain_tile_t *tile ) {
 	return tile;
 }
 
+inline bool terrain_tile_upload( terrain_tile_t *tile ) {
+	return heightmap_upload( tile->heightmap );
+}
+
+inline void terrain_tile_update( terrain_tile_t *tile, const vec3f *const camera_position ) {
+	// Camera position in texels, mapped like the vertex shader does
+	const float extent_1 = (float)tile->heightmap->extent - 1.0f;
+	const float texel_x = ( camera_position->x - tile->aabb.min.x ) / ( tile->aabb.max.x - tile->aabb.min.x ) * extent_1;
+	const float texel_z = ( camera_position->z - tile->aabb.min.z ) / ( tile->aabb.max.z - tile->aabb.min.z ) * extent_1;
+	heightmap_update( tile->heightmap, texel_x, texel_z );
+}
+
+inline bool terrain_tile_is_uploaded( const terrain_tile_t *const tile ) {
+	return heightmap_is_uploaded( tile->heightmap );
+}
+
+inline void terrain_tile_release_gpu( terrain_tile_t *tile ) {
+	heightmap_release_texture( tile->heightmap );
+}
+
+inline bool terrain_tile_drop_cpu_heights( terrain_tile_t *tile ) {
+	return heightmap_drop_height_values( tile->heightmap );
+}
+
+inline bool terrain_tile_has_cpu_heights( const terrain_tile_t *const tile ) {
+	return heightmap_has_height_values( tile->heightmap );
+}
+
+inline size_t terrain_tile_get_memory_size( const terrain_tile_t *const tile ) {
+	return sizeof(terrain_tile_t) + heightmap_get_memory_size( tile->heightmap ) + quadtree_get_size( tile->quadtree );
+}
+
+inline size_t terrain_tile_get_gpu_size( const terrain_tile_t *const tile ) {
+	const bool on_gpu = tile->heightmap->texture || tile->heightmap->clipmap;
+	return on_gpu ? heightmap_get_texture_size( tile->heightmap ) : 0;
+}
+
+bool terrain_tile_read_aabb( const char *aabb_filename, aabbf *aabb ) {
+	char msg[MAX_LEN_MESSAGES];
+	FILE *bb = fopen( aabb_filename, "r" );
+	if( !bb ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1,
+				"Error loading heightmap bounding box file '%s'", aabb_filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	if( 6 != fscanf( bb, "%f %f %f %f %f %f",
+			&aabb->min.x, &aabb->min.y, &aabb->min.z, &aabb->max.x, &aabb->max.y, &aabb->max.z ) ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1,
+				"Error reading heightmap bounding box '%s'. Wrong format ?", aabb_filename );
+		logbook_log( LOG_ERROR, msg );
+		fclose(bb);
+		return false;
+	}
+	fclose(bb);
+	return true;
+}
+
 /* Needs a pointer to the shader to pass in uniforms
  * Returns number of rendered nodes (x) and triangles (y) */
 void terrain_tile_render(
 		const terrain_t *const terrain, const unsigned int tile_index,
 		const GLenum draw_mode, int *num_tris, int *num_nodes ) {
-	*num_tris = 0; *num_nodes = 0;
-	heightmap_bind( terrain->tiles[tile_index]->heightmap );
-	// Submeshes are evenly spaced in index buffer. Else calc offsets individually.
-	const int half_d = terrain->gridmesh->end_index_tl;
-	// Iterate through the lod selection's lod levels
-	for( unsigned int i = lod_selection_get_min_level(); i <= lod_selection_get_max_level(); ++i ) {
-		const unsigned int filter_lod_level = i;
-		unsigned int prev_morph_const_level_set = 1000000;
-		for( unsigned int i = 0; i < lod_selection_get_selection_count(); ++i ) {
-			const selected_node_t *n = lod_selection_get_selected_node(i);
-			// Only draw tiles of the currently bound heightmap; filter out nodes if not of the current level
-			if( n->tile_index != tile_index || filter_lod_level != n->lod_level )
-				continue;
-			// Set LOD level specific consts if they have changed from last lod level
-			if( prev_morph_const_level_set != n->lod_level ) {
-				prev_morph_const_level_set = n->lod_level;
-				const vec4f v = lod_selection_get_morph_consts( prev_morph_const_level_set-1 );
-				glUniform4fv( terrain->u_morph_consts, 1, (float*)&v );
-			}
-			bool draw_full = n->hasTL && n->hasTR && n->hasBL && n->hasBR;
-			const aabbf *const bb = &n->node->aabb;
-			// .w holds the current lod level
-			vec3f size;
-			aabbf_get_size(bb,&size);
-			glUniform4f( terrain->u_node_scale, size.x, 0.0f, size.z, (float)n->lod_level );
-			glUniform3f( terrain->u_node_offset, bb->min.x, (bb->min.y+bb->max.y) * 0.5f, bb->min.z );
-			if( draw_full ) {
-				glDrawElements( draw_mode, terrain->gridmesh->num_indices, GL_UNSIGNED_INT, NULL );
-				(*num_nodes)++;
-				*num_tris += terrain->gridmesh->num_indices / 3;
-			} else {
-				const GLsizeiptr i_size = (GLsizeiptr)sizeof(GLuint);
-				// can be optimized by combining calls
-				if( n->hasTL ) {
-					glDrawElements( draw_mode, half_d, GL_UNSIGNED_INT, NULL );
-					(*num_nodes)++;
-					*num_tris += half_d / 3;
-				}
-				if( n->hasTR ) {
-					glDrawElements( draw_mode, half_d, GL_UNSIGNED_INT, (void *)(terrain->gridmesh->end_index_tl*i_size ) );
-					(*num_nodes)++;
-					*num_tris += half_d / 3;
-				}
-				if( n->hasBL ) {
-					glDrawElements( draw_mode, half_d, GL_UNSIGNED_INT, (void *)(terrain->gridmesh->end_index_tr*i_size) );
-					(*num_nodes)++;
-					*num_tris += half_d / 3;
-				}
-				if( n->hasBR ) {
-					glDrawElements( draw_mode, half_d, GL_UNSIGNED_INT, (void *)(terrain->gridmesh->end_index_bl*i_size) );
-					(*num_nodes)++;
-					*num_tris += half_d / 3;
-				}
-			}
-		}
+	heightmap_bind( terrain->tiles[tile_index].tile->heightmap );
+	// The tile's nodes and quadrants go out in one indirect draw, see draw_list.h
+	if( terrain->gpu_selection )
+		gpu_selection_draw_tile( tile_index, draw_mode, num_tris, num_nodes );
+	else
+		draw_list_draw_tile( tile_index, draw_mode, num_tris, num_nodes );
+}
+
+// *** static stuff
+// Loads the heightmap and the bounding box and builds the quadtree from scratch
+bool terrain_tile_build(
+		const char *aabb_filename, const bool list_nodes, const unsigned int num_threads, terrain_tile_t *tile ) {
+	// Load the heightmap and tile relative and world min/max coords for the bounding boxes
+	// @todo: check if size == terrain::TILE_SIZE !
+	tile->heightmap = heightmap_create( tile->filename, num_threads, tile->heightmap );
+	char msg[MAX_LEN_MESSAGES];
+	if( !tile->heightmap ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error loading heightmap texture '%s'", tile->filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
 	}
+	if( !terrain_tile_read_aabb( aabb_filename, &tile->aabb ) )
+		return false;
+
+	// Build quadtree with nodes and their bounding boxes.
+	tile->quadtree = quadtree_create( tile, list_nodes, num_threads, tile->quadtree );
+	if( !tile->quadtree ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error '%s' could not be loaded because quadtree error", tile->filename );
+		logbook_log( LOG_ERROR, msg );
+		return false;
+	}
+	return true;
+}
+
+// Replaces the extension of filename. False if the result is too long.
+bool terrain_tile_replace_extension( const char *filename, const char *extension, char *out_filename ) {
+	const char *ext = strrchr( filename, '.' );
+	// a dot in a directory name is no extension
+	if( ext && strchr( ext, '/' ) )
+		ext = NULL;
+	const size_t stem_len = ext ? (size_t)( ext - filename ) : strlen( filename );
+	if( stem_len + strlen(extension) >= MAX_LEN_FILENAMES-1 )
+		return false;
+	memcpy( out_filename, filename, stem_len );
+	strcpy( out_filename + stem_len, extension );
+	return true;
 }
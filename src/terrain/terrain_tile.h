@@ -7,6 +7,7 @@
 #include "omath/vec2.h"
 #include "glad/glad.h"
 #include "terrain.h"
+#include <stddef.h>
 
 struct terrain_tile_t {
 	char filename[MAX_LEN_FILENAMES];
@@ -19,11 +20,40 @@ struct terrain_tile_t {
 };
 
 /* Pathname of the tile heightmap
+ * Only does cpu work and file i/o, so it can be called from the tile loader threads.
  * Ellispoid is used to calculate world cartesian positions of posts from lower left corner
  * and anular distance between posts. Positions are stored as high/low floats in two textures.
- * two files needed: the 16 bit monochrome texture and the bounding box in world coords */
+ * two files needed: the 16 bit monochrome texture and the bounding box in world coords
+ * num_threads, the calling one included, decode a compressed heightmap and build the quadtree. */
 terrain_tile_t *terrain_tile_create(
-		const char *texture_filename, const char *aabb_filename, const bool list_nodes, terrain_tile_t *tile );
+		const char *texture_filename, const char *aabb_filename, const bool list_nodes,
+		const unsigned int num_threads, terrain_tile_t *tile );
+
+// Creates the gpu resources of a tile made by terrain_tile_create(). Gl thread only.
+extern bool terrain_tile_upload( terrain_tile_t *tile );
+
+// Per frame gpu work of a ready tile, e.g. moving the clipmap of a virtual heightmap. Gl thread only.
+extern void terrain_tile_update( terrain_tile_t *tile, const vec3f *const camera_position );
+
+// True when the uploads started by terrain_tile_upload() are done and the tile can be drawn
+extern bool terrain_tile_is_uploaded( const terrain_tile_t *const tile );
+
+// Deletes the gpu resources, the tile stays in memory and can be uploaded again. Gl thread only.
+extern void terrain_tile_release_gpu( terrain_tile_t *tile );
+
+/* Frees the texels once uploaded, see HEIGHTMAP_GPU_ONLY. Nodes and bounding boxes stay, the tile
+ * can be drawn but not uploaded again. */
+extern bool terrain_tile_drop_cpu_heights( terrain_tile_t *tile );
+
+// False once the texels were dropped, the gpu then holds the only copy
+extern bool terrain_tile_has_cpu_heights( const terrain_tile_t *const tile );
+
+// Bytes the tile occupies in main memory and, if uploaded, in video memory
+extern size_t terrain_tile_get_memory_size( const terrain_tile_t *const tile );
+extern size_t terrain_tile_get_gpu_size( const terrain_tile_t *const tile );
+
+// Reads the six floats min x/y/z, max x/y/z of a bounding box file
+bool terrain_tile_read_aabb( const char *aabb_filename, aabbf *aabb );
 
 extern terrain_tile_t *terrain_tile_delete( terrain_tile_t *tile );
 
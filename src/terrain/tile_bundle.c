@@ -0,0 +1,145 @@
+#include "tile_bundle.h"
+#include "terrain_tile.h"
+#include "heightmap.h"
+#include "minmax_pyramid.h"
+#include "quadtree.h"
+#include "node.h"
+#include "base/logbook.h"
+#include "base/mapped_file.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static bool tile_bundle_get_mtime( const char *filename, int64_t *out_mtime );
+static inline uint64_t tile_bundle_align( const uint64_t offset );
+static bool tile_bundle_fwrite_padding( const uint64_t from, const uint64_t to, FILE *file );
+
+bool tile_bundle_load( const char *bundle_filename, terrain_tile_t *tile ) {
+	char msg[MAX_LEN_MESSAGES];
+	if( !mapped_file_exists( bundle_filename ) )
+		return false;
+	int64_t heightmap_mtime, bb_mtime;
+	if( !tile_bundle_get_mtime( tile->filename, &heightmap_mtime ) ||
+		!tile_bundle_get_mtime( tile->bb_file, &bb_mtime ) )
+		return false;
+	mapped_file_t *file = mapped_file_create( bundle_filename, NULL );
+	if( !file )
+		return false;
+	const tile_bundle_header_t *header = file->data;
+	if( file->size < sizeof(tile_bundle_header_t) ||
+		0 != memcmp( header->magic, TILE_BUNDLE_MAGIC, sizeof(header->magic) ) ||
+		TILE_BUNDLE_VERSION != header->version ||
+		LEAF_NODE_SIZE != header->leaf_node_size ||
+		NUMBER_OF_LOD_LEVELS != header->number_of_lod_levels ||
+		MINMAX_PYRAMID_BASE_SIZE != header->pyramid_base_size ||
+		heightmap_mtime != header->heightmap_mtime || bb_mtime != header->bb_mtime ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Tile bundle '%s' is outdated and will be rebuilt", bundle_filename );
+		logbook_log( LOG_INFO, msg );
+		mapped_file_delete( file );
+		return false;
+	}
+	if( header->nodes_offset + (uint64_t)header->node_count * sizeof(node_t) > header->pyramid_offset ||
+		header->pyramid_offset + header->pyramid_cell_count * sizeof(minmax_t) > header->heightmap_offset ||
+		header->heightmap_offset + sizeof(heightmap_raw_header_t) > file->size ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Tile bundle '%s' is corrupt and will be rebuilt", bundle_filename );
+		logbook_log( LOG_WARNING, msg );
+		mapped_file_delete( file );
+		return false;
+	}
+	tile->aabb = header->tile_aabb;
+	const node_t *nodes = (const node_t *)( (const char *)file->data + header->nodes_offset );
+	const unsigned int node_count = header->node_count;
+	const heightmap_raw_header_t *raw_header =
+			(const heightmap_raw_header_t *)( (const char *)file->data + header->heightmap_offset );
+	minmax_pyramid_t *pyramid = minmax_pyramid_create_from_cells(
+			(const minmax_t *)( (const char *)file->data + header->pyramid_offset ),
+			(size_t)header->pyramid_cell_count, raw_header->extent, NULL );
+	if( !pyramid ) {
+		mapped_file_delete( file );
+		return false;
+	}
+	// The heightmap owns mapping and pyramid from here on, the nodes stay valid as long as the heightmap lives
+	tile->heightmap = heightmap_create_mapped( file, (size_t)header->heightmap_offset, pyramid, tile->heightmap );
+	if( !tile->heightmap )
+		return false;
+	tile->quadtree = quadtree_create_from_nodes( tile, nodes, node_count, tile->quadtree );
+	if( !tile->quadtree ) {
+		tile->heightmap = heightmap_delete( tile->heightmap );
+		return false;
+	}
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Tile '%s' restored from bundle '%s'", tile->filename, bundle_filename );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+bool tile_bundle_write( const terrain_tile_t *const tile, const char *bundle_filename ) {
+	char msg[MAX_LEN_MESSAGES];
+	const quadtree_t *quadtree = tile->quadtree;
+	tile_bundle_header_t header;
+	memset( &header, 0, sizeof(header) );
+	memcpy( header.magic, TILE_BUNDLE_MAGIC, sizeof(header.magic) );
+	header.version = TILE_BUNDLE_VERSION;
+	header.leaf_node_size = LEAF_NODE_SIZE;
+	header.number_of_lod_levels = NUMBER_OF_LOD_LEVELS;
+	header.pyramid_base_size = MINMAX_PYRAMID_BASE_SIZE;
+	if( !tile_bundle_get_mtime( tile->filename, &header.heightmap_mtime ) ||
+		!tile_bundle_get_mtime( tile->bb_file, &header.bb_mtime ) ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Tile bundle '%s' not written, sources not found", bundle_filename );
+		logbook_log( LOG_WARNING, msg );
+		return false;
+	}
+	header.tile_aabb = tile->aabb;
+	header.node_count = quadtree->node_count;
+	const minmax_pyramid_t *pyramid = tile->heightmap->pyramid;
+	header.pyramid_cell_count = pyramid->num_cells;
+	header.nodes_offset = tile_bundle_align( sizeof(header) );
+	const uint64_t nodes_end = header.nodes_offset + (uint64_t)quadtree->node_count * sizeof(node_t);
+	header.pyramid_offset = tile_bundle_align( nodes_end );
+	const uint64_t pyramid_end = header.pyramid_offset + pyramid->num_cells * sizeof(minmax_t);
+	header.heightmap_offset = tile_bundle_align( pyramid_end );
+	FILE *f = fopen( bundle_filename, "wb" );
+	if( !f ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Could not open tile bundle '%s' for writing", bundle_filename );
+		logbook_log( LOG_WARNING, msg );
+		return false;
+	}
+	bool success = 1 == fwrite( &header, sizeof(header), 1, f ) &&
+			tile_bundle_fwrite_padding( sizeof(header), header.nodes_offset, f );
+	success = success && quadtree->node_count == fwrite( quadtree->all_nodes, sizeof(node_t), quadtree->node_count, f );
+	success = success && tile_bundle_fwrite_padding( nodes_end, header.pyramid_offset, f ) &&
+			pyramid->num_cells == fwrite( pyramid->cells, sizeof(minmax_t), pyramid->num_cells, f ) &&
+			tile_bundle_fwrite_padding( pyramid_end, header.heightmap_offset, f ) &&
+			heightmap_fwrite_raw( tile->heightmap, f );
+	success = ( 0 == fclose(f) ) && success;
+	if( !success ) {
+		snprintf( msg, MAX_LEN_MESSAGES-1, "Error writing tile bundle '%s'", bundle_filename );
+		logbook_log( LOG_WARNING, msg );
+		remove( bundle_filename );
+		return false;
+	}
+	const float size = (float)( header.heightmap_offset + heightmap_get_raw_size( tile->heightmap ) ) / 1024.0f;
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Tile bundle '%s' written, %d nodes, %.2fkb",
+			bundle_filename, quadtree->node_count, size );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+// *** static stuff
+bool tile_bundle_get_mtime( const char *filename, int64_t *out_mtime ) {
+	struct stat st;
+	if( stat( filename, &st ) != 0 )
+		return false;
+	*out_mtime = (int64_t)st.st_mtime;
+	return true;
+}
+
+static inline uint64_t tile_bundle_align( const uint64_t offset ) {
+	return ( offset + TILE_BUNDLE_ALIGNMENT - 1 ) / TILE_BUNDLE_ALIGNMENT * TILE_BUNDLE_ALIGNMENT;
+}
+
+bool tile_bundle_fwrite_padding( const uint64_t from, const uint64_t to, FILE *file ) {
+	static const char zeros[TILE_BUNDLE_ALIGNMENT] = { 0 };
+	const size_t count = (size_t)( to - from );
+	return count == 0 || count == fwrite( zeros, 1, count, file );
+}
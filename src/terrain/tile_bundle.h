@@ -0,0 +1,46 @@
+/* Precomputed tile bundle. One versioned binary file per tile that holds the tile bounds,
+ * the quadtree nodes with their min/max heights and bounding boxes, the min/max pyramid
+ * and the heightmap texels.
+ * It is written on the first load of a tile and mapped on the following ones, so neither
+ * the image is decoded nor the quadtree rebuilt.
+ * Layout: header, the node array as in memory, pyramid cells, embedded raw heightmap.
+ * Sections are padded to TILE_BUNDLE_ALIGNMENT. */
+
+#pragma once
+
+#include "settings.h"
+#include "omath/aabb.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+#define TILE_BUNDLE_EXTENSION ".bundle"
+#define TILE_BUNDLE_MAGIC "ORTB"
+#define TILE_BUNDLE_VERSION 4
+// Alignment of the sections in the file
+#define TILE_BUNDLE_ALIGNMENT 16
+
+typedef struct tile_bundle_header_t {
+	char magic[4];
+	uint32_t version;
+	// Quadtree settings the bundle was built with. Bundle is rebuilt if they differ.
+	uint32_t leaf_node_size;
+	uint32_t number_of_lod_levels;
+	uint32_t pyramid_base_size;
+	uint32_t node_count;
+	// Modification times of the sources. Bundle is rebuilt if they changed.
+	int64_t heightmap_mtime;
+	int64_t bb_mtime;
+	aabbf tile_aabb;
+	uint64_t pyramid_cell_count;
+	uint64_t nodes_offset;
+	uint64_t pyramid_offset;
+	uint64_t heightmap_offset;
+} tile_bundle_header_t;
+
+/* Restores heightmap, quadtree and bounding box of the tile from the bundle. tile->filename and
+ * tile->bb_file must be set to the sources. Returns false without logging an error if there is
+ * no bundle or it is outdated, the caller then builds the tile and writes a new bundle. */
+bool tile_bundle_load( const char *bundle_filename, terrain_tile_t *tile );
+
+// Writes a bundle of a completely loaded tile. A failure is logged but not fatal.
+bool tile_bundle_write( const terrain_tile_t *const tile, const char *bundle_filename );
@@ -0,0 +1,176 @@
+#include "tile_cache.h"
+#include "terrain_tile.h"
+#include "tile_loader.h"
+#include "heightmap.h"
+#include "base/logbook.h"
+#include <tgmath.h>
+#include <stdio.h>
+
+static tiles_t *tile_cache_find_victim( tiles_t *tiles, const unsigned int num_tiles, const bool on_gpu );
+static bool tile_cache_is_on_gpu( const tile_status_t status );
+static void tile_cache_evict( tiles_t *entry );
+
+static struct {
+	size_t memory_budget;
+	size_t gpu_budget;
+	size_t memory_usage;
+	size_t gpu_usage;
+	unsigned int memory_tiles;
+	unsigned int gpu_tiles;
+	unsigned int frame;
+	// Over budget with all tiles in range is only reported once until it resolves
+	bool over_budget_reported;
+} tile_cache;
+
+inline void tile_cache_create( const size_t memory_budget, const size_t gpu_budget ) {
+	tile_cache.memory_budget = memory_budget;
+	tile_cache.gpu_budget = gpu_budget;
+	tile_cache.memory_usage = 0;
+	tile_cache.gpu_usage = 0;
+	tile_cache.memory_tiles = 0;
+	tile_cache.gpu_tiles = 0;
+	tile_cache.frame = 0;
+	tile_cache.over_budget_reported = false;
+}
+
+void tile_cache_update(
+		tiles_t *tiles, const unsigned int num_tiles, const vec3f *const camera_position, const float range ) {
+	// frame 0 means never used
+	++tile_cache.frame;
+	bool changed = false;
+	// Refresh distances and usage, request wanted tiles
+	tile_cache.memory_usage = 0;
+	tile_cache.gpu_usage = 0;
+	tile_cache.memory_tiles = 0;
+	tile_cache.gpu_tiles = 0;
+	for( unsigned int i = 0; i < num_tiles; ++i ) {
+		tiles_t *entry = &tiles[i];
+		entry->distance_to_camera = sqrt( aabbf_min_distance_from_point_sq( &entry->aabb, camera_position ) );
+		const bool in_range = entry->distance_to_camera <= range;
+		if( in_range )
+			entry->last_used_frame = tile_cache.frame;
+		tile_status_t status = atomic_load( &entry->status );
+		if( uploading == status && terrain_tile_is_uploaded( entry->tile ) ) {
+			status = ready;
+			atomic_store( &entry->status, status );
+			if( HEIGHTMAP_GPU_ONLY && !heightmap_is_virtual( entry->tile->heightmap ) )
+				terrain_tile_drop_cpu_heights( entry->tile );
+		}
+		if( unloaded == status && in_range )
+			tile_loader_request( entry );
+		else if( loaded == status || tile_cache_is_on_gpu( status ) ) {
+			tile_cache.memory_usage += terrain_tile_get_memory_size( entry->tile );
+			++tile_cache.memory_tiles;
+			if( tile_cache_is_on_gpu( status ) ) {
+				tile_cache.gpu_usage += terrain_tile_get_gpu_size( entry->tile );
+				++tile_cache.gpu_tiles;
+			}
+		}
+	}
+	// Start uploads of loaded tiles in range, making room on the gpu if needed
+	unsigned int num_uploads = 0;
+	for( unsigned int i = 0; i < num_tiles && num_uploads < TILE_UPLOADS_PER_FRAME; ++i ) {
+		tiles_t *entry = &tiles[i];
+		if( loaded != atomic_load( &entry->status ) || entry->last_used_frame != tile_cache.frame )
+			continue;
+		const size_t size = heightmap_get_texture_size( entry->tile->heightmap );
+		tiles_t *victim;
+		while( tile_cache.gpu_usage + size > tile_cache.gpu_budget &&
+				NULL != ( victim = tile_cache_find_victim( tiles, num_tiles, true ) ) ) {
+			// Without texels in memory the gpu copy is the only one, the tile goes altogether
+			if( !terrain_tile_has_cpu_heights( victim->tile ) ) {
+				tile_cache_evict( victim );
+				continue;
+			}
+			tile_cache.gpu_usage -= terrain_tile_get_gpu_size( victim->tile );
+			--tile_cache.gpu_tiles;
+			terrain_tile_release_gpu( victim->tile );
+			atomic_store( &victim->status, loaded );
+		}
+		if( tile_cache.gpu_usage + size > tile_cache.gpu_budget )
+			break;
+		++num_uploads;
+		changed = true;
+		if( terrain_tile_upload( entry->tile ) ) {
+			tile_cache.gpu_usage += size;
+			++tile_cache.gpu_tiles;
+			atomic_store( &entry->status, uploading );
+		} else {
+			tile_cache.memory_usage -= terrain_tile_get_memory_size( entry->tile );
+			--tile_cache.memory_tiles;
+			entry->tile = terrain_tile_delete( entry->tile );
+			atomic_store( &entry->status, failed );
+		}
+	}
+	// Evict from memory, tiles that are only in memory first
+	while( tile_cache.memory_usage > tile_cache.memory_budget ) {
+		tiles_t *victim = tile_cache_find_victim( tiles, num_tiles, false );
+		if( !victim )
+			victim = tile_cache_find_victim( tiles, num_tiles, true );
+		if( !victim )
+			break;
+		tile_cache_evict( victim );
+		changed = true;
+	}
+	const bool over_budget = tile_cache.memory_usage > tile_cache.memory_budget ||
+			tile_cache.gpu_usage > tile_cache.gpu_budget;
+	if( over_budget && !tile_cache.over_budget_reported )
+		logbook_log( LOG_WARNING, "Tile cache over budget with all resident tiles in range" );
+	tile_cache.over_budget_reported = over_budget;
+	if( changed )
+		tile_cache_log_usage();
+}
+
+inline size_t tile_cache_get_memory_usage() {
+	return tile_cache.memory_usage;
+}
+
+inline size_t tile_cache_get_gpu_usage() {
+	return tile_cache.gpu_usage;
+}
+
+void tile_cache_log_usage() {
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1,
+			"Tile cache: %d tiles in memory %.2fMb of %.2fMb, %d on gpu %.2fMb of %.2fMb",
+			tile_cache.memory_tiles, (double)tile_cache.memory_usage / ( 1024.0 * 1024.0 ),
+			(double)tile_cache.memory_budget / ( 1024.0 * 1024.0 ),
+			tile_cache.gpu_tiles, (double)tile_cache.gpu_usage / ( 1024.0 * 1024.0 ),
+			(double)tile_cache.gpu_budget / ( 1024.0 * 1024.0 ) );
+	logbook_log( LOG_INFO, msg );
+}
+
+// *** static stuff
+// Least recently used resident tile out of range this frame, the farthest if equally recent.
+// Either among the tiles on the gpu or the ones in memory only.
+tiles_t *tile_cache_find_victim( tiles_t *tiles, const unsigned int num_tiles, const bool on_gpu ) {
+	tiles_t *victim = NULL;
+	for( unsigned int i = 0; i < num_tiles; ++i ) {
+		tiles_t *entry = &tiles[i];
+		const tile_status_t status = atomic_load( &entry->status );
+		const bool matches = on_gpu ? tile_cache_is_on_gpu( status ) : loaded == status;
+		if( !matches || entry->last_used_frame == tile_cache.frame )
+			continue;
+		if( !victim || entry->last_used_frame < victim->last_used_frame ||
+				( entry->last_used_frame == victim->last_used_frame &&
+				entry->distance_to_camera > victim->distance_to_camera ) )
+			victim = entry;
+	}
+	return victim;
+}
+
+// Drops a tile from video and main memory. It is requested again when back in range.
+void tile_cache_evict( tiles_t *entry ) {
+	if( tile_cache_is_on_gpu( atomic_load( &entry->status ) ) ) {
+		tile_cache.gpu_usage -= terrain_tile_get_gpu_size( entry->tile );
+		--tile_cache.gpu_tiles;
+	}
+	tile_cache.memory_usage -= terrain_tile_get_memory_size( entry->tile );
+	--tile_cache.memory_tiles;
+	entry->tile = terrain_tile_delete( entry->tile );
+	atomic_store( &entry->status, unloaded );
+}
+
+bool tile_cache_is_on_gpu( const tile_status_t status ) {
+	return uploading == status || ready == status;
+}
@@ -0,0 +1,26 @@
+/* Residency of terrain tiles under a main memory and a video memory budget.
+ * Tiles in range of the camera are requested from the tile loader and uploaded when loaded.
+ * Over budget, tiles out of range are demoted from gpu resident to memory only and then
+ * evicted, least recently in range first, farther first among equally recent ones.
+ * Render thread only. */
+
+#pragma once
+
+#include "terrain.h"
+#include "omath/vec3.h"
+#include <stddef.h>
+
+// Budgets in bytes
+extern void tile_cache_create( const size_t memory_budget, const size_t gpu_budget );
+
+/* Once per frame before the lod selection. Tiles closer than range to the camera are wanted.
+ * Starts at most TILE_UPLOADS_PER_FRAME uploads, a tile is ready when its upload is done. */
+void tile_cache_update(
+		tiles_t *tiles, const unsigned int num_tiles, const vec3f *const camera_position, const float range );
+
+// Usage as of the last update
+extern size_t tile_cache_get_memory_usage();
+
+extern size_t tile_cache_get_gpu_usage();
+
+void tile_cache_log_usage();
@@ -0,0 +1,124 @@
+#include "tile_loader.h"
+#include "terrain_tile.h"
+#include "base/logbook.h"
+#include <threads.h>
+#include <stdio.h>
+
+static int tile_loader_worker( void *arg );
+
+#define TILE_LOADER_NUM_THREADS ( NUMBER_OF_THREADS < TERRAIN_MAX_TILES ? NUMBER_OF_THREADS : TERRAIN_MAX_TILES )
+
+static struct {
+	bool list_nodes;
+	bool running;
+	unsigned int num_threads;
+	// Threads working on tiles, the workers' own and those they started for a tile
+	unsigned int num_busy_threads;
+	thrd_t threads[TILE_LOADER_NUM_THREADS];
+	mtx_t mutex;
+	cnd_t condition;
+	// Ring buffer of requested tiles. Every tile is requested at most once.
+	tiles_t *queue[TERRAIN_MAX_TILES];
+	unsigned int queue_head;
+	unsigned int queue_count;
+} tile_loader;
+
+bool tile_loader_create( const bool list_nodes ) {
+	if( tile_loader.running ) {
+		logbook_log( LOG_WARNING, "Tile loader already running" );
+		return true;
+	}
+	tile_loader.list_nodes = list_nodes;
+	tile_loader.queue_head = 0;
+	tile_loader.queue_count = 0;
+	tile_loader.num_threads = 0;
+	tile_loader.num_busy_threads = 0;
+	if( thrd_success != mtx_init( &tile_loader.mutex, mtx_plain ) )
+		return false;
+	if( thrd_success != cnd_init( &tile_loader.condition ) ) {
+		mtx_destroy( &tile_loader.mutex );
+		return false;
+	}
+	tile_loader.running = true;
+	for( unsigned int i = 0; i < TILE_LOADER_NUM_THREADS; ++i ) {
+		if( thrd_success != thrd_create( &tile_loader.threads[i], tile_loader_worker, NULL ) )
+			break;
+		++tile_loader.num_threads;
+	}
+	if( 0 == tile_loader.num_threads ) {
+		logbook_log( LOG_ERROR, "Error starting tile loader threads" );
+		tile_loader_delete();
+		return false;
+	}
+	char msg[MAX_LEN_MESSAGES];
+	snprintf( msg, MAX_LEN_MESSAGES-1, "Tile loader started with %d threads", tile_loader.num_threads );
+	logbook_log( LOG_INFO, msg );
+	return true;
+}
+
+void tile_loader_delete() {
+	if( !tile_loader.running )
+		return;
+	mtx_lock( &tile_loader.mutex );
+	tile_loader.running = false;
+	cnd_broadcast( &tile_loader.condition );
+	mtx_unlock( &tile_loader.mutex );
+	for( unsigned int i = 0; i < tile_loader.num_threads; ++i )
+		thrd_join( tile_loader.threads[i], NULL );
+	tile_loader.num_threads = 0;
+	tile_loader.queue_count = 0;
+	cnd_destroy( &tile_loader.condition );
+	mtx_destroy( &tile_loader.mutex );
+}
+
+bool tile_loader_request( tiles_t *entry ) {
+	if( !tile_loader.running ) {
+		logbook_log( LOG_ERROR, "Tile requested but tile loader not running" );
+		return false;
+	}
+	mtx_lock( &tile_loader.mutex );
+	if( tile_loader.queue_count >= TERRAIN_MAX_TILES ) {
+		mtx_unlock( &tile_loader.mutex );
+		logbook_log( LOG_ERROR, "Tile loader queue full" );
+		return false;
+	}
+	atomic_store( &entry->status, requested );
+	tile_loader.queue[( tile_loader.queue_head + tile_loader.queue_count ) % TERRAIN_MAX_TILES] = entry;
+	++tile_loader.queue_count;
+	cnd_signal( &tile_loader.condition );
+	mtx_unlock( &tile_loader.mutex );
+	return true;
+}
+
+// *** static stuff
+// Takes tiles from the queue until the loader is stopped
+int tile_loader_worker( void *arg ) {
+	(void)arg;
+	for(;;) {
+		mtx_lock( &tile_loader.mutex );
+		while( tile_loader.running && 0 == tile_loader.queue_count )
+			cnd_wait( &tile_loader.condition, &tile_loader.mutex );
+		if( !tile_loader.running ) {
+			mtx_unlock( &tile_loader.mutex );
+			return 0;
+		}
+		tiles_t *entry = tile_loader.queue[tile_loader.queue_head];
+		tile_loader.queue_head = ( tile_loader.queue_head + 1 ) % TERRAIN_MAX_TILES;
+		--tile_loader.queue_count;
+		// Idle cores help with this tile unless other tiles wait for a worker. Workers that start later
+		// count one thread each, so there are at most NUMBER_OF_THREADS + workers - 1 threads.
+		unsigned int num_threads = 1;
+		if( 0 == tile_loader.queue_count && tile_loader.num_busy_threads + 1 < NUMBER_OF_THREADS )
+			num_threads = NUMBER_OF_THREADS - tile_loader.num_busy_threads;
+		tile_loader.num_busy_threads += num_threads;
+		mtx_unlock( &tile_loader.mutex );
+
+		atomic_store( &entry->status, loading );
+		entry->tile = terrain_tile_create( entry->filename, entry->bb_file, tile_loader.list_nodes, num_threads, NULL );
+		mtx_lock( &tile_loader.mutex );
+		tile_loader.num_busy_threads -= num_threads;
+		mtx_unlock( &tile_loader.mutex );
+		// Publishes the tile to the render thread
+		atomic_store( &entry->status, entry->tile ? loaded : failed );
+	}
+}
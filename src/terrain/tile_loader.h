@@ -0,0 +1,17 @@
+/* Background loading of terrain tiles. Worker threads read the heightmap or bundle and build
+ * the quadtree; the gl thread only uploads finished tiles, see terrain.c.
+ * A tile moves requested -> loading -> loaded (or failed) here. */
+
+#pragma once
+
+#include "terrain.h"
+#include <stdbool.h>
+
+// Starts the worker threads. list_nodes is passed on to terrain_tile_create().
+extern bool tile_loader_create( const bool list_nodes );
+
+// Stops and joins the workers. A tile that is being loaded is finished first, queued ones stay requested.
+extern void tile_loader_delete();
+
+// Queues the tile described by filename and bb_file of the entry. Never blocks on i/o.
+extern bool tile_loader_request( tiles_t *entry );
@@ -0,0 +1,60 @@
+/* Converts a heightmap to the raw (HEIGHTMAP_RAW_EXTENSION) or compressed (HEIGHTMAP_CODEC_EXTENSION)
+ * format, picked by the extension of the output file. The input is anything heightmap_create() loads.
+ * Compressed output is decoded again and compared with the input.
+ * Build and run from the repository root:
+ *   gcc -std=gnu11 -O2 -Isrc -Iextern -Iextern/glad src/tools/heightmap_convert.c src/terrain/heightmap.c \
+ *       src/terrain/heightmap_codec.c src/terrain/height_kernels.c src/terrain/minmax_pyramid.c \
+ *       src/terrain/packed_heights.c src/terrain/clipmap.c src/renderer/texture_uploader.c \
+ *       src/renderer/sampler.c src/base/mapped_file.c src/base/logbook.c src/omath/common.c \
+ *       extern/stb/stb_image.c extern/glad/glad.c -lm -lpthread
+ * Usage: heightmap_convert <input> <output> */
+
+#include "base/logbook.h"
+#include "base/mapped_file.h"
+#include "terrain/heightmap.h"
+#include "terrain/heightmap_codec.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Decodes the written file and compares it texel by texel with the heightmap
+static bool check_compressed( const heightmap_t *const heightmap, const char *filename ) {
+	mapped_file_t *file = mapped_file_create( filename, NULL );
+	if( !file )
+		return false;
+	bool is_equal = false;
+	if( heightmap_codec_validate( file ) ) {
+		uint16_t *decoded = heightmap_codec_decode( file, NUMBER_OF_THREADS );
+		is_equal = decoded && 0 == memcmp( decoded, heightmap->height_values,
+				(size_t)heightmap->extent * heightmap->extent * sizeof(uint16_t) );
+		free( decoded );
+	}
+	mapped_file_delete( file );
+	return is_equal;
+}
+
+int main( int argc, char **argv ) {
+	if( 3 != argc ) {
+		printf( "Usage: %s <input> <output%s|output%s>\n", argv[0], HEIGHTMAP_RAW_EXTENSION, HEIGHTMAP_CODEC_EXTENSION );
+		return EXIT_FAILURE;
+	}
+	const char *output = argv[2];
+	const bool is_compressed = heightmap_codec_is_codec_file( output );
+	if( !is_compressed && !heightmap_is_raw_file( output ) ) {
+		printf( "Output must end with %s or %s\n", HEIGHTMAP_RAW_EXTENSION, HEIGHTMAP_CODEC_EXTENSION );
+		return EXIT_FAILURE;
+	}
+	logbook_init();
+	heightmap_t *heightmap = heightmap_create( argv[1], NUMBER_OF_THREADS, NULL );
+	bool success = NULL != heightmap;
+	if( success )
+		success = is_compressed ? heightmap_write_compressed( heightmap, output ) : heightmap_write_raw( heightmap, output );
+	if( success && is_compressed && !check_compressed( heightmap, output ) ) {
+		printf( "'%s' doesn't decode to the input\n", output );
+		remove( output );
+		success = false;
+	}
+	heightmap_delete( heightmap );
+	logbook_de_init();
+	return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}